@@ -0,0 +1,567 @@
+/**
+ * @file bench.c
+ * @brief Times every pipeline stage on synthetic images
+ *
+ * Images are generated from a fixed seed, so two runs on the same
+ * machine see exactly the same pixels. Each stage is run on its own,
+ * several times, with the setup it needs kept out of the timing. One
+ * JSON object per line goes to stdout:
+ *
+ *   {"image":"noise","size":1024,"stage":"qtree_build","reps":3,
+ *    "min_s":0.0123,"mean_s":0.0131,"mb_per_s":81.3,"nodes_per_s":1.1e8,
+ *    "nodes":1398101,"peak_rss_kb":40212}
+ *
+ * MB/s is image bytes over the best time. peak_rss_kb is the process
+ * high-water mark once the stage is done, so it only ever grows; run one
+ * size at a time to read it per size.
+ *
+ * Usage: qtc_bench [--sizes 256,1024] [--images flat,noise] [--reps 3]
+ *                  [--alpha 2.0] [--dir /tmp]
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "codec/compression.h"
+#include "codec/decompression.h"
+#include "codec/metrics.h"
+#include "core/quadtree.h"
+#include "grid/segmentation_grid.h"
+#include "io/pgm.h"
+#include "logger/logger.h"
+
+#define BENCH_MIN_SIZE 256u
+#define BENCH_MAX_SIZE 16384u
+#define BENCH_MAX_SIZES 16
+#define BENCH_DEFAULT_REPS 3u
+#define BENCH_DEFAULT_ALPHA 2.0f
+#define BENCH_SEED 0x9E3779B97F4A7C15ull
+#define BENCH_PATH_SIZE 512
+
+typedef enum
+{
+    IMAGE_FLAT,
+    IMAGE_GRADIENT,
+    IMAGE_NOISE,
+    IMAGE_NATURAL,
+    IMAGE_KIND_COUNT
+} image_kind_t;
+
+static const char *const image_names[IMAGE_KIND_COUNT] = {
+    [IMAGE_FLAT] = "flat",
+    [IMAGE_GRADIENT] = "gradient",
+    [IMAGE_NOISE] = "noise",
+    [IMAGE_NATURAL] = "natural"};
+
+typedef struct
+{
+    uint32_t sizes[BENCH_MAX_SIZES];
+    size_t n_sizes;
+    bool images[IMAGE_KIND_COUNT];
+    uint32_t reps;
+    float alpha;
+    const char *dir;
+} bench_options_t;
+
+/**
+ * @brief Timings of one stage
+ */
+typedef struct
+{
+    double min;
+    double total;
+    uint32_t runs;
+} bench_timer_t;
+
+/**
+ * @brief Everything one image size needs, kept between stages
+ */
+typedef struct
+{
+    const char *image;
+    uint32_t size;
+    uint32_t reps;
+    float alpha;
+    char pgm_path[BENCH_PATH_SIZE];
+    char qtc_path[BENCH_PATH_SIZE];
+    char grid_path[BENCH_PATH_SIZE];
+} bench_case_t;
+
+/* Keeps the pixel walk in bench_pgm_read() from being optimized away */
+static volatile uint64_t g_sink;
+
+static double monotonic_seconds(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec + (double)now.tv_nsec * 1e-9;
+}
+
+static void timer_add(bench_timer_t *timer, double start)
+{
+    const double elapsed = monotonic_seconds() - start;
+    if (timer->runs == 0 || elapsed < timer->min)
+        timer->min = elapsed;
+    timer->total += elapsed;
+    timer->runs++;
+}
+
+static long peak_rss_kb(void)
+{
+    struct rusage usage;
+    return getrusage(RUSAGE_SELF, &usage) == 0 ? usage.ru_maxrss : 0;
+}
+
+static void report(const bench_case_t *bench, const char *stage,
+                   const bench_timer_t *timer, size_t nodes)
+{
+    if (timer->runs == 0)
+    {
+        printf("{\"image\":\"%s\",\"size\":%u,\"stage\":\"%s\",\"error\":true}\n",
+               bench->image, bench->size, stage);
+        return;
+    }
+
+    const double bytes = (double)bench->size * bench->size;
+    const double best = timer->min > 0.0 ? timer->min : 1e-9;
+
+    printf("{\"image\":\"%s\",\"size\":%u,\"stage\":\"%s\",\"reps\":%u,"
+           "\"min_s\":%.6f,\"mean_s\":%.6f,\"mb_per_s\":%.2f,",
+           bench->image, bench->size, stage, timer->runs,
+           timer->min, timer->total / timer->runs, bytes / (1024.0 * 1024.0) / best);
+    if (nodes > 0)
+        printf("\"nodes_per_s\":%.4g,\"nodes\":%zu,", (double)nodes / best, nodes);
+    else
+        printf("\"nodes_per_s\":null,\"nodes\":null,");
+    printf("\"peak_rss_kb\":%ld}\n", peak_rss_kb());
+    fflush(stdout);
+}
+
+/* -------------------------------------------------------------------------- */
+/* Synthetic images                                                           */
+/* -------------------------------------------------------------------------- */
+
+/**
+ * @brief splitmix64 step, the whole randomness of the suite
+ */
+static uint64_t mix64(uint64_t x)
+{
+    x += 0x9E3779B97F4A7C15ull;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ull;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBull;
+    return x ^ (x >> 31);
+}
+
+/**
+ * @brief Random lattice value in 0..255 for value noise
+ */
+static uint32_t lattice(uint32_t x, uint32_t y, uint32_t octave)
+{
+    const uint64_t key = ((uint64_t)x << 40) ^ ((uint64_t)y << 16) ^ octave;
+    return (uint32_t)(mix64(key ^ BENCH_SEED) & 0xFF);
+}
+
+/**
+ * @brief Smooth value noise: bilinear blend of a coarse random lattice
+ */
+static uint32_t value_noise(uint32_t x, uint32_t y, uint32_t cell, uint32_t octave)
+{
+    const uint32_t cx = x / cell, cy = y / cell;
+    const uint32_t fx = x % cell, fy = y % cell;
+
+    const uint64_t top = (uint64_t)lattice(cx, cy, octave) * (cell - fx) +
+                         (uint64_t)lattice(cx + 1, cy, octave) * fx;
+    const uint64_t bottom = (uint64_t)lattice(cx, cy + 1, octave) * (cell - fx) +
+                            (uint64_t)lattice(cx + 1, cy + 1, octave) * fx;
+    return (uint32_t)((top * (cell - fy) + bottom * fy) / ((uint64_t)cell * cell));
+}
+
+/**
+ * @brief Something like a photo: smooth shapes, some texture, flat sky
+ */
+static uint8_t natural_pixel(uint32_t x, uint32_t y, uint32_t size)
+{
+    const uint32_t broad = value_noise(x, y, size / 4 > 0 ? size / 4 : 1, 0);
+    const uint32_t medium = value_noise(x, y, size / 32 > 0 ? size / 32 : 1, 1);
+    const uint32_t fine = value_noise(x, y, 4, 2);
+
+    // The top fifth is an almost flat sky, quantized so it forms uniform blocks
+    if (y < size / 5)
+        return (uint8_t)(200 + (broad >> 6));
+
+    return (uint8_t)((broad * 5 + medium * 2 + fine) / 8);
+}
+
+static uint8_t *generate_image(image_kind_t kind, uint32_t size)
+{
+    uint8_t *pixels = malloc((size_t)size * size);
+    if (!pixels)
+        return NULL;
+
+    for (uint32_t y = 0; y < size; y++)
+    {
+        uint8_t *row = pixels + (size_t)y * size;
+        for (uint32_t x = 0; x < size; x++)
+        {
+            switch (kind)
+            {
+            case IMAGE_FLAT:
+                row[x] = 128;
+                break;
+            case IMAGE_GRADIENT:
+                row[x] = (uint8_t)(((uint64_t)x + y) * 255 / (2 * (uint64_t)size - 2));
+                break;
+            case IMAGE_NOISE:
+                row[x] = (uint8_t)(mix64(BENCH_SEED ^ ((uint64_t)y * size + x)) >> 56);
+                break;
+            case IMAGE_NATURAL:
+                row[x] = natural_pixel(x, y, size);
+                break;
+            case IMAGE_KIND_COUNT:
+            default:
+                row[x] = 0;
+                break;
+            }
+        }
+    }
+    return pixels;
+}
+
+/* -------------------------------------------------------------------------- */
+/* Stages                                                                     */
+/* -------------------------------------------------------------------------- */
+
+static bool build_tree(qtree_t *tree, const uint8_t *pixels, uint32_t size)
+{
+    return qtree_init(tree, size) == QTREE_SUCCESS &&
+           qtree_build(tree, pixels, size, "bench") == QTREE_SUCCESS;
+}
+
+static void bench_pgm_read(const bench_case_t *bench)
+{
+    bench_timer_t timer = {0};
+    for (uint32_t rep = 0; rep < bench->reps; rep++)
+    {
+        pgm_t pgm = {0};
+        const double start = monotonic_seconds();
+        const pgm_status_t status = pgm_read(bench->pgm_path, &pgm);
+
+        // A mapped read is lazy; touching every pixel is part of reading
+        if (status == PGM_SUCCESS)
+        {
+            uint64_t sum = 0;
+            const size_t count = (size_t)pgm.size * pgm.size;
+            for (size_t i = 0; i < count; i++)
+            {
+                sum += pgm.pixels[i];
+            }
+            g_sink = sum;
+            timer_add(&timer, start);
+        }
+        pgm_free(&pgm);
+    }
+    report(bench, "pgm_read", &timer, 0);
+}
+
+static void bench_build(const bench_case_t *bench, const uint8_t *pixels, qtree_t *tree)
+{
+    bench_timer_t timer = {0};
+    for (uint32_t rep = 0; rep < bench->reps; rep++)
+    {
+        const double start = monotonic_seconds();
+        if (build_tree(tree, pixels, bench->size))
+            timer_add(&timer, start);
+    }
+    report(bench, "qtree_build", &timer, tree->arena.live_nodes);
+}
+
+static void bench_lossy(const bench_case_t *bench, const uint8_t *pixels, qtree_t *tree)
+{
+    bench_timer_t timer = {0};
+    size_t nodes = 0;
+    for (uint32_t rep = 0; rep < bench->reps; rep++)
+    {
+        if (!build_tree(tree, pixels, bench->size))
+            continue;
+
+        nodes = tree->arena.live_nodes;
+        const double start = monotonic_seconds();
+        if (apply_lossy_compression(tree, bench->alpha) == QTREE_SUCCESS)
+            timer_add(&timer, start);
+    }
+    report(bench, "apply_lossy_compression", &timer, nodes);
+}
+
+static void bench_distortion(const bench_case_t *bench, const uint8_t *pixels,
+                             const qtree_t *tree)
+{
+    bench_timer_t timer = {0};
+    for (uint32_t rep = 0; rep < bench->reps && tree->root; rep++)
+    {
+        qtree_distortion_t distortion;
+        const double start = monotonic_seconds();
+        if (qtree_measure_distortion(tree, pixels, &distortion) == QTREE_SUCCESS)
+        {
+            timer_add(&timer, start);
+            g_sink += distortion.squared_error;
+        }
+    }
+    report(bench, "qtree_measure_distortion", &timer, tree->arena.live_nodes);
+}
+
+static void bench_compress(const bench_case_t *bench, const qtree_t *tree)
+{
+    bench_timer_t timer = {0};
+    for (uint32_t rep = 0; rep < bench->reps; rep++)
+    {
+        const double start = monotonic_seconds();
+        FILE *file = fopen(bench->qtc_path, "wb");
+        if (!file)
+            continue;
+
+        const qtree_status_t status = compress(tree, bench->qtc_path, file);
+        if (fclose(file) == 0 && status == QTREE_SUCCESS)
+            timer_add(&timer, start);
+    }
+    report(bench, "compress", &timer, tree->arena.live_nodes);
+}
+
+static void bench_decompress(const bench_case_t *bench, qtree_t *decoded)
+{
+    bench_timer_t timer = {0};
+    for (uint32_t rep = 0; rep < bench->reps; rep++)
+    {
+        FILE *file = fopen(bench->qtc_path, "rb");
+        if (!file)
+            continue;
+
+        const double start = monotonic_seconds();
+        if (qtree_decompress(file, bench->qtc_path, decoded) == QTREE_SUCCESS)
+            timer_add(&timer, start);
+        fclose(file);
+    }
+    report(bench, "qtree_decompress", &timer, decoded->arena.live_nodes);
+}
+
+static void bench_to_pgm(const bench_case_t *bench, const qtree_t *decoded)
+{
+    bench_timer_t timer = {0};
+    for (uint32_t rep = 0; rep < bench->reps && decoded->root; rep++)
+    {
+        pgm_t pgm = {0};
+        const double start = monotonic_seconds();
+        if (qtree_to_pgm(decoded, bench->pgm_path, &pgm) == QTREE_SUCCESS)
+            timer_add(&timer, start);
+        pgm_free(&pgm);
+    }
+    report(bench, "qtree_to_pgm", &timer, decoded->arena.live_nodes);
+}
+
+static void bench_grid(const bench_case_t *bench, const qtree_t *tree)
+{
+    bench_timer_t timer = {0};
+    for (uint32_t rep = 0; rep < bench->reps; rep++)
+    {
+        const double start = monotonic_seconds();
+        if (qtree_generate_grid(tree, bench->grid_path) == QTREE_SUCCESS)
+            timer_add(&timer, start);
+    }
+    report(bench, "qtree_generate_grid", &timer, tree->arena.live_nodes);
+}
+
+/**
+ * @brief Every stage on one image, in pipeline order
+ */
+static bool bench_image(const bench_options_t *options, image_kind_t kind, uint32_t size)
+{
+    bench_case_t bench = {
+        .image = image_names[kind],
+        .size = size,
+        .reps = options->reps,
+        .alpha = options->alpha};
+    snprintf(bench.pgm_path, sizeof(bench.pgm_path), "%s/qtc_bench_%d.pgm",
+             options->dir, (int)getpid());
+    snprintf(bench.qtc_path, sizeof(bench.qtc_path), "%s/qtc_bench_%d.qtc",
+             options->dir, (int)getpid());
+    snprintf(bench.grid_path, sizeof(bench.grid_path), "%s/qtc_bench_%d_grid.pgm",
+             options->dir, (int)getpid());
+
+    uint8_t *pixels = generate_image(kind, size);
+    if (!pixels)
+    {
+        fprintf(stderr, "qtc_bench: out of memory for a %ux%u image\n", size, size);
+        return false;
+    }
+
+    const pgm_t image = {.pixels = pixels, .size = size, .max_value = 255};
+    if (pgm_write(&image, bench.pgm_path) != PGM_SUCCESS)
+    {
+        fprintf(stderr, "qtc_bench: cannot write %s\n", bench.pgm_path);
+        free(pixels);
+        return false;
+    }
+
+    qtree_t tree = {0};
+    qtree_t decoded = {0};
+
+    bench_pgm_read(&bench);
+    bench_build(&bench, pixels, &tree);
+    bench_lossy(&bench, pixels, &tree);
+    bench_distortion(&bench, pixels, &tree);
+
+    // The rest works on the lossless tree
+    if (build_tree(&tree, pixels, size))
+    {
+        bench_compress(&bench, &tree);
+        bench_decompress(&bench, &decoded);
+        bench_to_pgm(&bench, &decoded);
+        bench_grid(&bench, &tree);
+    }
+
+    qtree_free(&decoded);
+    qtree_free(&tree);
+    free(pixels);
+    remove(bench.pgm_path);
+    remove(bench.qtc_path);
+    remove(bench.grid_path);
+    return true;
+}
+
+/* -------------------------------------------------------------------------- */
+/* Command line                                                               */
+/* -------------------------------------------------------------------------- */
+
+static bool parse_sizes(const char *list, bench_options_t *options)
+{
+    options->n_sizes = 0;
+    const char *p = list;
+    while (*p)
+    {
+        char *end = NULL;
+        errno = 0;
+        const unsigned long size = strtoul(p, &end, 10);
+        if (end == p || errno != 0 || size < BENCH_MIN_SIZE || size > BENCH_MAX_SIZE ||
+            (size & (size - 1)) != 0 || options->n_sizes == BENCH_MAX_SIZES)
+        {
+            fprintf(stderr, "qtc_bench: sizes must be powers of two in %u..%u\n",
+                    BENCH_MIN_SIZE, BENCH_MAX_SIZE);
+            return false;
+        }
+        if (*end != ',' && *end != '\0')
+        {
+            fprintf(stderr, "qtc_bench: bad size list '%s'\n", list);
+            return false;
+        }
+        options->sizes[options->n_sizes++] = (uint32_t)size;
+        p = *end == ',' ? end + 1 : end;
+    }
+    return options->n_sizes > 0;
+}
+
+static bool parse_images(const char *list, bench_options_t *options)
+{
+    memset(options->images, 0, sizeof(options->images));
+    char copy[128];
+    snprintf(copy, sizeof(copy), "%s", list);
+
+    char *save = NULL;
+    for (char *name = strtok_r(copy, ",", &save); name; name = strtok_r(NULL, ",", &save))
+    {
+        bool found = false;
+        for (int k = 0; k < IMAGE_KIND_COUNT; k++)
+        {
+            if (strcmp(name, image_names[k]) == 0)
+            {
+                options->images[k] = true;
+                found = true;
+            }
+        }
+        if (!found)
+        {
+            fprintf(stderr, "qtc_bench: unknown image '%s' (flat, gradient, noise, natural)\n",
+                    name);
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool parse_options(int argc, char **argv, bench_options_t *options)
+{
+    *options = (bench_options_t){
+        .sizes = {256, 1024, 2048},
+        .n_sizes = 3,
+        .images = {true, true, true, true},
+        .reps = BENCH_DEFAULT_REPS,
+        .alpha = BENCH_DEFAULT_ALPHA,
+        .dir = "/tmp"};
+
+    for (int i = 1; i < argc; i++)
+    {
+        const char *arg = argv[i];
+        const char *value = i + 1 < argc ? argv[i + 1] : NULL;
+        if (!value)
+        {
+            fprintf(stderr, "qtc_bench: %s needs a value\n", arg);
+            return false;
+        }
+        i++;
+
+        bool ok = true;
+        if (strcmp(arg, "--sizes") == 0)
+            ok = parse_sizes(value, options);
+        else if (strcmp(arg, "--images") == 0)
+            ok = parse_images(value, options);
+        else if (strcmp(arg, "--reps") == 0)
+        {
+            const long reps = strtol(value, NULL, 10);
+            ok = reps > 0 && reps <= 1000;
+            options->reps = ok ? (uint32_t)reps : 0;
+        }
+        else if (strcmp(arg, "--alpha") == 0)
+        {
+            options->alpha = strtof(value, NULL);
+            ok = options->alpha >= 1.0f;
+        }
+        else if (strcmp(arg, "--dir") == 0)
+            options->dir = value;
+        else
+        {
+            fprintf(stderr, "qtc_bench: unknown option %s\n", arg);
+            return false;
+        }
+
+        if (!ok)
+        {
+            fprintf(stderr, "qtc_bench: bad value '%s' for %s\n", value, arg);
+            return false;
+        }
+    }
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    bench_options_t options;
+    if (!parse_options(argc, argv, &options))
+        return EXIT_FAILURE;
+
+    // Timings should not include terminal output
+    logger_configure((logger_config_t){.enabled = false});
+
+    int status = EXIT_SUCCESS;
+    for (size_t s = 0; s < options.n_sizes; s++)
+    {
+        for (int k = 0; k < IMAGE_KIND_COUNT; k++)
+        {
+            if (options.images[k] && !bench_image(&options, (image_kind_t)k, options.sizes[s]))
+                status = EXIT_FAILURE;
+        }
+    }
+    return status;
+}
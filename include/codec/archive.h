@@ -0,0 +1,200 @@
+/**
+ * @file archive.h
+ * @brief Archive: many small images in one file, found by id
+ *
+ * Serving thumbnails out of one .qtc each costs an open and a text
+ * header parse per request, which for a few hundred bytes of payload is
+ * most of the work. An archive keeps the payloads back to back with no
+ * header of their own and a fixed-size index sorted by id, so a reader
+ * maps the file once and then finds an image with a binary search and
+ * decodes it straight out of the mapping.
+ *
+ * Layout, integers little-endian:
+ *
+ *   "QA\n", version (1 byte), payload format (1 byte, 1 or 2), 3 zero bytes
+ *   entry count (8 bytes), offset of the index in the file (8 bytes)
+ *   the payloads, same bits a Q1/Q2 file has after its depth byte
+ *   one entry per image, by increasing id: id (8 bytes), offset in the
+ *   file (8 bytes), length (4 bytes), depth (1 byte), 3 zero bytes
+ *
+ * The index comes last so the builder can stream payloads out as they
+ * are coded and only has to hold the entries.
+ */
+
+#ifndef ARCHIVE_H
+#define ARCHIVE_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "codec/compression.h"
+#include "core/quadtree.h"
+
+#define QTREE_ARCHIVE_MAGIC "QA"
+#define QTREE_ARCHIVE_VERSION 1u
+
+/* Bytes of the header in front of the payloads */
+#define QTREE_ARCHIVE_HEADER_SIZE 24u
+
+/* Bytes per index entry: id, offset, length, depth and padding */
+#define QTREE_ARCHIVE_ENTRY_SIZE 24u
+
+/**
+ * @brief Where one image is
+ */
+typedef struct
+{
+    uint64_t id;
+    uint64_t offset;   /* First payload byte, in the file */
+    uint32_t length;   /* Payload size in bytes */
+    uint32_t n_levels; /* Tree depth */
+    uint32_t size;     /* Image width/height */
+} qtree_archive_entry_t;
+
+/**
+ * @brief An archive held in memory (or mapped), checked and ready to read
+ *
+ * Like a tiled view, nothing is copied and decoding never changes it,
+ * so one view can serve any number of threads. Only a view from
+ * qtree_archive_map() owns its bytes.
+ */
+typedef struct
+{
+    const uint8_t *data;   /* The whole archive */
+    size_t length;         /* Its size in bytes */
+    const uint8_t *index;  /* First index entry */
+    size_t count;          /* Images in it */
+    qtree_format_t format; /* How the payloads are coded */
+    void *map_base;        /* Mapping to undo on close (NULL if not ours) */
+    size_t map_length;
+} qtree_archive_t;
+
+/**
+ * @brief Writes an archive as images come, possibly from several threads
+ */
+typedef struct
+{
+    FILE *file;                     /* Seekable, positioned at the start */
+    qtree_format_t format;          /* Payload format for every image */
+    qtree_archive_entry_t *entries; /* In the order they were added */
+    size_t count;
+    size_t capacity;
+    uint64_t bytes;                 /* Written so far, header included */
+    qtree_status_t failure;         /* First error, the builder is stuck after it */
+    pthread_mutex_t lock;
+} qtree_archive_builder_t;
+
+/**
+ * @brief Tells an archive from a plain file by its magic
+ */
+bool qtree_archive_magic(const uint8_t *data, size_t length);
+
+/**
+ * @brief The id a file name stands for
+ *
+ * The directory and extension go; a name of digits only ("1234.pgm")
+ * is that number, anything else the 64-bit FNV-1a hash of the name.
+ */
+uint64_t qtree_archive_id(const char *name);
+
+/**
+ * @brief Starts an archive, leaving room for the header
+ * @param file Where to write it (must be seekable: the header is filled in last)
+ * @param format Payload format for every image
+ * @return QTREE_SUCCESS if it worked
+ */
+qtree_status_t qtree_archive_builder_init(qtree_archive_builder_t *builder, FILE *file,
+                                          qtree_format_t format);
+
+/**
+ * @brief Codes a tree and appends it (safe to call from several threads)
+ *
+ * The payload is coded outside the builder's lock; only the write is
+ * serialised. Images land in the file in the order they come in.
+ *
+ * @param id What the image will be found by (unique within the archive)
+ * @param length Set to the payload size in bytes (can be NULL)
+ * @return QTREE_SUCCESS if it worked
+ */
+qtree_status_t qtree_archive_builder_add(qtree_archive_builder_t *builder, uint64_t id,
+                                         const qtree_t *tree, size_t *length);
+
+/**
+ * @brief Appends a payload that is already coded (safe to call from several threads)
+ * @param data What compress_payload_to_buffer() gave, in the builder's format
+ * @param n_levels Depth of the tree it codes (1..16)
+ * @return QTREE_SUCCESS if it worked
+ */
+qtree_status_t qtree_archive_builder_append(qtree_archive_builder_t *builder, uint64_t id,
+                                            uint32_t n_levels, const uint8_t *data,
+                                            size_t length);
+
+/**
+ * @brief Sorts and writes the index, then fills in the header
+ * @return QTREE_ERROR_FORMAT for a repeated id, or the first error of an add
+ */
+qtree_status_t qtree_archive_builder_finish(qtree_archive_builder_t *builder);
+
+/**
+ * @brief Lets go of the entries (the file stays open, it is the caller's)
+ */
+void qtree_archive_builder_free(qtree_archive_builder_t *builder);
+
+/**
+ * @brief Checks an archive's header and index
+ * @param data The whole archive
+ * @param length Its size in bytes
+ * @param archive View to set up
+ * @return QTREE_ERROR_FORMAT if it is not a sound archive
+ */
+qtree_status_t qtree_archive_open(const uint8_t *data, size_t length, qtree_archive_t *archive);
+
+/**
+ * @brief Maps an archive file read-only and opens it
+ * @param path The archive
+ * @param archive View to set up; qtree_archive_close() unmaps it
+ * @return QTREE_SUCCESS if it worked
+ */
+qtree_status_t qtree_archive_map(const char *path, qtree_archive_t *archive);
+
+/**
+ * @brief Unmaps an archive from qtree_archive_map() (a plain view is just cleared)
+ */
+void qtree_archive_close(qtree_archive_t *archive);
+
+/**
+ * @brief The i-th image, by increasing id
+ * @return False if i is past the end
+ */
+bool qtree_archive_entry_at(const qtree_archive_t *archive, size_t i,
+                            qtree_archive_entry_t *entry);
+
+/**
+ * @brief Looks an image up by id
+ * @return False if the archive has no such image
+ */
+bool qtree_archive_find(const qtree_archive_t *archive, uint64_t id,
+                        qtree_archive_entry_t *entry);
+
+/**
+ * @brief Decodes one image straight from the archive's bytes, without logging
+ * @param entry What qtree_archive_find() or qtree_archive_entry_at() gave
+ * @param pixels Buffer of entry->size^2 bytes
+ * @return QTREE_SUCCESS if it worked
+ */
+qtree_status_t qtree_archive_decode(const qtree_archive_t *archive,
+                                    const qtree_archive_entry_t *entry, uint8_t *pixels);
+
+/**
+ * @brief Same as qtree_archive_decode(), counting the nodes it decoded
+ * @param stats Gets the nodes per level and the bits read (can be NULL)
+ * @return QTREE_SUCCESS if it worked
+ */
+qtree_status_t qtree_archive_decode_with_stats(const qtree_archive_t *archive,
+                                               const qtree_archive_entry_t *entry,
+                                               uint8_t *pixels, qtc_stats_t *stats);
+
+#endif /* ARCHIVE_H */
@@ -0,0 +1,50 @@
+/**
+ * @file band_compression.h
+ * @brief Q1 compression of images too big to hold, one band of rows at a time
+ *
+ * The image is read in bands of 2^k rows. Each band is cut into square
+ * 2^k blocks whose subtrees are built, written level by level into a
+ * spill file and dropped right away; only their roots stay in memory.
+ * Those roots make the top of the tree, and once the last band is done
+ * the levels are stitched together into the usual level-major stream,
+ * bit for bit what compress() writes for the same image.
+ *
+ * Memory is one band of pixels, one block's nodes and a few words per
+ * block; the compressed data waits on disk.
+ */
+
+#ifndef BAND_COMPRESSION_H
+#define BAND_COMPRESSION_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "codec/stats.h"
+#include "core/quadtree.h"
+
+/**
+ * @brief Compresses a PGM file without ever loading all of it (lossless, Q1)
+ * @param input_path The image to read
+ * @param band_rows Rows per band (power of 2), 0 for about sqrt(size)
+ * @param output_filename Path for the output file (only used for logging)
+ * @param output_file File already opened for writing
+ * @return QTREE_SUCCESS if everything went well
+ */
+qtree_status_t compress_banded(const char *input_path, uint32_t band_rows,
+                               const char *output_filename, FILE *output_file);
+
+/**
+ * @brief Same as compress_banded(), filling in what the passes counted
+ *
+ * Reading, building and coding the bands all happen in the first pass,
+ * which is timed as the encode stage; the stitch pass is the write.
+ *
+ * @param stats Gets stages, size, depth, nodes per level, bits and the arena's
+ *              counters (can be NULL)
+ * @return QTREE_SUCCESS if everything went well
+ */
+qtree_status_t compress_banded_with_stats(const char *input_path, uint32_t band_rows,
+                                          const char *output_filename, FILE *output_file,
+                                          qtc_stats_t *stats);
+
+#endif /* BAND_COMPRESSION_H */
@@ -0,0 +1,52 @@
+/**
+ * @file batch.h
+ * @brief Many files in one run
+ *
+ * The calling thread reads the next images while a pool of workers
+ * encodes the ones already loaded; a worker keeps its tree (and so its
+ * node arena) from one file to the next. Workers don't log, the batch
+ * reports totals at the end instead.
+ */
+
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "codec/codec.h"
+#include "config/config.h"
+
+/**
+ * @brief What a batch did
+ */
+typedef struct
+{
+    size_t files;          /* Inputs found */
+    size_t failed;         /* Inputs that did not make it */
+    uint64_t input_bytes;  /* Bytes of input files */
+    uint64_t output_bytes; /* Bytes of output files */
+    double seconds;        /* Wall time */
+} codec_batch_report_t;
+
+/**
+ * @brief Compresses or decompresses every file of config->batch_source
+ *
+ * The source is a directory (every .pgm, or every .qtc when
+ * decompressing), a text file with one path per line, or "-" to read
+ * those lines from stdin. Outputs go to config->output_file if it is
+ * set (it is made if missing), next to their input otherwise, with the
+ * extension swapped. config->threads is the worker count; each file is
+ * built on a single thread. With config->sequence_block set the inputs
+ * are instead the frames of one sequence, coded in order into
+ * config->output_file (see sequence.h). With config->archive_file set
+ * every compressed file is appended to that one archive instead of
+ * getting a file of its own (see archive.h).
+ *
+ * @param config All the settings, batch_source included
+ * @param report Where to put the totals (can be NULL)
+ * @return CODEC_SUCCESS if every file worked, else the first file's error
+ */
+codec_status_t codec_batch(const config_t *config, codec_batch_report_t *report);
+
+#endif /* BATCH_H */
@@ -0,0 +1,108 @@
+/**
+ * @file bit_reader.h
+ * @brief Block-buffered bit reader with a 64-bit lookahead
+ *
+ * Bytes come in from a FILE in big blocks (or straight from a memory
+ * buffer) and are shifted into a 64-bit window, MSB first. Reads are a
+ * shift and a mask; the window is only topped up when it runs low, and
+ * that is also the only place EOF and I/O errors are checked.
+ *
+ * When the caller is going to read to the end, big files and pipes are
+ * read ahead on a thread (see async_io.h), so the next blocks arrive
+ * while the decoder is busy with this one.
+ */
+
+#ifndef BIT_READER_H
+#define BIT_READER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "io/async_io.h"
+
+/* How much we pull from the file at once */
+#define BIT_READER_BLOCK_SIZE (64u * 1024u)
+
+/* Files with less than this left are read in place, a thread buys nothing */
+#define BIT_READER_PREFETCH_MIN (2u * ASYNC_IO_BLOCK_SIZE)
+
+/**
+ * @brief Reader state
+ */
+typedef struct
+{
+    uint64_t window;       /* Next bits, left-aligned */
+    uint32_t available;    /* How many bits of the window are valid */
+    const uint8_t *data;   /* Bytes not yet in the window */
+    size_t data_len;       /* Size of the current block */
+    size_t data_pos;       /* Next byte of the block */
+    size_t bytes_loaded;   /* Bytes moved into the window so far */
+    uint8_t *block;        /* Block buffer (file mode only) */
+    FILE *file;            /* Source file, NULL for memory mode */
+    async_reader_t *ahead; /* Read-ahead thread, NULL to read in place */
+    bool has_error;        /* Ran out of data or the read failed */
+    const char *error_msg; /* What went wrong */
+} qtree_bit_reader_t;
+
+/**
+ * @brief Reads from the current position of a file
+ * @param reader Reader to set up
+ * @param file Open file, positioned at the first data byte; with read-ahead
+ *             it is not to be touched again until bit_reader_close()
+ * @param read_ahead The whole payload will be read, so big files and pipes
+ *                   may be read ahead; pass false for a decode that stops
+ *                   early, which then only pulls the blocks it uses
+ * @return False if the block buffer can't be allocated
+ */
+bool bit_reader_open_file(qtree_bit_reader_t *reader, FILE *file, bool read_ahead);
+
+/**
+ * @brief Reads from a buffer that outlives the reader
+ * @param reader Reader to set up
+ * @param data First data byte
+ * @param size How many bytes there are
+ */
+void bit_reader_open_memory(qtree_bit_reader_t *reader, const uint8_t *data, size_t size);
+
+/**
+ * @brief Stops the read-ahead and frees the block buffer
+ * @param reader Reader to clean up
+ */
+void bit_reader_close(qtree_bit_reader_t *reader);
+
+/**
+ * @brief Tops the window up to at least 57 bits, or whatever is left
+ * @param reader Current reader
+ * @param needed Bits the caller wants next
+ * @return False (and has_error set) if fewer than `needed` bits remain
+ */
+bool bit_reader_refill(qtree_bit_reader_t *reader, uint32_t needed);
+
+/**
+ * @brief Reads up to 32 bits, MSB first
+ * @param reader Current reader
+ * @param num_bits How many (1-32)
+ * @return The value, or 0 once the reader has failed
+ */
+static inline uint32_t bit_reader_read(qtree_bit_reader_t *reader, uint32_t num_bits)
+{
+    if (reader->available < num_bits && !bit_reader_refill(reader, num_bits))
+        return 0;
+
+    const uint32_t value = (uint32_t)(reader->window >> (64 - num_bits));
+    reader->window <<= num_bits;
+    reader->available -= num_bits;
+    return value;
+}
+
+/**
+ * @brief How many bits have been consumed so far
+ */
+static inline size_t bit_reader_bits_read(const qtree_bit_reader_t *reader)
+{
+    return reader->bytes_loaded * 8 - reader->available;
+}
+
+#endif /* BIT_READER_H */
@@ -6,7 +6,13 @@
 #ifndef CODEC_H
 #define CODEC_H
 
+#include <stdio.h>
+
+#include "codec/archive.h"
+#include "codec/stats.h"
 #include "config/config.h"
+#include "core/quadtree.h"
+#include "io/pgm.h"
 
 /**
  * @brief Different status codes for our functions
@@ -23,16 +29,67 @@ typedef enum
 /**
  * @brief Takes an image and compresses it
  * @param config All the settings we need
+ * @param stats Filled in with times and counters if not NULL
  * @return How it went (success or what kind of error)
  */
-codec_status_t codec_compress(const config_t *config);
+codec_status_t codec_compress(const config_t *config, qtc_stats_t *stats);
+
+/**
+ * @brief Compresses an image that is already loaded
+ *
+ * Same as codec_compress() minus the reading, for callers that keep
+ * images and trees around between files. config->input_file is only
+ * used as a name.
+ *
+ * @param config All the settings we need
+ * @param pgm The image to compress
+ * @param tree Tree to build into, zeroed or left over from an earlier
+ *             call (its arena gets reused); the caller frees it
+ * @param stats Filled in with times and counters if not NULL (no read stage)
+ * @return How it went (success or what kind of error)
+ */
+codec_status_t codec_compress_image(const config_t *config, const pgm_t *pgm, qtree_t *tree,
+                                    qtc_stats_t *stats);
+
+/**
+ * @brief Compresses an image that is already loaded into an archive
+ *
+ * Builds and filters like codec_compress_image(), then appends the bare
+ * payload under the id qtree_archive_id() gives config->input_file.
+ * Safe to call from several threads on one archive, each with its own
+ * tree.
+ *
+ * @param config All the settings we need (output_file is only used as a name)
+ * @param pgm The image to compress
+ * @param tree Tree to build into, as for codec_compress_image()
+ * @param archive Builder to append to
+ * @param stats Filled in if not NULL; bytes_out is the payload, not the archive
+ * @return How it went (success or what kind of error)
+ */
+codec_status_t codec_compress_to_archive(const config_t *config, const pgm_t *pgm,
+                                        qtree_t *tree, qtree_archive_builder_t *archive,
+                                        qtc_stats_t *stats);
 
 /**
  * @brief Takes a compressed file and turns it back into an image
+ *
+ * Stages are only timed for Q1/Q2 files in the pointer layout; the
+ * other containers and layouts just get the totals and sizes.
+ *
  * @param config All the settings we need
+ * @param stats Filled in with times and counters if not NULL
+ * @return How it went (success or what kind of error)
+ */
+codec_status_t codec_decompress(const config_t *config, qtc_stats_t *stats);
+
+/**
+ * @brief Same as codec_decompress() on a stream that is already open
+ * @param config All the settings we need (input_file is only used as a name)
+ * @param input The compressed data, left open
+ * @param stats Filled in with times and counters if not NULL
  * @return How it went (success or what kind of error)
  */
-codec_status_t codec_decompress(const config_t *config);
+codec_status_t codec_decompress_file(const config_t *config, FILE *input, qtc_stats_t *stats);
 
 /**
  * @brief Converts error codes into readable messages
@@ -41,4 +98,11 @@ codec_status_t codec_decompress(const config_t *config);
  */
 const char *codec_status_string(codec_status_t status);
 
+/**
+ * @brief Maps a quadtree status onto the codec ones
+ * @param status What a qtree_* call returned
+ * @return The matching codec status
+ */
+codec_status_t codec_status_from_qtree(qtree_status_t status);
+
 #endif /* CODEC_H */
\ No newline at end of file
@@ -8,26 +8,55 @@
 
 #include <stdint.h>
 #include <stdio.h>
+#include "codec/entropy.h"
+#include "codec/stats.h"
 #include "core/quadtree.h"
+#include "core/qtree_array.h"
+#include "io/async_io.h"
+
+/* How much encoded data we stage before handing it to stdio */
+#define COMPRESS_BUFFER_SIZE (256u * 1024u)
+
+/**
+ * @brief Payload formats, told apart by the magic bytes
+ */
+typedef enum {
+    QTREE_FORMAT_Q1 = 0, /* Raw bits: 8 per mean, 2 or 3 per node for e/u */
+    QTREE_FORMAT_Q2      /* Same nodes, rANS coded (see entropy.h) */
+} qtree_format_t;
 
 /**
  * @brief Structure to keep track of compression progress
+ *
+ * Bits pile up in a 64-bit accumulator and leave it 32 at a time into
+ * a big staging buffer, which goes to the file when full: handed to a
+ * write-behind thread if one could be started, else in one fwrite.
+ * Without a file the buffer just grows and keeps the whole stream.
+ * compress() streams Q1 to its file, the size is worked out before
+ * the header goes out; buffers, containers and Q2 stay in memory.
+ * For Q2 the fields are queued instead, and compress_flush() codes
+ * them and swaps the result in as the buffer.
  */
 typedef struct {
-    uint8_t buffer;          /* Stores bits before writing them */
-    size_t bit_position;     /* Which bit we're currently at */
-    FILE *file;             /* Where we write the compressed data */
+    uint64_t accumulator;    /* Pending bits, newest in the low end */
+    size_t bit_count;        /* How many pending bits are valid */
+    uint8_t *buffer;         /* Staged bytes waiting for the file */
+    size_t buffer_used;      /* How much of the buffer is filled */
+    size_t buffer_capacity;  /* How big the buffer is right now */
+    FILE *file;              /* Where we write the data (NULL keeps it in memory) */
+    async_writer_t *writer;  /* Writes the file behind us (NULL writes in place) */
     size_t bytes_written;    /* How many bytes we've written */
     size_t total_bits;       /* Total bits processed */
-    int error;              /* Tracks if something went wrong */
-    size_t total_nodes;     /* Total nodes to process */
+    int error;               /* Tracks if something went wrong */
+    size_t total_nodes;      /* Total nodes to process */
     size_t processed_nodes;  /* How many we've done so far */
+    qtree_q2_encoder_t *q2;  /* Q2 symbol queue (NULL for Q1) */
 } qtree_compress_state_t;
 
 /**
  * @brief Sets up everything needed for compression
- * @param file Where to write the compressed data
- * @return The initialized state
+ * @param file Where to write the compressed data, or NULL for memory mode
+ * @return The initialized state (error is set if the buffer can't be made)
  */
 qtree_compress_state_t compress_init(FILE *file);
 
@@ -48,10 +77,27 @@ void compress_write_bits(qtree_compress_state_t *state, uint32_t value, size_t n
 
 /**
  * @brief Writes any remaining bits and cleans up
+ *
+ * In memory mode the buffer is kept: buffer[0..buffer_used) is the
+ * whole stream until compress_release() is called.
+ *
  * @param state Current compression state
  */
 void compress_flush(qtree_compress_state_t *state);
 
+/**
+ * @brief Starts a memory-mode state over, keeping its buffer
+ * @param state State made with compress_init(NULL)
+ */
+void compress_rewind(qtree_compress_state_t *state);
+
+/**
+ * @brief Drops whatever is still pending and frees the buffer
+ * @param state Current compression state
+ * @note Safe to call after compress_flush()
+ */
+void compress_release(qtree_compress_state_t *state);
+
 /**
  * @brief Checks how well we compressed the data
  * @param total_bits Size after compression
@@ -60,6 +106,40 @@ void compress_flush(qtree_compress_state_t *state);
  */
 float compress_get_rate(size_t total_bits, size_t original_size);
 
+/**
+ * @brief Writes the file header: magic, comment lines and tree depth
+ * @param file Output file pointer
+ * @param format Format of the payload that follows
+ * @param n_levels Depth of the quadtree being compressed
+ * @param compression_rate Rate for the comment line, in percent
+ * @return True if the header was written successfully
+ */
+bool compress_write_header(FILE *file, qtree_format_t format, uint32_t n_levels,
+                           float compression_rate);
+
+/**
+ * @brief Writes the root's own fields, the first thing in a payload
+ * @param n_levels Depth of the whole tree
+ */
+void compress_write_root(qtree_compress_state_t *state, const qtree_node_t *root,
+                         uint32_t n_levels);
+
+/**
+ * @brief Writes every level under a node, level-major (Q1 order)
+ *
+ * The node's own fields are not written. Children of uniform nodes are
+ * skipped and so is every fourth mean, exactly as in a whole payload.
+ *
+ * @param root Top of the part to write
+ * @param height Levels under root to write
+ * @param reaches_bottom True if the last level is pixels (no e/u there)
+ * @param level_ends Set to total_bits after each level (height entries);
+ *                   NULL draws the progress bar instead
+ * @return False if memory ran out or the state failed
+ */
+bool compress_levels(qtree_compress_state_t *state, const qtree_node_t *root,
+                     uint32_t height, bool reaches_bottom, size_t *level_ends);
+
 /**
  * @brief Main function to compress a quadtree
  * @param tree The tree to compress
@@ -69,6 +149,75 @@ float compress_get_rate(size_t total_bits, size_t original_size);
  */
 qtree_status_t compress(const qtree_t *tree, const char *output_filename, FILE *output_file);
 
+/**
+ * @brief Same as compress() with a choice of payload format
+ * @param tree The tree to compress
+ * @param format QTREE_FORMAT_Q1 or QTREE_FORMAT_Q2
+ * @param output_filename Path for the output file
+ * @param output_file File already opened for writing
+ * @return QTREE_SUCCESS if everything went well
+ */
+qtree_status_t compress_with_format(const qtree_t *tree, qtree_format_t format,
+                                    const char *output_filename, FILE *output_file);
+
+/**
+ * @brief Same as compress_with_format(), filling in the encode and write stages
+ *
+ * A Q1 payload is written while it is coded, so only its header counts
+ * as writing.
+ *
+ * @param stats Gets the stage times and bits in/out (can be NULL)
+ * @return QTREE_SUCCESS if everything went well
+ */
+qtree_status_t compress_with_stats(const qtree_t *tree, qtree_format_t format,
+                                   const char *output_filename, FILE *output_file,
+                                   qtc_stats_t *stats);
+
+/**
+ * @brief Same as compress() but the file ends up in memory
+ * @param tree The tree to compress
+ * @param data Set to the whole file, header included (free() it)
+ * @param length Set to its size in bytes
+ * @return QTREE_SUCCESS if everything went well
+ */
+qtree_status_t compress_to_buffer(const qtree_t *tree, uint8_t **data, size_t *length);
+
+/**
+ * @brief Just the payload, no header, for containers that keep their own
+ * @param tree The tree to compress
+ * @param format QTREE_FORMAT_Q1 or QTREE_FORMAT_Q2
+ * @param data Set to the payload bytes (free() it)
+ * @param length Set to its size in bytes
+ * @return QTREE_SUCCESS if everything went well
+ */
+qtree_status_t compress_payload_to_buffer(const qtree_t *tree, qtree_format_t format,
+                                          uint8_t **data, size_t *length);
+
+/**
+ * @brief Same as compress() but for the array layout
+ * @param tree The array tree to compress
+ * @param output_filename Path for the output file
+ * @param output_file File already opened for writing
+ * @return QTREE_SUCCESS if everything went well
+ */
+qtree_status_t compress_array(const qtree_array_t *tree, const char *output_filename,
+                              FILE *output_file);
+
+/**
+ * @brief Same as compress_with_format() but for the array layout
+ */
+qtree_status_t compress_array_with_format(const qtree_array_t *tree, qtree_format_t format,
+                                          const char *output_filename, FILE *output_file);
+
+/**
+ * @brief Same as compress_array_with_format(), filling in the encode and write stages
+ * @param stats Gets the stage times and bits in/out (can be NULL)
+ * @return QTREE_SUCCESS if everything went well
+ */
+qtree_status_t compress_array_with_stats(const qtree_array_t *tree, qtree_format_t format,
+                                         const char *output_filename, FILE *output_file,
+                                         qtc_stats_t *stats);
+
 /**
  * @brief Makes compression better by filtering small differences
  * @param tree The tree to filter
@@ -77,4 +226,71 @@ qtree_status_t compress(const qtree_t *tree, const char *output_filename, FILE *
  */
 qtree_status_t apply_lossy_compression(qtree_t *tree, float alpha);
 
+/**
+ * @brief What rate control aims for
+ */
+typedef enum
+{
+    RATE_TARGET_NONE = 0, /* Use the alpha we were given */
+    RATE_TARGET_BYTES,    /* Largest file size allowed */
+    RATE_TARGET_PSNR      /* Lowest quality allowed, in dB */
+} qtree_rate_target_kind_t;
+
+typedef struct
+{
+    qtree_rate_target_kind_t kind;
+    double value;          /* Bytes or dB, depending on kind */
+    qtree_format_t format; /* What will be written (only Q1 can be priced) */
+} qtree_rate_target_t;
+
+/**
+ * @brief What the encoder would produce for one alpha
+ */
+typedef struct
+{
+    float alpha;  /* 1.0 means no filtering */
+    size_t bits;  /* Payload bits */
+    size_t bytes; /* Whole file, header included */
+    double mse;   /* Mean squared error against the original */
+    double psnr;  /* In dB, INFINITY when lossless */
+} qtree_lossy_estimate_t;
+
+/**
+ * @brief Predicts size and quality for an alpha without touching the tree
+ *
+ * Only variances are (re)computed; nothing gets pruned or written.
+ *
+ * @param tree A tree straight out of qtree_build, not yet filtered
+ * @param alpha Alpha to try (1.0 or below for lossless)
+ * @param estimate Where to put the prediction
+ * @return QTREE_SUCCESS if it worked
+ */
+qtree_status_t estimate_lossy_compression(qtree_t *tree, float alpha,
+                                          qtree_lossy_estimate_t *estimate);
+
+/**
+ * @brief Searches alpha for a size or quality target, then filters with it
+ *
+ * Every candidate is tried with a dry run of the filter, so the tree is
+ * only pruned once, with the alpha that was picked. For a size target
+ * that is the best quality that fits; for a PSNR target, the smallest
+ * file that is still good enough. Lossless is picked when it qualifies.
+ * Sizes are Q1 sizes, so only a Q1 file can be aimed at.
+ *
+ * @param tree A tree straight out of qtree_build, not yet filtered
+ * @param target What to aim for
+ * @param chosen Where to report the pick (can be NULL)
+ * @return QTREE_ERROR_INVALID_PARAM for a Q2 target, QTREE_SUCCESS if it worked
+ */
+qtree_status_t apply_lossy_compression_target(qtree_t *tree, const qtree_rate_target_t *target,
+                                              qtree_lossy_estimate_t *chosen);
+
+/**
+ * @brief Same filtering as apply_lossy_compression() on the array layout
+ * @param tree The array tree to filter
+ * @param alpha How aggressive the filtering should be
+ * @return QTREE_SUCCESS if filtering worked
+ */
+qtree_status_t apply_lossy_compression_array(qtree_array_t *tree, float alpha);
+
 #endif /* COMPRESSION_H */
\ No newline at end of file
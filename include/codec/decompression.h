@@ -6,7 +6,10 @@
 #ifndef QUADTREE_DECOMPRESS_H
 #define QUADTREE_DECOMPRESS_H
 
+#include "codec/compression.h"
 #include "core/quadtree.h"
+#include "core/qtree_array.h"
+#include "core/qtree_succinct.h"
 #include "io/pgm.h"
 #include <stdio.h>
 
@@ -19,6 +22,14 @@
  */
 qtree_status_t qtree_decompress(FILE *file, const char *input_filename, qtree_t *tree);
 
+/**
+ * @brief Same as qtree_decompress(), also saying how many payload bits it read
+ * @param stats Gets bits_in and bits_out (can be NULL)
+ * @return QTREE_SUCCESS if it worked
+ */
+qtree_status_t qtree_decompress_with_stats(FILE *file, const char *input_filename,
+                                           qtree_t *tree, qtc_stats_t *stats);
+
 /**
  * @brief Converts our quadtree back into a normal image
  * @param tree The quadtree to convert
@@ -28,4 +39,166 @@ qtree_status_t qtree_decompress(FILE *file, const char *input_filename, qtree_t
  */
 qtree_status_t qtree_to_pgm(const qtree_t *tree, const char *output_filename, pgm_t *pgm);
 
+/**
+ * @brief Decodes a compressed file straight into an image
+ *
+ * No tree is built: only the non-uniform nodes of the level being read
+ * are kept, and every uniform or bottom-level block is painted into the
+ * image as soon as it is decoded.
+ *
+ * @param file The compressed file to read from
+ * @param input_filename Path to the file
+ * @param pgm Where to store the image (pixels allocated here)
+ * @return QTREE_SUCCESS if it worked
+ */
+qtree_status_t qtree_decompress_stream(FILE *file, const char *input_filename, pgm_t *pgm);
+
+/**
+ * @brief Same as qtree_decompress_stream(), counting the nodes it decoded
+ * @param stats Gets the nodes per level and the bits read (can be NULL)
+ * @return QTREE_SUCCESS if it worked
+ */
+qtree_status_t qtree_decompress_stream_with_stats(FILE *file, const char *input_filename,
+                                                  pgm_t *pgm, qtc_stats_t *stats);
+
+/**
+ * @brief Image side of a compressed file held in memory
+ * @param data The whole file
+ * @param length Its size in bytes
+ * @return Width/height of the image, or 0 if the header is bad
+ */
+uint32_t qtree_buffer_image_size(const uint8_t *data, size_t length);
+
+/**
+ * @brief Same as qtree_decompress_stream() on a file held in memory
+ * @param data The whole file, header included
+ * @param length Its size in bytes
+ * @param pixels Buffer of at least qtree_buffer_image_size()^2 bytes to
+ *               decode into, or NULL to have one allocated (pgm_free() it)
+ * @param pgm Where to store the image
+ * @return QTREE_SUCCESS if it worked
+ */
+qtree_status_t qtree_decompress_buffer(const uint8_t *data, size_t length,
+                                       uint8_t *pixels, pgm_t *pgm);
+
+/**
+ * @brief Same as qtree_decompress_buffer(), counting the nodes it decoded
+ * @param stats Gets the nodes per level and the bits read (can be NULL)
+ * @return QTREE_SUCCESS if it worked
+ */
+qtree_status_t qtree_decompress_buffer_with_stats(const uint8_t *data, size_t length,
+                                                  uint8_t *pixels, pgm_t *pgm,
+                                                  qtc_stats_t *stats);
+
+/**
+ * @brief Decodes a bare payload, for containers that keep the header elsewhere
+ * @param data First payload byte (what follows the depth byte in a file)
+ * @param length Payload size in bytes
+ * @param format How the payload is coded
+ * @param n_levels Tree depth (1..16)
+ * @param pixels Buffer of (2^n_levels)^2 bytes, or NULL to have one allocated
+ * @param pgm Where to store the image
+ * @return QTREE_SUCCESS if it worked
+ */
+qtree_status_t qtree_decompress_payload(const uint8_t *data, size_t length,
+                                        qtree_format_t format, uint32_t n_levels,
+                                        uint8_t *pixels, pgm_t *pgm);
+
+/**
+ * @brief Same as qtree_decompress_payload(), counting the nodes it decoded
+ * @param stats Gets the nodes per level and the bits read (can be NULL)
+ * @return QTREE_SUCCESS if it worked
+ */
+qtree_status_t qtree_decompress_payload_with_stats(const uint8_t *data, size_t length,
+                                                   qtree_format_t format, uint32_t n_levels,
+                                                   uint8_t *pixels, pgm_t *pgm,
+                                                   qtc_stats_t *stats);
+
+/**
+ * @brief Decodes only the first levels of a compressed file
+ *
+ * The stream is level-major, so levels 0..level are a prefix of the
+ * file and nothing after them is decoded. Each pixel of the result is
+ * the mean of its node on that level.
+ *
+ * @param file The compressed file to read from
+ * @param input_filename Path to the file
+ * @param level Last level to decode (0 is the root, past the depth means all)
+ * @param upscale True for a full-size preview, false for a (2^level)x(2^level) image
+ * @param pgm Where to store the image (pixels allocated here)
+ * @return QTREE_SUCCESS if it worked
+ */
+qtree_status_t qtree_decompress_preview(FILE *file, const char *input_filename,
+                                        uint32_t level, bool upscale, pgm_t *pgm);
+
+/**
+ * @brief Same as qtree_decompress_preview(), counting the nodes it decoded
+ * @param stats Gets the nodes per level and the bits read (can be NULL)
+ * @return QTREE_SUCCESS if it worked
+ */
+qtree_status_t qtree_decompress_preview_with_stats(FILE *file, const char *input_filename,
+                                                   uint32_t level, bool upscale, pgm_t *pgm,
+                                                   qtc_stats_t *stats);
+
+/**
+ * @brief Reads a compressed file into the array layout
+ * @param file The compressed file to read from
+ * @param input_filename Path to the file
+ * @param tree Where to store the rebuilt tree (allocated here)
+ * @return QTREE_SUCCESS if it worked
+ */
+qtree_status_t qtree_decompress_array(FILE *file, const char *input_filename,
+                                      qtree_array_t *tree);
+
+/**
+ * @brief Same as qtree_decompress_array(), counting the nodes it decoded
+ * @param stats Gets the nodes per level and the bits read (can be NULL)
+ * @return QTREE_SUCCESS if it worked
+ */
+qtree_status_t qtree_decompress_array_with_stats(FILE *file, const char *input_filename,
+                                                 qtree_array_t *tree, qtc_stats_t *stats);
+
+/**
+ * @brief Converts an array quadtree back into a normal image
+ * @param tree The quadtree to convert
+ * @param output_filename Where to save the image
+ * @param pgm Where to store the image data
+ * @return QTREE_SUCCESS if it worked
+ */
+qtree_status_t qtree_array_to_pgm(const qtree_array_t *tree, const char *output_filename,
+                                  pgm_t *pgm);
+
+/**
+ * @brief Reads a compressed file into the succinct layout
+ *
+ * Nodes go into the tree straight from the level-by-level decoder,
+ * which already reads them in breadth-first order; no pointer tree is
+ * ever built.
+ *
+ * @param file The compressed file to read from
+ * @param input_filename Path to the file
+ * @param tree Where to store the tree (allocated here, qtree_succinct_free() it)
+ * @return QTREE_SUCCESS if it worked
+ */
+qtree_status_t qtree_decompress_succinct(FILE *file, const char *input_filename,
+                                         qtree_succinct_t *tree);
+
+/**
+ * @brief Same as qtree_decompress_succinct(), counting the nodes it decoded
+ * @param stats Gets the nodes per level and the bits read (can be NULL)
+ * @return QTREE_SUCCESS if it worked
+ */
+qtree_status_t qtree_decompress_succinct_with_stats(FILE *file, const char *input_filename,
+                                                    qtree_succinct_t *tree, qtc_stats_t *stats);
+
+/**
+ * @brief Converts a succinct quadtree back into a normal image
+ * @param tree The quadtree to convert
+ * @param output_filename Where to save the image
+ * @param pgm Where to store the image data
+ * @return QTREE_SUCCESS if it worked
+ */
+qtree_status_t qtree_succinct_to_pgm(const qtree_succinct_t *tree, const char *output_filename,
+                                     pgm_t *pgm);
+
 #endif /* QUADTREE_DECOMPRESS_H */
\ No newline at end of file
@@ -0,0 +1,279 @@
+/**
+ * @file entropy.h
+ * @brief rANS coder with per-file frequency tables, and the Q2 model
+ *
+ * Q2 walks the tree in the same order as Q1 and drops the same nodes
+ * (children of uniform parents, every fourth mean), but the fields go
+ * through a range-ANS coder instead of raw bits:
+ *
+ * - a child mean becomes a residual against its parent's mean, coded as
+ *   one token (zero, or a sign and a range of magnitudes: 1, 2, 3, then
+ *   each power of two split in halves, 4-5, 6-7, 8-11 ... 192-255)
+ *   followed by the position within the range, at even odds;
+ * - e and u become one token: e == 0 with u, or e == 1, 2, 3.
+ *
+ * Tokens are contexted on the height of the block (0 for pixels) and,
+ * for means, on how far the earlier siblings strayed from the parent.
+ * The encoder counts every context over the whole tree first and sends
+ * the tables up front, so decoding a token is a single table lookup.
+ *
+ * The stream is one run of bytes, read front to back: the 8-byte coder
+ * state, then the tables, then the payload, all through the same coder.
+ * The encoder produces it back to front, so it keeps the whole list of
+ * symbols until the end.
+ */
+
+#ifndef ENTROPY_H
+#define ENTROPY_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "codec/bit_reader.h"
+
+/* Coder state stays in [RANS_LOW, 2^63) and moves 32 bits at a time */
+#define RANS_LOW ((uint64_t)1 << 31)
+
+/* Tables add up to 2^5 .. 2^12, depending on how much a context is used */
+#define Q2_MIN_SCALE_BITS 5
+#define Q2_MAX_SCALE_BITS 12
+
+/* Context layout */
+#define Q2_HEIGHTS 12          /* Block heights, 11 and up share one */
+#define Q2_ACTIVITY_CONTEXTS 5 /* First child, then how far siblings strayed */
+#define Q2_MEAN_CONTEXTS (Q2_HEIGHTS * Q2_ACTIVITY_CONTEXTS)
+#define Q2_CONTEXTS (Q2_MEAN_CONTEXTS + Q2_HEIGHTS)
+
+/* Token alphabets */
+#define Q2_MAGNITUDES 15   /* Magnitude ranges */
+#define Q2_MEAN_TOKENS 31  /* 0, then 15 positive ranges, then 15 negative ones */
+#define Q2_FLAG_TOKENS 5   /* e0 u0, e0 u1, e1, e2, e3 */
+#define Q2_BAD_TOKEN 31    /* What an unused context decodes to */
+
+/**
+ * @brief How far the earlier siblings of a family strayed
+ */
+typedef struct
+{
+    uint32_t peak;  /* Largest |residual| so far */
+    uint32_t count; /* How many siblings so far */
+} qtree_q2_family_t;
+
+/**
+ * @brief Encoder: everything is queued, then coded in one go at the end
+ */
+typedef struct
+{
+    uint32_t *symbols;                        /* Queued symbols, packed */
+    size_t count;                             /* How many */
+    size_t capacity;                          /* Room in symbols */
+    uint32_t counts[Q2_CONTEXTS][Q2_MEAN_TOKENS]; /* Token counts per context */
+    bool error;                               /* Out of memory */
+} qtree_q2_encoder_t;
+
+/**
+ * @brief One decoding table: 2^scale slots, each a packed token
+ */
+typedef struct
+{
+    const uint32_t *slots; /* token | freq << 5 | (slot - start) << 18 */
+    uint32_t mask;         /* 2^scale - 1 */
+    uint32_t scale;        /* Table size, in bits */
+} qtree_q2_table_t;
+
+/**
+ * @brief Decoder state, bytes come from a bit reader
+ */
+typedef struct
+{
+    uint64_t state;                       /* rANS state */
+    qtree_bit_reader_t *source;           /* Compressed bytes */
+    qtree_q2_table_t tables[Q2_CONTEXTS]; /* One per context */
+    uint32_t *slots;                      /* Storage behind the tables */
+    int16_t base[32];                     /* Residual a mean token starts at */
+    int8_t sign[32];                      /* Which way the extra bits go */
+    uint8_t extra[32];                    /* How many extra bits follow */
+    bool corrupt;                         /* Hit something no encoder makes */
+} qtree_q2_decoder_t;
+
+/**
+ * @brief Starts an encoder with nothing queued
+ * @return False if memory can't be had
+ */
+bool q2_encoder_init(qtree_q2_encoder_t *encoder);
+
+/**
+ * @brief Queues a child mean as a residual against its parent
+ * @param height Block height of the child (0 for a pixel)
+ * @param family Earlier siblings; updated with this one
+ * @param residual Child mean minus parent mean
+ */
+void q2_encode_residual(qtree_q2_encoder_t *encoder, uint32_t height,
+                        qtree_q2_family_t *family, int32_t residual);
+
+/**
+ * @brief Queues e, and u when e is 0
+ * @param height Block height of the node (never 0, pixels carry no flags)
+ */
+void q2_encode_flags(qtree_q2_encoder_t *encoder, uint32_t height, uint8_t e, uint8_t u);
+
+/**
+ * @brief Builds the tables and codes everything queued
+ * @param data Set to the stream (free() it)
+ * @param length Set to its size in bytes
+ * @return False if memory ran out at any point
+ */
+bool q2_encoder_finish(qtree_q2_encoder_t *encoder, uint8_t **data, size_t *length);
+
+/**
+ * @brief Frees the queue
+ */
+void q2_encoder_release(qtree_q2_encoder_t *encoder);
+
+/**
+ * @brief Reads the coder state and the tables
+ * @param source Positioned on the first payload byte
+ * @return False if the stream is cut short or the tables make no sense
+ */
+bool q2_decoder_init(qtree_q2_decoder_t *decoder, qtree_bit_reader_t *source);
+
+/**
+ * @brief Frees the tables
+ */
+void q2_decoder_release(qtree_q2_decoder_t *decoder);
+
+static inline uint32_t q2_height_context(uint32_t height)
+{
+    return height < Q2_HEIGHTS ? height : Q2_HEIGHTS - 1;
+}
+
+static inline uint32_t q2_mean_context(uint32_t height, const qtree_q2_family_t *family)
+{
+    uint32_t activity = 0;
+    if (family->count > 0)
+        activity = family->peak == 0 ? 1 : family->peak < 4 ? 2 : family->peak < 16 ? 3 : 4;
+    return q2_height_context(height) * Q2_ACTIVITY_CONTEXTS + activity;
+}
+
+static inline uint32_t q2_flag_context(uint32_t height)
+{
+    return Q2_MEAN_CONTEXTS + q2_height_context(height);
+}
+
+/**
+ * @brief Which magnitude range |r| (1..255) falls in
+ */
+static inline uint32_t q2_magnitude_range(uint32_t magnitude)
+{
+    if (magnitude < 4)
+        return magnitude - 1;
+
+    uint32_t c = 2;
+    while (magnitude >> (c + 1))
+        c++;
+    return 3 + 2 * (c - 2) + ((magnitude >> (c - 1)) & 1u);
+}
+
+/**
+ * @brief Smallest magnitude of a range, and how many extra bits it takes
+ */
+static inline uint32_t q2_range_start(uint32_t range, uint32_t *extra)
+{
+    if (range < 3)
+    {
+        *extra = 0;
+        return range + 1;
+    }
+
+    const uint32_t c = 2 + (range - 3) / 2;
+    *extra = c - 1;
+    return (1u << c) | (((range - 3) & 1u) << (c - 1));
+}
+
+/**
+ * @brief Counts one more sibling into a family
+ */
+static inline void q2_family_add(qtree_q2_family_t *family, int32_t residual)
+{
+    const uint32_t magnitude = (uint32_t)(residual < 0 ? -residual : residual);
+    if (magnitude > family->peak)
+        family->peak = magnitude;
+    family->count++;
+}
+
+/**
+ * @brief One refill always does: a symbol takes at most 20 bits off the state
+ */
+static inline void q2_renormalize(qtree_q2_decoder_t *decoder)
+{
+    if (decoder->state < RANS_LOW)
+        decoder->state = (decoder->state << 32) | bit_reader_read(decoder->source, 32);
+}
+
+/**
+ * @brief Table lookup and state update, without the refill
+ */
+static inline uint32_t q2_take_token(qtree_q2_decoder_t *decoder, uint32_t context)
+{
+    const qtree_q2_table_t *table = &decoder->tables[context];
+    const uint32_t slot = table->slots[decoder->state & table->mask];
+
+    decoder->state = ((slot >> 5) & 0x1FFFu) * (decoder->state >> table->scale) + (slot >> 18);
+    return slot & 31u;
+}
+
+/**
+ * @brief Up to 8 bits at even odds
+ */
+static inline uint32_t q2_decode_bits(qtree_q2_decoder_t *decoder, uint32_t num_bits)
+{
+    const uint32_t value = (uint32_t)decoder->state & ((1u << num_bits) - 1u);
+    decoder->state >>= num_bits;
+    q2_renormalize(decoder);
+    return value;
+}
+
+/**
+ * @brief Reverse of q2_encode_residual()
+ *
+ * The token and the low bits of the magnitude come off the state
+ * together, with a single refill after both.
+ */
+static inline int32_t q2_decode_residual(qtree_q2_decoder_t *decoder, uint32_t height,
+                                         qtree_q2_family_t *family)
+{
+    const uint32_t token = q2_take_token(decoder, q2_mean_context(height, family));
+    decoder->corrupt |= token >= Q2_MEAN_TOKENS;
+
+    const uint32_t extra = decoder->extra[token];
+    const uint32_t low = (uint32_t)decoder->state & ((1u << extra) - 1u);
+    decoder->state >>= extra;
+    q2_renormalize(decoder);
+
+    const int32_t residual = decoder->base[token] + decoder->sign[token] * (int32_t)low;
+
+    q2_family_add(family, residual);
+    return residual;
+}
+
+/**
+ * @brief Reverse of q2_encode_flags()
+ */
+static inline void q2_decode_flags(qtree_q2_decoder_t *decoder, uint32_t height,
+                                   uint8_t *e, uint8_t *u)
+{
+    const uint32_t token = q2_take_token(decoder, q2_flag_context(height));
+    q2_renormalize(decoder);
+    if (token >= Q2_FLAG_TOKENS)
+    {
+        decoder->corrupt = true;
+        *e = 0;
+        *u = 1;
+        return;
+    }
+    *e = token < 2 ? 0 : (uint8_t)(token - 1);
+    *u = token == 1;
+}
+
+#endif /* ENTROPY_H */
@@ -0,0 +1,70 @@
+/**
+ * @file metrics.h
+ * @brief How far a (filtered) tree is from the image it was built from
+ *
+ * Every flat block the decoder would paint is one node: a leaf, or a
+ * node the filter made uniform. Its error is the squared distance of
+ * the original block to that node's mean, summed straight off the
+ * source pixels with vector kernels, so measuring quality never needs
+ * a decode and a second image. The node variances give a cheaper
+ * guess: a flat block of n pixels costs about n·v².
+ */
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "core/qtree_array.h"
+#include "core/quadtree.h"
+
+/**
+ * @brief Quality of a tree against its source image
+ */
+typedef struct
+{
+    bool exact;              /* Measured on the pixels (false: estimate only) */
+    uint64_t squared_error;  /* Σ(original - decoded)², 0 without pixels */
+    double mse;              /* Per pixel, exact if we could, else the estimate */
+    double psnr;             /* In dB, INFINITY when nothing was lost */
+    double estimated_mse;    /* From the node variances alone */
+    double estimated_psnr;
+} qtree_distortion_t;
+
+/**
+ * @brief Measures (or estimates) what the tree would decode to
+ *
+ * The estimate needs the variances the lossy filter computes; on a tree
+ * straight out of qtree_build they are all zero. The walk runs on
+ * tree->pool if there is one.
+ *
+ * @param tree A pointer tree, filtered or not
+ * @param pixels The image it was built from, or NULL for the estimate only
+ * @param distortion Where to put the figures
+ * @return QTREE_SUCCESS if it worked
+ */
+qtree_status_t qtree_measure_distortion(const qtree_t *tree, const uint8_t *pixels,
+                                        qtree_distortion_t *distortion);
+
+/**
+ * @brief Same as qtree_measure_distortion() for the array layout, on this thread
+ * @param tree An array tree, filtered (and normalized) or not
+ * @param pixels The image it was built from, or NULL for the estimate only
+ * @param distortion Where to put the figures
+ * @return QTREE_SUCCESS if it worked
+ */
+qtree_status_t qtree_measure_array_distortion(const qtree_array_t *tree, const uint8_t *pixels,
+                                              qtree_distortion_t *distortion);
+
+/**
+ * @brief PSNR for 8-bit pixels, INFINITY for an MSE of 0
+ */
+double qtree_psnr_from_mse(double mse);
+
+/**
+ * @brief Which squared-error kernel was compiled in
+ */
+const char *qtree_metrics_kernel_name(void);
+
+#endif /* METRICS_H */
@@ -0,0 +1,74 @@
+/**
+ * @file qtc.h
+ * @brief Buffer-to-buffer codec for embedding
+ *
+ * No paths, no FILE*, no terminal output: pixels in, Q1 bytes out and
+ * back. Every call works on its own tree and buffers, so any number of
+ * threads can encode and decode at once.
+ *
+ * Output buffers work the same way for both directions: pass *out as
+ * NULL to get a buffer allocated (give it back with qtc_free()), or
+ * pass your own buffer in *out and its size in *out_len. Either way
+ * *out_len ends up holding the bytes written. If your buffer is too
+ * small nothing is written, CODEC_ERROR_MEMORY comes back and *out_len
+ * says how much is needed.
+ */
+
+#ifndef QTC_H
+#define QTC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "codec/codec.h"
+
+/**
+ * @brief Compresses a square image
+ * @param pixels size*size grey levels, row by row
+ * @param size Width/height, a power of two
+ * @param alpha Above 1.0 for lossy, 1.0 for lossless
+ * @param out Compressed file (see above)
+ * @param out_len Its size (see above)
+ * @return CODEC_SUCCESS or what went wrong
+ */
+codec_status_t qtc_encode(const uint8_t *pixels, uint32_t size, float alpha,
+                          uint8_t **out, size_t *out_len);
+
+/**
+ * @brief Same as qtc_encode(), timing the build, filter and encode stages
+ *
+ * There is no file here: bytes_out and bits_out are the whole buffer,
+ * header included. With alpha the filter's MSE/PSNR is measured too.
+ *
+ * @param stats Filled in if not NULL
+ * @return CODEC_SUCCESS or what went wrong
+ */
+codec_status_t qtc_encode_with_stats(const uint8_t *pixels, uint32_t size, float alpha,
+                                     uint8_t **out, size_t *out_len, qtc_stats_t *stats);
+
+/**
+ * @brief Decompresses what qtc_encode() (or the codec tool) produced
+ * @param data The compressed file
+ * @param len Its size in bytes
+ * @param pixels Image, size*size bytes (see above)
+ * @param pixels_len Its size (see above)
+ * @param size Set to the image width/height
+ * @return CODEC_SUCCESS or what went wrong
+ */
+codec_status_t qtc_decode(const uint8_t *data, size_t len, uint8_t **pixels,
+                          size_t *pixels_len, uint32_t *size);
+
+/**
+ * @brief Same as qtc_decode(), counting the nodes and timing the decode
+ * @param stats Filled in if not NULL
+ * @return CODEC_SUCCESS or what went wrong
+ */
+codec_status_t qtc_decode_with_stats(const uint8_t *data, size_t len, uint8_t **pixels,
+                                     size_t *pixels_len, uint32_t *size, qtc_stats_t *stats);
+
+/**
+ * @brief Gives back a buffer that qtc_encode() or qtc_decode() allocated
+ */
+void qtc_free(void *buffer);
+
+#endif /* QTC_H */
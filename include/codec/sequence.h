@@ -0,0 +1,145 @@
+/**
+ * @file sequence.h
+ * @brief Frame sequences where each frame only codes what changed
+ *
+ * Frames from a fixed camera mostly repeat the one before. The image
+ * is cut into 2^k x 2^k blocks, as in a tiled file, and the encoder
+ * keeps only the last frame's pixels: blocks whose pixels moved get
+ * their subtree built and coded on their own, and nothing else is
+ * touched. A frame is a bitmap of the changed blocks and one payload
+ * per set bit. The first frame has every bit set.
+ *
+ * Layout, integers little-endian:
+ *
+ *   "QS\n"
+ *   "# frames of <n>x<n>, blocks of <b>x<b>\n"
+ *   image depth (1 byte), block depth (1 byte), payload format (1 byte, 1 or 2)
+ *   then per frame:
+ *     bytes in the rest of the frame (4 bytes)
+ *     one bit per block, row by row, low bit first ((blocks + 7) / 8 bytes)
+ *     per set bit: payload length (4 bytes), payload (same bits a Q1/Q2 file
+ *     has after its depth byte)
+ *
+ * Frames are lossless: the filter of -a looks at the whole tree, so a
+ * block coded on its own would come out differently than in a full frame.
+ */
+
+#ifndef SEQUENCE_H
+#define SEQUENCE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "codec/compression.h"
+#include "core/quadtree.h"
+
+#define QTREE_SEQUENCE_MAGIC "QS"
+
+/* At most 2^10 blocks per side, like tiles */
+#define QTREE_SEQUENCE_MAX_SPLIT 10u
+
+/**
+ * @brief Writes a sequence a frame at a time
+ */
+typedef struct
+{
+    FILE *file;               /* Where frames go */
+    qtree_arena_t arena;      /* Nodes of the block being coded, reused */
+    uint8_t *previous;        /* Last frame's pixels (NULL before the first) */
+    uint8_t *bitmap;          /* Changed blocks of the frame being written */
+    uint8_t *frame;           /* Frame being put together */
+    size_t frame_capacity;    /* Bytes allocated for it */
+    uint32_t size;            /* Frame width/height */
+    uint32_t block_size;      /* Block width/height */
+    uint32_t block_levels;    /* Depth of each block's subtree */
+    uint32_t split;           /* Depth of the blocks under the root */
+    uint32_t blocks_per_side; /* size / block_size */
+    qtree_format_t format;    /* How the payloads are coded */
+    size_t frames;            /* Frames written */
+    size_t blocks_coded;      /* Changed blocks over all frames */
+    uint64_t bytes;           /* Bytes written, header included */
+} qtree_sequence_encoder_t;
+
+/**
+ * @brief Reads a sequence a frame at a time
+ *
+ * pixels always holds the last frame decoded; a frame only repaints
+ * the blocks it carries.
+ */
+typedef struct
+{
+    FILE *file;               /* Where frames come from */
+    uint8_t *pixels;          /* Current frame, size*size */
+    uint8_t *block;           /* One decoded block */
+    uint8_t *frame;           /* Frame as read from the file */
+    size_t frame_capacity;    /* Bytes allocated for it */
+    uint32_t size;
+    uint32_t block_size;
+    uint32_t block_levels;
+    uint32_t blocks_per_side;
+    qtree_format_t format;
+    size_t frames;            /* Frames decoded */
+    size_t blocks_decoded;    /* Blocks repainted over all frames */
+} qtree_sequence_decoder_t;
+
+/**
+ * @brief Tells a sequence from a plain file by its magic
+ */
+bool qtree_sequence_magic(const uint8_t *data, size_t length);
+
+/**
+ * @brief Starts a sequence and writes its header
+ * @param file Open for writing, left open
+ * @param size Frame width/height, a power of two
+ * @param block_size Block width/height, a power of two (clamped to size)
+ * @param format Payload format for every block
+ * @return QTREE_SUCCESS if everything went well
+ */
+qtree_status_t qtree_sequence_encoder_init(qtree_sequence_encoder_t *encoder, FILE *file,
+                                           uint32_t size, uint32_t block_size,
+                                           qtree_format_t format);
+
+/**
+ * @brief Codes the blocks that differ from the last frame
+ * @param pixels size*size grey levels, row by row (copied, not kept)
+ * @param changed Set to how many blocks were coded (can be NULL)
+ * @return QTREE_SUCCESS if everything went well
+ */
+qtree_status_t qtree_sequence_encode_frame(qtree_sequence_encoder_t *encoder,
+                                           const uint8_t *pixels, size_t *changed);
+
+/**
+ * @brief Frees everything (the file stays open)
+ */
+void qtree_sequence_encoder_free(qtree_sequence_encoder_t *encoder);
+
+/**
+ * @brief Reads the header of a sequence
+ * @param file Open for reading, at the magic
+ * @return QTREE_SUCCESS if everything went well
+ */
+qtree_status_t qtree_sequence_decoder_init(qtree_sequence_decoder_t *decoder, FILE *file);
+
+/**
+ * @brief Applies the next frame to decoder->pixels
+ * @param got Set to false when the file ended cleanly before a frame
+ * @return QTREE_SUCCESS if everything went well
+ */
+qtree_status_t qtree_sequence_decode_frame(qtree_sequence_decoder_t *decoder, bool *got);
+
+/**
+ * @brief Same as qtree_sequence_decode_frame(), adding the frame's blocks to stats
+ * @param stats Gets the blocks' nodes, on their level in the frame, and bits (can be NULL)
+ * @return QTREE_SUCCESS if everything went well
+ */
+qtree_status_t qtree_sequence_decode_frame_with_stats(qtree_sequence_decoder_t *decoder,
+                                                      bool *got, qtc_stats_t *stats);
+
+/**
+ * @brief Frees everything (the file stays open)
+ */
+void qtree_sequence_decoder_free(qtree_sequence_decoder_t *decoder);
+
+#endif /* SEQUENCE_H */
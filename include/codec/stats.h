@@ -0,0 +1,150 @@
+/**
+ * @file stats.h
+ * @brief Counters a codec call fills in, for telemetry instead of the terminal
+ *
+ * Pass a qtc_stats_t to codec_compress(), codec_decompress() or the
+ * *_with_stats() calls of qtc.h and it comes back with wall times per
+ * stage, the shape of the tree and what the arena did. Every field is
+ * plain data; qtc_stats_write_json() turns one into a JSON line:
+ *
+ *   {"op":"compress","input":"a.pgm","output":"a.qtc","size":512,"levels":9,
+ *    "total_s":0.0213,"stages":{"read":0.0011,"build":0.0062,...},
+ *    "nodes":87381,"level_nodes":[1,4,16,...],"bytes_in":262159,...,
+ *    "measured":true,"mse":3.21,"psnr":43.06,"mse_estimate":2.87,...}
+ *
+ * Times are monotonic wall clock, so with -t they are how long a stage
+ * took, not CPU time summed over threads. A stage a call never went
+ * through stays at 0. Tiled files, sequences and archives add up their
+ * payloads, each counted from the level its root sits on. A lossy
+ * encode also says what it cost in quality; the four figures are null
+ * in the JSON when nothing was measured, a PSNR too when nothing was lost.
+ */
+
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "core/qtree_array.h"
+#include "core/quadtree.h"
+
+/* Depth 16 plus the root */
+#define QTC_STATS_MAX_LEVELS 17u
+
+/**
+ * @brief Where the time goes
+ */
+typedef enum
+{
+    QTC_STAGE_READ = 0, /* Loading the input (the image, or the whole file in batch mode) */
+    QTC_STAGE_BUILD,    /* Pixels to tree */
+    QTC_STAGE_FILTER,   /* Lossy filter or rate control, with the quality check */
+    QTC_STAGE_ENCODE,   /* Tree to payload */
+    QTC_STAGE_WRITE,    /* Header, payload or image out to the file */
+    QTC_STAGE_DECODE,   /* File to tree (or straight to pixels) */
+    QTC_STAGE_RENDER,   /* Tree to pixels */
+    QTC_STAGE_GRID,     /* Segmentation grid */
+    QTC_STAGE_COUNT
+} qtc_stage_t;
+
+/**
+ * @brief What one compression or decompression did
+ */
+typedef struct
+{
+    const char *operation;                 /* "compress" or "decompress" */
+    const char *input;                     /* Path or name (can be NULL) */
+    const char *output;                    /* Path or name (can be NULL) */
+    double stage_seconds[QTC_STAGE_COUNT]; /* Wall time per stage */
+    double total_seconds;                  /* Whole call */
+    uint32_t size;                         /* Image width/height */
+    uint32_t n_levels;                     /* Tree depth */
+    uint64_t nodes;                        /* Nodes in the tree that was coded/decoded */
+    uint64_t level_nodes[QTC_STATS_MAX_LEVELS]; /* Same, per level (root first) */
+    uint64_t bytes_in;                     /* File read, or pixels handed in */
+    uint64_t bytes_out;                    /* File written, or bytes handed back */
+    uint64_t bits_in;                      /* Raw pixel bits, or payload bits read */
+    uint64_t bits_out;                     /* Payload bits written, or raw pixel bits */
+    uint64_t node_allocs;                  /* Nodes the arena handed out */
+    uint64_t block_allocs;                 /* Blocks the arena malloc'd */
+    uint64_t peak_nodes;                   /* Most nodes alive at once (upper bound with -t) */
+    uint64_t arena_bytes;                  /* Memory the arena holds */
+    bool measured;                         /* A lossy encode filled the four below */
+    double mse;                            /* Exact, against the source pixels */
+    double psnr;                           /* In dB, INFINITY when nothing was lost */
+    double mse_estimate;                   /* From the node variances alone */
+    double psnr_estimate;
+    bool ok;                               /* The call succeeded */
+} qtc_stats_t;
+
+/**
+ * @brief Clears the counters
+ * @param operation "compress" or "decompress"
+ */
+void qtc_stats_init(qtc_stats_t *stats, const char *operation);
+
+/**
+ * @brief Adds the time since start to a stage
+ * @param stats Where to add it (NULL does nothing)
+ * @param start What wall_seconds() said when the stage began
+ */
+void qtc_stats_stage(qtc_stats_t *stats, qtc_stage_t stage, double start);
+
+/**
+ * @brief Counts the nodes of a tree per level and copies the arena's counters
+ * @param stats Where to put them (NULL does nothing)
+ */
+void qtc_stats_count_tree(qtc_stats_t *stats, const qtree_t *tree);
+
+/**
+ * @brief Adds the nodes of one subtree per level, on this thread
+ *
+ * For encoders that never hold the whole tree, one piece at a time.
+ *
+ * @param stats Where to add them (NULL does nothing)
+ * @param level Level of root in the whole tree
+ */
+void qtc_stats_count_subtree(qtc_stats_t *stats, const qtree_node_t *root, uint32_t level);
+
+/**
+ * @brief Same as qtc_stats_count_tree() for the array layout (it has no arena)
+ * @param stats Where to put them (NULL does nothing)
+ */
+void qtc_stats_count_array(qtc_stats_t *stats, const qtree_array_t *tree);
+
+/**
+ * @brief Adds what one payload of a container (tile, block, image) decoded to a total
+ * @param stats Total to add to (NULL does nothing)
+ * @param part What the payload's decode filled in
+ * @param depth Level of the payload's root in the whole image
+ */
+void qtc_stats_add_payload(qtc_stats_t *stats, const qtc_stats_t *part, uint32_t depth);
+
+/**
+ * @brief Records what the lossy filter cost
+ * @param stats Where to put it (NULL does nothing)
+ * @param mse Exact mean squared error
+ * @param mse_estimate Same, guessed from the node variances
+ */
+void qtc_stats_set_distortion(qtc_stats_t *stats, double mse, double mse_estimate);
+
+/**
+ * @brief Name of a stage, as it appears in the JSON
+ */
+const char *qtc_stage_name(qtc_stage_t stage);
+
+/**
+ * @brief Writes the stats as one JSON object on one line
+ * @return False if the write failed
+ */
+bool qtc_stats_write_json(const qtc_stats_t *stats, FILE *file);
+
+/**
+ * @brief Appends the stats to a file as a JSON line ("-" is stdout)
+ * @return False if the file can't be opened or written
+ */
+bool qtc_stats_append_json(const qtc_stats_t *stats, const char *path);
+
+#endif /* STATS_H */
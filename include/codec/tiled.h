@@ -0,0 +1,163 @@
+/**
+ * @file tiled.h
+ * @brief Tiled container: one independent quadtree per 2^k x 2^k tile
+ *
+ * A plain Q1/Q2 file is one level-major stream, so every pixel depends
+ * on everything written before it. Here the image is cut into square
+ * tiles and each tile gets its own payload; an index up front says
+ * where each one is, so tiles can be decoded on several threads at
+ * once, or only the few that cover a region.
+ *
+ * Layout, integers little-endian:
+ *
+ *   "QT\n"
+ *   "# <count> tiles of <t>x<t>\n"
+ *   image depth (1 byte), tile depth (1 byte), payload format (1 byte, 1 or 2)
+ *   one entry per tile, row by row: offset in the file (8 bytes), length (4 bytes)
+ *   the payloads, same bits a Q1/Q2 file has after its depth byte
+ *
+ * With -a each tile is filtered on its own, its threshold starting from
+ * the tile's own variances: a tile comes out as it would as an image of
+ * its own, not as the same area does under the whole-image filter. That
+ * keeps tiles independent; it is also why a tiled lossy file differs
+ * from a plain one at the same alpha.
+ */
+
+#ifndef TILED_H
+#define TILED_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "codec/compression.h"
+#include "common/thread_pool.h"
+#include "core/quadtree.h"
+
+#define QTREE_TILED_MAGIC "QT"
+
+/* Bytes per index entry: 64-bit offset, 32-bit length */
+#define QTREE_TILED_ENTRY_SIZE 12u
+
+/* At most 2^10 tiles per side, so the index stays a few MB */
+#define QTREE_TILED_MAX_SPLIT 10u
+
+/**
+ * @brief A container held in memory (or mapped), checked and ready to read
+ *
+ * Nothing is copied: the view points into the caller's bytes, which
+ * must stay put while it is used. Decoding never changes it, so one
+ * view can serve any number of threads.
+ */
+typedef struct
+{
+    const uint8_t *data;     /* The whole container */
+    size_t length;           /* Its size in bytes */
+    const uint8_t *index;    /* First index entry */
+    uint32_t size;           /* Image width/height */
+    uint32_t n_levels;       /* Image depth */
+    uint32_t tile_size;      /* Tile width/height */
+    uint32_t tile_levels;    /* Depth of each tile's tree */
+    uint32_t tiles_per_side; /* size / tile_size */
+    qtree_format_t format;   /* How the payloads are coded */
+} qtree_tiled_t;
+
+/**
+ * @brief Tells a tiled container from a plain file by its magic
+ */
+bool qtree_tiled_magic(const uint8_t *data, size_t length);
+
+/**
+ * @brief Compresses an image into a tiled container
+ * @param pixels size*size grey levels, row by row
+ * @param size Width/height, a power of two
+ * @param tile_size Tile width/height, a power of two (clamped to size)
+ * @param format Payload format for every tile
+ * @param alpha Above 1.0 for lossy, applied to each tile on its own
+ * @param pool Where to encode the tiles, or NULL for the calling thread
+ * @param data Set to the whole container (free() it)
+ * @param length Set to its size in bytes
+ * @return QTREE_SUCCESS if everything went well
+ */
+qtree_status_t qtree_tiled_encode(const uint8_t *pixels, uint32_t size, uint32_t tile_size,
+                                  qtree_format_t format, float alpha, thread_pool_t *pool,
+                                  uint8_t **data, size_t *length);
+
+/**
+ * @brief Same as qtree_tiled_encode(), adding up what the tiles coded
+ * @param stats Gets size, depth, nodes per level (counted like a decode),
+ *              payload bits and, with alpha, the distortion over all the
+ *              tiles (can be NULL)
+ * @return QTREE_SUCCESS if everything went well
+ */
+qtree_status_t qtree_tiled_encode_with_stats(const uint8_t *pixels, uint32_t size,
+                                             uint32_t tile_size, qtree_format_t format,
+                                             float alpha, thread_pool_t *pool, uint8_t **data,
+                                             size_t *length, qtc_stats_t *stats);
+
+/**
+ * @brief Checks a container's header and index
+ * @param data The whole container
+ * @param length Its size in bytes
+ * @param tiled View to set up
+ * @return QTREE_ERROR_FORMAT if it is not a sound tiled container
+ */
+qtree_status_t qtree_tiled_open(const uint8_t *data, size_t length, qtree_tiled_t *tiled);
+
+/**
+ * @brief Decodes one tile
+ * @param tile_row Tile row, 0..tiles_per_side-1
+ * @param tile_col Tile column, 0..tiles_per_side-1
+ * @param pixels Buffer of tile_size^2 bytes
+ * @return QTREE_SUCCESS if it worked
+ */
+qtree_status_t qtree_tiled_decode_tile(const qtree_tiled_t *tiled, uint32_t tile_row,
+                                       uint32_t tile_col, uint8_t *pixels);
+
+/**
+ * @brief Same as qtree_tiled_decode_tile(), counting the nodes it decoded
+ * @param stats Gets the tile's nodes per level (its root first) and bits read (can be NULL)
+ * @return QTREE_SUCCESS if it worked
+ */
+qtree_status_t qtree_tiled_decode_tile_with_stats(const qtree_tiled_t *tiled,
+                                                  uint32_t tile_row, uint32_t tile_col,
+                                                  uint8_t *pixels, qtc_stats_t *stats);
+
+/**
+ * @brief Decodes a rectangle, touching only the tiles it overlaps
+ * @param row Top of the rectangle in the image
+ * @param col Left of the rectangle in the image
+ * @param width Rectangle width (row + height and col + width within the image)
+ * @param height Rectangle height
+ * @param pool Where to decode the tiles, or NULL for the calling thread
+ * @param pixels Buffer of width*height bytes, row by row
+ * @return QTREE_SUCCESS if it worked
+ */
+qtree_status_t qtree_tiled_decode_region(const qtree_tiled_t *tiled, uint32_t row, uint32_t col,
+                                         uint32_t width, uint32_t height, thread_pool_t *pool,
+                                         uint8_t *pixels);
+
+/**
+ * @brief Same as qtree_tiled_decode_region(), adding up what the tiles decoded
+ *
+ * Tile nodes are counted on their level in the whole image; the levels
+ * above the tiles aren't coded, so they stay at 0.
+ *
+ * @param stats Gets size, depth, nodes and bits (can be NULL)
+ * @return QTREE_SUCCESS if it worked
+ */
+qtree_status_t qtree_tiled_decode_region_with_stats(const qtree_tiled_t *tiled, uint32_t row,
+                                                    uint32_t col, uint32_t width,
+                                                    uint32_t height, thread_pool_t *pool,
+                                                    uint8_t *pixels, qtc_stats_t *stats);
+
+/**
+ * @brief Decodes the whole image
+ * @param pool Where to decode the tiles, or NULL for the calling thread
+ * @param pixels Buffer of size^2 bytes
+ * @return QTREE_SUCCESS if it worked
+ */
+qtree_status_t qtree_tiled_decode(const qtree_tiled_t *tiled, thread_pool_t *pool,
+                                  uint8_t *pixels);
+
+#endif /* TILED_H */
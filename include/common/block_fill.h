@@ -0,0 +1,83 @@
+/**
+ * @file block_fill.h
+ * @brief Paints decoded quadtree blocks into a row-major image
+ *
+ * Every layout ends up here once it knows which square gets which
+ * value. Blocks are square, a power of two wide and never cross the
+ * image edge, so there are no bounds checks and each row of a block is
+ * one store: a broadcast word for the small blocks the bottom levels
+ * are made of, a memset for the rest. Trees are walked depth first in
+ * quadrant order, so the rows a block touches are still in cache when
+ * its neighbour is painted.
+ */
+
+#ifndef BLOCK_FILL_H
+#define BLOCK_FILL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+/* One byte copied into every lane of a word */
+#define BLOCK_FILL_LANES 0x0101010101010101ull
+
+/**
+ * @brief Paints a size x size block with one value
+ * @param block Top-left pixel of the block
+ * @param stride Bytes per image row
+ */
+static inline void block_fill(uint8_t *block, size_t stride, uint32_t size, uint8_t value)
+{
+    const uint64_t word = BLOCK_FILL_LANES * value;
+
+    switch (size)
+    {
+    case 1:
+        block[0] = value;
+        break;
+    case 2:
+        memcpy(block, &word, 2);
+        memcpy(block + stride, &word, 2);
+        break;
+    case 4:
+        for (size_t r = 0; r < 4; r++)
+            memcpy(block + r * stride, &word, 4);
+        break;
+    case 8:
+        for (size_t r = 0; r < 8; r++)
+            memcpy(block + r * stride, &word, 8);
+        break;
+    default:
+        for (size_t r = 0; r < size; r++)
+            memset(block + r * stride, value, size);
+        break;
+    }
+}
+
+/**
+ * @brief Paints the four pixels of a bottom-level node
+ * @param means Its children's means in quadrant order (TL, TR, BR, BL)
+ */
+static inline void block_fill_2x2(uint8_t *block, size_t stride, const uint8_t means[4])
+{
+    const uint8_t top[2] = {means[0], means[1]};
+    const uint8_t bottom[2] = {means[3], means[2]};
+    memcpy(block, top, 2);
+    memcpy(block + stride, bottom, 2);
+}
+
+/**
+ * @brief Paints a 4x4 block whose four 2x2 quadrants are each uniform
+ * @param means The quadrants' means in quadrant order (TL, TR, BR, BL)
+ */
+static inline void block_fill_4x4(uint8_t *block, size_t stride, const uint8_t means[4])
+{
+    const uint8_t top[4] = {means[0], means[0], means[1], means[1]};
+    const uint8_t bottom[4] = {means[3], means[3], means[2], means[2]};
+    memcpy(block, top, 4);
+    memcpy(block + stride, top, 4);
+    memcpy(block + 2 * stride, bottom, 4);
+    memcpy(block + 3 * stride, bottom, 4);
+}
+
+#endif /* BLOCK_FILL_H */
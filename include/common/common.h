@@ -47,4 +47,12 @@ uint8_t calculate_fourth_mean(uint8_t parent_mean, uint8_t error,
  */
 bool is_power_of_two(uint32_t x);
 
+/**
+ * @brief Monotonic wall-clock seconds
+ *
+ * What every timing in the codec uses: clock() is CPU time, which adds
+ * up over threads and says nothing about how long a call took.
+ */
+double wall_seconds(void);
+
 #endif /* COMMON_H */
\ No newline at end of file
@@ -0,0 +1,131 @@
+/**
+ * @file thread_pool.h
+ * @brief Small work-stealing thread pool for fork-join jobs
+ *
+ * Every worker has its own deque: it pushes and pops new tasks at the
+ * back, and idle workers steal from the front of someone else's. A
+ * thread from outside the pool takes the seat of worker 0 with
+ * thread_pool_enter() and does its share of the work while it waits,
+ * so a pool of N threads starts N-1 of them. There is one such seat:
+ * outside threads sharing a pool take turns, so per-worker scratch
+ * indexed by thread_pool_worker_index() is never shared.
+ *
+ * Tasks are tracked in groups; waiting on a group runs queued tasks
+ * until every task of that group is done, so tasks may submit and wait
+ * on their own sub-tasks without tying up a thread.
+ */
+
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Longest queue a worker keeps; past that, submit runs the task inline */
+#define THREAD_POOL_QUEUE_SIZE 1024u
+
+/**
+ * @brief Something to run on the pool
+ */
+typedef void (*thread_pool_fn)(void *arg);
+
+/* Layout is private to thread_pool.c */
+typedef struct thread_pool thread_pool_t;
+
+/**
+ * @brief What thread_pool_enter() has to undo
+ */
+typedef struct
+{
+    const thread_pool_t *pool; /* Pool the thread worked for before */
+    uint32_t index;            /* Its slot there */
+    bool held;                 /* The seat was taken here, so leave gives it back */
+} thread_pool_seat_t;
+
+/**
+ * @brief Tasks that someone is going to wait for
+ */
+typedef struct
+{
+    atomic_size_t pending; /* Submitted and not finished yet */
+} thread_pool_group_t;
+
+/**
+ * @brief How many threads the machine can run at once
+ * @return Online CPU count (at least 1)
+ */
+uint32_t thread_pool_default_threads(void);
+
+/**
+ * @brief Starts a pool
+ * @param n_threads Workers including the calling thread (0 means one per CPU)
+ * @return The pool, or NULL if threads or memory ran out
+ */
+thread_pool_t *thread_pool_create(uint32_t n_threads);
+
+/**
+ * @brief Stops and joins the workers
+ * @param pool The pool to shut down (nothing may be pending)
+ */
+void thread_pool_destroy(thread_pool_t *pool);
+
+/**
+ * @brief Number of workers, the calling thread included
+ */
+uint32_t thread_pool_size(const thread_pool_t *pool);
+
+/**
+ * @brief Which worker is running the caller
+ * @return 1..size-1 on pool threads, 0 on the thread in worker 0's seat
+ */
+uint32_t thread_pool_worker_index(const thread_pool_t *pool);
+
+/**
+ * @brief Makes the calling thread worker 0 until thread_pool_leave()
+ *
+ * Anything that submits to a pool from outside it goes between the two.
+ * A second outside thread blocks here until the first leaves; pool
+ * threads, and a thread already seated, pass straight through, so
+ * tasks can nest walks and builds on their own pool.
+ *
+ * @param seat Filled in here, handed back to thread_pool_leave()
+ */
+void thread_pool_enter(thread_pool_t *pool, thread_pool_seat_t *seat);
+
+/**
+ * @brief Gives worker 0's seat back
+ */
+void thread_pool_leave(thread_pool_t *pool, const thread_pool_seat_t *seat);
+
+/**
+ * @brief Sets up an empty group
+ * @param group The group to set up
+ */
+void thread_pool_group_init(thread_pool_group_t *group);
+
+/**
+ * @brief Queues a task on the calling worker's deque
+ *
+ * The caller is a pool thread or sits in worker 0's seat.
+ *
+ * @param pool Where to run it
+ * @param group Group the task counts towards
+ * @param fn What to run
+ * @param arg Passed to fn, must stay valid until the group is waited on
+ */
+void thread_pool_submit(thread_pool_t *pool, thread_pool_group_t *group,
+                        thread_pool_fn fn, void *arg);
+
+/**
+ * @brief Runs tasks until every task of the group has finished
+ *
+ * Sleeps rather than spins while the last tasks run on other threads.
+ *
+ * @param pool The pool the tasks were submitted to
+ * @param group The group to wait for
+ */
+void thread_pool_wait(thread_pool_t *pool, thread_pool_group_t *group);
+
+#endif /* THREAD_POOL_H */
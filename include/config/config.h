@@ -7,24 +7,61 @@
 #define CONFIG_H
 
 #include <stdbool.h>
+#include <stddef.h>
+
+#include "codec/compression.h"
+#include "core/quadtree.h"
 
 /* Default output names if none given */
 #define DEFAULT_COMPRESS_OUTPUT "default_compress_output.qtc"
 #define DEFAULT_DECOMPRESS_OUTPUT "default_compress_input.pgm"
 #define DEFAULT_ALPHA 1.0f
+#define DEFAULT_PREVIEW_LEVEL (-1) /* Decode every level */
+#define DEFAULT_THREADS 1u
+
+/**
+ * @brief How the tree is kept in memory while we work on it
+ */
+typedef enum
+{
+    TREE_LAYOUT_POINTER = 0, /* Linked nodes from an arena */
+    TREE_LAYOUT_ARRAY,       /* Flat level-major arrays */
+    TREE_LAYOUT_SUCCINCT     /* Read-only bit-vector tree (decoding only) */
+} tree_layout_t;
 
 /**
  * @brief Structure to hold all our program settings
  */
 typedef struct
 {
-    bool compress;           /* Are we compressing? */
-    bool decompress;         /* Are we decompressing? */
-    bool generate_grid;      /* Should we make a grid view? */
-    const char *input_file;  /* Which file to read */
-    const char *output_file; /* Where to save the result */
-    const char *grid_file;   /* Where to save the grid */
-    float alpha;             /* How much to compress */
+    bool compress;                 /* Are we compressing? */
+    bool decompress;               /* Are we decompressing? */
+    bool generate_grid;            /* Should we make a grid view? */
+    const char *input_file;        /* Which file to read */
+    const char *output_file;       /* Where to save the result */
+    const char *grid_file;         /* Where to save the grid */
+    float alpha;                   /* How much to compress */
+    tree_layout_t layout;          /* Pointer tree or flat arrays */
+    qtree_build_mode_t build_mode; /* How the pointer tree gets built */
+    uint32_t threads;              /* Build threads (0 for one per CPU) */
+    size_t target_bytes;           /* Pick alpha to fit this size (0 = off) */
+    double target_psnr;            /* Pick alpha to reach this PSNR (0 = off) */
+    int preview_level;             /* Stop decoding after this level (-1 for all) */
+    bool preview_upscale;          /* Blow the preview up to full size */
+    const char *batch_source;      /* Directory, list file or "-" (NULL for one file) */
+    bool quiet;                    /* Only print warnings and errors */
+    qtree_format_t format;         /* Payload format to write (Q1 or Q2) */
+    bool banded;                   /* Compress band by band, never loading the image */
+    uint32_t band_rows;            /* Rows per band (0 picks about sqrt(size)) */
+    uint32_t tile_size;            /* Write a tiled container with these tiles (0 = off) */
+    bool region;                   /* Decode only part of a tiled file */
+    uint32_t region_col;           /* Left of the part, in pixels */
+    uint32_t region_row;           /* Top of the part, in pixels */
+    uint32_t region_size;          /* Width/height of the part */
+    uint32_t sequence_block;       /* Code the batch as one sequence of frames (0 = off) */
+    const char *stats_file;        /* Append a JSON line of stats per file here ("-" is stdout) */
+    const char *archive_file;      /* Pack the batch into this one archive (NULL = off) */
+    const char *archive_entry;     /* Decode only this image of an archive, by name or id */
 } config_t;
 
 /**
@@ -0,0 +1,82 @@
+/**
+ * @file node_arena.h
+ * @brief Block allocator for quadtree nodes
+ */
+
+#ifndef NODE_ARENA_H
+#define NODE_ARENA_H
+
+#include "core/quadtree.h"
+
+/**
+ * @brief Sets up an empty arena (same as zeroing it)
+ * @param arena The arena to set up
+ */
+void qtree_arena_init(qtree_arena_t *arena);
+
+/**
+ * @brief Hands out a zeroed node
+ * @param arena Where to take it from
+ * @return The node, or NULL if we ran out of memory
+ */
+qtree_node_t *qtree_arena_alloc(qtree_arena_t *arena);
+
+/**
+ * @brief Puts one node back on the free list (children are left alone)
+ * @param arena The arena the node came from
+ * @param node The node to give back
+ */
+void qtree_arena_release(qtree_arena_t *arena, qtree_node_t *node);
+
+/**
+ * @brief Puts a node and everything under it back on the free list
+ * @param arena The arena the nodes came from
+ * @param node Top of the subtree to give back
+ */
+void qtree_arena_release_subtree(qtree_arena_t *arena, qtree_node_t *node);
+
+/**
+ * @brief Forgets every node but keeps the blocks for the next tree
+ * @param arena The arena to rewind
+ */
+void qtree_arena_reset(qtree_arena_t *arena);
+
+/**
+ * @brief Frees all the blocks
+ * @param arena The arena to tear down
+ */
+void qtree_arena_destroy(qtree_arena_t *arena);
+
+/**
+ * @brief Moves every block of one arena into another
+ *
+ * Used to fold per-thread arenas into the tree's after a parallel
+ * build. Nodes keep their addresses and src's free list joins dst's;
+ * src is left empty. peak_nodes becomes the sum of both peaks, an upper
+ * bound on the real one since the threads didn't peak at once.
+ *
+ * @param dst Arena that takes ownership
+ * @param src Arena to empty
+ */
+void qtree_arena_merge(qtree_arena_t *dst, qtree_arena_t *src);
+
+/**
+ * @brief Gives nodes released into a side arena back to the tree's
+ *
+ * Threads pruning parts of one tree can't share its arena, so each
+ * releases into a zeroed arena of its own (and never allocates from
+ * it), and the nodes are handed back here once they are done.
+ *
+ * @param arena Arena the nodes came from
+ * @param side Arena they were released into, left empty
+ */
+void qtree_arena_take_released(qtree_arena_t *arena, qtree_arena_t *side);
+
+/**
+ * @brief How many bytes the arena is holding from the system
+ * @param arena The arena to look at
+ * @return Reserved bytes
+ */
+size_t qtree_arena_reserved_bytes(const qtree_arena_t *arena);
+
+#endif /* NODE_ARENA_H */
@@ -0,0 +1,65 @@
+/**
+ * @file pyramid.h
+ * @brief Bottom-up mean pyramid used to build the quadtree without recursion
+ *
+ * Level n is the image itself. Each level above is half the width and
+ * is reduced from 2x2 blocks of the one below, row by row, with the same
+ * m/e/u rules as the recursive build. Planes are stored row-major, one
+ * after another from level 0 down to level n-1.
+ */
+
+#ifndef PYRAMID_H
+#define PYRAMID_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "core/quadtree.h"
+
+/**
+ * @brief All levels of the pyramid
+ */
+typedef struct
+{
+    uint8_t *m;            /* Means, levels 0..n-1 */
+    uint8_t *e;            /* Rounding errors (sum % 4) */
+    uint8_t *u;            /* Uniformity mask (0/1) */
+    const uint8_t *pixels; /* Level n, borrowed from the caller */
+    uint32_t n_levels;     /* Depth of the matching quadtree */
+    uint32_t size;         /* Image size (must be 2^n) */
+} qtree_pyramid_t;
+
+/**
+ * @brief Reduces an image into a pyramid
+ * @param pyramid Where to store it (allocated here)
+ * @param pixels Row-major image, must outlive the pyramid
+ * @param size Image size (power of 2)
+ * @return QTREE_SUCCESS if it worked
+ */
+qtree_status_t qtree_pyramid_build(qtree_pyramid_t *pyramid, const uint8_t *pixels,
+                                   uint32_t size);
+
+/**
+ * @brief Frees the planes
+ * @param pyramid The pyramid to clean up
+ */
+void qtree_pyramid_free(qtree_pyramid_t *pyramid);
+
+/**
+ * @brief Turns a pyramid into a pointer tree
+ *
+ * Only nodes that survive in the final tree are allocated: children
+ * are never created under a uniform cell.
+ *
+ * @param pyramid A built pyramid
+ * @param tree Tree set up with qtree_init for the same size
+ * @return QTREE_SUCCESS if it worked
+ */
+qtree_status_t qtree_pyramid_to_tree(const qtree_pyramid_t *pyramid, qtree_t *tree);
+
+/**
+ * @brief Name of the reduction kernel compiled in (for logs)
+ */
+const char *qtree_pyramid_kernel_name(void);
+
+#endif /* PYRAMID_H */
@@ -0,0 +1,88 @@
+/**
+ * @file qtree_array.h
+ * @brief Pointer-free quadtree stored as flat arrays
+ *
+ * The tree is complete and level-major: the root is index 0, level L
+ * starts at qtree_array_level_offset(L) and the children of node i are
+ * qtree_first_child_index(i) + q for q in quadrant order. Each field
+ * lives in its own array so walks only touch what they need.
+ *
+ * Nodes under a uniform node are still there; they are kept uniform
+ * with the same mean so the encoder only has to look at the parent.
+ */
+
+#ifndef QTREE_ARRAY_H
+#define QTREE_ARRAY_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "core/quadtree.h"
+
+/**
+ * @brief The whole tree as structure-of-arrays
+ */
+typedef struct
+{
+    uint8_t *m;        /* Average intensity, one per node */
+    uint8_t *e;        /* Rounding error (0-3) */
+    uint8_t *u;        /* Is it uniform? (0/1) */
+    float *v;          /* How much variation */
+    size_t n_nodes;    /* Nodes in every array */
+    uint32_t n_levels; /* How many layers */
+    uint32_t size;     /* Image size (must be 2^n) */
+} qtree_array_t;
+
+/**
+ * @brief Where a level starts in the arrays
+ * @param level Depth (0 is the root)
+ * @return Index of the first node on that level
+ */
+size_t qtree_array_level_offset(uint32_t level);
+
+/**
+ * @brief How many nodes a complete tree of that depth has
+ * @param n_levels Depth of the tree
+ * @return Node count over all levels
+ */
+size_t qtree_array_node_count(uint32_t n_levels);
+
+/**
+ * @brief Allocates the arrays for an image of the given size
+ * @param tree Where to set things up
+ * @param size Image size (power of 2)
+ * @return QTREE_SUCCESS if it worked
+ */
+qtree_status_t qtree_array_init(qtree_array_t *tree, uint32_t size);
+
+/**
+ * @brief Frees the arrays
+ * @param tree The tree to clean up
+ */
+void qtree_array_free(qtree_array_t *tree);
+
+/**
+ * @brief Fills the tree from an image, same rules as qtree_build
+ * @param tree Tree set up with qtree_array_init
+ * @param pixels Row-major pixels
+ * @param size Image size
+ * @param input_filename Only used for logging
+ * @return QTREE_SUCCESS if it worked
+ */
+qtree_status_t qtree_array_build(qtree_array_t *tree, const uint8_t *pixels,
+                                 uint32_t size, const char *input_filename);
+
+/**
+ * @brief Makes everything under a uniform node uniform with its mean
+ *
+ * Run this after anything that flips nodes to uniform (lossy filter)
+ * so the "parent is uniform" check stays enough for the walkers.
+ */
+void qtree_array_normalize(qtree_array_t *tree);
+
+/**
+ * @brief Computes v for every node and returns median/max
+ */
+qtree_variance_stats_t qtree_array_variance_stats(qtree_array_t *tree);
+
+#endif /* QTREE_ARRAY_H */
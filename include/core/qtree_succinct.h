@@ -0,0 +1,128 @@
+/**
+ * @file qtree_succinct.h
+ * @brief Read-only quadtree packed down to about 1.4 bytes per node
+ *
+ * Nodes are kept in breadth-first order, the same order the decoder
+ * reads them in. A node has either no children or four, so the shape
+ * is one bit per node (set if it has children), and the children of
+ * node i start at 1 + 4 * rank(i), where rank(i) counts the set bits
+ * before i. Going up is the reverse: the parent of i is the node
+ * holding set bit number (i - 1) / 4, found with select().
+ *
+ * Next to the shape there is one byte of m per node and 2 bits of e.
+ * u needs no bits of its own: in a decoded tree a node is uniform
+ * exactly when it has no children.
+ */
+
+#ifndef QTREE_SUCCINCT_H
+#define QTREE_SUCCINCT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "core/quadtree.h"
+
+/* Shape bits covered by one rank entry */
+#define QTREE_SUCCINCT_BLOCK_BITS 512u
+#define QTREE_SUCCINCT_BLOCK_WORDS (QTREE_SUCCINCT_BLOCK_BITS / 64u)
+
+/**
+ * @brief The whole tree, built once and then only read
+ */
+typedef struct
+{
+    uint64_t *shape;   /* Bit i set if node i has children */
+    uint64_t *rank;    /* Set bits before each block of shape */
+    uint8_t *m;        /* Average intensity, one byte per node */
+    uint8_t *e;        /* Rounding error, four nodes per byte */
+    size_t n_nodes;    /* Nodes so far */
+    size_t n_parents;  /* Nodes with children */
+    size_t capacity;   /* Room for nodes while building */
+    uint32_t n_levels; /* How many layers */
+    uint32_t size;     /* Image size (must be 2^n) */
+} qtree_succinct_t;
+
+/**
+ * @brief Gets an empty tree ready for qtree_succinct_append()
+ * @param tree Where to set things up
+ * @param size Image size (power of 2)
+ * @return QTREE_SUCCESS if it worked
+ */
+qtree_status_t qtree_succinct_init(qtree_succinct_t *tree, uint32_t size);
+
+/**
+ * @brief Adds the next node in breadth-first order
+ * @param has_children True if four children will follow later
+ * @return False if we ran out of memory
+ */
+bool qtree_succinct_append(qtree_succinct_t *tree, uint8_t m, uint8_t e, bool has_children);
+
+/**
+ * @brief Builds the rank table and gives back the spare room
+ *
+ * The tree is read-only from here on.
+ *
+ * @return QTREE_ERROR_FORMAT if the nodes don't make a whole tree
+ */
+qtree_status_t qtree_succinct_finish(qtree_succinct_t *tree);
+
+/**
+ * @brief Frees everything
+ */
+void qtree_succinct_free(qtree_succinct_t *tree);
+
+/**
+ * @brief Bytes held by the tree
+ */
+size_t qtree_succinct_bytes(const qtree_succinct_t *tree);
+
+/**
+ * @brief Index of the node holding set bit k (k < n_parents)
+ */
+size_t qtree_succinct_select(const qtree_succinct_t *tree, size_t k);
+
+/**
+ * @brief Parent of a node (not the root)
+ */
+size_t qtree_succinct_parent(const qtree_succinct_t *tree, size_t index);
+
+static inline bool qtree_succinct_has_children(const qtree_succinct_t *tree, size_t index)
+{
+    return (tree->shape[index / 64] >> (index % 64)) & 1u;
+}
+
+/**
+ * @brief How many nodes before this one have children
+ */
+static inline size_t qtree_succinct_rank(const qtree_succinct_t *tree, size_t index)
+{
+    const size_t word = index / 64;
+    size_t count = tree->rank[index / QTREE_SUCCINCT_BLOCK_BITS];
+    for (size_t w = word & ~(size_t)(QTREE_SUCCINCT_BLOCK_WORDS - 1); w < word; w++)
+    {
+        count += (size_t)__builtin_popcountll(tree->shape[w]);
+    }
+    const uint64_t below = ((uint64_t)1 << (index % 64)) - 1u;
+    return count + (size_t)__builtin_popcountll(tree->shape[word] & below);
+}
+
+/**
+ * @brief First of the four children (the rest follow in quadrant order)
+ */
+static inline size_t qtree_succinct_first_child(const qtree_succinct_t *tree, size_t index)
+{
+    return 1 + 4 * qtree_succinct_rank(tree, index);
+}
+
+static inline uint8_t qtree_succinct_e(const qtree_succinct_t *tree, size_t index)
+{
+    return (uint8_t)(((uint32_t)tree->e[index / 4] >> (2 * (index % 4))) & 3u);
+}
+
+static inline bool qtree_succinct_u(const qtree_succinct_t *tree, size_t index)
+{
+    return !qtree_succinct_has_children(tree, index);
+}
+
+#endif /* QTREE_SUCCINCT_H */
@@ -6,9 +6,12 @@
 #ifndef QUADTREE_H
 #define QUADTREE_H
 
+#include <stddef.h>
 #include <stdint.h>
 #include <stdbool.h>
 
+#include "common/thread_pool.h"
+
 /**
  * @brief One node in our tree
  *
@@ -28,6 +31,31 @@ typedef struct qtree_node
     struct qtree_node *children[4]; /* Sub-regions */
 } qtree_node_t;
 
+/* Chunk of nodes owned by an arena (layout is private to node_arena.c) */
+typedef struct qtree_arena_block qtree_arena_block_t;
+
+/**
+ * @brief Where all the nodes of a tree come from
+ *
+ * Nodes are bump-allocated out of big blocks instead of one malloc each.
+ * Nodes given back during pruning go on a free list and get picked up
+ * again by the next allocation. Resetting keeps the blocks around so the
+ * same arena can be reused for the next image.
+ * A zeroed arena is a valid empty one.
+ */
+typedef struct
+{
+    qtree_arena_block_t *first;   /* Oldest block, start of the chain */
+    qtree_arena_block_t *current; /* Block we are bumping into */
+    qtree_node_t *free_list;      /* Released nodes, linked via children[0] */
+    qtree_node_t *free_tail;      /* Last node of free_list (stale once it's empty) */
+    size_t live_nodes;            /* Nodes handed out and not released */
+    size_t peak_nodes;            /* Highest live_nodes seen (upper bound after a merge) */
+    size_t reserved_nodes;        /* Capacity of all blocks together */
+    size_t node_allocs;           /* Nodes handed out since the last reset */
+    size_t block_allocs;          /* Blocks malloc'd, ever */
+} qtree_arena_t;
+
 /**
  * @brief Info about how varied our image is
  */
@@ -42,9 +70,11 @@ typedef struct
  */
 typedef struct
 {
-    qtree_node_t *root; /* Top of the tree */
-    uint32_t n_levels;  /* How many layers */
-    uint32_t size;      /* Image size (must be 2^n) */
+    qtree_node_t *root;  /* Top of the tree */
+    uint32_t n_levels;   /* How many layers */
+    uint32_t size;       /* Image size (must be 2^n) */
+    qtree_arena_t arena; /* Owns every node of the tree */
+    thread_pool_t *pool; /* Borrowed, passes over the tree split across it (NULL: serial) */
 } qtree_t;
 
 /**
@@ -58,8 +88,21 @@ typedef enum
     QTREE_ERROR_FORMAT,        /* File problems */
 } qtree_status_t;
 
+/**
+ * @brief How qtree_build_with() goes through the image
+ */
+typedef enum
+{
+    QTREE_BUILD_RECURSIVE = 0, /* Top-down, one call per node */
+    QTREE_BUILD_PYRAMID,       /* Bottom-up row reduction, then link nodes */
+    QTREE_BUILD_PRUNED,        /* Top-down, no nodes inside constant blocks */
+} qtree_build_mode_t;
+
 /**
  * @brief Gets a tree ready for use
+ *
+ * The tree must be zeroed the first time. Calling it again on a used
+ * tree drops the old nodes but keeps the arena memory for reuse.
  */
 qtree_status_t qtree_init(qtree_t *tree, uint32_t size);
 
@@ -70,19 +113,60 @@ qtree_status_t qtree_build(qtree_t *tree, const uint8_t *pixels,
                            uint32_t size, const char *input_filename);
 
 /**
- * @brief Cleans up memory
+ * @brief Makes a tree from an image using the given strategy
+ *
+ * Every strategy ends up with exactly the same tree. With more than one
+ * thread the recursive build hands whole subtrees to a work-stealing
+ * pool; each worker allocates from its own arena and the arenas are
+ * folded into the tree's at the end. A tree with a pool of its own
+ * builds on that pool, and threads is then ignored.
+ *
+ * @param threads Worker threads for the recursive build (1 is serial, 0 one per CPU)
+ */
+qtree_status_t qtree_build_with(qtree_t *tree, const uint8_t *pixels,
+                                uint32_t size, const char *input_filename,
+                                qtree_build_mode_t mode, uint32_t threads);
+
+/**
+ * @brief Builds the subtree of one square block of a bigger raster
+ *
+ * Same nodes as the pruned build of that block on its own.
+ *
+ * @param arena Where the nodes come from
+ * @param pixels Top-left corner of the raster (not of the block)
+ * @param stride Bytes from one raster row to the next
+ * @param level Height of the block (its side is 2^level)
+ * @param row Top edge of the block in the raster
+ * @param col Left edge of the block in the raster
+ * @return Root of the subtree, or NULL if we ran out of memory
+ */
+qtree_node_t *qtree_build_block(qtree_arena_t *arena, const uint8_t *pixels, uint32_t stride,
+                                uint32_t level, uint32_t row, uint32_t col);
+
+/**
+ * @brief Sets m, e and u of a node from its four children
+ *
+ * The same rule every build uses. The children are left in place; the
+ * caller drops them if the node came out uniform.
+ *
+ * @return True if the node is uniform
+ */
+bool qtree_node_combine(qtree_node_t *node);
+
+/**
+ * @brief Gives back every node and the arena memory in one go
  */
-void free_quadtree_recursive(qtree_node_t *node);
+void qtree_free(qtree_t *tree);
 
 /**
- * @brief Finds a node's parent
+ * @brief Finds a node's parent (level-major index, root is 0)
  */
-uint32_t qtree_parent_index(uint32_t index);
+size_t qtree_parent_index(size_t index);
 
 /**
- * @brief Finds a node's first child
+ * @brief Finds a node's first child (level-major index, root is 0)
  */
-uint32_t qtree_first_child_index(uint32_t index);
+size_t qtree_first_child_index(size_t index);
 
 /**
  * @brief Checks if a node is at the bottom
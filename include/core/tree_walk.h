@@ -0,0 +1,96 @@
+/**
+ * @file tree_walk.h
+ * @brief One walk over a pointer tree, split across a thread pool
+ *
+ * The top of the tree, down to a split depth, is walked on the calling
+ * thread; every node on that depth (or a leaf above it) is a whole
+ * subtree that goes to the pool as one task. A pass plugs in as three
+ * callbacks:
+ *
+ * - enter: pre-order, on the nodes above the split, before any task runs
+ * - subtree: the pass's own serial walk of one subtree, on any worker
+ * - leave: post-order, on the nodes above the split once every task is
+ *   done, with the results of its children to merge
+ *
+ * Subtrees are disjoint, so tasks never touch the same node. Anything
+ * else they share (a histogram, an arena) has to be kept per worker;
+ * subtree is told which worker it runs on for that.
+ */
+
+#ifndef TREE_WALK_H
+#define TREE_WALK_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "common/thread_pool.h"
+#include "core/quadtree.h"
+
+/* Subtrees are never cut smaller than 2^this pixels on a side */
+#define QTREE_WALK_MIN_GRAIN_LEVEL 5u
+
+/* Tasks per worker the automatic split aims for */
+#define QTREE_WALK_TASKS_PER_THREAD 16u
+
+/**
+ * @brief Where a node sits in the image
+ */
+typedef struct
+{
+    uint32_t level;    /* Depth under the root (0 is the root) */
+    uint32_t row;      /* Top edge of its block */
+    uint32_t col;      /* Left edge of its block */
+    uint32_t size;     /* Block width/height */
+    uint32_t quadrant; /* Which child of its parent it is (0 for the root) */
+} qtree_walk_cell_t;
+
+/**
+ * @brief A pass over the tree
+ */
+typedef struct
+{
+    /* Pre-order above the split (can be NULL) */
+    void (*enter)(void *ctx, qtree_node_t *node, const qtree_walk_cell_t *cell);
+    /* Serial walk of a whole subtree, result is result_size bytes */
+    void (*subtree)(void *ctx, qtree_node_t *node, const qtree_walk_cell_t *cell,
+                    uint32_t worker, void *result);
+    /* Post-order above the split; children[q] is NULL if there is no child q
+       (and always when result_size is 0) */
+    void (*leave)(void *ctx, qtree_node_t *node, const qtree_walk_cell_t *cell,
+                  const void *const children[4], void *result);
+    size_t result_size;   /* Bytes per result (0 if the pass has none) */
+    uint32_t split_level; /* Depth of the tasks, 0 picks one for the pool */
+} qtree_walk_t;
+
+/**
+ * @brief Block of child q of a node, same placement as everywhere else
+ */
+static inline qtree_walk_cell_t qtree_walk_child_cell(const qtree_walk_cell_t *cell, uint32_t q)
+{
+    const uint32_t half = cell->size / 2;
+    return (qtree_walk_cell_t){
+        .level = cell->level + 1,
+        .row = cell->row + ((q & 2u) ? half : 0),
+        .col = cell->col + (((q & 1u) ^ ((q & 2u) >> 1)) ? half : 0),
+        .size = half,
+        .quadrant = q};
+}
+
+/**
+ * @brief Runs a pass over the tree under root
+ *
+ * Without a pool, or with a tree too small to be worth splitting, this
+ * is just subtree() on the root. If the bookkeeping can't be allocated
+ * it falls back to that too, so the walk itself never fails.
+ *
+ * @param walk The pass
+ * @param ctx Handed to every callback
+ * @param root Top of the tree (not NULL)
+ * @param size Width of the root's block
+ * @param pool Where the tasks go (NULL walks serially)
+ * @param result Where the root's result ends up (NULL only if result_size is 0)
+ */
+void qtree_walk(const qtree_walk_t *walk, void *ctx, qtree_node_t *root, uint32_t size,
+                thread_pool_t *pool, void *result);
+
+#endif /* TREE_WALK_H */
@@ -0,0 +1,102 @@
+/**
+ * @file variance_hist.h
+ * @brief Exact median/max of node variances without keeping them all
+ *
+ * Positive floats sort the same way as their bit patterns, so the
+ * median can be found with two 16-bit histograms: the first pass bins
+ * every sample by its top half and finds the bin holding the median,
+ * the second only looks at samples in that bin and bins their bottom
+ * half. The max is tracked on the fly. Memory is one fixed table no
+ * matter how big the tree is.
+ */
+
+#ifndef VARIANCE_HIST_H
+#define VARIANCE_HIST_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "core/quadtree.h"
+
+#define VARIANCE_HIST_BINS 65536u
+
+/**
+ * @brief Running statistics
+ */
+typedef struct
+{
+    size_t *bins;        /* Counts, coarse pass then fine pass */
+    size_t count;        /* Samples seen in the coarse pass */
+    float max;           /* Largest sample so far */
+    uint32_t target;     /* Top 16 bits of the median (after the coarse pass) */
+    size_t rank_in_bin;  /* Where the median sits inside that bin */
+} qtree_variance_hist_t;
+
+/**
+ * @brief Allocates the table
+ * @return False if memory ran out
+ */
+bool qtree_variance_hist_init(qtree_variance_hist_t *hist);
+
+/**
+ * @brief Frees the table
+ */
+void qtree_variance_hist_free(qtree_variance_hist_t *hist);
+
+static inline uint32_t qtree_variance_hist_bits(float v)
+{
+    uint32_t bits;
+    memcpy(&bits, &v, sizeof(bits));
+    return bits;
+}
+
+/**
+ * @brief Coarse pass: count one sample (must be > 0)
+ */
+static inline void qtree_variance_hist_add(qtree_variance_hist_t *hist, float v)
+{
+    hist->bins[qtree_variance_hist_bits(v) >> 16]++;
+    hist->count++;
+    if (v > hist->max)
+        hist->max = v;
+}
+
+/**
+ * @brief Finds the median's coarse bin and clears the table for the fine pass
+ * @return False if there were no samples (no fine pass needed)
+ */
+bool qtree_variance_hist_select(qtree_variance_hist_t *hist);
+
+/**
+ * @brief Fine pass: feed the same samples again (order doesn't matter)
+ */
+static inline void qtree_variance_hist_refine(qtree_variance_hist_t *hist, float v)
+{
+    const uint32_t bits = qtree_variance_hist_bits(v);
+    if ((bits >> 16) == hist->target)
+        hist->bins[bits & 0xFFFFu]++;
+}
+
+/**
+ * @brief Adds the counts of another table into this one
+ *
+ * Lets every thread count its part of the tree in a table of its own.
+ * Works for either pass; for the fine one, start the other table with
+ * qtree_variance_hist_share_target() first.
+ */
+void qtree_variance_hist_merge(qtree_variance_hist_t *hist, const qtree_variance_hist_t *other);
+
+/**
+ * @brief Empties a per-thread table and points it at the median bin of hist
+ */
+void qtree_variance_hist_share_target(qtree_variance_hist_t *table,
+                                      const qtree_variance_hist_t *hist);
+
+/**
+ * @brief Median (the upper one for an even count) and max
+ */
+qtree_variance_stats_t qtree_variance_hist_finish(const qtree_variance_hist_t *hist);
+
+#endif /* VARIANCE_HIST_H */
@@ -7,6 +7,8 @@
 #define SEGMENTATION_GRID_H
 
 #include "core/quadtree.h"
+#include "core/qtree_array.h"
+#include "core/qtree_succinct.h"
 #include "io/pgm.h"
 
 /**
@@ -17,4 +19,20 @@
  */
 qtree_status_t qtree_generate_grid(const qtree_t *tree, const char *output_file);
 
+/**
+ * @brief Same grid, drawn from the array layout
+ * @param tree The array tree to visualize
+ * @param output_file Where to save the grid image
+ * @return QTREE_SUCCESS if it worked
+ */
+qtree_status_t qtree_array_generate_grid(const qtree_array_t *tree, const char *output_file);
+
+/**
+ * @brief Same grid, drawn from the succinct layout
+ * @param tree The succinct tree to visualize
+ * @param output_file Where to save the grid image
+ * @return QTREE_SUCCESS if it worked
+ */
+qtree_status_t qtree_succinct_generate_grid(const qtree_succinct_t *tree, const char *output_file);
+
 #endif /* SEGMENTATION_GRID_H */
\ No newline at end of file
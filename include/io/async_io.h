@@ -0,0 +1,82 @@
+/**
+ * @file async_io.h
+ * @brief Reads ahead and writes behind on a thread of their own
+ *
+ * Both sides keep a small ring of big blocks between the codec and the
+ * file. The reader fills blocks while the decoder works through the
+ * ones it already has; the writer takes full blocks from the encoder
+ * and writes them while the next ones are being produced. On slow or
+ * far-away storage the waiting then overlaps with the computing
+ * instead of taking turns with it.
+ *
+ * The bit reader reads ahead for whole-payload decodes; a file-mode
+ * compress state writes behind, for Q1 files bigger than one block and
+ * the --band-rows stitch pass.
+ *
+ * The thread owns the FILE until it is stopped: nothing else may read,
+ * write or seek it in the meantime.
+ */
+
+#ifndef ASYNC_IO_H
+#define ASYNC_IO_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/* Blocks in the ring, and how big each one is */
+#define ASYNC_IO_BLOCKS 4u
+#define ASYNC_IO_BLOCK_SIZE (1u << 20)
+
+/* Layouts are private to async_io.c */
+typedef struct async_reader async_reader_t;
+typedef struct async_writer async_writer_t;
+
+/**
+ * @brief Starts reading a file ahead from where it is now
+ * @param file Open file, positioned where reading should start
+ * @return The reader, or NULL if the thread or buffers can't be made
+ */
+async_reader_t *async_reader_start(FILE *file);
+
+/**
+ * @brief Gives back the last block and waits for the next one
+ * @param reader Reader from async_reader_start()
+ * @param data Set to the block, valid until the next call
+ * @return Bytes in the block, 0 at the end of the file (or after an error)
+ */
+size_t async_reader_next(async_reader_t *reader, const uint8_t **data);
+
+/**
+ * @brief True if a read failed (as opposed to reaching the end)
+ */
+bool async_reader_failed(async_reader_t *reader);
+
+/**
+ * @brief Stops the thread and frees the ring
+ *
+ * The file ends up somewhere past what was handed out.
+ */
+void async_reader_stop(async_reader_t *reader);
+
+/**
+ * @brief Starts writing behind into a file
+ * @param file Open file, positioned where writing should start
+ * @return The writer, or NULL if the thread or buffers can't be made
+ */
+async_writer_t *async_writer_start(FILE *file);
+
+/**
+ * @brief Queues bytes; waits only when every block is still being written
+ * @return False once a write has failed
+ */
+bool async_writer_write(async_writer_t *writer, const void *data, size_t length);
+
+/**
+ * @brief Writes what is left, stops the thread and frees the ring
+ * @return False if any write failed
+ */
+bool async_writer_finish(async_writer_t *writer);
+
+#endif /* ASYNC_IO_H */
@@ -32,14 +32,35 @@ typedef enum
  * - Uses 8 bits per pixel (grayscale)
  *
  * Remember to use pgm_free() when done!
+ *
+ * pgm_read() maps regular files instead of copying them, so pixels may
+ * point into a private file mapping. Writing to them is fine (the pages
+ * are copy-on-write) but only pgm_free() knows how to let go of them.
  */
 typedef struct
 {
     uint8_t *pixels;   /* The actual image data */
     uint32_t size;     /* Width/height of image */
     uint8_t max_value; /* Brightest possible pixel */
+    bool mapped;       /* Pixels live inside map_base, not on the heap */
+    void *map_base;    /* Start of the file mapping */
+    size_t map_length; /* Length of the file mapping */
 } pgm_t;
 
+/**
+ * @brief An image being read a few rows at a time
+ *
+ * Only the header is kept; the rows go straight to the caller's
+ * buffer, so images bigger than memory can be read in bands.
+ */
+typedef struct
+{
+    FILE *file;        /* Positioned on the next row */
+    uint32_t size;     /* Width/height of image */
+    uint8_t max_value; /* Brightest possible pixel */
+    uint32_t next_row; /* Rows handed out so far */
+} pgm_rows_t;
+
 /**
  * @brief Loads an image from a file
  * @param path Which file to load
@@ -56,6 +77,28 @@ pgm_status_t pgm_read(const char *path, pgm_t *pgm);
  */
 pgm_status_t pgm_write(const pgm_t *pgm, const char *path);
 
+/**
+ * @brief Opens an image and reads its header only
+ * @param path Which file to open
+ * @param rows Where to keep track of the reading
+ * @return PGM_SUCCESS if the header is good
+ */
+pgm_status_t pgm_open_rows(const char *path, pgm_rows_t *rows);
+
+/**
+ * @brief Reads the next rows of an image
+ * @param rows Opened with pgm_open_rows()
+ * @param pixels Room for count * size bytes
+ * @param count How many rows to read
+ * @return PGM_SUCCESS, or PGM_ERROR_FORMAT if the file ends early
+ */
+pgm_status_t pgm_read_rows(pgm_rows_t *rows, uint8_t *pixels, uint32_t count);
+
+/**
+ * @brief Closes an image opened with pgm_open_rows()
+ */
+void pgm_close_rows(pgm_rows_t *rows);
+
 /**
  * @brief Cleans up image memory
  * @param pgm The image to clean up
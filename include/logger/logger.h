@@ -27,13 +27,19 @@ typedef enum
 /* Logger configuration settings */
 typedef struct
 {
-    bool enabled;
+    bool enabled;        /* False drops everything */
+    bool quiet;          /* Only warnings and errors, no bars or banners */
     bool use_colors;
     bool show_timestamp;
 } logger_config_t;
 
+/* Shortest time between two progress redraws (10 Hz) */
+#define LOGGER_PROGRESS_INTERVAL 0.1
+
 /* Core functions */
 void logger_configure(logger_config_t config);
+void logger_mute_thread(bool muted); /* Only affects the calling thread */
+bool logger_thread_muted(void);
 void log_message(log_level_t level, const char *format, ...);
 void log_progress(double percentage);
 void log_end_progress(void);
@@ -49,6 +55,16 @@ void log_newline(void);
 void log_file_info(const char *filename, uint32_t size, uint32_t levels, double ratio);
 void log_size_stats(size_t original_size, size_t processed_size, size_t nodes, double time);
 
+/*
+ * Progress hooks for hot loops. Building with QTREE_NO_PROGRESS
+ * (make PROGRESS=0) compiles them out; the argument is not evaluated.
+ */
+#ifdef QTREE_NO_PROGRESS
+#define log_progress_hook(fraction) ((void)sizeof(fraction))
+#else
+#define log_progress_hook(fraction) log_progress(fraction)
+#endif
+
 /* Convenience macros */
 #define log_info(...) log_message(LOG_LEVEL_INFO, __VA_ARGS__)
 #define log_success(...) log_message(LOG_LEVEL_SUCCESS, __VA_ARGS__)
@@ -30,6 +30,7 @@ typedef struct
     FILE *output_stream;
     bool is_progress_active;
     bool is_initialized;
+    double last_progress_time; /* When the bar was last drawn */
 } LoggerState;
 
 /* Terminal symbols configuration */
@@ -85,6 +86,8 @@ extern const struct LayoutConfig *const LAYOUT;
 
 /* Internal utility functions */
 void ensure_initialized(void);
+bool output_enabled(void);
+bool chatter_enabled(void);
 void safe_vfprintf(FILE *out, const char *format, va_list args);
 ColorScheme get_level_colors(log_level_t level);
 const char *get_level_symbol(log_level_t level);
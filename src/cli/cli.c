@@ -20,6 +20,30 @@ void cli_print_help(void)
            "  -o <output>     Output file path\n"
            "  -g              Generate segmentation grid\n"
            "  -a <alpha>      Compression parameter (default: 1.0)\n"
+           "  -m <layout>     Tree layout: pointer, array or succinct (default: pointer)\n"
+           "  -b <strategy>   Tree build: recursive, pyramid or pruned (default: recursive)\n"
+           "  -f <format>     Output format: q1, or q2 for entropy coding (default: q1)\n"
+           "  -t <threads>    Worker threads, 0 for one per CPU (default: 1)\n"
+           "  -l <level>      Decode only up to this tree level (preview)\n"
+           "  -p              Upscale the preview to the full image size\n"
+           "  --target-bytes <n>  Pick alpha so the file fits in n bytes (Q1 only)\n"
+           "  --target-psnr <dB>  Pick alpha for at least this PSNR (Q1 only)\n"
+           "  --band-rows <n> Compress n rows at a time (power of 2, 0 = auto),\n"
+           "                  for images that don't fit in memory; lossless Q1 only\n"
+           "  --tile <n>      Write a tiled file of nxn tiles coded on their own\n"
+           "                  (power of 2), so they decode in parallel or one by one;\n"
+           "                  with -a each tile is filtered on its own\n"
+           "  --region <x>,<y>,<n>  Decode only the nxn square at x,y of a tiled file\n"
+           "  --batch <src>   Process a directory, a list file or - for stdin;\n"
+           "                  -o is then the output directory, -t the workers\n"
+           "  --sequence <n>  Code the --batch inputs as frames into one -o file, each\n"
+           "                  frame only the nxn blocks that changed; lossless only\n"
+           "  --stats <file>  Append one JSON line of timings and counters per file\n"
+           "                  (- for stdout, best with -q)\n"
+           "  --archive <file>  Pack the --batch inputs into one archive of bare\n"
+           "                  payloads, each found by the id its name gives\n"
+           "  --entry <id>    Decode only this image of an archive (a name or number)\n"
+           "  -q              Quiet: only warnings and errors\n"
            "  -h              Display this help\n");
 }
 
@@ -56,6 +80,83 @@ static bool handle_option_with_argument(const char opt,
         config->grid_file = argv[*i];
         config->generate_grid = true;
         break;
+    case 'm':
+        if (strcmp(argv[*i], "pointer") == 0)
+        {
+            config->layout = TREE_LAYOUT_POINTER;
+        }
+        else if (strcmp(argv[*i], "array") == 0)
+        {
+            config->layout = TREE_LAYOUT_ARRAY;
+        }
+        else if (strcmp(argv[*i], "succinct") == 0)
+        {
+            config->layout = TREE_LAYOUT_SUCCINCT;
+        }
+        else
+        {
+            fprintf(stderr, "Error: Invalid layout '%s'\n", argv[*i]);
+            return false;
+        }
+        break;
+    case 'b':
+        if (strcmp(argv[*i], "recursive") == 0)
+        {
+            config->build_mode = QTREE_BUILD_RECURSIVE;
+        }
+        else if (strcmp(argv[*i], "pyramid") == 0)
+        {
+            config->build_mode = QTREE_BUILD_PYRAMID;
+        }
+        else if (strcmp(argv[*i], "pruned") == 0)
+        {
+            config->build_mode = QTREE_BUILD_PRUNED;
+        }
+        else
+        {
+            fprintf(stderr, "Error: Invalid build strategy '%s'\n", argv[*i]);
+            return false;
+        }
+        break;
+    case 'f':
+        if (strcmp(argv[*i], "q1") == 0)
+        {
+            config->format = QTREE_FORMAT_Q1;
+        }
+        else if (strcmp(argv[*i], "q2") == 0)
+        {
+            config->format = QTREE_FORMAT_Q2;
+        }
+        else
+        {
+            fprintf(stderr, "Error: Invalid format '%s'\n", argv[*i]);
+            return false;
+        }
+        break;
+    case 'l':
+    {
+        char *end = NULL;
+        long level = strtol(argv[*i], &end, 10);
+        if (end == argv[*i] || *end != '\0' || level < 0 || level > 32)
+        {
+            fprintf(stderr, "Error: Invalid preview level '%s'\n", argv[*i]);
+            return false;
+        }
+        config->preview_level = (int)level;
+        break;
+    }
+    case 't':
+    {
+        char *end = NULL;
+        long threads = strtol(argv[*i], &end, 10);
+        if (end == argv[*i] || *end != '\0' || threads < 0 || threads > 1024)
+        {
+            fprintf(stderr, "Error: Invalid thread count '%s'\n", argv[*i]);
+            return false;
+        }
+        config->threads = (uint32_t)threads;
+        break;
+    }
     default:
         fprintf(stderr, "Error: Invalid option '-%c'\n", opt);
         return false;
@@ -64,6 +165,119 @@ static bool handle_option_with_argument(const char opt,
     return true;
 }
 
+static bool handle_long_option(const char *name, int *i, int argc, char **argv,
+                               config_t *config)
+{
+    const bool is_batch = strcmp(name, "batch") == 0;
+    const bool is_band = strcmp(name, "band-rows") == 0;
+    const bool is_tile = strcmp(name, "tile") == 0;
+    const bool is_sequence = strcmp(name, "sequence") == 0;
+    const bool is_region = strcmp(name, "region") == 0;
+    const bool is_stats = strcmp(name, "stats") == 0;
+    const bool is_archive = strcmp(name, "archive") == 0;
+    const bool is_entry = strcmp(name, "entry") == 0;
+    const bool is_bytes = strcmp(name, "target-bytes") == 0;
+    if (!is_batch && !is_band && !is_tile && !is_sequence && !is_region && !is_stats &&
+        !is_archive && !is_entry && !is_bytes && strcmp(name, "target-psnr") != 0)
+    {
+        fprintf(stderr, "Error: Unknown option '--%s'\n", name);
+        return false;
+    }
+
+    if (++(*i) >= argc)
+    {
+        fprintf(stderr, "Error: Missing argument for --%s\n", name);
+        return false;
+    }
+
+    if (is_batch)
+    {
+        config->batch_source = argv[*i];
+        return true;
+    }
+
+    if (is_stats)
+    {
+        config->stats_file = argv[*i];
+        return true;
+    }
+
+    if (is_archive || is_entry)
+    {
+        if (argv[*i][0] == '\0')
+        {
+            fprintf(stderr, "Error: Invalid value '' for --%s\n", name);
+            return false;
+        }
+        if (is_archive)
+            config->archive_file = argv[*i];
+        else
+            config->archive_entry = argv[*i];
+        return true;
+    }
+
+    char *end = NULL;
+    if (is_band)
+    {
+        const unsigned long rows = strtoul(argv[*i], &end, 10);
+        if (end == argv[*i] || *end != '\0' || rows > (1ul << 16) || (rows & (rows - 1)) != 0)
+        {
+            fprintf(stderr, "Error: Invalid value '%s' for --%s\n", argv[*i], name);
+            return false;
+        }
+        config->banded = true;
+        config->band_rows = (uint32_t)rows;
+        return true;
+    }
+
+    if (is_tile || is_sequence)
+    {
+        const unsigned long size = strtoul(argv[*i], &end, 10);
+        if (end == argv[*i] || *end != '\0' || size < 2 || size > (1ul << 16) ||
+            (size & (size - 1)) != 0)
+        {
+            fprintf(stderr, "Error: Invalid value '%s' for --%s\n", argv[*i], name);
+            return false;
+        }
+        if (is_tile)
+            config->tile_size = (uint32_t)size;
+        else
+            config->sequence_block = (uint32_t)size;
+        return true;
+    }
+
+    if (is_region)
+    {
+        unsigned int col = 0, row = 0, size = 0;
+        int used = 0;
+        if (sscanf(argv[*i], "%u,%u,%u%n", &col, &row, &size, &used) != 3 ||
+            argv[*i][used] != '\0' || size == 0)
+        {
+            fprintf(stderr, "Error: Invalid value '%s' for --%s (expected x,y,size)\n",
+                    argv[*i], name);
+            return false;
+        }
+        config->region = true;
+        config->region_col = col;
+        config->region_row = row;
+        config->region_size = size;
+        return true;
+    }
+
+    const double value = strtod(argv[*i], &end);
+    if (end == argv[*i] || *end != '\0' || !(value > 0.0))
+    {
+        fprintf(stderr, "Error: Invalid value '%s' for --%s\n", argv[*i], name);
+        return false;
+    }
+
+    if (is_bytes)
+        config->target_bytes = (size_t)value;
+    else
+        config->target_psnr = value;
+    return true;
+}
+
 static bool handle_flag_option(const char opt, config_t *config)
 {
     switch (opt)
@@ -74,6 +288,12 @@ static bool handle_flag_option(const char opt, config_t *config)
     case 'u':
         config->decompress = true;
         break;
+    case 'p':
+        config->preview_upscale = true;
+        break;
+    case 'q':
+        config->quiet = true;
+        break;
     case 'h':
         cli_print_help();
         exit(EXIT_SUCCESS);
@@ -98,14 +318,138 @@ static bool validate_config(config_t *config)
         return false;
     }
 
-    if (!config->input_file)
+    if (config->batch_source)
+    {
+        if (config->input_file)
+        {
+            fprintf(stderr, "Error: Use either -i or --batch, not both\n");
+            return false;
+        }
+        if (config->generate_grid)
+        {
+            fprintf(stderr, "Error: Grid output is not available in batch mode\n");
+            return false;
+        }
+    }
+    else if (!config->input_file)
     {
         fprintf(stderr, "Error: Input file not specified\n");
         return false;
     }
 
-    // Set default output file if not specified
-    if (!config->output_file)
+    if (config->compress && (config->preview_level >= 0 || config->preview_upscale))
+    {
+        fprintf(stderr, "Error: Preview options only apply to decompression\n");
+        return false;
+    }
+
+    // Decoders read the format from the file itself
+    if (config->compress && config->layout == TREE_LAYOUT_SUCCINCT)
+    {
+        fprintf(stderr, "Error: The succinct layout is read-only, use it to decompress\n");
+        return false;
+    }
+
+    if (config->decompress && config->format != QTREE_FORMAT_Q1)
+    {
+        fprintf(stderr, "Error: The output format only applies to compression\n");
+        return false;
+    }
+
+    if (config->banded &&
+        (!config->compress || config->batch_source || config->generate_grid ||
+         config->alpha > 1.0f || config->target_bytes > 0 || config->target_psnr > 0.0 ||
+         config->layout != TREE_LAYOUT_POINTER || config->format != QTREE_FORMAT_Q1))
+    {
+        fprintf(stderr, "Error: --band-rows is for single-file lossless Q1 compression "
+                        "(no -a, -g, -m, -f, --target-* or --batch)\n");
+        return false;
+    }
+
+    if (config->tile_size > 0 &&
+        (!config->compress || config->banded || config->generate_grid ||
+         config->target_bytes > 0 || config->target_psnr > 0.0 ||
+         config->layout != TREE_LAYOUT_POINTER))
+    {
+        fprintf(stderr, "Error: --tile is for compression without -g, -m, --band-rows "
+                        "or --target-*\n");
+        return false;
+    }
+
+    if (config->sequence_block > 0 &&
+        (!config->compress || !config->batch_source || !config->output_file ||
+         config->banded || config->tile_size > 0 || config->alpha > 1.0f ||
+         config->target_bytes > 0 || config->target_psnr > 0.0 ||
+         config->layout != TREE_LAYOUT_POINTER))
+    {
+        fprintf(stderr, "Error: --sequence is for lossless compression of a --batch into "
+                        "one -o file (no -a, -m, --tile, --band-rows or --target-*)\n");
+        return false;
+    }
+
+    // Frames aren't files of their own, so there is nothing to report per line
+    if (config->sequence_block > 0 && config->stats_file)
+    {
+        fprintf(stderr, "Error: --stats is not available with --sequence\n");
+        return false;
+    }
+
+    if (config->archive_file &&
+        (!config->compress || !config->batch_source || config->output_file ||
+         config->banded || config->tile_size > 0 || config->sequence_block > 0 ||
+         config->layout != TREE_LAYOUT_POINTER))
+    {
+        fprintf(stderr, "Error: --archive is for compressing a --batch into one file "
+                        "(no -o, -m, --tile, --band-rows or --sequence)\n");
+        return false;
+    }
+
+    if (config->archive_entry &&
+        (!config->decompress || config->batch_source || config->generate_grid ||
+         config->preview_level >= 0 || config->preview_upscale || config->region ||
+         config->layout != TREE_LAYOUT_POINTER))
+    {
+        fprintf(stderr, "Error: --entry is for decompressing one archive "
+                        "(no -g, -l, -p, -m, --region or --batch)\n");
+        return false;
+    }
+
+    if (config->region &&
+        (!config->decompress || config->batch_source || config->generate_grid ||
+         config->preview_level >= 0 || config->preview_upscale ||
+         config->layout != TREE_LAYOUT_POINTER))
+    {
+        fprintf(stderr, "Error: --region is for decompressing one tiled file "
+                        "(no -g, -l, -p, -m or --batch)\n");
+        return false;
+    }
+
+    if (config->target_bytes > 0 || config->target_psnr > 0.0)
+    {
+        if (!config->compress)
+        {
+            fprintf(stderr, "Error: Rate targets only apply to compression\n");
+            return false;
+        }
+        if (config->target_bytes > 0 && config->target_psnr > 0.0)
+        {
+            fprintf(stderr, "Error: Use either --target-bytes or --target-psnr, not both\n");
+            return false;
+        }
+        if (config->layout != TREE_LAYOUT_POINTER)
+        {
+            fprintf(stderr, "Error: Rate targets need the pointer layout\n");
+            return false;
+        }
+        if (config->format == QTREE_FORMAT_Q2)
+        {
+            fprintf(stderr, "Error: Rate targets price Q1 files, they can't be used with -f q2\n");
+            return false;
+        }
+    }
+
+    // Set default output file if not specified (batch writes next to the inputs)
+    if (!config->output_file && !config->batch_source)
     {
         config->output_file = config->compress ? DEFAULT_COMPRESS_OUTPUT : DEFAULT_DECOMPRESS_OUTPUT;
     }
@@ -128,8 +472,16 @@ bool cli_parse_arguments(int argc, char **argv, config_t *config)
             return false;
         }
 
+        // Long options all take an argument
+        if (arg[1] == '-')
+        {
+            if (!handle_long_option(arg + 2, &i, argc, argv, config))
+            {
+                return false;
+            }
+        }
         // Handle options that require additional arguments
-        if (strchr("ioga", arg[1]))
+        else if (strchr("iogambflt", arg[1]))
         {
             if (!handle_option_with_argument(arg[1], &i, argc, argv, config))
             {
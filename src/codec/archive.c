@@ -0,0 +1,453 @@
+/**
+ * @file archive.c
+ * @brief Archive of headerless payloads, built a payload at a time
+ *
+ * The builder takes payloads in whatever order the workers finish
+ * them: each one goes straight to the file under the lock and only its
+ * entry is kept. finish() sorts the entries by id, writes them after
+ * the last payload and goes back to fill in the header, so a file that
+ * never got there has no index and won't open.
+ */
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "codec/archive.h"
+#include "codec/decompression.h"
+#include "logger/logger.h"
+
+/* FNV-1a, 64-bit */
+#define FNV_OFFSET 0xcbf29ce484222325ull
+#define FNV_PRIME 0x100000001b3ull
+
+static void put_le(uint8_t *out, uint64_t value, unsigned n_bytes)
+{
+    for (unsigned i = 0; i < n_bytes; i++)
+        out[i] = (uint8_t)(value >> (8 * i));
+}
+
+static uint64_t get_le(const uint8_t *in, unsigned n_bytes)
+{
+    uint64_t value = 0;
+    for (unsigned i = 0; i < n_bytes; i++)
+        value |= (uint64_t)in[i] << (8 * i);
+    return value;
+}
+
+static void read_entry(const uint8_t *in, qtree_archive_entry_t *entry)
+{
+    entry->id = get_le(in, 8);
+    entry->offset = get_le(in + 8, 8);
+    entry->length = (uint32_t)get_le(in + 16, 4);
+    entry->n_levels = in[20];
+    entry->size = entry->n_levels <= 16 ? 1u << entry->n_levels : 0;
+}
+
+static void write_entry(uint8_t *out, const qtree_archive_entry_t *entry)
+{
+    put_le(out, entry->id, 8);
+    put_le(out + 8, entry->offset, 8);
+    put_le(out + 16, entry->length, 4);
+    out[20] = (uint8_t)entry->n_levels;
+    memset(out + 21, 0, 3);
+}
+
+static int compare_entries(const void *a, const void *b)
+{
+    const uint64_t x = ((const qtree_archive_entry_t *)a)->id;
+    const uint64_t y = ((const qtree_archive_entry_t *)b)->id;
+    return (x > y) - (x < y);
+}
+
+bool qtree_archive_magic(const uint8_t *data, size_t length)
+{
+    return data && length >= 3 && memcmp(data, QTREE_ARCHIVE_MAGIC "\n", 3) == 0;
+}
+
+uint64_t qtree_archive_id(const char *name)
+{
+    if (!name)
+        return FNV_OFFSET;
+
+    const char *slash = strrchr(name, '/');
+    const char *stem = slash ? slash + 1 : name;
+    const char *dot = strrchr(stem, '.');
+    const size_t length = dot && dot != stem ? (size_t)(dot - stem) : strlen(stem);
+
+    // Digits that fit are the id itself
+    uint64_t number = 0;
+    bool numeric = length > 0;
+    for (size_t i = 0; numeric && i < length; i++)
+    {
+        const uint64_t digit = (uint64_t)(stem[i] - '0');
+        numeric = stem[i] >= '0' && stem[i] <= '9' && number <= (UINT64_MAX - digit) / 10;
+        number = number * 10 + (numeric ? digit : 0);
+    }
+    if (numeric)
+        return number;
+
+    uint64_t hash = FNV_OFFSET;
+    for (size_t i = 0; i < length; i++)
+    {
+        hash ^= (uint8_t)stem[i];
+        hash *= FNV_PRIME;
+    }
+    return hash;
+}
+
+/**
+ * @brief The header, with the index where it ended up
+ */
+static void fill_header(uint8_t *out, qtree_format_t format, uint64_t count,
+                        uint64_t index_offset)
+{
+    memset(out, 0, QTREE_ARCHIVE_HEADER_SIZE);
+    memcpy(out, QTREE_ARCHIVE_MAGIC "\n", 3);
+    out[3] = QTREE_ARCHIVE_VERSION;
+    out[4] = format == QTREE_FORMAT_Q2 ? 2 : 1;
+    put_le(out + 8, count, 8);
+    put_le(out + 16, index_offset, 8);
+}
+
+qtree_status_t qtree_archive_builder_init(qtree_archive_builder_t *builder, FILE *file,
+                                          qtree_format_t format)
+{
+    if (!builder || !file)
+    {
+        log_message(LOG_LEVEL_ERROR, "Invalid parameters for an archive");
+        return QTREE_ERROR_INVALID_PARAM;
+    }
+
+    *builder = (qtree_archive_builder_t){.file = file, .format = format};
+    pthread_mutex_init(&builder->lock, NULL);
+
+    // No index yet: until finish() this reads as an archive that isn't done
+    uint8_t header[QTREE_ARCHIVE_HEADER_SIZE];
+    fill_header(header, format, 0, 0);
+    if (fwrite(header, 1, sizeof(header), file) != sizeof(header))
+    {
+        log_message(LOG_LEVEL_ERROR, "Failed to write the archive header");
+        return QTREE_ERROR_FORMAT;
+    }
+    builder->bytes = sizeof(header);
+    return QTREE_SUCCESS;
+}
+
+qtree_status_t qtree_archive_builder_append(qtree_archive_builder_t *builder, uint64_t id,
+                                            uint32_t n_levels, const uint8_t *data,
+                                            size_t length)
+{
+    if (!builder || !builder->file || (!data && length > 0) || n_levels < 1 ||
+        n_levels > 16)
+    {
+        log_message(LOG_LEVEL_ERROR, "Invalid parameters for an archive entry");
+        return QTREE_ERROR_INVALID_PARAM;
+    }
+    if (length > UINT32_MAX)
+    {
+        log_message(LOG_LEVEL_ERROR, "Image %llu is too big for the index",
+                    (unsigned long long)id);
+        return QTREE_ERROR_FORMAT;
+    }
+
+    pthread_mutex_lock(&builder->lock);
+    qtree_status_t status = builder->failure;
+    if (status == QTREE_SUCCESS && builder->count == builder->capacity)
+    {
+        const size_t capacity = builder->capacity ? builder->capacity * 2 : 256;
+        qtree_archive_entry_t *entries =
+            realloc(builder->entries, capacity * sizeof(qtree_archive_entry_t));
+        if (entries)
+        {
+            builder->entries = entries;
+            builder->capacity = capacity;
+        }
+        else
+        {
+            status = QTREE_ERROR_MEMORY;
+        }
+    }
+    if (status == QTREE_SUCCESS && length > 0 && fwrite(data, 1, length, builder->file) != length)
+        status = QTREE_ERROR_FORMAT;
+
+    if (status == QTREE_SUCCESS)
+    {
+        builder->entries[builder->count++] = (qtree_archive_entry_t){
+            .id = id,
+            .offset = builder->bytes,
+            .length = (uint32_t)length,
+            .n_levels = n_levels,
+            .size = 1u << n_levels};
+        builder->bytes += length;
+    }
+    else if (builder->failure == QTREE_SUCCESS)
+    {
+        // Half a payload may be in the file now, so nothing after it can be trusted
+        builder->failure = status;
+    }
+    pthread_mutex_unlock(&builder->lock);
+    return status;
+}
+
+qtree_status_t qtree_archive_builder_add(qtree_archive_builder_t *builder, uint64_t id,
+                                         const qtree_t *tree, size_t *length)
+{
+    if (!builder || !tree)
+    {
+        log_message(LOG_LEVEL_ERROR, "Invalid parameters for an archive entry");
+        return QTREE_ERROR_INVALID_PARAM;
+    }
+
+    uint8_t *data = NULL;
+    size_t coded = 0;
+    qtree_status_t status = compress_payload_to_buffer(tree, builder->format, &data, &coded);
+    if (status == QTREE_SUCCESS)
+        status = qtree_archive_builder_append(builder, id, tree->n_levels, data, coded);
+    if (status == QTREE_SUCCESS && length)
+        *length = coded;
+    free(data);
+    return status;
+}
+
+qtree_status_t qtree_archive_builder_finish(qtree_archive_builder_t *builder)
+{
+    if (!builder || !builder->file)
+        return QTREE_ERROR_INVALID_PARAM;
+
+    pthread_mutex_lock(&builder->lock);
+    qtree_status_t status = builder->failure;
+    if (status != QTREE_SUCCESS)
+        log_message(LOG_LEVEL_ERROR, "An image could not be added to the archive");
+
+    if (status == QTREE_SUCCESS && builder->count > 1)
+    {
+        qsort(builder->entries, builder->count, sizeof(qtree_archive_entry_t),
+              compare_entries);
+        for (size_t i = 1; i < builder->count; i++)
+        {
+            if (builder->entries[i].id == builder->entries[i - 1].id)
+            {
+                log_message(LOG_LEVEL_ERROR, "Two images have the id %llu",
+                            (unsigned long long)builder->entries[i].id);
+                status = QTREE_ERROR_FORMAT;
+                break;
+            }
+        }
+    }
+
+    const size_t index_size = builder->count * QTREE_ARCHIVE_ENTRY_SIZE;
+    uint8_t *index = status == QTREE_SUCCESS ? malloc(index_size ? index_size : 1) : NULL;
+    if (status == QTREE_SUCCESS && !index)
+        status = QTREE_ERROR_MEMORY;
+
+    if (status == QTREE_SUCCESS)
+    {
+        for (size_t i = 0; i < builder->count; i++)
+            write_entry(index + i * QTREE_ARCHIVE_ENTRY_SIZE, &builder->entries[i]);
+
+        uint8_t header[QTREE_ARCHIVE_HEADER_SIZE];
+        fill_header(header, builder->format, builder->count, builder->bytes);
+        if (fwrite(index, 1, index_size, builder->file) != index_size ||
+            fseeko(builder->file, 0, SEEK_SET) != 0 ||
+            fwrite(header, 1, sizeof(header), builder->file) != sizeof(header) ||
+            fseeko(builder->file, 0, SEEK_END) != 0 || fflush(builder->file) != 0)
+        {
+            log_message(LOG_LEVEL_ERROR, "Failed to write the archive index");
+            status = QTREE_ERROR_FORMAT;
+        }
+        else
+        {
+            builder->bytes += index_size;
+        }
+    }
+
+    free(index);
+    builder->failure = status;
+    pthread_mutex_unlock(&builder->lock);
+    return status;
+}
+
+void qtree_archive_builder_free(qtree_archive_builder_t *builder)
+{
+    if (!builder || !builder->file)
+        return;
+    pthread_mutex_destroy(&builder->lock);
+    free(builder->entries);
+    *builder = (qtree_archive_builder_t){0};
+}
+
+qtree_status_t qtree_archive_open(const uint8_t *data, size_t length, qtree_archive_t *archive)
+{
+    if (!archive || !qtree_archive_magic(data, length))
+    {
+        log_message(LOG_LEVEL_ERROR, "Invalid file signature (expected '%s')",
+                    QTREE_ARCHIVE_MAGIC);
+        return QTREE_ERROR_FORMAT;
+    }
+    if (length < QTREE_ARCHIVE_HEADER_SIZE)
+    {
+        log_message(LOG_LEVEL_ERROR, "Truncated archive header");
+        return QTREE_ERROR_FORMAT;
+    }
+
+    const uint8_t version = data[3];
+    const uint8_t format = data[4];
+    const uint64_t count = get_le(data + 8, 8);
+    const uint64_t index_offset = get_le(data + 16, 8);
+    if (version != QTREE_ARCHIVE_VERSION || (format != 1 && format != 2))
+    {
+        log_message(LOG_LEVEL_ERROR, "Invalid archive header (version %u, format %u)",
+                    (uint32_t)version, (uint32_t)format);
+        return QTREE_ERROR_FORMAT;
+    }
+    if (index_offset < QTREE_ARCHIVE_HEADER_SIZE || index_offset > length ||
+        count > (length - index_offset) / QTREE_ARCHIVE_ENTRY_SIZE)
+    {
+        log_message(LOG_LEVEL_ERROR, "Truncated or unfinished archive index");
+        return QTREE_ERROR_FORMAT;
+    }
+
+    // Check every entry once so lookups and decodes can trust them
+    const uint8_t *index = data + index_offset;
+    uint64_t previous = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        qtree_archive_entry_t entry;
+        read_entry(index + i * QTREE_ARCHIVE_ENTRY_SIZE, &entry);
+        if (entry.n_levels < 1 || entry.n_levels > 16 ||
+            entry.offset < QTREE_ARCHIVE_HEADER_SIZE || entry.offset > index_offset ||
+            entry.length > index_offset - entry.offset)
+        {
+            log_message(LOG_LEVEL_ERROR, "Archive entry %zu is damaged", i);
+            return QTREE_ERROR_FORMAT;
+        }
+        if (i > 0 && entry.id <= previous)
+        {
+            log_message(LOG_LEVEL_ERROR, "Archive index is not sorted at entry %zu", i);
+            return QTREE_ERROR_FORMAT;
+        }
+        previous = entry.id;
+    }
+
+    *archive = (qtree_archive_t){
+        .data = data,
+        .length = length,
+        .index = index,
+        .count = (size_t)count,
+        .format = format == 2 ? QTREE_FORMAT_Q2 : QTREE_FORMAT_Q1};
+    return QTREE_SUCCESS;
+}
+
+qtree_status_t qtree_archive_map(const char *path, qtree_archive_t *archive)
+{
+    if (!path || !archive)
+        return QTREE_ERROR_INVALID_PARAM;
+
+    const int fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        log_message(LOG_LEVEL_ERROR, "Failed to open archive: %s", path);
+        return QTREE_ERROR_FORMAT;
+    }
+
+    struct stat info;
+    void *base = MAP_FAILED;
+    size_t length = 0;
+    if (fstat(fd, &info) == 0 && S_ISREG(info.st_mode) && info.st_size > 0)
+    {
+        length = (size_t)info.st_size;
+        base = mmap(NULL, length, PROT_READ, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (base == MAP_FAILED)
+    {
+        log_message(LOG_LEVEL_ERROR, "Failed to map archive: %s", path);
+        return QTREE_ERROR_FORMAT;
+    }
+
+    const qtree_status_t status = qtree_archive_open(base, length, archive);
+    if (status != QTREE_SUCCESS)
+    {
+        munmap(base, length);
+        return status;
+    }
+
+    // Lookups jump around; reading ahead would only pull in images nobody asked for
+    madvise(base, length, MADV_RANDOM);
+    archive->map_base = base;
+    archive->map_length = length;
+    return QTREE_SUCCESS;
+}
+
+void qtree_archive_close(qtree_archive_t *archive)
+{
+    if (!archive)
+        return;
+    if (archive->map_base)
+        munmap(archive->map_base, archive->map_length);
+    *archive = (qtree_archive_t){0};
+}
+
+bool qtree_archive_entry_at(const qtree_archive_t *archive, size_t i,
+                            qtree_archive_entry_t *entry)
+{
+    if (!archive || !entry || i >= archive->count)
+        return false;
+    read_entry(archive->index + i * QTREE_ARCHIVE_ENTRY_SIZE, entry);
+    return true;
+}
+
+bool qtree_archive_find(const qtree_archive_t *archive, uint64_t id,
+                        qtree_archive_entry_t *entry)
+{
+    if (!archive || !entry)
+        return false;
+
+    size_t low = 0;
+    size_t high = archive->count;
+    while (low < high)
+    {
+        const size_t middle = low + (high - low) / 2;
+        const uint64_t found = get_le(archive->index + middle * QTREE_ARCHIVE_ENTRY_SIZE, 8);
+        if (found == id)
+            return qtree_archive_entry_at(archive, middle, entry);
+        if (found < id)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+    return false;
+}
+
+qtree_status_t qtree_archive_decode(const qtree_archive_t *archive,
+                                    const qtree_archive_entry_t *entry, uint8_t *pixels)
+{
+    return qtree_archive_decode_with_stats(archive, entry, pixels, NULL);
+}
+
+qtree_status_t qtree_archive_decode_with_stats(const qtree_archive_t *archive,
+                                               const qtree_archive_entry_t *entry,
+                                               uint8_t *pixels, qtc_stats_t *stats)
+{
+    if (!archive || !entry || !pixels || entry->n_levels < 1 || entry->n_levels > 16 ||
+        entry->offset > archive->length || entry->length > archive->length - entry->offset)
+    {
+        log_message(LOG_LEVEL_ERROR, "Invalid archive entry");
+        return QTREE_ERROR_INVALID_PARAM;
+    }
+
+    // A server decodes thousands of these; the progress display is for the tool
+    const bool was_muted = logger_thread_muted();
+    logger_mute_thread(true);
+    pgm_t pgm = {0};
+    const qtree_status_t status =
+        qtree_decompress_payload_with_stats(archive->data + entry->offset, entry->length,
+                                            archive->format, entry->n_levels, pixels, &pgm,
+                                            stats);
+    logger_mute_thread(was_muted);
+    return status;
+}
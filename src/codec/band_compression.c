@@ -0,0 +1,491 @@
+/**
+ * @file band_compression.c
+ * @brief Band-by-band Q1 compression through a spill file
+ *
+ * Level L of the stream lists the nodes of level L in the order of
+ * their parents, which is the order of the block roots on the cut
+ * level (left to right along the quadrant path) followed by each
+ * block's own level-major order. So every block is written on its own,
+ * its level boundaries are remembered, and the final pass runs over the
+ * levels and, for each, over the blocks, copying bit ranges out of the
+ * spill file.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "codec/band_compression.h"
+#include "codec/compression.h"
+#include "core/node_arena.h"
+#include "io/pgm.h"
+#include "logger/logger.h"
+#include "common/common.h"
+
+/* At most 4^10 blocks, so the per-block bookkeeping stays small */
+#define MAX_TOP_LEVELS 10u
+
+/**
+ * @brief What the top of the tree needs to know about a block
+ */
+typedef struct
+{
+    uint8_t m; /* Mean of the block */
+    uint8_t e; /* Rounding error */
+    uint8_t u; /* Is it uniform? */
+} block_root_t;
+
+/**
+ * @brief Everything one banded compression keeps between passes
+ */
+typedef struct
+{
+    uint32_t size;         /* Image side */
+    uint32_t n_levels;     /* Depth of the whole tree */
+    uint32_t block_levels; /* Height of a block (its side is 2^k) */
+    uint32_t grid;         /* Blocks along each side */
+    block_root_t *roots;   /* One per block, row-major */
+    uint64_t *offsets;     /* Where each block starts in the spill file */
+    size_t *ends;          /* Bit end of every level of every block */
+    FILE *spill;           /* Written blocks, waiting for the last pass */
+    uint64_t spill_bytes;  /* How much of it there is */
+    uint8_t *chunk;        /* Bytes read back from the spill file */
+    size_t chunk_capacity; /* Room in chunk */
+    qtc_stats_t *stats;    /* Gets the nodes of every block (can be NULL) */
+} band_job_t;
+
+/**
+ * @brief log2 of a power of two
+ */
+static uint32_t levels_of(uint32_t size)
+{
+    uint32_t levels = 0;
+    while ((1u << levels) < size)
+        levels++;
+    return levels;
+}
+
+/**
+ * @brief Append count bits to a stream, starting first_bit bits into bytes
+ */
+static void append_bits(qtree_compress_state_t *out, const uint8_t *bytes,
+                        size_t first_bit, size_t count)
+{
+    while (count > 0 && !out->error)
+    {
+        // 24 bits starting anywhere in a byte take up at most 4 bytes
+        const size_t take = count < 24 ? count : 24;
+        const size_t byte = first_bit / 8;
+        const size_t shift = first_bit % 8;
+        const size_t span = (shift + take + 7) / 8;
+
+        uint32_t window = 0;
+        for (size_t i = 0; i < span; i++)
+        {
+            window = (window << 8) | bytes[byte + i];
+        }
+        window <<= 8 * (4 - span);
+
+        compress_write_bits(out, (window << shift) >> (32 - take), take);
+        first_bit += take;
+        count -= take;
+    }
+}
+
+/**
+ * @brief Read length bytes of the spill file at offset into job->chunk
+ */
+static bool read_spill(band_job_t *job, uint64_t offset, size_t length)
+{
+    if (length > job->chunk_capacity)
+    {
+        uint8_t *grown = realloc(job->chunk, length);
+        if (!grown)
+            return false;
+        job->chunk = grown;
+        job->chunk_capacity = length;
+    }
+
+    size_t done = 0;
+    while (done < length)
+    {
+        const ssize_t got = pread(fileno(job->spill), job->chunk + done, length - done,
+                                  (off_t)(offset + done));
+        if (got < 0 && errno == EINTR)
+            continue;
+        if (got <= 0)
+            return false;
+        done += (size_t)got;
+    }
+    return true;
+}
+
+/**
+ * @brief Build, write and drop the blocks of one band
+ * @param band 2^k rows of pixels
+ * @param y Which band (block row) this is
+ */
+static bool compress_band(band_job_t *job, const uint8_t *band, uint32_t y,
+                          qtree_arena_t *arena, qtree_compress_state_t *state)
+{
+    const uint32_t k = job->block_levels;
+
+    for (uint32_t x = 0; x < job->grid; x++)
+    {
+        const size_t s = (size_t)y * job->grid + x;
+
+        qtree_arena_reset(arena);
+        const qtree_node_t *root = qtree_build_block(arena, band, job->size, k, 0, x << k);
+        if (!root)
+        {
+            log_message(LOG_LEVEL_ERROR, "Memory allocation failed for block %zu", s);
+            return false;
+        }
+        job->roots[s] = (block_root_t){.m = root->m, .e = root->e, .u = root->u};
+        job->offsets[s] = job->spill_bytes;
+        if (root->u)
+            continue;
+
+        // The root itself is coded with the top levels
+        for (int q = 0; q < 4; q++)
+            qtc_stats_count_subtree(job->stats, root->children[q], job->n_levels - k + 1);
+
+        compress_rewind(state);
+        if (!compress_levels(state, root, k, true, job->ends + s * k))
+            return false;
+        compress_flush(state);
+        if (state->error ||
+            fwrite(state->buffer, 1, state->buffer_used, job->spill) != state->buffer_used)
+        {
+            log_message(LOG_LEVEL_ERROR, "Failed to write the spill file");
+            return false;
+        }
+        job->spill_bytes += state->buffer_used;
+    }
+    return true;
+}
+
+/**
+ * @brief Top of the tree, with the block roots as its bottom level
+ */
+static qtree_node_t *build_top(qtree_arena_t *arena, const band_job_t *job,
+                               uint32_t level, uint32_t row, uint32_t col)
+{
+    qtree_node_t *node = qtree_arena_alloc(arena);
+    if (!node)
+        return NULL;
+
+    if (level == 0)
+    {
+        const block_root_t *block = &job->roots[(size_t)row * job->grid + col];
+        node->m = block->m;
+        node->e = (unsigned char)(block->e & 0x3);
+        node->u = (unsigned char)(block->u & 0x1);
+        return node;
+    }
+
+    const uint32_t step = 1u << (level - 1);
+    for (int q = 0; q < 4; q++)
+    {
+        node->children[q] = build_top(arena, job, level - 1,
+                                      row + ((q & 2) ? step : 0),
+                                      col + (((q & 1) ^ ((q & 2) >> 1)) ? step : 0));
+        if (!node->children[q])
+            return NULL;
+    }
+
+    if (qtree_node_combine(node))
+    {
+        for (int q = 0; q < 4; q++)
+        {
+            qtree_arena_release_subtree(arena, node->children[q]);
+            node->children[q] = NULL;
+        }
+    }
+    return node;
+}
+
+/**
+ * @brief Copy one level of every block, in stream order
+ * @param depth Level inside the blocks (1..k)
+ */
+static bool emit_level(band_job_t *job, qtree_compress_state_t *out, uint32_t depth,
+                       uint32_t level, uint32_t row, uint32_t col)
+{
+    if (level > 0)
+    {
+        const uint32_t step = 1u << (level - 1);
+        for (int q = 0; q < 4; q++)
+        {
+            if (!emit_level(job, out, depth, level - 1,
+                            row + ((q & 2) ? step : 0),
+                            col + (((q & 1) ^ ((q & 2) >> 1)) ? step : 0)))
+                return false;
+        }
+        return true;
+    }
+
+    const size_t s = (size_t)row * job->grid + col;
+    if (job->roots[s].u)
+        return true;
+
+    const size_t *ends = job->ends + s * job->block_levels;
+    const size_t first = depth > 1 ? ends[depth - 2] : 0;
+    const size_t last = ends[depth - 1];
+    if (last == first)
+        return true;
+
+    const size_t length = (last + 7) / 8 - first / 8;
+    if (!read_spill(job, job->offsets[s] + first / 8, length))
+    {
+        log_message(LOG_LEVEL_ERROR, "Failed to read the spill file");
+        return false;
+    }
+    append_bits(out, job->chunk, first % 8, last - first);
+    return !out->error;
+}
+
+/**
+ * @brief Free whatever a job holds
+ */
+static void job_release(band_job_t *job)
+{
+    free(job->roots);
+    free(job->offsets);
+    free(job->ends);
+    free(job->chunk);
+    if (job->spill)
+        fclose(job->spill);
+}
+
+/**
+ * @brief Every band through its blocks, then the top of the tree
+ * @param top Set to the top levels' stream (memory mode)
+ */
+static qtree_status_t first_pass(band_job_t *job, pgm_rows_t *rows, qtree_arena_t *arena,
+                                 qtree_compress_state_t *top, size_t *processed_nodes)
+{
+    const uint32_t k = job->block_levels;
+    const uint32_t top_levels = job->n_levels - k;
+
+    uint8_t *band = malloc((size_t)job->size << k);
+    qtree_compress_state_t state = compress_init(NULL);
+    if (!band || state.error)
+    {
+        free(band);
+        compress_release(&state);
+        log_message(LOG_LEVEL_ERROR, "Memory allocation failed for the band buffer");
+        return QTREE_ERROR_MEMORY;
+    }
+
+    qtree_status_t status = QTREE_SUCCESS;
+    for (uint32_t y = 0; y < job->grid && status == QTREE_SUCCESS; y++)
+    {
+        if (pgm_read_rows(rows, band, 1u << k) != PGM_SUCCESS)
+        {
+            log_message(LOG_LEVEL_ERROR, "Failed to read rows %u..%u", y << k,
+                        ((y + 1) << k) - 1);
+            status = QTREE_ERROR_FORMAT;
+        }
+        else if (!compress_band(job, band, y, arena, &state))
+        {
+            status = QTREE_ERROR_MEMORY;
+        }
+        log_progress_hook((double)(y + 1) / (double)job->grid);
+    }
+    *processed_nodes = state.processed_nodes;
+    free(band);
+    compress_release(&state);
+    if (status != QTREE_SUCCESS)
+        return status;
+
+    if (fflush(job->spill) != 0)
+    {
+        log_message(LOG_LEVEL_ERROR, "Failed to write the spill file");
+        return QTREE_ERROR_FORMAT;
+    }
+
+    // The block roots are all that is left of the image now
+    qtree_arena_reset(arena);
+    const qtree_node_t *root = build_top(arena, job, top_levels, 0, 0);
+    *top = compress_init(NULL);
+    if (!root || top->error)
+    {
+        log_message(LOG_LEVEL_ERROR, "Memory allocation failed for the top levels");
+        return QTREE_ERROR_MEMORY;
+    }
+
+    size_t top_ends[MAX_TOP_LEVELS];
+    qtc_stats_count_subtree(job->stats, root, 0);
+    compress_write_root(top, root, job->n_levels);
+    if (!compress_levels(top, root, top_levels, k == 0, top_ends))
+        return QTREE_ERROR_MEMORY;
+    compress_flush(top);
+    *processed_nodes += top->processed_nodes;
+    return top->error ? QTREE_ERROR_MEMORY : QTREE_SUCCESS;
+}
+
+/**
+ * @brief Header, the top levels, then every block level in stream order
+ */
+static qtree_status_t second_pass(band_job_t *job, const qtree_compress_state_t *top,
+                                  FILE *output_file, size_t *total_bits)
+{
+    const uint32_t k = job->block_levels;
+    const size_t n_blocks = (size_t)job->grid * job->grid;
+
+    *total_bits = top->total_bits;
+    for (size_t s = 0; s < n_blocks; s++)
+    {
+        // A block of height 0 is a pixel, and pixels are always uniform
+        if (!job->roots[s].u && k > 0)
+            *total_bits += job->ends[s * k + k - 1];
+    }
+
+    const size_t original_size = (size_t)job->size * job->size * 8;
+    if (!compress_write_header(output_file, QTREE_FORMAT_Q1, job->n_levels,
+                               compress_get_rate(*total_bits, original_size)))
+    {
+        log_message(LOG_LEVEL_ERROR, "Failed to write file header");
+        return QTREE_ERROR_FORMAT;
+    }
+
+    qtree_compress_state_t out = compress_init(output_file);
+    if (out.error)
+    {
+        log_message(LOG_LEVEL_ERROR, "Failed to allocate the output buffer");
+        return QTREE_ERROR_MEMORY;
+    }
+
+    append_bits(&out, top->buffer, 0, top->total_bits);
+    bool ok = !out.error;
+    for (uint32_t depth = 1; ok && depth <= k; depth++)
+    {
+        ok = emit_level(job, &out, depth, job->n_levels - k, 0, 0);
+        log_progress_hook((double)depth / (double)k);
+    }
+
+    if (!ok)
+    {
+        compress_release(&out);
+        log_message(LOG_LEVEL_ERROR, "Failed to write compressed data");
+        return QTREE_ERROR_FORMAT;
+    }
+
+    compress_flush(&out);
+    return out.error ? QTREE_ERROR_FORMAT : QTREE_SUCCESS;
+}
+
+qtree_status_t compress_banded(const char *input_path, uint32_t band_rows,
+                               const char *output_filename, FILE *output_file)
+{
+    return compress_banded_with_stats(input_path, band_rows, output_filename, output_file,
+                                      NULL);
+}
+
+qtree_status_t compress_banded_with_stats(const char *input_path, uint32_t band_rows,
+                                          const char *output_filename, FILE *output_file,
+                                          qtc_stats_t *stats)
+{
+    log_header("BANDED COMPRESSION");
+
+    if (!input_path || !output_file || (band_rows != 0 && !is_power_of_two(band_rows)))
+    {
+        log_message(LOG_LEVEL_ERROR, "Invalid compression parameters");
+        return QTREE_ERROR_INVALID_PARAM;
+    }
+
+    pgm_rows_t rows;
+    if (pgm_open_rows(input_path, &rows) != PGM_SUCCESS)
+    {
+        log_message(LOG_LEVEL_ERROR, "Failed to read PGM header");
+        return QTREE_ERROR_FORMAT;
+    }
+
+    band_job_t job = {.size = rows.size, .n_levels = levels_of(rows.size), .stats = stats};
+
+    // Bands of about sqrt(size) rows keep both the band and the index small
+    uint32_t k = band_rows ? levels_of(band_rows) : (job.n_levels + 1) / 2;
+    if (k > job.n_levels)
+        k = job.n_levels;
+    if (job.n_levels - k > MAX_TOP_LEVELS)
+        k = job.n_levels - MAX_TOP_LEVELS;
+    job.block_levels = k;
+    job.grid = 1u << (job.n_levels - k);
+
+    const size_t n_blocks = (size_t)job.grid * job.grid;
+    log_subheader("Image Information");
+    log_item("Input path", input_path);
+    log_item("Dimensions", "%ux%u pixels", rows.size, rows.size);
+    log_item("Tree depth", "%u levels", job.n_levels);
+    log_item("Band", "%u rows (%.2f MB)", 1u << k,
+             (double)((size_t)rows.size << k) / (1024.0 * 1024.0));
+    log_item("Blocks", "%zu of %ux%u pixels", n_blocks, 1u << k, 1u << k);
+
+    job.roots = malloc(n_blocks * sizeof(block_root_t));
+    job.offsets = malloc(n_blocks * sizeof(uint64_t));
+    job.ends = malloc(n_blocks * (k ? k : 1) * sizeof(size_t));
+    job.spill = tmpfile();
+    if (!job.roots || !job.offsets || !job.ends || !job.spill)
+    {
+        job_release(&job);
+        pgm_close_rows(&rows);
+        log_message(LOG_LEVEL_ERROR, "Failed to set up the band index or spill file");
+        return QTREE_ERROR_MEMORY;
+    }
+
+    const double start_time = wall_seconds();
+    qtree_arena_t arena = {0};
+    qtree_compress_state_t top = {0};
+    size_t processed_nodes = 0;
+
+    log_subheader("Building Blocks");
+    qtree_status_t status = first_pass(&job, &rows, &arena, &top, &processed_nodes);
+    log_end_progress();
+    qtc_stats_stage(stats, QTC_STAGE_ENCODE, start_time);
+    if (stats)
+    {
+        stats->node_allocs = arena.node_allocs;
+        stats->block_allocs = arena.block_allocs;
+        stats->peak_nodes = arena.peak_nodes;
+        stats->arena_bytes = (uint64_t)arena.reserved_nodes * sizeof(qtree_node_t);
+    }
+    qtree_arena_destroy(&arena);
+    pgm_close_rows(&rows);
+
+    size_t total_bits = 0;
+    if (status == QTREE_SUCCESS)
+    {
+        log_item("Spill data", "%.2f MB", (double)job.spill_bytes / (1024.0 * 1024.0));
+
+        log_subheader("Writing Output");
+        log_item("Output path", "%s", output_filename);
+        const double write_start = wall_seconds();
+        status = second_pass(&job, &top, output_file, &total_bits);
+        qtc_stats_stage(stats, QTC_STAGE_WRITE, write_start);
+        log_end_progress();
+    }
+    compress_release(&top);
+    job_release(&job);
+
+    if (status != QTREE_SUCCESS)
+    {
+        log_message(LOG_LEVEL_ERROR, "Banded compression failed");
+        return status;
+    }
+
+    const double elapsed = wall_seconds() - start_time;
+    const size_t original_size = (size_t)job.size * job.size * 8;
+    if (stats)
+    {
+        stats->size = job.size;
+        stats->n_levels = job.n_levels;
+        stats->bits_in = original_size;
+        stats->bits_out = total_bits;
+    }
+    log_size_stats(original_size, total_bits, processed_nodes, elapsed);
+    log_message(LOG_LEVEL_SUCCESS, "Compression completed with %.2f%% ratio",
+                (double)compress_get_rate(total_bits, original_size));
+    return QTREE_SUCCESS;
+}
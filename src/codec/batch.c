@@ -0,0 +1,706 @@
+/**
+ * @file batch.c
+ * @brief Batch mode: a reader feeding a pool of encoders
+ *
+ * The calling thread is the reader. It loads one file at a time and
+ * hands it to the pool, staying at most BATCH_READ_AHEAD files per
+ * worker ahead so memory stays bounded however long the list is.
+ */
+
+#include <dirent.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "codec/archive.h"
+#include "codec/batch.h"
+#include "codec/sequence.h"
+#include "common/common.h"
+#include "common/thread_pool.h"
+#include "logger/logger.h"
+
+/* Loaded files waiting per worker, on top of the one it is working on */
+#define BATCH_READ_AHEAD 1u
+
+/* Touch one byte per page so mapped input is read here, not in a worker */
+#define BATCH_PAGE_SIZE 4096u
+
+typedef struct batch batch_t;
+
+/**
+ * @brief One file going through the batch
+ */
+typedef struct
+{
+    char *input;           /* Path to read */
+    char *output;          /* Path to write */
+    pgm_t pgm;             /* Loaded image (compression) */
+    uint8_t *data;         /* Loaded file (decompression) */
+    size_t data_size;      /* Bytes in data */
+    codec_status_t status; /* How it went */
+    uint64_t input_bytes;  /* Size of the input file */
+    uint64_t output_bytes; /* Size of the output file */
+    double read_seconds;   /* Time the reader spent loading it */
+    qtc_stats_t stats;     /* Filled in for --stats */
+    batch_t *batch;        /* Back to the shared state */
+} batch_job_t;
+
+struct batch
+{
+    const config_t *config;
+    batch_job_t *jobs;
+    size_t n_jobs;
+    thread_pool_t *pool;
+    qtree_t *trees;          /* One per worker, reused across files */
+    size_t n_trees;
+    qtree_archive_builder_t *archive; /* Where files go with --archive (NULL otherwise) */
+    pthread_mutex_t lock;
+    pthread_cond_t slot_free;
+    size_t in_flight;        /* Loaded and not finished yet */
+    size_t max_in_flight;
+};
+
+/**
+ * @brief Growable list of paths
+ */
+typedef struct
+{
+    char **paths;
+    size_t count;
+    size_t capacity;
+} path_list_t;
+
+static bool path_list_add(path_list_t *list, const char *dir, const char *name)
+{
+    if (list->count == list->capacity)
+    {
+        const size_t capacity = list->capacity ? list->capacity * 2 : 64;
+        char **paths = realloc(list->paths, capacity * sizeof(char *));
+        if (!paths)
+            return false;
+        list->paths = paths;
+        list->capacity = capacity;
+    }
+
+    const size_t length = (dir ? strlen(dir) + 1 : 0) + strlen(name) + 1;
+    char *path = malloc(length);
+    if (!path)
+        return false;
+
+    if (dir)
+        snprintf(path, length, "%s/%s", dir, name);
+    else
+        snprintf(path, length, "%s", name);
+
+    list->paths[list->count++] = path;
+    return true;
+}
+
+static void path_list_free(path_list_t *list)
+{
+    for (size_t i = 0; i < list->count; i++)
+    {
+        free(list->paths[i]);
+    }
+    free(list->paths);
+    *list = (path_list_t){0};
+}
+
+static bool has_extension(const char *name, const char *extension)
+{
+    const size_t name_len = strlen(name);
+    const size_t ext_len = strlen(extension);
+    return name_len > ext_len && strcmp(name + name_len - ext_len, extension) == 0;
+}
+
+static int compare_paths(const void *a, const void *b)
+{
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+/**
+ * @brief Every file with the right extension, in name order
+ */
+static bool list_directory(const char *dir, const char *extension, path_list_t *list)
+{
+    DIR *handle = opendir(dir);
+    if (!handle)
+    {
+        log_error("Failed to open directory: %s", dir);
+        return false;
+    }
+
+    bool ok = true;
+    const struct dirent *entry;
+    while (ok && (entry = readdir(handle)) != NULL)
+    {
+        if (entry->d_name[0] != '.' && has_extension(entry->d_name, extension))
+            ok = path_list_add(list, dir, entry->d_name);
+    }
+    closedir(handle);
+
+    if (ok && list->count > 1)
+        qsort(list->paths, list->count, sizeof(char *), compare_paths);
+    return ok;
+}
+
+/**
+ * @brief One path per line; blank lines and # comments are skipped
+ */
+static bool list_lines(FILE *file, path_list_t *list)
+{
+    char *line = NULL;
+    size_t capacity = 0;
+    ssize_t length;
+    bool ok = true;
+
+    while (ok && (length = getline(&line, &capacity, file)) >= 0)
+    {
+        while (length > 0 && (line[length - 1] == '\n' || line[length - 1] == '\r'))
+        {
+            line[--length] = '\0';
+        }
+        if (length > 0 && line[0] != '#')
+            ok = path_list_add(list, NULL, line);
+    }
+    free(line);
+    return ok;
+}
+
+static bool collect_inputs(const char *source, const char *extension, path_list_t *list)
+{
+    if (strcmp(source, "-") == 0)
+        return list_lines(stdin, list);
+
+    struct stat info;
+    if (stat(source, &info) != 0)
+    {
+        log_error("Batch source not found: %s", source);
+        return false;
+    }
+    if (S_ISDIR(info.st_mode))
+        return list_directory(source, extension, list);
+
+    FILE *file = fopen(source, "r");
+    if (!file)
+    {
+        log_error("Failed to open file list: %s", source);
+        return false;
+    }
+    const bool ok = list_lines(file, list);
+    fclose(file);
+    return ok;
+}
+
+/**
+ * @brief Output path: same name with the other extension, in dir or beside the input
+ */
+static char *output_path(const char *input, const char *dir, const char *extension)
+{
+    const char *slash = strrchr(input, '/');
+    const char *name = slash ? slash + 1 : input;
+    const char *dot = strrchr(name, '.');
+    const size_t stem = dot && dot != name ? (size_t)(dot - name) : strlen(name);
+
+    // Without an output directory, keep the input's own
+    const char *prefix = dir ? dir : input;
+    const size_t prefix_len = dir ? strlen(dir) : (size_t)(name - input);
+    const char *separator = dir && prefix_len > 0 && dir[prefix_len - 1] != '/' ? "/" : "";
+
+    const size_t length = prefix_len + strlen(separator) + stem + strlen(extension) + 1;
+    char *path = malloc(length);
+    if (path)
+    {
+        snprintf(path, length, "%.*s%s%.*s%s", (int)prefix_len, prefix, separator,
+                 (int)stem, name, extension);
+    }
+    return path;
+}
+
+static uint64_t file_size(const char *path)
+{
+    struct stat info;
+    return stat(path, &info) == 0 && info.st_size > 0 ? (uint64_t)info.st_size : 0;
+}
+
+/**
+ * @brief Reads a whole file into memory
+ */
+static codec_status_t read_whole_file(const char *path, uint8_t **data, size_t *size)
+{
+    FILE *file = fopen(path, "rb");
+    if (!file)
+        return CODEC_ERROR_FILE_IO;
+
+    codec_status_t status = CODEC_SUCCESS;
+    struct stat info;
+    if (fstat(fileno(file), &info) != 0 || info.st_size <= 0)
+    {
+        status = CODEC_ERROR_FORMAT;
+    }
+    else
+    {
+        *size = (size_t)info.st_size;
+        *data = malloc(*size);
+        if (!*data)
+            status = CODEC_ERROR_MEMORY;
+        else if (fread(*data, 1, *size, file) != *size)
+            status = CODEC_ERROR_FILE_IO;
+    }
+
+    fclose(file);
+    if (status != CODEC_SUCCESS)
+    {
+        free(*data);
+        *data = NULL;
+        *size = 0;
+    }
+    return status;
+}
+
+/**
+ * @brief Everything slow about getting a file in, done on the reader thread
+ */
+static void load_job(batch_job_t *job)
+{
+    job->input_bytes = file_size(job->input);
+
+    if (!job->batch->config->compress)
+    {
+        job->status = read_whole_file(job->input, &job->data, &job->data_size);
+        return;
+    }
+
+    const pgm_status_t status = pgm_read(job->input, &job->pgm);
+    if (status != PGM_SUCCESS)
+    {
+        job->status = status == PGM_ERROR_FILE     ? CODEC_ERROR_FILE_IO
+                      : status == PGM_ERROR_MEMORY ? CODEC_ERROR_MEMORY
+                                                   : CODEC_ERROR_FORMAT;
+        return;
+    }
+
+    // Fault the mapping in now so the worker never waits on the disk
+    const size_t pixels = (size_t)job->pgm.size * job->pgm.size;
+    const volatile uint8_t *bytes = job->pgm.pixels;
+    for (size_t i = 0; i < pixels; i += BATCH_PAGE_SIZE)
+    {
+        (void)bytes[i];
+    }
+}
+
+static void release_job(batch_job_t *job)
+{
+    pgm_free(&job->pgm);
+    free(job->data);
+    job->data = NULL;
+    job->data_size = 0;
+}
+
+static codec_status_t decompress_job(const config_t *config, batch_job_t *job)
+{
+    FILE *input = fmemopen(job->data, job->data_size, "rb");
+    if (!input)
+        return CODEC_ERROR_MEMORY;
+
+    const codec_status_t status =
+        codec_decompress_file(config, input, config->stats_file ? &job->stats : NULL);
+    fclose(input);
+    return status;
+}
+
+static void run_job(void *arg)
+{
+    batch_job_t *job = arg;
+    batch_t *batch = job->batch;
+
+    logger_mute_thread(true);
+
+    if (job->status == CODEC_SUCCESS)
+    {
+        config_t config = *batch->config;
+        config.input_file = job->input;
+        config.output_file = batch->archive ? config.archive_file : job->output;
+        config.threads = 1;
+        config.batch_source = NULL;
+
+        if (batch->archive)
+        {
+            qtree_t *tree = &batch->trees[thread_pool_worker_index(batch->pool)];
+            job->status = codec_compress_to_archive(&config, &job->pgm, tree, batch->archive,
+                                                    config.stats_file ? &job->stats : NULL);
+        }
+        else if (config.compress)
+        {
+            qtree_t *tree = &batch->trees[thread_pool_worker_index(batch->pool)];
+            job->status = codec_compress_image(&config, &job->pgm, tree,
+                                               config.stats_file ? &job->stats : NULL);
+        }
+        else
+        {
+            job->status = decompress_job(&config, job);
+        }
+
+        // Archived files have no output of their own, the archive is counted at the end
+        if (job->status == CODEC_SUCCESS && job->output)
+            job->output_bytes = file_size(job->output);
+    }
+    else
+    {
+        // Never got to the codec, but still gets its line
+        qtc_stats_init(&job->stats, batch->config->compress ? "compress" : "decompress");
+        job->stats.input = job->input;
+        job->stats.output = batch->archive ? batch->config->archive_file : job->output;
+    }
+
+    // The codec only saw memory; the file and its loading happened on the reader
+    job->stats.bytes_in = job->input_bytes;
+    job->stats.stage_seconds[QTC_STAGE_READ] += job->read_seconds;
+    job->stats.total_seconds += job->read_seconds;
+
+    release_job(job);
+
+    pthread_mutex_lock(&batch->lock);
+    batch->in_flight--;
+    pthread_cond_signal(&batch->slot_free);
+    pthread_mutex_unlock(&batch->lock);
+}
+
+/**
+ * @brief Reader loop: load, wait for room, hand to the pool
+ */
+static void run_batch(batch_t *batch)
+{
+    thread_pool_seat_t seat;
+    thread_pool_enter(batch->pool, &seat);
+    thread_pool_group_t group;
+    thread_pool_group_init(&group);
+
+    for (size_t i = 0; i < batch->n_jobs; i++)
+    {
+        pthread_mutex_lock(&batch->lock);
+        while (batch->in_flight >= batch->max_in_flight)
+        {
+            pthread_cond_wait(&batch->slot_free, &batch->lock);
+        }
+        batch->in_flight++;
+        pthread_mutex_unlock(&batch->lock);
+
+        const double read_start = wall_seconds();
+        load_job(&batch->jobs[i]);
+        batch->jobs[i].read_seconds = wall_seconds() - read_start;
+        thread_pool_submit(batch->pool, &group, run_job, &batch->jobs[i]);
+    }
+
+    // Lend a hand with whatever is left
+    thread_pool_wait(batch->pool, &group);
+    thread_pool_leave(batch->pool, &seat);
+    logger_mute_thread(false);
+}
+
+static void log_report(const batch_t *batch, const codec_batch_report_t *report)
+{
+    for (size_t i = 0; i < batch->n_jobs; i++)
+    {
+        if (batch->jobs[i].status != CODEC_SUCCESS)
+        {
+            log_error("%s: %s", batch->jobs[i].input,
+                      codec_status_string(batch->jobs[i].status));
+        }
+    }
+
+    const double in_mb = (double)report->input_bytes / (1024.0 * 1024.0);
+    const double out_mb = (double)report->output_bytes / (1024.0 * 1024.0);
+    const double seconds = report->seconds > 0.0 ? report->seconds : 1e-9;
+
+    log_subheader("Batch Summary");
+    log_item("Files", "%zu done, %zu failed", report->files - report->failed, report->failed);
+    log_item("Input", "%.2f MB", in_mb);
+    log_item("Output", "%.2f MB (%.2f%% of input)", out_mb,
+             report->input_bytes ? 100.0 * out_mb / in_mb : 0.0);
+    log_item("Workers", "%u", thread_pool_size(batch->pool) - 1);
+    log_item("Wall time", "%.3f seconds", report->seconds);
+    log_item("Throughput", "%.1f files/sec, %.2f MB/sec",
+             (double)report->files / seconds, in_mb / seconds);
+}
+
+/**
+ * @brief Codes one frame of a sequence, starting it on the first
+ */
+static codec_status_t encode_frame(const config_t *config, qtree_sequence_encoder_t *encoder,
+                                   FILE *output, const char *path, size_t *changed)
+{
+    pgm_t pgm = {0};
+    const pgm_status_t read_status = pgm_read(path, &pgm);
+    if (read_status != PGM_SUCCESS)
+    {
+        log_error("Failed to read frame: %s", path);
+        return read_status == PGM_ERROR_MEMORY ? CODEC_ERROR_MEMORY : CODEC_ERROR_FILE_IO;
+    }
+
+    qtree_status_t status = QTREE_SUCCESS;
+    if (encoder->frames == 0 && !encoder->file)
+    {
+        status = qtree_sequence_encoder_init(encoder, output, pgm.size, config->sequence_block,
+                                             config->format);
+    }
+    else if (pgm.size != encoder->size)
+    {
+        log_error("%s is %ux%u, the sequence is %ux%u", path, pgm.size, pgm.size,
+                  encoder->size, encoder->size);
+        status = QTREE_ERROR_INVALID_PARAM;
+    }
+    if (status == QTREE_SUCCESS)
+        status = qtree_sequence_encode_frame(encoder, pgm.pixels, changed);
+
+    pgm_free(&pgm);
+    return codec_status_from_qtree(status);
+}
+
+/**
+ * @brief Sequence mode: every input is a frame of one file, in list order
+ *
+ * Each frame is coded against the one before, so there is nothing to
+ * hand out: frames are read and coded in turn on this thread.
+ */
+static codec_status_t encode_sequence(const config_t *config, const path_list_t *inputs,
+                                      codec_batch_report_t *totals)
+{
+    FILE *output = fopen(config->output_file, "wb");
+    if (!output)
+    {
+        log_error("Failed to open output file: %s", config->output_file);
+        return CODEC_ERROR_FILE_IO;
+    }
+
+    log_info("Coding %zu frames into %s...", inputs->count, config->output_file);
+    qtree_sequence_encoder_t encoder = {0};
+    codec_status_t status = CODEC_SUCCESS;
+    for (size_t i = 0; i < inputs->count && status == CODEC_SUCCESS; i++)
+    {
+        size_t changed = 0;
+        totals->input_bytes += file_size(inputs->paths[i]);
+        status = encode_frame(config, &encoder, output, inputs->paths[i], &changed);
+        if (status == CODEC_SUCCESS)
+            totals->files++;
+    }
+
+    if (fclose(output) != 0 && status == CODEC_SUCCESS)
+    {
+        log_error("Failed to write %s", config->output_file);
+        status = CODEC_ERROR_FILE_IO;
+    }
+    totals->output_bytes = encoder.bytes;
+    totals->failed = inputs->count - totals->files;
+
+    const size_t blocks = (size_t)encoder.blocks_per_side * encoder.blocks_per_side;
+    const double in_mb = (double)totals->input_bytes / (1024.0 * 1024.0);
+    const double out_mb = (double)totals->output_bytes / (1024.0 * 1024.0);
+    log_subheader("Sequence Summary");
+    log_item("Frames", "%zu done, %zu failed", totals->files, totals->failed);
+    log_item("Blocks", "%zu coded of %zu (%.2f%%)", encoder.blocks_coded,
+             blocks * encoder.frames,
+             encoder.frames ? 100.0 * (double)encoder.blocks_coded /
+                                  (double)(blocks * encoder.frames)
+                            : 0.0);
+    log_item("Output", "%.2f MB (%.2f%% of input)", out_mb,
+             totals->input_bytes ? 100.0 * out_mb / in_mb : 0.0);
+
+    qtree_sequence_encoder_free(&encoder);
+    return status;
+}
+
+/**
+ * @brief Writes the index of an --archive batch and closes the file
+ *
+ * Only files that made it are in the index; a failed one just leaves
+ * its id out.
+ */
+static codec_status_t finish_archive(const config_t *config, qtree_archive_builder_t *archive,
+                                     FILE **file)
+{
+    codec_status_t status = codec_status_from_qtree(qtree_archive_builder_finish(archive));
+    if (fclose(*file) != 0 && status == CODEC_SUCCESS)
+        status = CODEC_ERROR_FILE_IO;
+    *file = NULL;
+
+    if (status != CODEC_SUCCESS)
+        log_error("Failed to write %s", config->archive_file);
+    else
+        log_item("Archive", "%zu images in %s", archive->count, config->archive_file);
+    return status;
+}
+
+codec_status_t codec_batch(const config_t *config, codec_batch_report_t *report)
+{
+    if (!config || !config->batch_source)
+    {
+        log_error("Invalid batch parameters");
+        return CODEC_ERROR_INVALID_PARAM;
+    }
+
+    const char *in_ext = config->compress ? ".pgm" : ".qtc";
+    const char *out_ext = config->compress ? ".qtc" : ".pgm";
+    const char *out_dir = config->output_file;
+    codec_batch_report_t totals = {0};
+    codec_status_t status = CODEC_SUCCESS;
+    path_list_t inputs = {0};
+    batch_t batch = {.config = config};
+    bool sync_ready = false;
+    qtree_archive_builder_t archive = {0};
+    FILE *archive_file = NULL;
+
+    const double start = wall_seconds();
+
+    if (!collect_inputs(config->batch_source, in_ext, &inputs))
+    {
+        status = CODEC_ERROR_FILE_IO;
+        goto cleanup;
+    }
+    if (inputs.count == 0)
+    {
+        log_warn("No input files in %s", config->batch_source);
+        goto cleanup;
+    }
+
+    if (config->sequence_block > 0)
+    {
+        status = encode_sequence(config, &inputs, &totals);
+        totals.seconds = wall_seconds() - start;
+        log_item("Wall time", "%.3f seconds", totals.seconds);
+        goto cleanup;
+    }
+
+    if (out_dir && mkdir(out_dir, 0777) != 0 && errno != EEXIST)
+    {
+        log_error("Failed to create output directory: %s", out_dir);
+        status = CODEC_ERROR_FILE_IO;
+        goto cleanup;
+    }
+
+    batch.jobs = calloc(inputs.count, sizeof(batch_job_t));
+    if (!batch.jobs)
+    {
+        status = CODEC_ERROR_MEMORY;
+        goto cleanup;
+    }
+    for (size_t i = 0; i < inputs.count; i++)
+    {
+        batch_job_t *job = &batch.jobs[i];
+        job->batch = &batch;
+        job->input = inputs.paths[i];
+        inputs.paths[i] = NULL;
+        batch.n_jobs++;
+        if (config->archive_file)
+            continue;
+
+        job->output = output_path(job->input, out_dir, out_ext);
+        if (!job->output)
+        {
+            status = CODEC_ERROR_MEMORY;
+            goto cleanup;
+        }
+    }
+
+    // The caller is worker 0 and does the reading; the rest encode
+    const uint32_t workers = config->threads ? config->threads : thread_pool_default_threads();
+    batch.pool = thread_pool_create(workers + 1);
+    batch.trees = calloc((size_t)workers + 1, sizeof(qtree_t));
+    batch.n_trees = batch.trees ? (size_t)workers + 1 : 0;
+    if (!batch.pool || !batch.trees)
+    {
+        log_error("Failed to start %u batch workers", workers);
+        status = CODEC_ERROR_MEMORY;
+        goto cleanup;
+    }
+
+    if (config->archive_file)
+    {
+        archive_file = fopen(config->archive_file, "wb");
+        if (!archive_file)
+        {
+            log_error("Failed to open output file: %s", config->archive_file);
+            status = CODEC_ERROR_FILE_IO;
+            goto cleanup;
+        }
+        if (qtree_archive_builder_init(&archive, archive_file, config->format) != QTREE_SUCCESS)
+        {
+            status = CODEC_ERROR_FILE_IO;
+            goto cleanup;
+        }
+        batch.archive = &archive;
+    }
+
+    pthread_mutex_init(&batch.lock, NULL);
+    pthread_cond_init(&batch.slot_free, NULL);
+    sync_ready = true;
+    batch.max_in_flight = (size_t)workers * (1 + BATCH_READ_AHEAD);
+
+    log_info("Processing %zu files on %u workers...", batch.n_jobs, workers);
+    run_batch(&batch);
+
+    totals.files = batch.n_jobs;
+    for (size_t i = 0; i < batch.n_jobs; i++)
+    {
+        const batch_job_t *job = &batch.jobs[i];
+        totals.input_bytes += job->input_bytes;
+        totals.output_bytes += job->output_bytes;
+        if (job->status != CODEC_SUCCESS)
+        {
+            if (totals.failed++ == 0)
+                status = job->status;
+        }
+    }
+    if (batch.archive)
+    {
+        const codec_status_t archive_status = finish_archive(config, &archive, &archive_file);
+        if (status == CODEC_SUCCESS)
+            status = archive_status;
+        totals.output_bytes = archive.bytes;
+    }
+    totals.seconds = wall_seconds() - start;
+    log_report(&batch, &totals);
+
+    // In input order, whatever order the workers finished in
+    for (size_t i = 0; config->stats_file && i < batch.n_jobs; i++)
+    {
+        if (!qtc_stats_append_json(&batch.jobs[i].stats, config->stats_file))
+        {
+            log_error("Failed to write stats to %s", config->stats_file);
+            if (status == CODEC_SUCCESS)
+                status = CODEC_ERROR_FILE_IO;
+            break;
+        }
+    }
+
+cleanup:
+    if (sync_ready)
+    {
+        pthread_cond_destroy(&batch.slot_free);
+        pthread_mutex_destroy(&batch.lock);
+    }
+    for (size_t i = 0; i < batch.n_trees; i++)
+    {
+        qtree_free(&batch.trees[i]);
+    }
+    free(batch.trees);
+    thread_pool_destroy(batch.pool);
+    qtree_archive_builder_free(&archive);
+    if (archive_file)
+        fclose(archive_file);
+    for (size_t i = 0; i < batch.n_jobs; i++)
+    {
+        free(batch.jobs[i].input);
+        free(batch.jobs[i].output);
+    }
+    free(batch.jobs);
+    path_list_free(&inputs);
+
+    if (report)
+        *report = totals;
+    return status;
+}
@@ -0,0 +1,126 @@
+/**
+ * @file bit_reader.c
+ * @brief Refill path of the block-buffered bit reader
+ */
+
+#include "codec/bit_reader.h"
+
+#include <stdlib.h>
+#include <sys/stat.h>
+
+/**
+ * @brief Big regular files and anything stream-like get a read-ahead thread
+ *
+ * Memory streams (no descriptor) and small files are read in place.
+ */
+static bool worth_reading_ahead(FILE *file)
+{
+    const int fd = fileno(file);
+    struct stat info;
+    if (fd < 0 || fstat(fd, &info) != 0)
+        return false;
+
+    if (S_ISFIFO(info.st_mode) || S_ISSOCK(info.st_mode))
+        return true;
+
+    const off_t position = ftello(file);
+    return S_ISREG(info.st_mode) && position >= 0 &&
+           info.st_size - position >= (off_t)BIT_READER_PREFETCH_MIN;
+}
+
+bool bit_reader_open_file(qtree_bit_reader_t *reader, FILE *file, bool read_ahead)
+{
+    *reader = (qtree_bit_reader_t){0};
+    reader->file = file;
+
+    // Falls back to reading in place if the thread can't be started
+    if (read_ahead && worth_reading_ahead(file))
+    {
+        reader->ahead = async_reader_start(file);
+        if (reader->ahead)
+            return true;
+    }
+
+    reader->block = malloc(BIT_READER_BLOCK_SIZE);
+    if (!reader->block)
+    {
+        reader->has_error = true;
+        reader->error_msg = "Memory allocation failed for the read buffer";
+        return false;
+    }
+    reader->data = reader->block;
+    return true;
+}
+
+void bit_reader_open_memory(qtree_bit_reader_t *reader, const uint8_t *data, size_t size)
+{
+    *reader = (qtree_bit_reader_t){0};
+    reader->data = data;
+    reader->data_len = size;
+}
+
+void bit_reader_close(qtree_bit_reader_t *reader)
+{
+    async_reader_stop(reader->ahead);
+    reader->ahead = NULL;
+    free(reader->block);
+    reader->block = NULL;
+    reader->data = NULL;
+    reader->data_len = 0;
+    reader->data_pos = 0;
+}
+
+/**
+ * @brief Pull the next block from the file
+ * @return False if there is nothing more to read
+ */
+static bool load_block(qtree_bit_reader_t *reader)
+{
+    if (!reader->file)
+        return false;
+
+    if (reader->ahead)
+    {
+        reader->data_len = async_reader_next(reader->ahead, &reader->data);
+        reader->data_pos = 0;
+        if (reader->data_len == 0 && async_reader_failed(reader->ahead))
+        {
+            reader->error_msg = "Read error on compressed data";
+        }
+        return reader->data_len > 0;
+    }
+
+    reader->data_len = fread(reader->block, 1, BIT_READER_BLOCK_SIZE, reader->file);
+    reader->data_pos = 0;
+
+    if (reader->data_len == 0 && ferror(reader->file))
+    {
+        reader->error_msg = "Read error on compressed data";
+    }
+    return reader->data_len > 0;
+}
+
+bool bit_reader_refill(qtree_bit_reader_t *reader, uint32_t needed)
+{
+    if (reader->has_error)
+        return false;
+
+    while (reader->available <= 56)
+    {
+        if (reader->data_pos == reader->data_len && !load_block(reader))
+            break;
+
+        reader->window |= (uint64_t)reader->data[reader->data_pos++] << (56 - reader->available);
+        reader->available += 8;
+        reader->bytes_loaded++;
+    }
+
+    if (reader->available < needed)
+    {
+        reader->has_error = true;
+        if (!reader->error_msg)
+            reader->error_msg = "Unexpected end of file while reading bits";
+        return false;
+    }
+    return true;
+}
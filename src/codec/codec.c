@@ -1,9 +1,21 @@
+#include <errno.h>
 #include <stdio.h>
+#include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
 
+#include "codec/archive.h"
+#include "codec/band_compression.h"
 #include "codec/codec.h"
 #include "codec/compression.h"
 #include "codec/decompression.h"
+#include "codec/metrics.h"
+#include "codec/sequence.h"
+#include "codec/tiled.h"
+#include "codec/stats.h"
+#include "common/common.h"
+#include "common/thread_pool.h"
 #include "core/quadtree.h"
 #include "io/pgm.h"
 #include "logger/logger.h"
@@ -27,7 +39,7 @@ const char *codec_status_string(codec_status_t status)
 }
 
 /* Convert internal error codes to codec status */
-static codec_status_t convert_qtree_status(qtree_status_t status)
+codec_status_t codec_status_from_qtree(qtree_status_t status)
 {
     switch (status)
     {
@@ -65,7 +77,708 @@ static codec_status_t convert_pgm_status(pgm_status_t status)
     }
 }
 
-codec_status_t codec_compress(const config_t *config)
+/**
+ * @brief Says what the filter cost and keeps it in the stats
+ */
+static void report_distortion(const config_t *config, double mse, double estimated_mse,
+                              qtc_stats_t *stats)
+{
+    const double psnr = qtree_psnr_from_mse(mse);
+    log_item("PSNR", "%.2f dB (MSE %.4f)", psnr, mse);
+    log_item("Variance estimate", "%.2f dB", qtree_psnr_from_mse(estimated_mse));
+    if (config->target_psnr > 0.0 && psnr < config->target_psnr)
+        log_warn("Measured PSNR is below the %.2f dB target", config->target_psnr);
+    qtc_stats_set_distortion(stats, mse, estimated_mse);
+}
+
+/**
+ * @brief Measures what the filter cost straight on the source pixels
+ */
+static void log_distortion(const config_t *config, const qtree_t *tree, const uint8_t *pixels,
+                           qtc_stats_t *stats)
+{
+    qtree_distortion_t distortion;
+    if (qtree_measure_distortion(tree, pixels, &distortion) == QTREE_SUCCESS)
+        report_distortion(config, distortion.mse, distortion.estimated_mse, stats);
+}
+
+/**
+ * @brief Build, filter and encode using the flat array layout
+ */
+static codec_status_t compress_array_layout(const config_t *config, const pgm_t *pgm,
+                                            qtc_stats_t *stats)
+{
+    qtree_array_t tree = {0};
+    FILE *output = NULL;
+    codec_status_t status = CODEC_SUCCESS;
+
+    const double build_start = wall_seconds();
+    qtree_status_t op_status = qtree_array_init(&tree, pgm->size);
+    if (op_status != QTREE_SUCCESS)
+    {
+        log_error("Failed to initialize quadtree");
+        return codec_status_from_qtree(op_status);
+    }
+
+    op_status = qtree_array_build(&tree, pgm->pixels, pgm->size, config->input_file);
+    qtc_stats_stage(stats, QTC_STAGE_BUILD, build_start);
+    if (op_status != QTREE_SUCCESS)
+    {
+        log_error("Failed to build quadtree");
+        status = codec_status_from_qtree(op_status);
+        goto cleanup;
+    }
+
+    if (config->alpha > 1.0f)
+    {
+        const double filter_start = wall_seconds();
+        op_status = apply_lossy_compression_array(&tree, config->alpha);
+        if (op_status != QTREE_SUCCESS)
+        {
+            qtc_stats_stage(stats, QTC_STAGE_FILTER, filter_start);
+            log_error("Failed to apply lossy compression");
+            status = codec_status_from_qtree(op_status);
+            goto cleanup;
+        }
+
+        qtree_distortion_t distortion;
+        if (qtree_measure_array_distortion(&tree, pgm->pixels, &distortion) == QTREE_SUCCESS)
+            report_distortion(config, distortion.mse, distortion.estimated_mse, stats);
+        qtc_stats_stage(stats, QTC_STAGE_FILTER, filter_start);
+    }
+
+    output = fopen(config->output_file, "wb");
+    if (!output)
+    {
+        log_error("Failed to open output file: %s", config->output_file);
+        status = CODEC_ERROR_FILE_IO;
+        goto cleanup;
+    }
+
+    op_status = compress_array_with_stats(&tree, config->format, config->output_file, output,
+                                          stats);
+    if (op_status != QTREE_SUCCESS)
+    {
+        log_error("Failed to compress data");
+        status = codec_status_from_qtree(op_status);
+        goto cleanup;
+    }
+    qtc_stats_count_array(stats, &tree);
+
+    if (config->generate_grid)
+    {
+        const double grid_start = wall_seconds();
+        qtree_array_generate_grid(&tree, config->grid_file);
+        qtc_stats_stage(stats, QTC_STAGE_GRID, grid_start);
+    }
+
+cleanup:
+    if (output)
+    {
+        fclose(output);
+    }
+    qtree_array_free(&tree);
+    return status;
+}
+
+/**
+ * @brief Decode into the flat array layout and write the image
+ */
+static codec_status_t decompress_array_layout(const config_t *config, FILE *input,
+                                              qtc_stats_t *stats)
+{
+    qtree_array_t tree = {0};
+    pgm_t pgm = {0};
+    codec_status_t status = CODEC_SUCCESS;
+
+    const double decode_start = wall_seconds();
+    qtree_status_t op_status =
+        qtree_decompress_array_with_stats(input, config->input_file, &tree, stats);
+    qtc_stats_stage(stats, QTC_STAGE_DECODE, decode_start);
+    if (op_status != QTREE_SUCCESS)
+    {
+        log_error("Failed to read compressed data");
+        return codec_status_from_qtree(op_status);
+    }
+
+    const double render_start = wall_seconds();
+    op_status = qtree_array_to_pgm(&tree, config->output_file, &pgm);
+    qtc_stats_stage(stats, QTC_STAGE_RENDER, render_start);
+    if (op_status != QTREE_SUCCESS)
+    {
+        log_error("Failed to convert to PGM format");
+        status = codec_status_from_qtree(op_status);
+        goto cleanup;
+    }
+
+    const double write_start = wall_seconds();
+    pgm_status_t write_status = pgm_write(&pgm, config->output_file);
+    qtc_stats_stage(stats, QTC_STAGE_WRITE, write_start);
+    if (write_status != PGM_SUCCESS)
+    {
+        log_error("Failed to write PGM file");
+        status = convert_pgm_status(write_status);
+        goto cleanup;
+    }
+
+    if (config->generate_grid)
+    {
+        const double grid_start = wall_seconds();
+        qtree_array_generate_grid(&tree, config->grid_file);
+        qtc_stats_stage(stats, QTC_STAGE_GRID, grid_start);
+    }
+
+cleanup:
+    pgm_free(&pgm);
+    qtree_array_free(&tree);
+    return status;
+}
+
+/**
+ * @brief Decode into the succinct layout and write the image
+ */
+static codec_status_t decompress_succinct_layout(const config_t *config, FILE *input,
+                                                 qtc_stats_t *stats)
+{
+    qtree_succinct_t tree = {0};
+    pgm_t pgm = {0};
+    codec_status_t status = CODEC_SUCCESS;
+
+    const double decode_start = wall_seconds();
+    qtree_status_t op_status =
+        qtree_decompress_succinct_with_stats(input, config->input_file, &tree, stats);
+    qtc_stats_stage(stats, QTC_STAGE_DECODE, decode_start);
+    if (op_status != QTREE_SUCCESS)
+    {
+        log_error("Failed to read compressed data");
+        return codec_status_from_qtree(op_status);
+    }
+
+    const double render_start = wall_seconds();
+    op_status = qtree_succinct_to_pgm(&tree, config->output_file, &pgm);
+    qtc_stats_stage(stats, QTC_STAGE_RENDER, render_start);
+    if (op_status != QTREE_SUCCESS)
+    {
+        log_error("Failed to convert to PGM format");
+        status = codec_status_from_qtree(op_status);
+        goto cleanup;
+    }
+
+    const double write_start = wall_seconds();
+    pgm_status_t write_status = pgm_write(&pgm, config->output_file);
+    qtc_stats_stage(stats, QTC_STAGE_WRITE, write_start);
+    if (write_status != PGM_SUCCESS)
+    {
+        log_error("Failed to write PGM file");
+        status = convert_pgm_status(write_status);
+        goto cleanup;
+    }
+
+    if (config->generate_grid)
+    {
+        const double grid_start = wall_seconds();
+        qtree_succinct_generate_grid(&tree, config->grid_file);
+        qtc_stats_stage(stats, QTC_STAGE_GRID, grid_start);
+    }
+
+cleanup:
+    pgm_free(&pgm);
+    qtree_succinct_free(&tree);
+    return status;
+}
+
+/**
+ * @brief Pool for -t, or NULL when one thread was asked for
+ * @param failed Set if a pool was wanted but could not be started
+ */
+static thread_pool_t *start_pool(const config_t *config, bool *failed)
+{
+    *failed = false;
+    if (config->threads == 1)
+        return NULL;
+
+    thread_pool_t *pool = thread_pool_create(config->threads);
+    if (!pool)
+    {
+        log_error("Failed to start %u threads", config->threads);
+        *failed = true;
+    }
+    return pool;
+}
+
+/**
+ * @brief Encode tile by tile into a tiled container
+ */
+static codec_status_t compress_tiled_layout(const config_t *config, const pgm_t *pgm,
+                                            qtc_stats_t *stats)
+{
+    bool pool_failed = false;
+    thread_pool_t *pool = start_pool(config, &pool_failed);
+    if (pool_failed)
+        return CODEC_ERROR_MEMORY;
+
+    // Each tile is built, filtered and coded in one go, so it all counts as encoding
+    uint8_t *data = NULL;
+    size_t length = 0;
+    qtc_stats_t mine = {0};
+    qtc_stats_t *counted = stats ? stats : &mine;
+    const double encode_start = wall_seconds();
+    qtree_status_t op_status = qtree_tiled_encode_with_stats(
+        pgm->pixels, pgm->size, config->tile_size, config->format, config->alpha, pool, &data,
+        &length, counted);
+    qtc_stats_stage(stats, QTC_STAGE_ENCODE, encode_start);
+    if (pool)
+        thread_pool_destroy(pool);
+    if (op_status != QTREE_SUCCESS)
+    {
+        log_error("Failed to compress tiles");
+        return codec_status_from_qtree(op_status);
+    }
+    if (counted->measured)
+        report_distortion(config, counted->mse, counted->mse_estimate, stats);
+
+    codec_status_t status = CODEC_SUCCESS;
+    const double write_start = wall_seconds();
+    FILE *output = fopen(config->output_file, "wb");
+    if (!output)
+    {
+        log_error("Failed to open output file: %s", config->output_file);
+        status = CODEC_ERROR_FILE_IO;
+    }
+    else
+    {
+        if (fwrite(data, 1, length, output) != length)
+            status = CODEC_ERROR_FILE_IO;
+        if (fclose(output) != 0)
+            status = CODEC_ERROR_FILE_IO;
+        if (status != CODEC_SUCCESS)
+            log_error("Failed to write compressed data");
+    }
+    qtc_stats_stage(stats, QTC_STAGE_WRITE, write_start);
+
+    if (status == CODEC_SUCCESS)
+        log_item("Written", "%.2f KB", (double)length / 1024.0);
+    free(data);
+    return status;
+}
+
+/**
+ * @brief Reads what is left of a stream into memory
+ * @return False if reading failed or memory ran out
+ */
+static bool read_remaining(FILE *input, uint8_t **data, size_t *length)
+{
+    size_t capacity = 1u << 16;
+    size_t used = 0;
+    uint8_t *buffer = malloc(capacity);
+
+    while (buffer)
+    {
+        used += fread(buffer + used, 1, capacity - used, input);
+        if (used < capacity)
+            break;
+
+        uint8_t *grown = realloc(buffer, capacity * 2);
+        if (!grown)
+        {
+            free(buffer);
+            buffer = NULL;
+            break;
+        }
+        buffer = grown;
+        capacity *= 2;
+    }
+
+    if (!buffer || ferror(input))
+    {
+        free(buffer);
+        return false;
+    }
+    *data = buffer;
+    *length = used;
+    return true;
+}
+
+/**
+ * @brief Decode a tiled container, whole or just the --region square
+ */
+static codec_status_t decompress_tiled_layout(const config_t *config, FILE *input,
+                                              qtc_stats_t *stats)
+{
+    if (config->generate_grid || config->layout != TREE_LAYOUT_POINTER ||
+        config->preview_level >= 0 || config->preview_upscale)
+    {
+        log_error("Tiled files only decode to an image (no -g, -m, -l or -p)");
+        return CODEC_ERROR_INVALID_PARAM;
+    }
+
+    uint8_t *data = NULL;
+    size_t length = 0;
+    const double read_start = wall_seconds();
+    if (!read_remaining(input, &data, &length))
+    {
+        log_error("Failed to read compressed data");
+        return CODEC_ERROR_FILE_IO;
+    }
+    qtc_stats_stage(stats, QTC_STAGE_READ, read_start);
+    if (stats)
+        stats->bytes_in = length;
+
+    codec_status_t status = CODEC_SUCCESS;
+    thread_pool_t *pool = NULL;
+    pgm_t pgm = {0};
+    qtree_tiled_t tiled;
+
+    qtree_status_t op_status = qtree_tiled_open(data, length, &tiled);
+    if (op_status != QTREE_SUCCESS)
+    {
+        log_error("Failed to read compressed data");
+        status = codec_status_from_qtree(op_status);
+        goto cleanup;
+    }
+    log_item("Image", "%ux%u in %ux%u tiles (%s)", tiled.size, tiled.size, tiled.tile_size,
+             tiled.tile_size, tiled.format == QTREE_FORMAT_Q2 ? "Q2" : "Q1");
+
+    const uint32_t row = config->region ? config->region_row : 0;
+    const uint32_t col = config->region ? config->region_col : 0;
+    const uint32_t size = config->region ? config->region_size : tiled.size;
+    if (row >= tiled.size || col >= tiled.size || size > tiled.size - row ||
+        size > tiled.size - col)
+    {
+        log_error("Region %u,%u,%u is outside the %ux%u image", col, row, size,
+                  tiled.size, tiled.size);
+        status = CODEC_ERROR_INVALID_PARAM;
+        goto cleanup;
+    }
+
+    bool pool_failed = false;
+    pool = start_pool(config, &pool_failed);
+    pgm = (pgm_t){.size = size, .max_value = 255, .pixels = malloc((size_t)size * size)};
+    if (pool_failed || !pgm.pixels)
+    {
+        log_error("Memory allocation failed for the image");
+        status = CODEC_ERROR_MEMORY;
+        goto cleanup;
+    }
+
+    const double decode_start = wall_seconds();
+    op_status = qtree_tiled_decode_region_with_stats(&tiled, row, col, size, size, pool,
+                                                     pgm.pixels, stats);
+    qtc_stats_stage(stats, QTC_STAGE_DECODE, decode_start);
+    if (op_status != QTREE_SUCCESS)
+    {
+        log_error("Failed to read compressed data");
+        status = codec_status_from_qtree(op_status);
+        goto cleanup;
+    }
+
+    const double write_start = wall_seconds();
+    pgm_status_t write_status = pgm_write(&pgm, config->output_file);
+    qtc_stats_stage(stats, QTC_STAGE_WRITE, write_start);
+    if (write_status != PGM_SUCCESS)
+    {
+        log_error("Failed to write PGM file");
+        status = convert_pgm_status(write_status);
+        goto cleanup;
+    }
+
+    log_success("Decompression completed successfully");
+
+cleanup:
+    if (pool)
+        thread_pool_destroy(pool);
+    pgm_free(&pgm);
+    free(data);
+    return status;
+}
+
+/**
+ * @brief Decode a sequence into one PGM per frame, in the -o directory
+ */
+static codec_status_t decompress_sequence_layout(const config_t *config, FILE *input,
+                                                 qtc_stats_t *stats)
+{
+    if (config->generate_grid || config->layout != TREE_LAYOUT_POINTER ||
+        config->preview_level >= 0 || config->preview_upscale || config->region)
+    {
+        log_error("Sequences only decode to images (no -g, -m, -l, -p or --region)");
+        return CODEC_ERROR_INVALID_PARAM;
+    }
+
+    qtree_sequence_decoder_t decoder = {0};
+    qtree_status_t op_status = qtree_sequence_decoder_init(&decoder, input);
+    if (op_status != QTREE_SUCCESS)
+    {
+        log_error("Failed to read compressed data");
+        return codec_status_from_qtree(op_status);
+    }
+    log_item("Frames", "%ux%u in %ux%u blocks (%s)", decoder.size, decoder.size,
+             decoder.block_size, decoder.block_size,
+             decoder.format == QTREE_FORMAT_Q2 ? "Q2" : "Q1");
+    if (stats)
+    {
+        stats->size = decoder.size;
+        stats->n_levels = decoder.block_levels;
+        while ((1u << stats->n_levels) < decoder.size)
+            stats->n_levels++;
+    }
+
+    codec_status_t status = CODEC_SUCCESS;
+    if (mkdir(config->output_file, 0777) != 0 && errno != EEXIST)
+    {
+        log_error("Failed to create output directory: %s", config->output_file);
+        status = CODEC_ERROR_FILE_IO;
+    }
+
+    // Room for the directory, the separator and frame_<n>.pgm
+    const size_t path_size = strlen(config->output_file) + 32;
+    char *path = malloc(path_size);
+    if (!path && status == CODEC_SUCCESS)
+        status = CODEC_ERROR_MEMORY;
+
+    const pgm_t frame = {.size = decoder.size, .max_value = 255, .pixels = decoder.pixels};
+    while (status == CODEC_SUCCESS)
+    {
+        bool got = false;
+        const double decode_start = wall_seconds();
+        op_status = qtree_sequence_decode_frame_with_stats(&decoder, &got, stats);
+        qtc_stats_stage(stats, QTC_STAGE_DECODE, decode_start);
+        if (op_status != QTREE_SUCCESS)
+        {
+            log_error("Failed to read compressed data");
+            status = codec_status_from_qtree(op_status);
+            break;
+        }
+        if (!got)
+            break;
+
+        snprintf(path, path_size, "%s/frame_%06zu.pgm", config->output_file, decoder.frames - 1);
+        const double write_start = wall_seconds();
+        pgm_status_t write_status = pgm_write(&frame, path);
+        qtc_stats_stage(stats, QTC_STAGE_WRITE, write_start);
+        if (write_status != PGM_SUCCESS)
+        {
+            log_error("Failed to write PGM file: %s", path);
+            status = convert_pgm_status(write_status);
+        }
+    }
+
+    if (status == CODEC_SUCCESS)
+    {
+        log_item("Decoded", "%zu frames, %zu blocks", decoder.frames, decoder.blocks_decoded);
+        log_success("Decompression completed successfully");
+    }
+    free(path);
+    qtree_sequence_decoder_free(&decoder);
+    return status;
+}
+
+/**
+ * @brief Writes one archive image as a PGM
+ */
+static codec_status_t write_archive_entry(const qtree_archive_t *archive,
+                                          const qtree_archive_entry_t *entry, pgm_t *pgm,
+                                          const char *path, qtc_stats_t *stats)
+{
+    qtc_stats_t part = {0};
+    const double decode_start = wall_seconds();
+    const qtree_status_t op_status =
+        qtree_archive_decode_with_stats(archive, entry, pgm->pixels, stats ? &part : NULL);
+    qtc_stats_stage(stats, QTC_STAGE_DECODE, decode_start);
+    if (op_status != QTREE_SUCCESS)
+    {
+        log_error("Failed to decode image %llu", (unsigned long long)entry->id);
+        return codec_status_from_qtree(op_status);
+    }
+
+    // Images can differ in size; the line reports the biggest
+    qtc_stats_add_payload(stats, &part, 0);
+    if (stats && entry->size > stats->size)
+    {
+        stats->size = entry->size;
+        stats->n_levels = entry->n_levels;
+    }
+
+    pgm->size = entry->size;
+    const double write_start = wall_seconds();
+    const pgm_status_t write_status = pgm_write(pgm, path);
+    qtc_stats_stage(stats, QTC_STAGE_WRITE, write_start);
+    if (write_status != PGM_SUCCESS)
+    {
+        log_error("Failed to write PGM file: %s", path);
+        return convert_pgm_status(write_status);
+    }
+    return CODEC_SUCCESS;
+}
+
+/**
+ * @brief Decode an archive: the --entry image to -o, or every image into the -o directory
+ */
+static codec_status_t decompress_archive_layout(const config_t *config, FILE *input,
+                                                qtc_stats_t *stats)
+{
+    if (config->generate_grid || config->layout != TREE_LAYOUT_POINTER ||
+        config->preview_level >= 0 || config->preview_upscale || config->region)
+    {
+        log_error("Archives only decode to images (no -g, -m, -l, -p or --region)");
+        return CODEC_ERROR_INVALID_PARAM;
+    }
+
+    uint8_t *data = NULL;
+    size_t length = 0;
+    const double read_start = wall_seconds();
+    if (!read_remaining(input, &data, &length))
+    {
+        log_error("Failed to read compressed data");
+        return CODEC_ERROR_FILE_IO;
+    }
+    qtc_stats_stage(stats, QTC_STAGE_READ, read_start);
+    if (stats)
+        stats->bytes_in = length;
+
+    codec_status_t status = CODEC_SUCCESS;
+    char *path = NULL;
+    pgm_t pgm = {.max_value = 255};
+    qtree_archive_t archive;
+
+    qtree_status_t op_status = qtree_archive_open(data, length, &archive);
+    if (op_status != QTREE_SUCCESS)
+    {
+        log_error("Failed to read compressed data");
+        status = codec_status_from_qtree(op_status);
+        goto cleanup;
+    }
+    log_item("Archive", "%zu images (%s)", archive.count,
+             archive.format == QTREE_FORMAT_Q2 ? "Q2" : "Q1");
+
+    // One buffer fits them all
+    uint32_t largest = 0;
+    qtree_archive_entry_t entry;
+    for (size_t i = 0; qtree_archive_entry_at(&archive, i, &entry); i++)
+    {
+        if (entry.size > largest)
+            largest = entry.size;
+    }
+    pgm.pixels = malloc(largest ? (size_t)largest * largest : 1);
+    if (!pgm.pixels)
+    {
+        log_error("Memory allocation failed for the image");
+        status = CODEC_ERROR_MEMORY;
+        goto cleanup;
+    }
+
+    if (config->archive_entry)
+    {
+        const uint64_t id = qtree_archive_id(config->archive_entry);
+        if (!qtree_archive_find(&archive, id, &entry))
+        {
+            log_error("No image %s (id %llu) in the archive", config->archive_entry,
+                      (unsigned long long)id);
+            status = CODEC_ERROR_INVALID_PARAM;
+            goto cleanup;
+        }
+        status = write_archive_entry(&archive, &entry, &pgm, config->output_file, stats);
+        if (status == CODEC_SUCCESS)
+            log_success("Decompression completed successfully");
+        goto cleanup;
+    }
+
+    if (mkdir(config->output_file, 0777) != 0 && errno != EEXIST)
+    {
+        log_error("Failed to create output directory: %s", config->output_file);
+        status = CODEC_ERROR_FILE_IO;
+        goto cleanup;
+    }
+
+    // Room for the directory, the separator and <id>.pgm
+    const size_t path_size = strlen(config->output_file) + 32;
+    path = malloc(path_size);
+    if (!path)
+    {
+        status = CODEC_ERROR_MEMORY;
+        goto cleanup;
+    }
+
+    for (size_t i = 0; status == CODEC_SUCCESS && qtree_archive_entry_at(&archive, i, &entry);
+         i++)
+    {
+        snprintf(path, path_size, "%s/%llu.pgm", config->output_file,
+                 (unsigned long long)entry.id);
+        status = write_archive_entry(&archive, &entry, &pgm, path, stats);
+    }
+
+    if (status == CODEC_SUCCESS)
+    {
+        log_item("Decoded", "%zu images", archive.count);
+        log_success("Decompression completed successfully");
+    }
+
+cleanup:
+    free(path);
+    free(pgm.pixels);
+    free(data);
+    return status;
+}
+
+/**
+ * @brief Looks at the magic without using it up
+ * @param is_magic Tells the container from its first bytes
+ * @return True if the stream holds that container
+ */
+static bool input_matches(FILE *input, bool (*is_magic)(const uint8_t *, size_t))
+{
+    uint8_t magic[3];
+    const long start = ftell(input);
+    if (start < 0)
+        return false;
+
+    const size_t got = fread(magic, 1, sizeof(magic), input);
+    const bool matches = is_magic(magic, got);
+    if (fseek(input, start, SEEK_SET) != 0)
+        return false;
+    return matches;
+}
+
+/**
+ * @brief Size of a regular file, 0 if there is none (a sequence writes a directory)
+ */
+static uint64_t file_bytes(const char *path)
+{
+    struct stat info;
+    if (!path || stat(path, &info) != 0 || !S_ISREG(info.st_mode))
+        return 0;
+    return (uint64_t)info.st_size;
+}
+
+/**
+ * @brief Starts the stats of one codec call
+ */
+static void begin_stats(qtc_stats_t *stats, const char *operation, const config_t *config)
+{
+    if (!stats)
+        return;
+    qtc_stats_init(stats, operation);
+    stats->input = config->input_file;
+    stats->output = config->output_file;
+}
+
+/**
+ * @brief Closes the stats of one codec call: total time, outcome, output size
+ */
+static void end_stats(qtc_stats_t *stats, double start, codec_status_t status)
+{
+    if (!stats)
+        return;
+    stats->total_seconds = wall_seconds() - start;
+    stats->ok = status == CODEC_SUCCESS;
+    if (stats->ok)
+        stats->bytes_out = file_bytes(stats->output);
+}
+
+static codec_status_t compress_image(const config_t *config, const pgm_t *pgm, qtree_t *tree,
+                                     qtc_stats_t *stats);
+
+codec_status_t codec_compress(const config_t *config, qtc_stats_t *stats)
 {
     if (!config || !config->input_file || !config->output_file)
     {
@@ -75,57 +788,191 @@ codec_status_t codec_compress(const config_t *config)
 
     pgm_t pgm = {0};
     qtree_t tree = {0};
-    FILE *output = NULL;
-    codec_status_t status = CODEC_SUCCESS;
-    bool pgm_initialized = false;
-    bool tree_initialized = false;
-    qtree_status_t op_status;
+
+    const double start = wall_seconds();
+    begin_stats(stats, "compress", config);
 
     log_subheader("Compression Operation");
     log_item("Input", "%s", config->input_file);
     log_item("Output", "%s", config->output_file);
 
+    // Out-of-core: the image is only ever read one band at a time
+    if (config->banded)
+    {
+        FILE *output = fopen(config->output_file, "wb");
+        if (!output)
+        {
+            log_error("Failed to open output file: %s", config->output_file);
+            return CODEC_ERROR_FILE_IO;
+        }
+
+        // Reading, building and coding are interleaved band by band
+        qtree_status_t op_status = compress_banded_with_stats(
+            config->input_file, config->band_rows, config->output_file, output, stats);
+        if (fclose(output) != 0 && op_status == QTREE_SUCCESS)
+            op_status = QTREE_ERROR_FORMAT;
+        if (stats)
+            stats->bytes_in = file_bytes(config->input_file);
+        if (op_status != QTREE_SUCCESS)
+        {
+            log_error("Failed to compress data");
+            end_stats(stats, start, codec_status_from_qtree(op_status));
+            return codec_status_from_qtree(op_status);
+        }
+
+        log_success("Compression completed successfully");
+        end_stats(stats, start, CODEC_SUCCESS);
+        return CODEC_SUCCESS;
+    }
+
     // Read input PGM
+    const double read_start = wall_seconds();
     pgm_status_t pgm_result = pgm_read(config->input_file, &pgm);
+    qtc_stats_stage(stats, QTC_STAGE_READ, read_start);
     if (pgm_result != PGM_SUCCESS)
     {
         log_error("Failed to read PGM file");
-        status = convert_pgm_status(pgm_result);
-        goto cleanup;
+        end_stats(stats, start, convert_pgm_status(pgm_result));
+        return convert_pgm_status(pgm_result);
     }
-    pgm_initialized = true;
+    if (stats)
+        stats->bytes_in = file_bytes(config->input_file);
+
+    codec_status_t status = compress_image(config, &pgm, &tree, stats);
+
+    qtree_free(&tree);
+    pgm_free(&pgm);
+    end_stats(stats, start, status);
+    return status;
+}
+
+codec_status_t codec_compress_image(const config_t *config, const pgm_t *pgm, qtree_t *tree,
+                                    qtc_stats_t *stats)
+{
+    if (!config || !config->input_file || !config->output_file || !pgm || !pgm->pixels || !tree)
+    {
+        log_error("Invalid compression parameters");
+        return CODEC_ERROR_INVALID_PARAM;
+    }
+
+    const double start = wall_seconds();
+    begin_stats(stats, "compress", config);
+    if (stats)
+        stats->bytes_in = (uint64_t)pgm->size * pgm->size;
+
+    const codec_status_t status = compress_image(config, pgm, tree, stats);
+    end_stats(stats, start, status);
+    return status;
+}
 
-    // Create and initialize quadtree
-    op_status = qtree_init(&tree, pgm.size);
+/**
+ * @brief Builds the tree and runs the filter or rate control the config asks for
+ *
+ * Leaves tree->pool running when -t asked for one; the caller stops it.
+ */
+static codec_status_t build_and_filter(const config_t *config, const pgm_t *pgm, qtree_t *tree,
+                                       qtc_stats_t *stats)
+{
+    // Create and initialize quadtree (a used tree keeps its arena)
+    const double build_start = wall_seconds();
+    qtree_status_t op_status = qtree_init(tree, pgm->size);
     if (op_status != QTREE_SUCCESS)
     {
         log_error("Failed to initialize quadtree");
-        status = convert_qtree_status(op_status);
-        goto cleanup;
+        return codec_status_from_qtree(op_status);
     }
-    tree_initialized = true;
+
+    // Build, filter and grid all run on one pool when there is more than one thread
+    bool pool_failed = false;
+    tree->pool = start_pool(config, &pool_failed);
+    if (pool_failed)
+        return CODEC_ERROR_MEMORY;
 
     // Build quadtree from image data
-    op_status = qtree_build(&tree, pgm.pixels, pgm.size, config->input_file);
+    op_status = qtree_build_with(tree, pgm->pixels, pgm->size, config->input_file,
+                                 config->build_mode, config->threads);
+    qtc_stats_stage(stats, QTC_STAGE_BUILD, build_start);
     if (op_status != QTREE_SUCCESS)
     {
         log_error("Failed to build quadtree");
-        status = convert_qtree_status(op_status);
-        goto cleanup;
+        return codec_status_from_qtree(op_status);
     }
 
+    // A size or quality target picks alpha by itself
+    const double filter_start = wall_seconds();
+    if (config->target_bytes > 0 || config->target_psnr > 0.0)
+    {
+        const qtree_rate_target_t target = config->target_bytes > 0
+            ? (qtree_rate_target_t){RATE_TARGET_BYTES, (double)config->target_bytes,
+                                    config->format}
+            : (qtree_rate_target_t){RATE_TARGET_PSNR, config->target_psnr, config->format};
+
+        op_status = apply_lossy_compression_target(tree, &target, NULL);
+        if (op_status != QTREE_SUCCESS)
+        {
+            log_error("Failed to apply rate control");
+            return codec_status_from_qtree(op_status);
+        }
+    }
     // Apply lossy compression if requested
-    if (config->alpha > 1.0f)
+    else if (config->alpha > 1.0f)
     {
-        op_status = apply_lossy_compression(&tree, config->alpha);
+        op_status = apply_lossy_compression(tree, config->alpha);
         if (op_status != QTREE_SUCCESS)
         {
             log_error("Failed to apply lossy compression");
-            status = convert_qtree_status(op_status);
-            goto cleanup;
+            return codec_status_from_qtree(op_status);
+        }
+    }
+
+    if (config->target_bytes > 0 || config->target_psnr > 0.0 || config->alpha > 1.0f)
+    {
+        log_distortion(config, tree, pgm->pixels, stats);
+    }
+    qtc_stats_stage(stats, QTC_STAGE_FILTER, filter_start);
+    return CODEC_SUCCESS;
+}
+
+/**
+ * @brief Everything after the image is in memory; stats may already hold the read
+ */
+static codec_status_t compress_image(const config_t *config, const pgm_t *pgm, qtree_t *tree,
+                                     qtc_stats_t *stats)
+{
+    if (stats)
+    {
+        stats->size = pgm->size;
+        stats->bits_in = (uint64_t)pgm->size * pgm->size * 8;
+    }
+
+    FILE *output = NULL;
+    codec_status_t status = CODEC_SUCCESS;
+    qtree_status_t op_status;
+
+    if (config->tile_size > 0)
+    {
+        status = compress_tiled_layout(config, pgm, stats);
+        if (status == CODEC_SUCCESS)
+        {
+            log_success("Compression completed successfully");
+        }
+        return status;
+    }
+
+    if (config->layout == TREE_LAYOUT_ARRAY)
+    {
+        status = compress_array_layout(config, pgm, stats);
+        if (status == CODEC_SUCCESS)
+        {
+            log_success("Compression completed successfully");
         }
+        return status;
     }
 
+    status = build_and_filter(config, pgm, tree, stats);
+    if (status != CODEC_SUCCESS)
+        goto cleanup;
+
     // Open output file - only after all preprocessing is done
     output = fopen(config->output_file, "wb");
     if (!output)
@@ -136,17 +983,20 @@ codec_status_t codec_compress(const config_t *config)
     }
 
     // Perform compression
-    op_status = compress(&tree, config->output_file, output);
+    op_status = compress_with_stats(tree, config->format, config->output_file, output, stats);
     if (op_status != QTREE_SUCCESS)
     {
         log_error("Failed to compress data");
-        status = convert_qtree_status(op_status);
+        status = codec_status_from_qtree(op_status);
         goto cleanup;
     }
+    qtc_stats_count_tree(stats, tree);
 
     if (config->generate_grid)
     {
-        qtree_generate_grid(&tree, config->grid_file);
+        const double grid_start = wall_seconds();
+        qtree_generate_grid(tree, config->grid_file);
+        qtc_stats_stage(stats, QTC_STAGE_GRID, grid_start);
     }
 
     log_success("Compression completed successfully");
@@ -156,18 +1006,69 @@ cleanup:
     {
         fclose(output);
     }
-    if (tree_initialized)
+    if (tree->pool)
     {
-        free_quadtree_recursive(tree.root);
+        thread_pool_destroy(tree->pool);
+        tree->pool = NULL;
     }
-    if (pgm_initialized)
+    return status;
+}
+
+codec_status_t codec_compress_to_archive(const config_t *config, const pgm_t *pgm,
+                                        qtree_t *tree, qtree_archive_builder_t *archive,
+                                        qtc_stats_t *stats)
+{
+    if (!config || !config->input_file || !pgm || !pgm->pixels || !tree || !archive)
     {
-        pgm_free(&pgm);
+        log_error("Invalid compression parameters");
+        return CODEC_ERROR_INVALID_PARAM;
+    }
+
+    const double start = wall_seconds();
+    begin_stats(stats, "compress", config);
+    if (stats)
+    {
+        stats->size = pgm->size;
+        stats->bytes_in = (uint64_t)pgm->size * pgm->size;
+        stats->bits_in = stats->bytes_in * 8;
+    }
+
+    size_t length = 0;
+    codec_status_t status = build_and_filter(config, pgm, tree, stats);
+    if (status == CODEC_SUCCESS)
+    {
+        // No header and no file of its own: the payload goes straight after the last one
+        const double encode_start = wall_seconds();
+        const qtree_status_t op_status = qtree_archive_builder_add(
+            archive, qtree_archive_id(config->input_file), tree, &length);
+        qtc_stats_stage(stats, QTC_STAGE_ENCODE, encode_start);
+        if (op_status != QTREE_SUCCESS)
+        {
+            log_error("Failed to add %s to the archive", config->input_file);
+            status = codec_status_from_qtree(op_status);
+        }
+        qtc_stats_count_tree(stats, tree);
+    }
+
+    if (tree->pool)
+    {
+        thread_pool_destroy(tree->pool);
+        tree->pool = NULL;
+    }
+    end_stats(stats, start, status);
+
+    // The output is the whole archive; this image's share is its payload
+    if (stats && status == CODEC_SUCCESS)
+    {
+        stats->bytes_out = length;
+        stats->bits_out = (uint64_t)length * 8;
     }
     return status;
 }
 
-codec_status_t codec_decompress(const config_t *config)
+static codec_status_t decompress_file(const config_t *config, FILE *input, qtc_stats_t *stats);
+
+codec_status_t codec_decompress(const config_t *config, qtc_stats_t *stats)
 {
     if (!config || !config->input_file || !config->output_file)
     {
@@ -175,75 +1076,237 @@ codec_status_t codec_decompress(const config_t *config)
         return CODEC_ERROR_INVALID_PARAM;
     }
 
-    qtree_t tree = {0};
-    pgm_t pgm = {0};
-    codec_status_t status = CODEC_SUCCESS;
-    bool tree_initialized = false;
-    bool pgm_initialized = false;
-    FILE *input = NULL;
-    qtree_status_t op_status;
+    const double start = wall_seconds();
+    begin_stats(stats, "decompress", config);
 
     log_subheader("Decompression Operation");
     log_item("Input", "%s", config->input_file);
     log_item("Output", "%s", config->output_file);
 
     // Open input file
-    input = fopen(config->input_file, "rb");
+    FILE *input = fopen(config->input_file, "rb");
     if (!input)
     {
         log_error("Failed to open input file: %s", config->input_file);
-        status = CODEC_ERROR_FILE_IO;
+        end_stats(stats, start, CODEC_ERROR_FILE_IO);
+        return CODEC_ERROR_FILE_IO;
+    }
+
+    codec_status_t status = decompress_file(config, input, stats);
+    fclose(input);
+    end_stats(stats, start, status);
+    return status;
+}
+
+codec_status_t codec_decompress_file(const config_t *config, FILE *input, qtc_stats_t *stats)
+{
+    if (!config || !config->input_file || !config->output_file || !input)
+    {
+        log_error("Invalid decompression parameters");
+        return CODEC_ERROR_INVALID_PARAM;
+    }
+
+    const double start = wall_seconds();
+    begin_stats(stats, "decompress", config);
+    const codec_status_t status = decompress_file(config, input, stats);
+    end_stats(stats, start, status);
+    return status;
+}
+
+/**
+ * @brief What is left of the stream from here on, in bytes
+ */
+static uint64_t remaining_bytes(FILE *input)
+{
+    struct stat info;
+    const long at = ftell(input);
+    if (at < 0 || fstat(fileno(input), &info) != 0 || !S_ISREG(info.st_mode) ||
+        info.st_size < at)
+        return 0;
+    return (uint64_t)(info.st_size - at);
+}
+
+/**
+ * @brief Picks the decoder for the container and layout and runs it
+ */
+static codec_status_t decompress_file(const config_t *config, FILE *input, qtc_stats_t *stats)
+{
+    if (stats)
+        stats->bytes_in = remaining_bytes(input);
+
+    qtree_t tree = {0};
+    pgm_t pgm = {0};
+    codec_status_t status = CODEC_SUCCESS;
+    bool pgm_initialized = false;
+    qtree_status_t op_status;
+
+    if (input_matches(input, qtree_tiled_magic))
+    {
+        return decompress_tiled_layout(config, input, stats);
+    }
+    if (input_matches(input, qtree_sequence_magic))
+    {
+        return decompress_sequence_layout(config, input, stats);
+    }
+    if (input_matches(input, qtree_archive_magic))
+    {
+        return decompress_archive_layout(config, input, stats);
+    }
+    if (config->archive_entry)
+    {
+        log_error("--entry needs an archive (compress a --batch with --archive)");
+        return CODEC_ERROR_INVALID_PARAM;
+    }
+    if (config->region)
+    {
+        log_error("--region needs a tiled file (compress with --tile)");
+        return CODEC_ERROR_INVALID_PARAM;
+    }
+
+    // A preview never has a whole tree, so it always streams
+    if (config->preview_level >= 0 || config->preview_upscale)
+    {
+        if (config->generate_grid)
+        {
+            log_warn("Grid output is not available for previews");
+        }
+
+        const uint32_t level = config->preview_level >= 0 ? (uint32_t)config->preview_level
+                                                          : UINT32_MAX;
+        const double decode_start = wall_seconds();
+        op_status = qtree_decompress_preview_with_stats(input, config->input_file, level,
+                                                        config->preview_upscale, &pgm, stats);
+        qtc_stats_stage(stats, QTC_STAGE_DECODE, decode_start);
+        if (op_status != QTREE_SUCCESS)
+        {
+            log_error("Failed to read compressed data");
+            status = codec_status_from_qtree(op_status);
+            goto cleanup;
+        }
+        pgm_initialized = true;
+
+        const double write_start = wall_seconds();
+        pgm_status_t write_status = pgm_write(&pgm, config->output_file);
+        qtc_stats_stage(stats, QTC_STAGE_WRITE, write_start);
+        if (write_status != PGM_SUCCESS)
+        {
+            log_error("Failed to write PGM file");
+            status = convert_pgm_status(write_status);
+            goto cleanup;
+        }
+
+        log_success("Preview completed successfully");
+        goto cleanup;
+    }
+
+    if (config->layout == TREE_LAYOUT_ARRAY)
+    {
+        status = decompress_array_layout(config, input, stats);
+        if (status == CODEC_SUCCESS)
+        {
+            log_success("Decompression completed successfully");
+        }
+        goto cleanup;
+    }
+
+    if (config->layout == TREE_LAYOUT_SUCCINCT)
+    {
+        status = decompress_succinct_layout(config, input, stats);
+        if (status == CODEC_SUCCESS)
+        {
+            log_success("Decompression completed successfully");
+        }
+        goto cleanup;
+    }
+
+    // Without a grid nobody needs the tree, so decode straight to pixels
+    if (!config->generate_grid)
+    {
+        const double decode_start = wall_seconds();
+        op_status = qtree_decompress_stream_with_stats(input, config->input_file, &pgm, stats);
+        qtc_stats_stage(stats, QTC_STAGE_DECODE, decode_start);
+        if (op_status != QTREE_SUCCESS)
+        {
+            log_error("Failed to read compressed data");
+            status = codec_status_from_qtree(op_status);
+            goto cleanup;
+        }
+        pgm_initialized = true;
+
+        const double write_start = wall_seconds();
+        pgm_status_t write_status = pgm_write(&pgm, config->output_file);
+        qtc_stats_stage(stats, QTC_STAGE_WRITE, write_start);
+        if (write_status != PGM_SUCCESS)
+        {
+            log_error("Failed to write PGM file");
+            status = convert_pgm_status(write_status);
+            goto cleanup;
+        }
+
+        log_success("Decompression completed successfully");
         goto cleanup;
     }
 
     // Read compressed data
-    op_status = qtree_decompress(input, config->input_file, &tree);
+    const double decode_start = wall_seconds();
+    op_status = qtree_decompress_with_stats(input, config->input_file, &tree, stats);
+    qtc_stats_stage(stats, QTC_STAGE_DECODE, decode_start);
     if (op_status != QTREE_SUCCESS)
     {
         log_error("Failed to read compressed data");
-        status = convert_qtree_status(op_status);
+        status = codec_status_from_qtree(op_status);
+        goto cleanup;
+    }
+
+    // Pixels and grid are painted subtree by subtree on the pool
+    bool pool_failed = false;
+    tree.pool = start_pool(config, &pool_failed);
+    if (pool_failed)
+    {
+        status = CODEC_ERROR_MEMORY;
         goto cleanup;
     }
-    tree_initialized = true;
 
     // Convert to PGM format
+    const double render_start = wall_seconds();
     op_status = qtree_to_pgm(&tree, config->output_file, &pgm);
+    qtc_stats_stage(stats, QTC_STAGE_RENDER, render_start);
     if (op_status != QTREE_SUCCESS)
     {
         log_error("Failed to convert to PGM format");
-        status = convert_qtree_status(op_status);
+        status = codec_status_from_qtree(op_status);
         goto cleanup;
     }
     pgm_initialized = true;
 
     // Write output file
+    const double write_start = wall_seconds();
     pgm_status_t write_status = pgm_write(&pgm, config->output_file);
+    qtc_stats_stage(stats, QTC_STAGE_WRITE, write_start);
     if (write_status != PGM_SUCCESS)
     {
         log_error("Failed to write PGM file");
         status = convert_pgm_status(write_status);
         goto cleanup;
     }
+    qtc_stats_count_tree(stats, &tree);
 
     if (config->generate_grid)
     {
+        const double grid_start = wall_seconds();
         qtree_generate_grid(&tree, config->grid_file);
+        qtc_stats_stage(stats, QTC_STAGE_GRID, grid_start);
     }
 
     log_success("Decompression completed successfully");
 
 cleanup:
-    if (input)
-    {
-        fclose(input);
-    }
     if (pgm_initialized)
     {
         pgm_free(&pgm);
     }
-    if (tree_initialized)
-    {
-        free_quadtree_recursive(tree.root);
-    }
+    if (tree.pool)
+        thread_pool_destroy(tree.pool);
+    qtree_free(&tree);
     return status;
 }
\ No newline at end of file
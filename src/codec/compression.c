@@ -12,15 +12,27 @@
  */
 
 #include "codec/compression.h"
+#include "codec/entropy.h"
+#include "codec/metrics.h"
+#include "core/node_arena.h"
+#include "core/qtree_array.h"
+#include "core/tree_walk.h"
 #include "logger/logger.h"
 #include "common/common.h"
 #include "common/common.h"
 
+#include <stdlib.h>
+#include <string.h>
 #include <time.h>
 #include <math.h>
 
-#define MAGIC_BYTES "Q1"
-#define BUFFER_SIZE 1024
+#define MAGIC_Q1 "Q1"
+#define MAGIC_Q2 "Q2"
+#define HEADER_TEXT_SIZE 128
+
+/* Rate control searches alpha in (1, RATE_ALPHA_MAX] */
+#define RATE_ALPHA_MAX 64.0f
+#define RATE_SEARCH_STEPS 24
 
 /**
  * @brief Initialize a new compression state
@@ -29,41 +41,109 @@
  */
 qtree_compress_state_t compress_init(FILE *file)
 {
-    return (qtree_compress_state_t){
-        .buffer = 0,
-        .bit_position = 0,
+    qtree_compress_state_t state = {
+        .accumulator = 0,
+        .bit_count = 0,
+        .buffer = malloc(COMPRESS_BUFFER_SIZE),
+        .buffer_used = 0,
+        .buffer_capacity = COMPRESS_BUFFER_SIZE,
         .file = file,
+        .writer = NULL,
         .bytes_written = 0,
         .total_bits = 0,
         .error = 0,
         .total_nodes = 0,
-        .processed_nodes = 0};
+        .processed_nodes = 0,
+        .q2 = NULL};
+
+    if (!state.buffer)
+        state.error = 1;
+    else if (file)
+        state.writer = async_writer_start(file);
+    return state;
 }
 
 /**
- * @brief Write a single bit to the output stream
+ * @brief Hand the staged bytes to the file
  * @param state Current compression state
- * @param bit Bit to write (0 or 1)
  */
-void compress_write_bit(qtree_compress_state_t *state, const uint8_t bit)
+static void drain_buffer(qtree_compress_state_t *state)
 {
-    if (state->error)
+    if (state->buffer_used == 0)
+        return;
+
+    const bool written = state->writer
+        ? async_writer_write(state->writer, state->buffer, state->buffer_used)
+        : fwrite(state->buffer, 1, state->buffer_used, state->file) == state->buffer_used;
+    if (!written)
+    {
+        state->error = 1;
         return;
+    }
+    state->buffer_used = 0;
+}
+
+/**
+ * @brief Make sure the buffer has room for a few more bytes
+ *
+ * File mode empties it into the file, memory mode doubles it.
+ *
+ * @param state Current compression state
+ * @param bytes How many bytes are about to be added
+ * @return True if there is room now
+ */
+static bool make_room(qtree_compress_state_t *state, size_t bytes)
+{
+    if (state->buffer_used + bytes <= state->buffer_capacity)
+        return true;
 
-    state->buffer |= (bit & 1) << (7 - state->bit_position++);
-    state->total_bits++;
+    if (state->file)
+    {
+        drain_buffer(state);
+        return !state->error;
+    }
 
-    if (state->bit_position == 8)
+    const size_t capacity = state->buffer_capacity * 2;
+    uint8_t *grown = realloc(state->buffer, capacity);
+    if (!grown)
     {
-        if (fwrite(&state->buffer, 1, 1, state->file) != 1)
-        {
-            state->error = 1;
-            return;
-        }
-        state->buffer = 0;
-        state->bit_position = 0;
-        state->bytes_written++;
+        state->error = 1;
+        return false;
     }
+    state->buffer = grown;
+    state->buffer_capacity = capacity;
+    return true;
+}
+
+/**
+ * @brief Move the oldest 32 pending bits into the buffer, MSB first
+ * @param state Current compression state
+ */
+static void emit_word(qtree_compress_state_t *state)
+{
+    if (!make_room(state, 4))
+        return;
+
+    const uint32_t word = (uint32_t)(state->accumulator >> (state->bit_count - 32));
+    uint8_t *out = state->buffer + state->buffer_used;
+    out[0] = (uint8_t)(word >> 24);
+    out[1] = (uint8_t)(word >> 16);
+    out[2] = (uint8_t)(word >> 8);
+    out[3] = (uint8_t)word;
+
+    state->buffer_used += 4;
+    state->bytes_written += 4;
+    state->bit_count -= 32;
+}
+
+/**
+ * @brief Write a single bit to the output stream
+ * @param state Current compression state
+ * @param bit Bit to write (0 or 1)
+ */
+void compress_write_bit(qtree_compress_state_t *state, const uint8_t bit)
+{
+    compress_write_bits(state, bit & 1u, 1);
 }
 
 /**
@@ -74,9 +154,18 @@ void compress_write_bit(qtree_compress_state_t *state, const uint8_t bit)
  */
 void compress_write_bits(qtree_compress_state_t *state, const uint32_t value, const size_t num_bits)
 {
-    for (size_t i = 0; i < num_bits && !state->error; i++)
+    if (state->error || num_bits == 0 || num_bits > 32)
+        return;
+
+    // At most 31 bits are pending here, so 32 more always fit
+    const uint64_t mask = (num_bits == 32) ? 0xFFFFFFFFu : ((1u << num_bits) - 1u);
+    state->accumulator = (state->accumulator << num_bits) | (value & mask);
+    state->bit_count += num_bits;
+    state->total_bits += num_bits;
+
+    if (state->bit_count >= 32)
     {
-        compress_write_bit(state, value >> (num_bits - 1 - i) & 1);
+        emit_word(state);
     }
 }
 
@@ -86,18 +175,90 @@ void compress_write_bits(qtree_compress_state_t *state, const uint32_t value, co
  */
 void compress_flush(qtree_compress_state_t *state)
 {
-    if (state->error || state->bit_position == 0)
-        return;
+    // Q2: the coded queue becomes the stream
+    if (state->q2 && !state->error)
+    {
+        uint8_t *data = NULL;
+        size_t length = 0;
+        if (q2_encoder_finish(state->q2, &data, &length))
+        {
+            free(state->buffer);
+            state->buffer = data;
+            state->buffer_used = length;
+            state->buffer_capacity = length;
+            state->bytes_written = length;
+            state->total_bits = length * 8;
+        }
+        else
+        {
+            state->error = 1;
+        }
+    }
+    else if (!state->error)
+    {
+        // Whole bytes first, then the last partial byte padded with zeros
+        while (state->bit_count > 0)
+        {
+            if (!make_room(state, 1))
+                break;
+
+            uint8_t byte;
+            if (state->bit_count >= 8)
+            {
+                byte = (uint8_t)(state->accumulator >> (state->bit_count - 8));
+                state->bit_count -= 8;
+            }
+            else
+            {
+                byte = (uint8_t)(state->accumulator << (8 - state->bit_count));
+                state->bit_count = 0;
+            }
+            state->buffer[state->buffer_used++] = byte;
+            state->bytes_written++;
+        }
+    }
 
-    if (fwrite(&state->buffer, 1, 1, state->file) != 1)
+    // Memory mode hands the buffer to the caller
+    if (state->file)
     {
-        state->error = 1;
-        return;
+        if (!state->error)
+            drain_buffer(state);
+        if (state->writer && !async_writer_finish(state->writer))
+            state->error = 1;
+        state->writer = NULL;
+        compress_release(state);
     }
+}
+
+void compress_rewind(qtree_compress_state_t *state)
+{
+    state->accumulator = 0;
+    state->bit_count = 0;
+    state->buffer_used = 0;
+    state->bytes_written = 0;
+    state->total_bits = 0;
+    state->error = 0;
+}
 
-    state->buffer = 0;
-    state->bit_position = 0;
-    state->bytes_written++;
+void compress_release(qtree_compress_state_t *state)
+{
+    if (state->writer)
+    {
+        async_writer_finish(state->writer);
+        state->writer = NULL;
+    }
+    if (state->q2)
+    {
+        q2_encoder_release(state->q2);
+        free(state->q2);
+        state->q2 = NULL;
+    }
+    free(state->buffer);
+    state->buffer = NULL;
+    state->buffer_used = 0;
+    state->buffer_capacity = 0;
+    state->accumulator = 0;
+    state->bit_count = 0;
 }
 
 /**
@@ -111,75 +272,136 @@ float compress_get_rate(const size_t total_bits, const size_t original_size)
     return (float)total_bits / (float)original_size * 100.0f;
 }
 
+/**
+ * @brief Text part of the header: magic, timestamp and rate lines
+ * @param text Buffer of HEADER_TEXT_SIZE bytes
+ * @param format Picks the magic bytes
+ * @param compression_rate Rate to print
+ * @return Length of the text
+ */
+static size_t format_header(char *text, const qtree_format_t format,
+                            const float compression_rate)
+{
+    char timestamp[64];
+    time_t now;
+    struct tm local;
+
+    // Write timestamp (localtime_r: batch mode encodes on several threads)
+    time(&now);
+    localtime_r(&now, &local);
+    strftime(timestamp, sizeof(timestamp), "# %a %b %d %H:%M:%S %Y\n", &local);
+
+    // Magic bytes, then the comment lines
+    const int length = snprintf(text, HEADER_TEXT_SIZE, "%s\n%s# compression rate %.2f%%\n",
+                                format == QTREE_FORMAT_Q2 ? MAGIC_Q2 : MAGIC_Q1, timestamp, (double)compression_rate);
+    return length > 0 ? (size_t)length : 0;
+}
+
 /**
  * @brief Write file header including metadata
  *
  * Writes a header containing:
- * - Magic bytes ("Q1")
+ * - Magic bytes ("Q1", or "Q2" for the entropy-coded payload)
  * - Timestamp of the compression operation
  * - Compression rate (percentage)
  * - Tree depth (`n_levels`)
- *
- * @param file Output file pointer
- * @param tree Pointer to the quadtree being compressed
- * @param compression_rate Calculated compression rate
- * @return True if the header was written successfully, false otherwise
  */
-static bool write_header(FILE *file, const qtree_t *tree, const float compression_rate)
+bool compress_write_header(FILE *file, const qtree_format_t format, const uint32_t n_levels,
+                           const float compression_rate)
 {
-    char timestamp[64];
-    time_t now;
+    char text[HEADER_TEXT_SIZE];
+    const size_t length = format_header(text, format, compression_rate);
 
-    // Write magic bytes and format version
-    if (fwrite(MAGIC_BYTES, 1, 2, file) != 2)
-        return false;
-    if (fputc('\n', file) == EOF)
+    if (fwrite(text, 1, length, file) != length)
         return false;
 
-    // Write timestamp
-    time(&now);
-    strftime(timestamp, sizeof(timestamp), "# %a %b %d %H:%M:%S %Y\n", localtime(&now));
-    if (fputs(timestamp, file) == EOF)
-        return false;
+    // Write tree depth
+    const uint8_t depth = (uint8_t)n_levels;
+    return fwrite(&depth, sizeof(uint8_t), 1, file) == 1;
+}
 
-    // Write compression statistics
-    if (fprintf(file, "# compression rate %.2f%%\n", (double)compression_rate) < 0)
-        return false;
+/**
+ * @brief The four children of one parent (the root is alone in its own)
+ *
+ * Only Q2 looks at this: means are coded against parent_m, and the
+ * contexts depend on the height and the siblings already written.
+ */
+typedef struct {
+    uint8_t parent_m;           /* Mean the residuals are taken against */
+    uint32_t height;            /* Block height of the children, 0 for pixels */
+    qtree_q2_family_t siblings; /* Children written so far */
+} family_t;
 
-    // Write tree depth
-    return fwrite(&tree->n_levels, sizeof(uint8_t), 1, file) == 1;
+/* The root has no parent; Q2 codes its mean against mid-grey */
+#define ROOT_PARENT_MEAN 128u
+
+static family_t family_start(const uint8_t parent_m, const uint32_t height)
+{
+    return (family_t){.parent_m = parent_m, .height = height, .siblings = {0}};
+}
+
+/**
+ * @brief Q2 version of write_node_fields()
+ */
+static void write_node_entropy(qtree_compress_state_t *state, const uint8_t m,
+                               const uint8_t e, const uint8_t u,
+                               const bool is_leaf, const bool is_interpolated,
+                               family_t *family)
+{
+    if (!is_interpolated)
+    {
+        q2_encode_residual(state->q2, family->height, &family->siblings,
+                           (int32_t)m - (int32_t)family->parent_m);
+    }
+
+    if (is_leaf)
+        return;
+
+    q2_encode_flags(state->q2, family->height, e, u);
+    state->processed_nodes++;
 }
 
 /**
- * @brief Write node data to temporary buffer
+ * @brief Write one node's fields to the output buffer
  *
  * @param state Current compression state
- * @param node Pointer to the node to write
+ * @param m Mean value of the node
+ * @param e Rounding error of the node
+ * @param u Uniformity flag of the node
  * @param is_leaf True if the node is a leaf
  * @param is_interpolated True if the node's value is derived via interpolation
+ * @param family Parent and earlier siblings (Q2 only)
  */
-static void write_node(qtree_compress_state_t *state, const qtree_node_t *node,
-                       const bool is_leaf, const bool is_interpolated)
+static void write_node_fields(qtree_compress_state_t *state, const uint8_t m,
+                              const uint8_t e, const uint8_t u,
+                              const bool is_leaf, const bool is_interpolated,
+                              family_t *family)
 {
     if (state->error)
         return;
 
+    if (state->q2)
+    {
+        write_node_entropy(state, m, e, u, is_leaf, is_interpolated, family);
+        return;
+    }
+
     // Write mean value if not interpolated
     if (!is_interpolated)
     {
-        compress_write_bits(state, node->m, 8);
+        compress_write_bits(state, m, 8);
     }
 
     if (is_leaf)
         return;
 
     // Write error value (2 bits)
-    compress_write_bits(state, node->e, 2);
+    compress_write_bits(state, e, 2);
 
     // Write uniformity bit if error is 0
-    if (node->e == 0)
+    if (e == 0)
     {
-        compress_write_bits(state, node->u, 1);
+        compress_write_bits(state, u, 1);
     }
 
     // Increment processed nodes count
@@ -187,71 +409,229 @@ static void write_node(qtree_compress_state_t *state, const qtree_node_t *node,
 }
 
 /**
- * @brief Recursively compress a level of the quadtree
- *
- * Traverses the quadtree recursively and encodes nodes at the specified target level.
- * Nodes are processed in a specific order determined by `quadrant_order`.
+ * @brief Bits write_node_fields spends on one node
+ */
+static size_t node_field_bits(uint8_t e, bool is_leaf, bool is_interpolated)
+{
+    size_t bits = is_interpolated ? 0 : 8;
+    if (!is_leaf)
+        bits += e == 0 ? 3 : 2;
+    return bits;
+}
+
+/**
+ * @brief Write node data to the output buffer
  *
  * @param state Current compression state
- * @param tree Pointer to the quadtree being compressed
- * @param node Pointer to the current node
- * @param current_level Current depth in the tree
- * @param target_level Target depth to process
- * @param is_interpolated True if the current node is interpolated
+ * @param node Pointer to the node to write
+ * @param is_leaf True if the node is a leaf
+ * @param is_interpolated True if the node's value is derived via interpolation
+ * @param family Parent and earlier siblings (Q2 only)
+ */
+static void write_node(qtree_compress_state_t *state, const qtree_node_t *node,
+                       const bool is_leaf, const bool is_interpolated, family_t *family)
+{
+    write_node_fields(state, node->m, node->e, node->u, is_leaf, is_interpolated, family);
+}
+
+/**
+ * @brief Non-uniform nodes of one level, waiting for their children
+ */
+typedef struct {
+    const qtree_node_t **nodes;
+    size_t count;
+    size_t capacity;
+} frontier_t;
+
+/**
+ * @brief Grow a frontier so it can hold at least `needed` nodes
+ * @return False if memory ran out
+ */
+static bool frontier_reserve(frontier_t *frontier, size_t needed)
+{
+    if (needed <= frontier->capacity)
+        return true;
+
+    size_t capacity = frontier->capacity ? frontier->capacity : 64;
+    while (capacity < needed)
+        capacity *= 2;
+
+    const qtree_node_t **grown = realloc(frontier->nodes, capacity * sizeof(*grown));
+    if (!grown)
+        return false;
+    frontier->nodes = grown;
+    frontier->capacity = capacity;
+    return true;
+}
+
+/**
+ * @brief A bottom node that is written as nothing but its mean
+ */
+static bool is_plain_leaf(const qtree_node_t *node)
+{
+    return node->e == 0 && node->u == 1;
+}
+
+void compress_write_root(qtree_compress_state_t *state, const qtree_node_t *root,
+                         const uint32_t n_levels)
+{
+    family_t family = family_start(ROOT_PARENT_MEAN, n_levels);
+    write_node(state, root, n_levels == 0 && root->e == 0 && root->u == 1, false, &family);
+}
+
+/**
+ * @brief Write the levels under a node, one breadth-first pass
  *
- * @note This function does nothing if the node is uniform or null.
+ * The frontier holds every non-uniform node of the previous level, and
+ * their children are written in quadrant_order, which is the same
+ * sequence a per-level walk from the root produces.
  */
-static void compress_tree_level(qtree_compress_state_t *state, const qtree_t *tree,
-                                const qtree_node_t *node, const uint32_t current_level,
-                                const uint32_t target_level, const bool is_interpolated)
+bool compress_levels(qtree_compress_state_t *state, const qtree_node_t *root,
+                     const uint32_t height, const bool reaches_bottom, size_t *level_ends)
 {
-    if (node == NULL || state->error)
-        return;
+    frontier_t current = {0};
+    frontier_t next = {0};
+    bool ok = frontier_reserve(&current, 1);
 
-    const bool is_leaf = node->e == 0 && node->u == 1 && current_level == tree->n_levels;
+    if (ok && !root->u)
+        current.nodes[current.count++] = root;
 
-    // Write node data if we're at the target level
-    if (current_level == target_level)
+    for (uint32_t level = 1; ok && level <= height; level++)
     {
-        write_node(state, node, is_leaf, is_interpolated);
-        return;
-    }
+        next.count = 0;
+        ok = frontier_reserve(&next, current.count * 4);
 
-    // Recursively process children if not uniform
-    if (node->u == 0)
-    {
-        for (int i = 0; i < 4; i++)
+        const bool leaves = reaches_bottom && level == height && !state->q2;
+        for (size_t p = 0; ok && p < current.count && !state->error; p++)
+        {
+            const qtree_node_t *parent = current.nodes[p];
+            const qtree_node_t *const *children =
+                (const qtree_node_t *const *)parent->children;
+
+            // Q1 leaves are a mean each and the fourth is implied: 24 bits in one go
+            if (leaves && children[0] && children[1] && children[2] && children[3] &&
+                is_plain_leaf(children[0]) && is_plain_leaf(children[1]) &&
+                is_plain_leaf(children[2]) && is_plain_leaf(children[3]))
+            {
+                compress_write_bits(state,
+                                    (uint32_t)children[0]->m << 16 |
+                                        (uint32_t)children[1]->m << 8 | children[2]->m,
+                                    24);
+                continue;
+            }
+
+            family_t family = family_start(parent->m, height - level);
+            for (int i = 0; i < 4; i++)
+            {
+                const qtree_node_t *child = parent->children[quadrant_order[i]];
+                if (!child)
+                    continue;
+
+                const bool is_leaf = reaches_bottom && level == height &&
+                                     child->e == 0 && child->u == 1;
+                write_node(state, child, is_leaf, i == 3, &family);
+                if (!child->u)
+                    next.nodes[next.count++] = child;
+            }
+        }
+
+        if (state->error)
         {
-            compress_tree_level(state, tree, node->children[quadrant_order[i]],
-                                current_level + 1, target_level, i == 3);
+            log_message(LOG_LEVEL_ERROR, "Failed at level %u", level);
+            ok = false;
+            break;
         }
+
+        frontier_t swap = current;
+        current = next;
+        next = swap;
+
+        if (level_ends)
+            level_ends[level - 1] = state->total_bits;
+        else
+            log_progress_hook((double)level / (double)height);
     }
+
+    free(current.nodes);
+    free(next.nodes);
+
+    if (!ok && !state->error)
+        log_message(LOG_LEVEL_ERROR, "Memory allocation failed for the encoder frontier");
+    return ok;
+}
+
+/**
+ * @brief Compress quadtree data to the output buffer
+ * @param state Compression state
+ * @param ctx Quadtree to compress (qtree_t)
+ * @return True if compression succeeded, false otherwise
+ */
+static bool compress_tree_data(qtree_compress_state_t *state, const void *ctx)
+{
+    const qtree_t *tree = ctx;
+
+    log_item("Tree depth", "%u levels", tree->n_levels);
+    log_item("Image size", "%ux%u pixels", tree->size, tree->size);
+
+    compress_write_root(state, tree->root, tree->n_levels);
+    log_progress_hook(0.0);
+    if (!compress_levels(state, tree->root, tree->n_levels, true, NULL))
+        return false;
+
+    compress_flush(state);
+    return !state->error;
 }
 
 /**
- * @brief Compress quadtree data to a temporary buffer
+ * @brief Compress array quadtree data to the output buffer
+ *
+ * Level by level, every child of a non-uniform parent is written in
+ * index order, which is the same order the pointer encoder uses.
  *
  * @param state Compression state
- * @param tree Quadtree to compress
+ * @param ctx Quadtree to compress (qtree_array_t)
  * @return True if compression succeeded, false otherwise
  */
-static bool compress_tree_data(qtree_compress_state_t *state, const qtree_t *tree)
+static bool compress_array_data(qtree_compress_state_t *state, const void *ctx)
 {
+    const qtree_array_t *tree = ctx;
+
     log_item("Tree depth", "%u levels", tree->n_levels);
     log_item("Image size", "%ux%u pixels", tree->size, tree->size);
 
-    // Process each level
-    for (uint32_t level = 0; level <= tree->n_levels; level++)
+    family_t root_family = family_start(ROOT_PARENT_MEAN, tree->n_levels);
+    write_node_fields(state, tree->m[0], tree->e[0], tree->u[0],
+                      tree->n_levels == 0, false, &root_family);
+
+    for (uint32_t level = 1; level <= tree->n_levels && !state->error; level++)
     {
-        compress_tree_level(state, tree, tree->root, 0, level, false);
+        const size_t begin = qtree_array_level_offset(level - 1);
+        const size_t end = qtree_array_level_offset(level);
+        const bool bottom = level == tree->n_levels;
+
+        for (size_t parent = begin; parent < end && !state->error; parent++)
+        {
+            if (tree->u[parent])
+                continue;
+
+            const size_t c = qtree_first_child_index(parent);
+            family_t family = family_start(tree->m[parent], tree->n_levels - level);
+            for (size_t k = 0; k < 4; k++)
+            {
+                const size_t i = c + k;
+                const bool is_leaf = bottom && tree->e[i] == 0 && tree->u[i] == 1;
+                write_node_fields(state, tree->m[i], tree->e[i], tree->u[i],
+                                  is_leaf, k == 3, &family);
+            }
+        }
+
         if (state->error)
         {
             log_message(LOG_LEVEL_ERROR, "Failed at level %u", level);
             return false;
         }
 
-        const double progress = (double)level / (double)tree->n_levels;
-        log_progress(progress);
+        log_progress_hook((double)level / (double)tree->n_levels);
     }
 
     compress_flush(state);
@@ -259,94 +639,261 @@ static bool compress_tree_data(qtree_compress_state_t *state, const qtree_t *tre
 }
 
 /**
- * @brief Compress a quadtree structure
+ * @brief The last child in write order has its mean interpolated
  */
-qtree_status_t compress(const qtree_t *tree, const char *output_filename, FILE *output_file)
+static bool cell_is_interpolated(const qtree_walk_cell_t *cell)
 {
-    log_header("QUADTREE COMPRESSION");
+    return cell->level > 0 && cell->quadrant == (uint32_t)quadrant_order[3];
+}
 
-    // Validate parameters
-    if (!tree || !output_file || !tree->root)
+/**
+ * @brief Exact Q1 bits of a node and everything written under it
+ */
+static size_t node_payload_bits(const qtree_node_t *node, uint32_t level, uint32_t n_levels,
+                                bool is_interpolated)
+{
+    size_t bits = node_field_bits(node->e, level == n_levels && node->e == 0 && node->u,
+                                  is_interpolated);
+    if (node->u)
+        return bits;
+
+    for (int i = 0; i < 4; i++)
     {
-        log_message(LOG_LEVEL_ERROR, "Invalid compression parameters");
-        return QTREE_ERROR_INVALID_PARAM;
+        const qtree_node_t *child = node->children[quadrant_order[i]];
+        if (child)
+            bits += node_payload_bits(child, level + 1, n_levels, i == 3);
     }
+    return bits;
+}
 
-    // Log initial file information
-    log_file_info("input.pgm", tree->size, tree->n_levels, 0.0);
-
-    log_subheader("Preprocessing Data");
+static void size_subtree(void *ctx, qtree_node_t *node, const qtree_walk_cell_t *cell,
+                         uint32_t worker, void *result)
+{
+    (void)worker;
+    const uint32_t *n_levels = ctx;
+    *(size_t *)result = node_payload_bits(node, cell->level, *n_levels,
+                                          cell_is_interpolated(cell));
+}
 
-    // Create temporary buffer for two-pass compression
-    FILE *temp_buffer = tmpfile();
-    if (!temp_buffer)
+static void size_leave(void *ctx, qtree_node_t *node, const qtree_walk_cell_t *cell,
+                       const void *const children[4], void *result)
+{
+    const uint32_t *n_levels = ctx;
+    size_t bits = node_field_bits(node->e, cell->level == *n_levels && node->e == 0 && node->u,
+                                  cell_is_interpolated(cell));
+    for (int q = 0; q < 4 && !node->u; q++)
     {
-        log_message(LOG_LEVEL_ERROR, "Failed to create temporary buffer");
-        return QTREE_ERROR_FORMAT;
+        if (children[q])
+            bits += *(const size_t *)children[q];
     }
+    *(size_t *)result = bits;
+}
 
-    // First pass: compress to get exact size
-    qtree_compress_state_t temp_state = compress_init(temp_buffer);
+static const qtree_walk_t size_pass = {
+    .subtree = size_subtree,
+    .leave = size_leave,
+    .result_size = sizeof(size_t)};
 
-    log_message(LOG_LEVEL_SUCCESS, "Successfully made first pass");
+/**
+ * @brief Q1 payload size of a pointer tree, before anything is coded
+ */
+static size_t tree_payload_bits(const void *ctx)
+{
+    const qtree_t *tree = ctx;
+    uint32_t n_levels = tree->n_levels;
+    size_t bits = 0;
+    qtree_walk(&size_pass, &n_levels, tree->root, tree->size, tree->pool, &bits);
+    return bits;
+}
 
-    // Track compression time
-    clock_t start_time = clock();
+/**
+ * @brief Same for the array layout, in the order compress_array_data() writes
+ */
+static size_t array_payload_bits(const void *ctx)
+{
+    const qtree_array_t *tree = ctx;
+    size_t bits = node_field_bits(tree->e[0], tree->n_levels == 0, false);
 
-    log_subheader("Compressing Data");
-    if (!compress_tree_data(&temp_state, tree))
+    for (uint32_t level = 1; level <= tree->n_levels; level++)
     {
-        fclose(temp_buffer);
-        log_message(LOG_LEVEL_ERROR, "Compression failed during data encoding");
-        return QTREE_ERROR_FORMAT;
-    }
+        const size_t begin = qtree_array_level_offset(level - 1);
+        const size_t end = qtree_array_level_offset(level);
+        const bool bottom = level == tree->n_levels;
 
-    // Calculate compression statistics
-    const size_t original_size = tree->size * tree->size * 8;
-    const float compression_rate = compress_get_rate(temp_state.total_bits, original_size);
-    const double cpu_time = (double)(clock() - start_time) / CLOCKS_PER_SEC;
+        for (size_t parent = begin; parent < end; parent++)
+        {
+            if (tree->u[parent])
+                continue;
+
+            const size_t c = qtree_first_child_index(parent);
+            for (size_t k = 0; k < 4; k++)
+                bits += node_field_bits(tree->e[c + k],
+                                        bottom && tree->e[c + k] == 0 && tree->u[c + k] == 1,
+                                        k == 3);
+        }
+    }
+    return bits;
+}
 
-    log_end_progress();
+/**
+ * @brief Front half of every pipeline: the whole payload
+ *
+ * Without a file the payload stays in memory and on success the caller
+ * owns state's buffer and releases it. With one, it goes to the file as
+ * it is coded and state is already released on return.
+ *
+ * @param file Where to stream the payload (NULL keeps it in memory)
+ * @param write_behind Hand the file to a writer thread
+ */
+static qtree_status_t encode_payload(bool (*encode)(qtree_compress_state_t *, const void *),
+                                     const void *ctx, uint32_t n_levels, uint32_t size,
+                                     qtree_format_t format, FILE *file, bool write_behind,
+                                     qtree_compress_state_t *state)
+{
+    // Log initial file information
+    log_file_info("input.pgm", size, n_levels, 0.0);
 
-    // Write header with actual compression rate
-    log_subheader("Writing Output");
-    log_item("Output path", "%s", output_filename);
-    log_item("Writing header", "Q1 format");
+    log_subheader("Preprocessing Data");
 
-    if (!write_header(output_file, tree, compression_rate))
+    *state = compress_init(NULL);
+    if (state->error)
     {
-        fclose(temp_buffer);
-        log_message(LOG_LEVEL_ERROR, "Failed to write file header");
-        return QTREE_ERROR_FORMAT;
+        log_message(LOG_LEVEL_ERROR, "Failed to allocate the output buffer");
+        return QTREE_ERROR_MEMORY;
     }
 
-    // Copy compressed data to output file
-    log_item("Copying data", "%.2f KB", (double)temp_state.total_bits / 8192.0);
-
-    rewind(temp_buffer);
-    char buffer[BUFFER_SIZE];  // Using smaller buffer size
-    size_t bytes_read;
-    size_t total_copied = 0;
-    const size_t total_bytes = (temp_state.total_bits + 7) / 8;
-
-    while ((bytes_read = fread(buffer, 1, BUFFER_SIZE, temp_buffer)) > 0)
+    // File mode; the writer is optional, without it the buffer is written in place
+    if (file)
     {
-        if (fwrite(buffer, 1, bytes_read, output_file) != bytes_read)
+        state->file = file;
+        if (write_behind)
+            state->writer = async_writer_start(file);
+    }
+
+    if (format == QTREE_FORMAT_Q2)
+    {
+        state->q2 = malloc(sizeof(*state->q2));
+        if (!state->q2 || !q2_encoder_init(state->q2))
         {
-            fclose(temp_buffer);
+            compress_release(state);
+            log_message(LOG_LEVEL_ERROR, "Failed to allocate the entropy coder");
+            return QTREE_ERROR_MEMORY;
+        }
+    }
+
+    log_message(LOG_LEVEL_SUCCESS, "Successfully made first pass");
+
+    log_subheader("Compressing Data");
+    if (!encode(state, ctx))
+    {
+        compress_release(state);
+        log_message(LOG_LEVEL_ERROR, "Compression failed during data encoding");
+        return QTREE_ERROR_FORMAT;
+    }
+
+    log_end_progress();
+    return QTREE_SUCCESS;
+}
+
+/**
+ * @brief Logs and writes the header of a file
+ */
+static bool write_output_header(const char *output_filename, FILE *output_file,
+                                qtree_format_t format, uint32_t n_levels,
+                                float compression_rate)
+{
+    log_subheader("Writing Output");
+    log_item("Output path", "%s", output_filename);
+    log_item("Writing header", "%s format", format == QTREE_FORMAT_Q2 ? MAGIC_Q2 : MAGIC_Q1);
+
+    if (!compress_write_header(output_file, format, n_levels, compression_rate))
+    {
+        log_message(LOG_LEVEL_ERROR, "Failed to write file header");
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Shared pipeline: header, then payload
+ *
+ * A Q1 payload is sized before it is coded, so the header goes first and
+ * the levels stream to the file as they come out of the encoder, behind
+ * a writer thread once there is more than a block of them. Q2 only knows
+ * its size after the rANS coder has run over everything, so it is coded
+ * into memory and written in one go.
+ *
+ * @param payload_bits Exact Q1 payload size of ctx
+ */
+static qtree_status_t compress_with(bool (*encode)(qtree_compress_state_t *, const void *),
+                                    size_t (*payload_bits)(const void *), const void *ctx,
+                                    uint32_t n_levels, uint32_t size, qtree_format_t format,
+                                    const char *output_filename, FILE *output_file,
+                                    qtc_stats_t *stats)
+{
+    qtree_compress_state_t state;
+    qtree_status_t status;
+
+    // Track compression time
+    const double start_time = wall_seconds();
+    const size_t original_size = (size_t)size * size * 8;
+
+    if (format == QTREE_FORMAT_Q1)
+    {
+        const size_t bits = payload_bits(ctx);
+        if (!write_output_header(output_filename, output_file, format, n_levels,
+                                 compress_get_rate(bits, original_size)))
+            return QTREE_ERROR_FORMAT;
+
+        // A thread only pays off once the ring has something to overlap
+        const bool write_behind = (bits + 7) / 8 > ASYNC_IO_BLOCK_SIZE;
+        log_item("Streaming data", "%.2f KB%s", (double)((bits + 7) / 8) / 1024.0,
+                 write_behind ? ", written behind" : "");
+
+        status = encode_payload(encode, ctx, n_levels, size, format, output_file,
+                                write_behind, &state);
+        if (status != QTREE_SUCCESS)
+            return status;
+        qtc_stats_stage(stats, QTC_STAGE_ENCODE, start_time);
+    }
+    else
+    {
+        status = encode_payload(encode, ctx, n_levels, size, format, NULL, false, &state);
+        if (status != QTREE_SUCCESS)
+            return status;
+        qtc_stats_stage(stats, QTC_STAGE_ENCODE, start_time);
+        const double write_start = wall_seconds();
+
+        if (!write_output_header(output_filename, output_file, format, n_levels,
+                                 compress_get_rate(state.total_bits, original_size)))
+        {
+            compress_release(&state);
+            return QTREE_ERROR_FORMAT;
+        }
+
+        // The payload goes out in a single write
+        log_item("Writing data", "%.2f KB", (double)state.buffer_used / 1024.0);
+
+        if (fwrite(state.buffer, 1, state.buffer_used, output_file) != state.buffer_used)
+        {
+            compress_release(&state);
             log_message(LOG_LEVEL_ERROR, "Failed to write compressed data");
             return QTREE_ERROR_FORMAT;
         }
-        total_copied += bytes_read;
-        log_progress((double)total_copied / (double)total_bytes);
+        compress_release(&state);
+        qtc_stats_stage(stats, QTC_STAGE_WRITE, write_start);
     }
 
-    log_end_progress();
-    fclose(temp_buffer);
+    if (stats)
+    {
+        stats->bits_in = original_size;
+        stats->bits_out = state.total_bits;
+    }
 
     // Log final statistics
-    log_size_stats(original_size, temp_state.total_bits,
-                   temp_state.processed_nodes, cpu_time);
+    const float compression_rate = compress_get_rate(state.total_bits, original_size);
+    log_size_stats(original_size, state.total_bits,
+                   state.processed_nodes, wall_seconds() - start_time);
 
     log_message(LOG_LEVEL_SUCCESS, "Compression completed with %.2f%% ratio",
                 (double)compression_rate);
@@ -354,11 +901,128 @@ qtree_status_t compress(const qtree_t *tree, const char *output_filename, FILE *
     return QTREE_SUCCESS;
 }
 
-static void update_node_variance(qtree_node_t *node)
+qtree_status_t compress_to_buffer(const qtree_t *tree, uint8_t **data, size_t *length)
 {
-    if (!node || qtree_is_leaf(node))
-        return;
+    if (!tree || !tree->root || !data || !length)
+    {
+        log_message(LOG_LEVEL_ERROR, "Invalid compression parameters");
+        return QTREE_ERROR_INVALID_PARAM;
+    }
+
+    qtree_compress_state_t state;
+    qtree_status_t status = encode_payload(compress_tree_data, tree, tree->n_levels,
+                                           tree->size, QTREE_FORMAT_Q1, NULL, false, &state);
+    if (status != QTREE_SUCCESS)
+        return status;
+
+    const size_t original_size = (size_t)tree->size * tree->size * 8;
+    char text[HEADER_TEXT_SIZE];
+    const size_t text_length = format_header(text, QTREE_FORMAT_Q1,
+                                             compress_get_rate(state.total_bits, original_size));
+
+    // Slide the payload up and put the header in front of it
+    const size_t header_length = text_length + 1;
+    if (!make_room(&state, header_length))
+    {
+        compress_release(&state);
+        return QTREE_ERROR_MEMORY;
+    }
+    memmove(state.buffer + header_length, state.buffer, state.buffer_used);
+    memcpy(state.buffer, text, text_length);
+    state.buffer[text_length] = (uint8_t)tree->n_levels;
+
+    *data = state.buffer;
+    *length = state.buffer_used + header_length;
+    return QTREE_SUCCESS;
+}
+
+qtree_status_t compress_payload_to_buffer(const qtree_t *tree, qtree_format_t format,
+                                          uint8_t **data, size_t *length)
+{
+    if (!tree || !tree->root || !data || !length)
+    {
+        log_message(LOG_LEVEL_ERROR, "Invalid compression parameters");
+        return QTREE_ERROR_INVALID_PARAM;
+    }
+
+    qtree_compress_state_t state;
+    const qtree_status_t status = encode_payload(compress_tree_data, tree, tree->n_levels,
+                                                 tree->size, format, NULL, false, &state);
+    if (status != QTREE_SUCCESS)
+        return status;
+
+    // Keep the bytes, let go of the rest (the Q2 coder, if any)
+    *data = state.buffer;
+    *length = state.buffer_used;
+    state.buffer = NULL;
+    compress_release(&state);
+    return QTREE_SUCCESS;
+}
+
+/**
+ * @brief Compress a quadtree structure
+ */
+qtree_status_t compress(const qtree_t *tree, const char *output_filename, FILE *output_file)
+{
+    return compress_with_format(tree, QTREE_FORMAT_Q1, output_filename, output_file);
+}
+
+qtree_status_t compress_with_format(const qtree_t *tree, qtree_format_t format,
+                                    const char *output_filename, FILE *output_file)
+{
+    return compress_with_stats(tree, format, output_filename, output_file, NULL);
+}
 
+qtree_status_t compress_with_stats(const qtree_t *tree, qtree_format_t format,
+                                   const char *output_filename, FILE *output_file,
+                                   qtc_stats_t *stats)
+{
+    log_header("QUADTREE COMPRESSION");
+
+    // Validate parameters
+    if (!tree || !output_file || !tree->root)
+    {
+        log_message(LOG_LEVEL_ERROR, "Invalid compression parameters");
+        return QTREE_ERROR_INVALID_PARAM;
+    }
+
+    return compress_with(compress_tree_data, tree_payload_bits, tree, tree->n_levels,
+                         tree->size, format, output_filename, output_file, stats);
+}
+
+qtree_status_t compress_array(const qtree_array_t *tree, const char *output_filename,
+                              FILE *output_file)
+{
+    return compress_array_with_format(tree, QTREE_FORMAT_Q1, output_filename, output_file);
+}
+
+qtree_status_t compress_array_with_format(const qtree_array_t *tree, qtree_format_t format,
+                                          const char *output_filename, FILE *output_file)
+{
+    return compress_array_with_stats(tree, format, output_filename, output_file, NULL);
+}
+
+qtree_status_t compress_array_with_stats(const qtree_array_t *tree, qtree_format_t format,
+                                         const char *output_filename, FILE *output_file,
+                                         qtc_stats_t *stats)
+{
+    log_header("QUADTREE COMPRESSION");
+
+    if (!tree || !output_file || !tree->m)
+    {
+        log_message(LOG_LEVEL_ERROR, "Invalid compression parameters");
+        return QTREE_ERROR_INVALID_PARAM;
+    }
+
+    return compress_with(compress_array_data, array_payload_bits, tree, tree->n_levels,
+                         tree->size, format, output_filename, output_file, stats);
+}
+
+/**
+ * @brief Variance the filter sees for a node, from its children's v
+ */
+static float filter_node_variance(const qtree_node_t *node)
+{
     float sum = 0.0f;
     for (int i = 0; i < 4; i++)
     {
@@ -371,7 +1035,15 @@ static void update_node_variance(qtree_node_t *node)
             sum += diff * diff;
         }
     }
-    node->v = sqrtf(sum / 4.0f);
+    return sqrtf(sum / 4.0f);
+}
+
+static void update_node_variance(qtree_node_t *node)
+{
+    if (!node || qtree_is_leaf(node))
+        return;
+
+    node->v = filter_node_variance(node);
 }
 
 static bool is_uniform_block(qtree_node_t *node)
@@ -406,10 +1078,44 @@ static bool is_uniform_block(qtree_node_t *node)
     return true;
 }
 
+/**
+ * @brief Second half of filtering a node, once its children are done
+ * @return The node's u afterwards
+ */
+static bool filter_node_finish(qtree_arena_t *arena, qtree_node_t *node,
+                               float threshold, bool all_children_uniform)
+{
+    // Node can be made uniform if:
+    // 1. Its variance is below threshold AND
+    // 2. All its children are uniform or it's at the leaf level
+    if ((node->v <= threshold) && all_children_uniform)
+    {
+        // Make node uniform and hand children back to the arena
+        node->u = 1;
+        node->e = 0;
+        for (int i = 0; i < 4; i++)
+        {
+            if (node->children[i])
+            {
+                qtree_arena_release_subtree(arena, node->children[i]);
+                node->children[i] = NULL;
+            }
+        }
+        return true;
+    }
+    else
+    {
+        // Update uniformity flag based on children
+        node->u = is_uniform_block(node);
+        return node->u;
+    }
+}
+
 /**
  * @brief Apply variance-based filtering to a node and its subtree
  */
-static bool filter_node_recursive(qtree_node_t *node, float threshold, float alpha)
+static bool filter_node_recursive(qtree_arena_t *arena, qtree_node_t *node,
+                                  float threshold, float alpha)
 {
     if (!node || qtree_is_leaf(node))
     {
@@ -425,37 +1131,292 @@ static bool filter_node_recursive(qtree_node_t *node, float threshold, float alp
     {
         if (node->children[i])
         {
-            if (!filter_node_recursive(node->children[i], threshold * alpha, alpha))
+            if (!filter_node_recursive(arena, node->children[i], threshold * alpha, alpha))
             {
                 all_children_uniform = false;
             }
         }
     }
 
-    // Node can be made uniform if:
-    // 1. Its variance is below threshold AND
-    // 2. All its children are uniform or it's at the leaf level
-    if ((node->v <= threshold) && all_children_uniform)
+    return filter_node_finish(arena, node, threshold, all_children_uniform);
+}
+
+/**
+ * @brief Threshold the recursion has reached at a depth
+ *
+ * Same multiplications in the same order, so the very same float.
+ */
+static float threshold_at(float threshold, float alpha, uint32_t level)
+{
+    for (uint32_t l = 0; l < level; l++)
     {
-        // Make node uniform and free children
-        node->u = 1;
-        node->e = 0;
-        for (int i = 0; i < 4; i++)
+        threshold *= alpha;
+    }
+    return threshold;
+}
+
+/**
+ * @brief What the workers of a filter pass share
+ */
+typedef struct
+{
+    qtree_t *tree;
+    qtree_arena_t *sides; /* Per worker, for what they prune ([0] uses the tree's) */
+    float threshold;      /* At the root */
+    float alpha;
+} filter_walk_t;
+
+static void filter_enter(void *ctx, qtree_node_t *node, const qtree_walk_cell_t *cell)
+{
+    (void)ctx;
+    (void)cell;
+    update_node_variance(node);
+}
+
+static void filter_subtree(void *ctx, qtree_node_t *node, const qtree_walk_cell_t *cell,
+                           uint32_t worker, void *result)
+{
+    const filter_walk_t *walk = ctx;
+    qtree_arena_t *arena = worker == 0 ? &walk->tree->arena : &walk->sides[worker];
+    *(bool *)result = filter_node_recursive(arena, node,
+                                            threshold_at(walk->threshold, walk->alpha, cell->level),
+                                            walk->alpha);
+}
+
+static void filter_leave(void *ctx, qtree_node_t *node, const qtree_walk_cell_t *cell,
+                         const void *const children[4], void *result)
+{
+    const filter_walk_t *walk = ctx;
+    bool all_children_uniform = true;
+    for (int q = 0; q < 4; q++)
+    {
+        if (children[q] && !*(const bool *)children[q])
+            all_children_uniform = false;
+    }
+    *(bool *)result = filter_node_finish(&walk->tree->arena, node,
+                                         threshold_at(walk->threshold, walk->alpha, cell->level),
+                                         all_children_uniform);
+}
+
+static const qtree_walk_t filter_pass = {
+    .enter = filter_enter,
+    .subtree = filter_subtree,
+    .leave = filter_leave,
+    .result_size = sizeof(bool)};
+
+/**
+ * @brief filter_node_recursive on the whole tree, on its pool if it has one
+ */
+static void filter_tree(qtree_t *tree, float threshold, float alpha)
+{
+    const uint32_t workers = tree->pool ? thread_pool_size(tree->pool) : 1;
+    qtree_arena_t *sides = calloc(workers, sizeof(qtree_arena_t));
+    filter_walk_t walk = {.tree = tree, .sides = sides, .threshold = threshold, .alpha = alpha};
+
+    bool uniform;
+    qtree_walk(&filter_pass, &walk, tree->root, tree->size, sides ? tree->pool : NULL, &uniform);
+
+    for (uint32_t w = 1; sides && w < workers; w++)
+    {
+        qtree_arena_take_released(&tree->arena, &sides[w]);
+    }
+    free(sides);
+}
+
+/**
+ * @brief Tells what filter_node_recursive would do, without doing it
+ */
+typedef struct
+{
+    bool uniform;    /* u after filtering */
+    size_t bits;     /* Bits the encoder writes for the node and below */
+    uint64_t sum;    /* Sum of the original pixels under the node */
+    uint64_t sum_sq; /* Sum of their squares */
+    uint64_t error;  /* Squared error of what the decoder paints */
+} filter_estimate_t;
+
+/**
+ * @brief Second half of estimate_node, once the children are estimated
+ * @param children Estimates in quadrant order ({.uniform = true} where
+ *                 there is no child)
+ */
+static filter_estimate_t estimate_combine(const qtree_node_t *node, uint32_t level,
+                                          uint32_t n_levels, float threshold,
+                                          bool is_interpolated,
+                                          const filter_estimate_t children[4])
+{
+    filter_estimate_t est = {0};
+    const uint64_t pixels = (uint64_t)1 << (2 * (n_levels - level));
+    const float v = filter_node_variance(node);
+
+    bool all_children_uniform = true;
+    for (int q = 0; q < 4; q++)
+    {
+        if (node->children[q])
+            all_children_uniform = all_children_uniform && children[q].uniform;
+        est.sum += children[q].sum;
+        est.sum_sq += children[q].sum_sq;
+    }
+
+    uint8_t e = node->e;
+    if (v <= threshold && all_children_uniform)
+    {
+        est.uniform = true;
+        e = 0;
+    }
+    else
+    {
+        // Same test as is_uniform_block, on the flags the children would get
+        est.uniform = e == 0;
+        for (int i = 0; i < 4 && est.uniform; i++)
         {
-            if (node->children[i])
-            {
-                free_quadtree_recursive(node->children[i]);
-                node->children[i] = NULL;
-            }
+            const qtree_node_t *child = node->children[i];
+            if (child && (!children[i].uniform ||
+                          (node->children[0] && child->m != node->children[0]->m)))
+                est.uniform = false;
         }
-        return true;
+    }
+
+    est.bits = node_field_bits(e, false, is_interpolated);
+    if (est.uniform)
+    {
+        // One flat block of m: Σ(p - m)² = Σp² + n·m² - 2m·Σp
+        const uint64_t m = node->m;
+        est.error = est.sum_sq + pixels * m * m - 2 * m * est.sum;
     }
     else
     {
-        // Update uniformity flag based on children
-        node->u = is_uniform_block(node);
-        return node->u;
+        for (int q = 0; q < 4; q++)
+        {
+            est.bits += children[q].bits;
+            est.error += children[q].error;
+        }
+    }
+    return est;
+}
+
+/**
+ * @brief Dry run of filter_node_recursive on an untouched tree
+ *
+ * Makes the same decisions with the same float operations, but only
+ * reads the tree. The pixel moments come from the tree itself, which is
+ * exact as long as nothing has been filtered yet.
+ */
+static filter_estimate_t estimate_node(const qtree_node_t *node, uint32_t level,
+                                       uint32_t n_levels, float threshold, float alpha,
+                                       bool is_interpolated)
+{
+    if (qtree_is_leaf(node))
+    {
+        const uint64_t pixels = (uint64_t)1 << (2 * (n_levels - level));
+        filter_estimate_t est = {.uniform = true};
+        est.sum = pixels * node->m;
+        est.sum_sq = pixels * node->m * node->m;
+        est.bits = node_field_bits(node->e, level == n_levels && node->e == 0 && node->u,
+                                   is_interpolated);
+        return est;
+    }
+
+    filter_estimate_t children[4];
+    for (int i = 0; i < 4; i++)
+    {
+        const int q = quadrant_order[i];
+        children[q] = node->children[q]
+                          ? estimate_node(node->children[q], level + 1, n_levels,
+                                          threshold * alpha, alpha, i == 3)
+                          : (filter_estimate_t){.uniform = true};
+    }
+    return estimate_combine(node, level, n_levels, threshold, is_interpolated, children);
+}
+
+/**
+ * @brief What the estimate pass needs to know
+ */
+typedef struct
+{
+    uint32_t n_levels;
+    float threshold; /* At the root */
+    float alpha;
+} estimate_walk_t;
+
+static void estimate_subtree(void *ctx, qtree_node_t *node, const qtree_walk_cell_t *cell,
+                             uint32_t worker, void *result)
+{
+    (void)worker;
+    const estimate_walk_t *walk = ctx;
+    *(filter_estimate_t *)result =
+        estimate_node(node, cell->level, walk->n_levels,
+                      threshold_at(walk->threshold, walk->alpha, cell->level), walk->alpha,
+                      cell_is_interpolated(cell));
+}
+
+static void estimate_leave(void *ctx, qtree_node_t *node, const qtree_walk_cell_t *cell,
+                           const void *const children[4], void *result)
+{
+    const estimate_walk_t *walk = ctx;
+    filter_estimate_t estimates[4];
+    for (int q = 0; q < 4; q++)
+    {
+        estimates[q] = children[q] ? *(const filter_estimate_t *)children[q]
+                                   : (filter_estimate_t){.uniform = true};
     }
+    *(filter_estimate_t *)result =
+        estimate_combine(node, cell->level, walk->n_levels,
+                         threshold_at(walk->threshold, walk->alpha, cell->level),
+                         cell_is_interpolated(cell), estimates);
+}
+
+static const qtree_walk_t estimate_pass = {
+    .subtree = estimate_subtree,
+    .leave = estimate_leave,
+    .result_size = sizeof(filter_estimate_t)};
+
+/**
+ * @brief File size and quality a given alpha would give
+ * @param alpha 1.0 or below means no filtering at all
+ */
+static qtree_lossy_estimate_t estimate_lossy(const qtree_t *tree, float threshold, float alpha)
+{
+    // A negative threshold prunes nothing, which is the lossless tree
+    estimate_walk_t walk = {
+        .n_levels = tree->n_levels,
+        .threshold = alpha > 1.0f ? threshold : -1.0f,
+        .alpha = alpha};
+    filter_estimate_t est;
+    qtree_walk(&estimate_pass, &walk, tree->root, tree->size, tree->pool, &est);
+
+    const size_t original_bits = (size_t)tree->size * tree->size * 8;
+    char text[HEADER_TEXT_SIZE];
+    const double mse = (double)est.error / ((double)tree->size * tree->size);
+
+    return (qtree_lossy_estimate_t){
+        .alpha = alpha > 1.0f ? alpha : 1.0f,
+        .bits = est.bits,
+        .bytes = format_header(text, QTREE_FORMAT_Q1,
+                               compress_get_rate(est.bits, original_bits)) + 1 +
+                 (est.bits + 7) / 8,
+        .mse = mse,
+        .psnr = qtree_psnr_from_mse(mse)};
+}
+
+static bool meets_target(const qtree_lossy_estimate_t *est, const qtree_rate_target_t *target)
+{
+    return target->kind == RATE_TARGET_BYTES ? (double)est->bytes <= target->value
+                                             : est->psnr >= target->value;
+}
+
+/**
+ * @brief Compute the stats and starting threshold the filter uses
+ */
+static float lossy_initial_threshold(qtree_t *tree)
+{
+    qtree_variance_stats_t stats = calculate_variance_stats(tree);
+    float initial_threshold = stats.median_variance / stats.max_variance;
+
+    log_item("Initial threshold", "%.4f", (double)initial_threshold);
+    log_item("Median variance", "%.4f", (double)stats.median_variance);
+    log_item("Maximum variance", "%.4f", (double)stats.max_variance);
+    return initial_threshold;
 }
 
 qtree_status_t apply_lossy_compression(qtree_t *tree, float alpha)
@@ -467,16 +1428,193 @@ qtree_status_t apply_lossy_compression(qtree_t *tree, float alpha)
     log_item("Alpha parameter", "%.2f", (double)alpha);
 
     // Calculate initial statistics
-    qtree_variance_stats_t stats = calculate_variance_stats(tree);
+    const float initial_threshold = lossy_initial_threshold(tree);
+
+    // Apply filtering
+    filter_tree(tree, initial_threshold, alpha);
+
+    log_message(LOG_LEVEL_SUCCESS, "Lossy filtering applied successfully");
+    return QTREE_SUCCESS;
+}
+
+qtree_status_t estimate_lossy_compression(qtree_t *tree, float alpha,
+                                          qtree_lossy_estimate_t *estimate)
+{
+    if (!tree || !tree->root || !estimate)
+        return QTREE_ERROR_INVALID_PARAM;
+
+    const qtree_variance_stats_t stats = calculate_variance_stats(tree);
+    *estimate = estimate_lossy(tree, stats.median_variance / stats.max_variance, alpha);
+    return QTREE_SUCCESS;
+}
+
+qtree_status_t apply_lossy_compression_target(qtree_t *tree, const qtree_rate_target_t *target,
+                                              qtree_lossy_estimate_t *chosen)
+{
+    if (!tree || !tree->root || !target || target->kind == RATE_TARGET_NONE)
+        return QTREE_ERROR_INVALID_PARAM;
+
+    // The search prices Q1 bits, a Q2 file would miss the target either way
+    if (target->format != QTREE_FORMAT_Q1)
+        return QTREE_ERROR_INVALID_PARAM;
+
+    log_subheader("Rate Control");
+    if (target->kind == RATE_TARGET_BYTES)
+        log_item("Target size", "%.0f bytes", target->value);
+    else
+        log_item("Target quality", "%.2f dB PSNR", target->value);
+
+    const float threshold = lossy_initial_threshold(tree);
+
+    // Lossless is the best quality and the biggest file
+    qtree_lossy_estimate_t best = estimate_lossy(tree, threshold, 1.0f);
+    const bool lossless_ok = meets_target(&best, target);
+
+    if (target->kind == RATE_TARGET_BYTES && !lossless_ok)
+    {
+        // Smallest alpha that still fits: keep the best quality under budget
+        qtree_lossy_estimate_t hi = estimate_lossy(tree, threshold, RATE_ALPHA_MAX);
+        best = hi;
+        if (meets_target(&hi, target))
+        {
+            float lo_alpha = 1.0f;
+            float hi_alpha = RATE_ALPHA_MAX;
+            for (int step = 0; step < RATE_SEARCH_STEPS; step++)
+            {
+                const float mid = sqrtf(lo_alpha * hi_alpha);
+                const qtree_lossy_estimate_t est = estimate_lossy(tree, threshold, mid);
+                if (meets_target(&est, target))
+                {
+                    hi_alpha = mid;
+                    best = est;
+                }
+                else
+                {
+                    lo_alpha = mid;
+                }
+            }
+        }
+        else
+        {
+            log_warn("Target size is out of reach, using alpha %.1f", (double)RATE_ALPHA_MAX);
+        }
+    }
+    else if (target->kind == RATE_TARGET_PSNR)
+    {
+        // Biggest alpha that still looks good enough: keep the smallest file
+        qtree_lossy_estimate_t hi = estimate_lossy(tree, threshold, RATE_ALPHA_MAX);
+        if (meets_target(&hi, target))
+        {
+            best = hi;
+        }
+        else
+        {
+            float lo_alpha = 1.0f;
+            float hi_alpha = RATE_ALPHA_MAX;
+            for (int step = 0; step < RATE_SEARCH_STEPS; step++)
+            {
+                const float mid = sqrtf(lo_alpha * hi_alpha);
+                const qtree_lossy_estimate_t est = estimate_lossy(tree, threshold, mid);
+                if (meets_target(&est, target))
+                {
+                    lo_alpha = mid;
+                    best = est;
+                }
+                else
+                {
+                    hi_alpha = mid;
+                }
+            }
+        }
+    }
+
+    log_item("Chosen alpha", best.alpha > 1.0f ? "%.4f" : "%.4f (lossless)", (double)best.alpha);
+    log_item("Estimated size", "%zu bytes", best.bytes);
+    log_item("Estimated PSNR", "%.2f dB", best.psnr);
+
+    if (best.alpha > 1.0f)
+    {
+        filter_tree(tree, threshold, best.alpha);
+        log_message(LOG_LEVEL_SUCCESS, "Lossy filtering applied successfully");
+    }
+
+    if (chosen)
+        *chosen = best;
+    return QTREE_SUCCESS;
+}
+
+/**
+ * @brief Array version of filter_node_recursive
+ *
+ * Same visiting order and the same float operations as the pointer
+ * walk, so both layouts prune exactly the same nodes. Pruned nodes only
+ * get flagged here; qtree_array_normalize clears what's under them.
+ */
+static bool filter_array_recursive(qtree_array_t *tree, size_t i, uint32_t level,
+                                   float threshold, float alpha)
+{
+    if (level == tree->n_levels || tree->u[i])
+    {
+        return true;
+    }
+
+    const size_t c = qtree_first_child_index(i);
+
+    // First calculate variance properly
+    float sum = 0.0f;
+    for (size_t k = 0; k < 4; k++)
+    {
+        sum += tree->v[c + k] * tree->v[c + k];
+        float diff = (float)(tree->m[i] - tree->m[c + k]);
+        sum += diff * diff;
+    }
+    tree->v[i] = sqrtf(sum / 4.0f);
+
+    // Process children with increased threshold
+    bool all_children_uniform = true;
+    for (size_t k = 0; k < 4; k++)
+    {
+        if (!filter_array_recursive(tree, c + k, level + 1, threshold * alpha, alpha))
+        {
+            all_children_uniform = false;
+        }
+    }
+
+    if ((tree->v[i] <= threshold) && all_children_uniform)
+    {
+        tree->u[i] = 1;
+        tree->e[i] = 0;
+        return true;
+    }
+
+    // Update uniformity flag based on children
+    bool uniform = tree->e[i] == 0;
+    for (size_t k = 0; k < 4 && uniform; k++)
+    {
+        uniform = tree->u[c + k] && tree->m[c + k] == tree->m[c];
+    }
+    tree->u[i] = uniform ? 1 : 0;
+    return uniform;
+}
+
+qtree_status_t apply_lossy_compression_array(qtree_array_t *tree, float alpha)
+{
+    if (!tree || !tree->m || alpha <= 1.0f)
+        return QTREE_ERROR_INVALID_PARAM;
+
+    log_subheader("Applying Lossy Filtering");
+    log_item("Alpha parameter", "%.2f", (double)alpha);
+
+    qtree_variance_stats_t stats = qtree_array_variance_stats(tree);
     float initial_threshold = stats.median_variance / stats.max_variance;
 
     log_item("Initial threshold", "%.4f", (double)initial_threshold);
     log_item("Median variance", "%.4f", (double)stats.median_variance);
     log_item("Maximum variance", "%.4f", (double)stats.max_variance);
 
-    // Apply filtering
-    filter_node_recursive(tree->root, initial_threshold, alpha);
+    filter_array_recursive(tree, 0, 0, initial_threshold, alpha);
+    qtree_array_normalize(tree);
 
     log_message(LOG_LEVEL_SUCCESS, "Lossy filtering applied successfully");
     return QTREE_SUCCESS;
-}
\ No newline at end of file
+}
@@ -4,18 +4,22 @@
  */
 
 #include "codec/decompression.h"
+#include "codec/bit_reader.h"
+#include "codec/entropy.h"
+#include "core/node_arena.h"
+#include "core/tree_walk.h"
 #include "logger/logger.h"
+#include "common/block_fill.h"
 #include "common/common.h"
 
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
 #include <ctype.h>
-#include <time.h>
 
-static void extract_pixels(const qtree_node_t *node, uint8_t *pixels,
-                           uint32_t row, uint32_t col,
-                           uint32_t size, uint32_t total_size);
+static void extract_pixels(const qtree_node_t *node, uint8_t *block,
+                           size_t stride, uint32_t size);
+static void extract_tree(const qtree_t *tree, uint8_t *pixels);
 
 /**
  * @brief Enhanced statistics tracking for detailed progress reporting
@@ -26,14 +30,12 @@ typedef struct
     {
         size_t total;     // Total nodes estimate
         size_t processed; // Currently processed count
-        double rate;      // Processing rate (nodes/sec)
     } nodes;
 
     struct
     {
         size_t read;     // Bits read from input
         size_t original; // Original image size in bits
-        double ratio;    // Compression ratio
     } bits;
 
     struct
@@ -43,7 +45,7 @@ typedef struct
         double progress;  // Overall progress (0-1)
     } levels;
 
-    clock_t start_time; // Processing start timestamp
+    double start_time; // Processing start (wall clock)
 } decompress_stats_t;
 
 /**
@@ -51,28 +53,20 @@ typedef struct
  */
 typedef struct
 {
-    uint8_t buffer;            // Current byte buffer
-    size_t position;           // Current bit position
-    FILE *file;                // Input file stream
-    bool eof;                  // End-of-file indicator
+    qtree_bit_reader_t bits;   // Buffered input bits
+    qtree_arena_t *arena;      // Where decoded nodes are allocated
     decompress_stats_t *stats; // Statistics reference
+    qtree_q2_decoder_t *q2;    // Q2 tables and state (NULL for Q1)
     bool has_error;            // Error state indicator
     const char *error_msg;     // Error message if any
 } bit_reader_t;
 
 static void update_progress(decompress_stats_t *stats)
 {
-    stats->levels.progress = (double)stats->levels.current / stats->levels.max;
-    stats->nodes.rate = (double)stats->nodes.processed /
-                        ((double)(clock() - stats->start_time) / CLOCKS_PER_SEC);
-
-    // Update compression ratio
-    if (stats->bits.original > 0)
-    {
-        stats->bits.ratio = (double)stats->bits.read / (double)stats->bits.original * 100.0;
-    }
-
-    log_progress((double)stats->levels.progress);
+    stats->levels.progress = stats->levels.max > 0
+                                 ? (double)stats->levels.current / stats->levels.max
+                                 : 1.0;
+    log_progress_hook(stats->levels.progress);
 }
 
 static decompress_stats_t init_stats(uint32_t max_levels, size_t image_size)
@@ -83,70 +77,184 @@ static decompress_stats_t init_stats(uint32_t max_levels, size_t image_size)
     return (decompress_stats_t){
         .nodes = {
             .total = total_nodes,
-            .processed = 0,
-            .rate = 0.0},
-        .bits = {.read = 0, .original = original_bits, .ratio = 0.0},
+            .processed = 0},
+        .bits = {.read = 0, .original = original_bits},
         .levels = {.current = 0, .max = max_levels, .progress = 0.0},
-        .start_time = clock()};
+        .start_time = wall_seconds()};
 }
 
-static uint8_t read_bit(bit_reader_t *reader)
+static inline uint8_t read_bits(bit_reader_t *reader, uint32_t num_bits)
 {
-    if (reader->has_error || reader->eof)
+    const uint8_t value = (uint8_t)bit_reader_read(&reader->bits, num_bits);
+    if (reader->bits.has_error && !reader->has_error)
     {
-        return 0;
+        reader->has_error = true;
+        reader->error_msg = reader->bits.error_msg;
+    }
+    return value;
+}
+
+static inline uint8_t read_bit(bit_reader_t *reader)
+{
+    return read_bits(reader, 1);
+}
+
+/**
+ * @brief The three explicit means of a Q1 bottom family in one read
+ *
+ * Leaves carry nothing but their 8-bit mean, so the family is 24
+ * straight bits; the fourth mean is interpolated from them.
+ *
+ * @param means Set to the four means in quadrant order
+ */
+static inline void read_leaf_family(bit_reader_t *reader, uint8_t parent_m, uint8_t parent_e,
+                                    uint8_t means[4])
+{
+    const uint32_t bits = bit_reader_read(&reader->bits, 24);
+    if (reader->bits.has_error && !reader->has_error)
+    {
+        reader->has_error = true;
+        reader->error_msg = reader->bits.error_msg;
     }
+    means[0] = (uint8_t)(bits >> 16);
+    means[1] = (uint8_t)(bits >> 8);
+    means[2] = (uint8_t)bits;
+    means[3] = calculate_fourth_mean(parent_m, parent_e, means[0], means[1], means[2]);
+}
+
+/* The root has no parent; Q2 codes its mean against mid-grey */
+#define ROOT_PARENT_MEAN 128u
 
-    if (reader->position == 8)
+/**
+ * @brief Pass a failure of the underlying bit reader on
+ */
+static void check_source(bit_reader_t *reader)
+{
+    if (reader->bits.has_error && !reader->has_error)
     {
-        size_t bytes_read = fread(&reader->buffer, 1, 1, reader->file);
-        if (bytes_read != 1)
-        {
-            reader->eof = true;
-            reader->has_error = true;
-            reader->error_msg = "Unexpected end of file while reading bits";
-            return 0;
-        }
-        reader->position = 0;
+        reader->has_error = true;
+        reader->error_msg = reader->bits.error_msg;
+    }
+}
+
+/**
+ * @brief Q2 decoding doesn't stop for errors; this picks them up
+ *
+ * Called once per level: a damaged stream only ever produces wrong
+ * values in the meantime, never a read outside the tables.
+ */
+static void check_payload(bit_reader_t *reader)
+{
+    if (!reader->q2)
+        return;
+
+    check_source(reader);
+    if (reader->q2->corrupt && !reader->has_error)
+    {
+        reader->has_error = true;
+        reader->error_msg = "Invalid entropy-coded data";
     }
+}
+
+/**
+ * @brief Next explicit mean: 8 raw bits (Q1) or a residual (Q2)
+ * @param parent_m Parent's mean (ROOT_PARENT_MEAN for the root)
+ * @param height Block height of the node, 0 for pixels
+ * @param family Earlier siblings; only Q2 reads or updates it
+ */
+static uint8_t read_mean(bit_reader_t *reader, uint8_t parent_m, uint32_t height,
+                         qtree_q2_family_t *family)
+{
+    if (!reader->q2)
+        return read_bits(reader, 8);
+
+    const int32_t m = (int32_t)parent_m + q2_decode_residual(reader->q2, height, family);
+    reader->q2->corrupt |= m < 0 || m > 255;
+    return (uint8_t)(m & 0xFF);
+}
 
-    uint8_t bit = (reader->buffer >> (7 - reader->position)) & 1;
-    reader->position++;
-    reader->stats->bits.read++;
-    return bit;
+/**
+ * @brief e, then u if e is 0 (u is 0 otherwise)
+ * @param height Block height of the node, never 0
+ */
+static void read_flags(bit_reader_t *reader, uint32_t height, uint8_t *e, uint8_t *u)
+{
+    if (reader->q2)
+    {
+        q2_decode_flags(reader->q2, height, e, u);
+        return;
+    }
+    *e = read_bits(reader, 2);
+    *u = *e == 0 ? read_bit(reader) : 0;
 }
 
-static uint8_t read_bits(bit_reader_t *reader, size_t num_bits)
+/**
+ * @brief Get ready for the payload once the bit reader is open
+ *
+ * Q1 reads raw bits, so there is nothing to do. Q2 reads its coder
+ * state and frequency tables first.
+ *
+ * @param magic What process_file_header() found
+ * @return False (error set) if that fails
+ */
+static bool begin_payload(bit_reader_t *reader, const char *magic)
 {
-    if (reader->has_error || reader->eof || num_bits > 8)
+    reader->q2 = NULL;
+    if (magic[1] != '2')
+        return true;
+
+    reader->q2 = malloc(sizeof(*reader->q2));
+    if (!reader->q2)
     {
-        return 0;
+        reader->has_error = true;
+        reader->error_msg = "Memory allocation failed for the entropy tables";
+        return false;
     }
 
-    uint8_t value = 0;
-    for (size_t i = 0; i < num_bits; i++)
+    if (!q2_decoder_init(reader->q2, &reader->bits))
     {
-        value = (uint8_t)((value << 1) | read_bit(reader));
-        if (reader->eof && i < num_bits - 1)
+        check_source(reader);
+        if (!reader->has_error)
         {
             reader->has_error = true;
-            reader->error_msg = "Incomplete byte while reading multiple bits";
-            return 0;
+            reader->error_msg = "Invalid entropy-coded stream";
         }
+        return false;
     }
-    return value;
+    return true;
+}
+
+/**
+ * @brief Closes the bit reader and drops the Q2 tables
+ */
+static void reader_close(bit_reader_t *reader)
+{
+    if (reader->q2)
+    {
+        q2_decoder_release(reader->q2);
+        free(reader->q2);
+        reader->q2 = NULL;
+    }
+    bit_reader_close(&reader->bits);
+}
+
+/**
+ * @brief Q1 or Q2 followed by a newline
+ */
+static bool valid_magic(const char *magic)
+{
+    return magic[0] == 'Q' && (magic[1] == '1' || magic[1] == '2');
 }
 
 static void process_file_header(FILE *file, char *magic, uint8_t *levels)
 {
     // Read and validate magic number
-    if (fread(magic, 1, 2, file) != 2 || strncmp(magic, "Q1", 2) != 0 ||
-        fgetc(file) != '\n')
+    if (fread(magic, 1, 2, file) != 2 || !valid_magic(magic) || fgetc(file) != '\n')
     {
-        log_message(LOG_LEVEL_ERROR, "Invalid file signature (expected 'Q1')");
+        log_message(LOG_LEVEL_ERROR, "Invalid file signature (expected 'Q1' or 'Q2')");
         return;
     }
-    log_item("Signature", "Q1 (valid)");
+    log_item("Signature", "%s (valid)", magic);
 
     // Process metadata comments
     char line[256];
@@ -188,7 +296,7 @@ static qtree_node_t *decompress_node(bit_reader_t *reader, uint32_t level,
         return NULL;
     }
 
-    qtree_node_t *node = calloc(1, sizeof(qtree_node_t));
+    qtree_node_t *node = qtree_arena_alloc(reader->arena);
     if (!node)
     {
         reader->has_error = true;
@@ -201,7 +309,14 @@ static qtree_node_t *decompress_node(bit_reader_t *reader, uint32_t level,
     // Handle mean value computation
     if (child_index < 3)
     {
-        node->m = read_bits(reader, 8);
+        qtree_q2_family_t family = {0};
+        if (reader->q2 && parent)
+        {
+            for (int j = 0; j < child_index; j++)
+                q2_family_add(&family, (int32_t)parent->children[j]->m - (int32_t)parent->m);
+        }
+        node->m = read_mean(reader, parent ? parent->m : ROOT_PARENT_MEAN,
+                            max_level - level, &family);
     }
     else
     {
@@ -210,7 +325,7 @@ static qtree_node_t *decompress_node(bit_reader_t *reader, uint32_t level,
         {
             reader->has_error = true;
             reader->error_msg = "Invalid parent node structure";
-            free(node);
+            qtree_arena_release(reader->arena, node);
             return NULL;
         }
         node->m = calculate_fourth_mean(parent->m, parent->e,
@@ -222,25 +337,18 @@ static qtree_node_t *decompress_node(bit_reader_t *reader, uint32_t level,
     // Process node attributes based on level
     if (level < max_level)
     {
-        uint8_t error_bits = read_bits(reader, 2);
+        uint8_t error_bits = 0;
+        uint8_t uniform_bit = 0;
+        read_flags(reader, max_level - level, &error_bits, &uniform_bit);
         if (error_bits > 3)
         {
             reader->has_error = true;
             reader->error_msg = "Invalid error value";
-            free(node);
+            qtree_arena_release(reader->arena, node);
             return NULL;
         }
         node->e = (unsigned char)(error_bits & 0x3);
-
-        if (error_bits == 0)
-        {
-            uint8_t uniform_bit = read_bit(reader);
-            node->u = (unsigned char)(uniform_bit != 0) & 0x1;
-        }
-        else
-        {
-            node->u = 0;
-        }
+        node->u = (unsigned char)(uniform_bit != 0) & 0x1;
     }
     else
     {
@@ -299,13 +407,32 @@ static qtree_node_t **decompress_level(bit_reader_t *reader, uint32_t level,
             continue;
         }
 
+        // Q1 leaves: the whole family at once
+        if (level == max_level && !reader->q2) {
+            uint8_t means[4];
+            read_leaf_family(reader, parent->m, parent->e, means);
+            for (int j = 0; j < 4; j++) {
+                qtree_node_t *leaf = qtree_arena_alloc(reader->arena);
+                if (!leaf) {
+                    reader->has_error = true;
+                    reader->error_msg = "Memory allocation failed for new node";
+                    free(current_level);
+                    return NULL;
+                }
+                leaf->m = means[j];
+                leaf->u = 1;
+                parent->children[j] = leaf;
+                current_level[current_idx++] = leaf;
+            }
+            reader->stats->nodes.processed += 4;
+            continue;
+        }
+
         for (int j = 0; j < 4; j++) {
             current_level[current_idx] = decompress_node(reader, level, max_level,
                                                        parent, j);
             if (!current_level[current_idx]) {
-                for (size_t k = 0; k < current_idx; k++) {
-                    free(current_level[k]);
-                }
+                // Nodes already linked in stay with the tree's arena
                 free(current_level);
                 return NULL;
             }
@@ -314,14 +441,27 @@ static qtree_node_t **decompress_level(bit_reader_t *reader, uint32_t level,
         }
     }
 
+    check_payload(reader);
+    if (reader->has_error) {
+        free(current_level);
+        return NULL;
+    }
+
     // Update progress
     reader->stats->levels.current = level;
+    reader->stats->bits.read = bit_reader_bits_read(&reader->bits);
     update_progress(reader->stats);
 
     return current_level;
 }
 
 qtree_status_t qtree_decompress(FILE *file, const char *input_filename, qtree_t *tree)
+{
+    return qtree_decompress_with_stats(file, input_filename, tree, NULL);
+}
+
+qtree_status_t qtree_decompress_with_stats(FILE *file, const char *input_filename,
+                                           qtree_t *tree, qtc_stats_t *out)
 {
     log_header("QUADTREE DECOMPRESSION");
 
@@ -344,17 +484,27 @@ qtree_status_t qtree_decompress(FILE *file, const char *input_filename, qtree_t
     // Initialize tree structure
     tree->n_levels = n_levels;
     tree->size = 1 << n_levels;
+    tree->root = NULL;
+    qtree_arena_reset(&tree->arena);
 
     // Initialize statistics and bit reader
     decompress_stats_t stats = init_stats(n_levels, tree->size);
     bit_reader_t reader = {
-        .buffer = 0,
-        .position = 8,
-        .file = file,
-        .eof = false,
+        .arena = &tree->arena,
         .stats = &stats,
         .has_error = false,
         .error_msg = NULL};
+    if (!bit_reader_open_file(&reader.bits, file, true))
+    {
+        log_message(LOG_LEVEL_ERROR, "%s", reader.bits.error_msg);
+        return QTREE_ERROR_MEMORY;
+    }
+    if (!begin_payload(&reader, magic))
+    {
+        log_message(LOG_LEVEL_ERROR, "%s", reader.error_msg);
+        reader_close(&reader);
+        return QTREE_ERROR_FORMAT;
+    }
 
     // Display initial file information
     log_file_info("input.qtc", tree->size, n_levels, 0.0);
@@ -367,6 +517,7 @@ qtree_status_t qtree_decompress(FILE *file, const char *input_filename, qtree_t
     {
         log_message(LOG_LEVEL_ERROR, "Root node decompression failed: %s",
                     reader.error_msg ? reader.error_msg : "Unknown error");
+        reader_close(&reader);
         return QTREE_ERROR_FORMAT;
     }
 
@@ -375,13 +526,15 @@ qtree_status_t qtree_decompress(FILE *file, const char *input_filename, qtree_t
     if (!prev_level)
     {
         log_message(LOG_LEVEL_ERROR, "Memory allocation failed");
+        reader_close(&reader);
         return QTREE_ERROR_MEMORY;
     }
 
     prev_level[0] = tree->root;
     size_t prev_level_size = 1;
 
-    for (uint32_t level = 1; level <= n_levels && !reader.has_error; level++)
+    // Stop early once a level has no non-uniform nodes left to expand
+    for (uint32_t level = 1; level <= n_levels && prev_level_size > 0 && !reader.has_error; level++)
     {
         qtree_node_t **current_level = decompress_level(&reader, level, n_levels,
                                                         prev_level, prev_level_size);
@@ -390,6 +543,7 @@ qtree_status_t qtree_decompress(FILE *file, const char *input_filename, qtree_t
             log_message(LOG_LEVEL_ERROR, "Level %u decompression failed: %s",
                         level, reader.error_msg ? reader.error_msg : "Unknown error");
             free(prev_level);
+            reader_close(&reader);
             return QTREE_ERROR_FORMAT;
         }
 
@@ -409,11 +563,19 @@ qtree_status_t qtree_decompress(FILE *file, const char *input_filename, qtree_t
     }
 
     // Calculate final statistics
-    double cpu_time = (double)(clock() - stats.start_time) / CLOCKS_PER_SEC;
+    check_payload(&reader);
+    double elapsed = wall_seconds() - stats.start_time;
+    stats.bits.read = bit_reader_bits_read(&reader.bits);
+    reader_close(&reader);
+    if (out)
+    {
+        out->bits_in = stats.bits.read;
+        out->bits_out = stats.bits.original;
+    }
 
     log_end_progress();
     log_size_stats(stats.bits.original, stats.bits.read,
-                   stats.nodes.processed, cpu_time);
+                   stats.nodes.processed, elapsed);
 
     if (!reader.has_error)
     {
@@ -443,8 +605,8 @@ qtree_status_t qtree_to_pgm(const qtree_t *tree, const char *output_filename, pg
     pgm->max_value = 255;
 
     // Calculate memory requirements and allocate pixel buffer
-    size_t total_pixels = tree->size * tree->size;
-    pgm->pixels = calloc(total_pixels, sizeof(uint8_t));
+    size_t total_pixels = (size_t)tree->size * tree->size;
+    pgm->pixels = malloc(total_pixels);
     if (!pgm->pixels)
     {
         log_message(LOG_LEVEL_ERROR, "Memory allocation failed for pixel data");
@@ -457,17 +619,17 @@ qtree_status_t qtree_to_pgm(const qtree_t *tree, const char *output_filename, pg
     log_item("Memory allocated", "%.2f KB", (double)(total_pixels) / 1024.0);
 
     // Start pixel extraction with progress tracking
-    clock_t start_time = clock();
+    const double start_time = wall_seconds();
 
     // Extract pixels recursively from the quadtree
-    extract_pixels(tree->root, pgm->pixels, 0, 0, tree->size, tree->size);
+    extract_tree(tree, pgm->pixels);
 
     // Calculate and log performance metrics
-    double cpu_time = (double)(clock() - start_time) / CLOCKS_PER_SEC;
-    double pixels_per_sec = (double)total_pixels / cpu_time;
+    double elapsed = wall_seconds() - start_time;
+    double pixels_per_sec = (double)total_pixels / elapsed;
 
     log_item("Processing rate", "%.2f MP/s", pixels_per_sec / 1000000.0);
-    log_item("Processing time", "%.3f seconds", cpu_time);
+    log_item("Processing time", "%.3f seconds", elapsed);
 
     log_separator();
     log_message(LOG_LEVEL_SUCCESS, "PGM conversion completed successfully");
@@ -475,59 +637,938 @@ qtree_status_t qtree_to_pgm(const qtree_t *tree, const char *output_filename, pg
     return QTREE_SUCCESS;
 }
 
+/**
+ * @brief Paints a node over a 2x2 block, whatever shape it is in
+ *
+ * A missing node or child is black, a uniform node one value, else the
+ * four children's means with their offsets written out.
+ */
+static void extract_block_2(const qtree_node_t *node, uint8_t *block, size_t stride)
+{
+    if (!node || node->u)
+    {
+        block_fill(block, stride, 2, node ? node->m : 0);
+        return;
+    }
+
+    const qtree_node_t *const *children = (const qtree_node_t *const *)node->children;
+    const uint8_t means[4] = {children[0] ? children[0]->m : 0, children[1] ? children[1]->m : 0,
+                              children[2] ? children[2]->m : 0, children[3] ? children[3]->m : 0};
+    block_fill_2x2(block, stride, means);
+}
+
+/**
+ * @brief Same over a 4x4 block, quadrants at fixed offsets
+ */
+static void extract_block_4(const qtree_node_t *node, uint8_t *block, size_t stride)
+{
+    if (!node || node->u)
+    {
+        block_fill(block, stride, 4, node ? node->m : 0);
+        return;
+    }
+
+    const qtree_node_t *const *children = (const qtree_node_t *const *)node->children;
+    if (children[0] && children[1] && children[2] && children[3] &&
+        children[0]->u && children[1]->u && children[2]->u && children[3]->u)
+    {
+        const uint8_t means[4] = {children[0]->m, children[1]->m,
+                                  children[2]->m, children[3]->m};
+        block_fill_4x4(block, stride, means);
+        return;
+    }
+
+    extract_block_2(children[QUADRANT_TOP_LEFT], block, stride);
+    extract_block_2(children[QUADRANT_TOP_RIGHT], block + 2, stride);
+    extract_block_2(children[QUADRANT_BOTTOM_RIGHT], block + 2 * stride + 2, stride);
+    extract_block_2(children[QUADRANT_BOTTOM_LEFT], block + 2 * stride, stride);
+}
+
+/**
+ * @brief Same over an 8x8 block
+ */
+static void extract_block_8(const qtree_node_t *node, uint8_t *block, size_t stride)
+{
+    if (!node || node->u)
+    {
+        block_fill(block, stride, 8, node ? node->m : 0);
+        return;
+    }
+
+    const qtree_node_t *const *children = (const qtree_node_t *const *)node->children;
+    extract_block_4(children[QUADRANT_TOP_LEFT], block, stride);
+    extract_block_4(children[QUADRANT_TOP_RIGHT], block + 4, stride);
+    extract_block_4(children[QUADRANT_BOTTOM_RIGHT], block + 4 * stride + 4, stride);
+    extract_block_4(children[QUADRANT_BOTTOM_LEFT], block + 4 * stride, stride);
+}
+
 /**
  * @brief Extract pixels from quadtree nodes into linear pixel array
  *
- * This function recursively traverses the quadtree and fills the pixel array
- * according to the quadrant ordering defined in the display configuration.
- * For uniform nodes, it efficiently fills the entire block with the same value.
+ * This function recursively traverses the quadtree and paints each block
+ * at block (its top-left pixel). Uniform nodes are one block_fill();
+ * blocks of 8x8 and less go to the kernels above instead of recursing
+ * down to single pixels. Every pixel is written, except under a
+ * non-uniform node that lost its children, which is painted black.
  */
-static void extract_pixels(const qtree_node_t *node, uint8_t *pixels,
-                           uint32_t row, uint32_t col,
-                           uint32_t size, uint32_t total_size)
+static void extract_pixels(const qtree_node_t *node, uint8_t *block,
+                           size_t stride, uint32_t size)
 {
+    switch (size)
+    {
+    case 2:
+        extract_block_2(node, block, stride);
+        return;
+    case 4:
+        extract_block_4(node, block, stride);
+        return;
+    case 8:
+        extract_block_8(node, block, stride);
+        return;
+    default:
+        break;
+    }
+
     if (!node)
+    {
+        block_fill(block, stride, size, 0);
         return;
+    }
 
     // Handle leaf nodes and uniform regions
     if (node->u || size == 1)
     {
-        for (uint32_t i = row; i < row + size && i < total_size; i++)
+        block_fill(block, stride, size, node->m);
+        return;
+    }
+
+    // Process child nodes in the correct display order
+    const qtree_node_t *const *children = (const qtree_node_t *const *)node->children;
+    const uint32_t half_size = size / 2;
+    extract_pixels(children[QUADRANT_TOP_LEFT], block, stride, half_size);
+    extract_pixels(children[QUADRANT_TOP_RIGHT], block + half_size, stride, half_size);
+    extract_pixels(children[QUADRANT_BOTTOM_RIGHT], block + half_size * stride + half_size,
+                   stride, half_size);
+    extract_pixels(children[QUADRANT_BOTTOM_LEFT], block + half_size * stride, stride,
+                   half_size);
+}
+
+typedef struct
+{
+    uint8_t *pixels;
+    size_t stride;
+} extract_walk_t;
+
+static void extract_subtree(void *ctx, qtree_node_t *node, const qtree_walk_cell_t *cell,
+                            uint32_t worker, void *result)
+{
+    (void)worker;
+    (void)result;
+    const extract_walk_t *walk = ctx;
+    extract_pixels(node, walk->pixels + (size_t)cell->row * walk->stride + cell->col,
+                   walk->stride, cell->size);
+}
+
+static void extract_leave(void *ctx, qtree_node_t *node, const qtree_walk_cell_t *cell,
+                          const void *const children[4], void *result)
+{
+    (void)children;
+    (void)result;
+    const extract_walk_t *walk = ctx;
+
+    // Same as extract_pixels: a uniform node paints over what's below it,
+    // and a missing child is black
+    for (uint32_t q = 0; q < 4; q++)
+    {
+        const qtree_walk_cell_t child = qtree_walk_child_cell(cell, q);
+        if (node->u || !node->children[q])
+            block_fill(walk->pixels + (size_t)child.row * walk->stride + child.col,
+                       walk->stride, child.size, node->u ? node->m : 0);
+    }
+}
+
+static const qtree_walk_t extract_pass = {.subtree = extract_subtree, .leave = extract_leave};
+
+/**
+ * @brief extract_pixels on the whole tree, on its pool if it has one
+ */
+static void extract_tree(const qtree_t *tree, uint8_t *pixels)
+{
+    extract_walk_t walk = {.pixels = pixels, .stride = tree->size};
+    qtree_walk(&extract_pass, &walk, tree->root, tree->size, tree->pool, NULL);
+}
+
+/**
+ * @brief Read one node's fields straight into the arrays
+ */
+static void decompress_array_node(bit_reader_t *reader, qtree_array_t *tree,
+                                  size_t i, uint32_t level, bool interpolated)
+{
+    reader->stats->nodes.processed++;
+
+    if (interpolated)
+    {
+        const size_t parent = qtree_parent_index(i);
+        tree->m[i] = calculate_fourth_mean(tree->m[parent], tree->e[parent],
+                                           tree->m[i - 3], tree->m[i - 2],
+                                           tree->m[i - 1]);
+    }
+    else
+    {
+        qtree_q2_family_t family = {0};
+        uint8_t parent_m = ROOT_PARENT_MEAN;
+        if (i > 0)
         {
-            for (uint32_t j = col; j < col + size && j < total_size; j++)
+            const size_t parent = qtree_parent_index(i);
+            parent_m = tree->m[parent];
+            if (reader->q2)
             {
-                pixels[i * total_size + j] = node->m;
+                for (size_t j = qtree_first_child_index(parent); j < i; j++)
+                    q2_family_add(&family, (int32_t)tree->m[j] - (int32_t)parent_m);
             }
         }
-        return;
+        tree->m[i] = read_mean(reader, parent_m, tree->n_levels - level, &family);
     }
 
-    // Process child nodes in the correct display order
-    uint32_t half_size = size / 2;
-    for (int i = 0; i < 4; i++)
+    if (level < tree->n_levels)
+    {
+        read_flags(reader, tree->n_levels - level, &tree->e[i], &tree->u[i]);
+    }
+    else
+    {
+        tree->e[i] = 0;
+        tree->u[i] = 1;
+    }
+    tree->v[i] = 0.0f;
+}
+
+qtree_status_t qtree_decompress_array(FILE *file, const char *input_filename,
+                                      qtree_array_t *tree)
+{
+    return qtree_decompress_array_with_stats(file, input_filename, tree, NULL);
+}
+
+qtree_status_t qtree_decompress_array_with_stats(FILE *file, const char *input_filename,
+                                                 qtree_array_t *tree, qtc_stats_t *out)
+{
+    log_header("QUADTREE DECOMPRESSION");
+
+    if (!file || !tree)
+    {
+        log_message(LOG_LEVEL_ERROR, "Invalid input parameters");
+        return QTREE_ERROR_INVALID_PARAM;
+    }
+
+    char magic[3] = {0};
+    uint8_t n_levels = 0;
+
+    log_subheader("Processing File Header");
+    log_item("Input path", input_filename);
+
+    process_file_header(file, magic, &n_levels);
+    if (n_levels < 1 || n_levels > 16)
+    {
+        log_message(LOG_LEVEL_ERROR, "Unsupported tree depth for array layout");
+        return QTREE_ERROR_FORMAT;
+    }
+
+    qtree_status_t status = qtree_array_init(tree, 1u << n_levels);
+    if (status != QTREE_SUCCESS)
+        return status;
+
+    decompress_stats_t stats = init_stats(n_levels, tree->size);
+    bit_reader_t reader = {
+        .arena = NULL,
+        .stats = &stats,
+        .has_error = false,
+        .error_msg = NULL};
+    if (!bit_reader_open_file(&reader.bits, file, true))
+    {
+        log_message(LOG_LEVEL_ERROR, "%s", reader.bits.error_msg);
+        qtree_array_free(tree);
+        return QTREE_ERROR_MEMORY;
+    }
+    if (!begin_payload(&reader, magic))
+    {
+        log_message(LOG_LEVEL_ERROR, "%s", reader.error_msg);
+        reader_close(&reader);
+        qtree_array_free(tree);
+        return QTREE_ERROR_FORMAT;
+    }
+
+    log_file_info("input.qtc", tree->size, n_levels, 0.0);
+    log_subheader("Decompressing Data");
+
+    decompress_array_node(&reader, tree, 0, 0, false);
+    if (out)
     {
-        uint32_t new_row = row;
-        uint32_t new_col = col;
+        out->size = tree->size;
+        out->n_levels = n_levels;
+        out->level_nodes[0] = 1;
+    }
+
+    // Children of uniform parents are filled in, not read
+    for (uint32_t level = 1; level <= n_levels && !reader.has_error; level++)
+    {
+        const size_t begin = qtree_array_level_offset(level - 1);
+        const size_t end = qtree_array_level_offset(level);
+        uint64_t read = 0;
 
-        // Calculate position based on quadrant
-        switch (quadrant_order[i])
+        for (size_t parent = begin; parent < end && !reader.has_error; parent++)
         {
-        case QUADRANT_TOP_RIGHT:
-            new_col += half_size;
-            break;
-        case QUADRANT_BOTTOM_RIGHT:
-            new_row += half_size;
-            new_col += half_size;
-            break;
-        case QUADRANT_BOTTOM_LEFT:
-            new_row += half_size;
-            break;
-        default: // QUADRANT_TOP_LEFT
-            break;
+            const size_t c = qtree_first_child_index(parent);
+            if (tree->u[parent])
+            {
+                for (size_t k = 0; k < 4; k++)
+                {
+                    tree->m[c + k] = tree->m[parent];
+                    tree->e[c + k] = 0;
+                    tree->u[c + k] = 1;
+                    tree->v[c + k] = 0.0f;
+                }
+                continue;
+            }
+
+            for (size_t k = 0; k < 4; k++)
+            {
+                decompress_array_node(&reader, tree, c + k, level, k == 3);
+            }
+            read += 4;
         }
+        if (out)
+            out->level_nodes[level] = read;
+
+        check_payload(&reader);
+        stats.levels.current = level;
+        stats.bits.read = bit_reader_bits_read(&reader.bits);
+        update_progress(&stats);
+    }
+
+    check_payload(&reader);
+    double elapsed = wall_seconds() - stats.start_time;
+    stats.bits.read = bit_reader_bits_read(&reader.bits);
+    reader_close(&reader);
+    if (out)
+    {
+        out->nodes = stats.nodes.processed;
+        out->bits_in = stats.bits.read;
+        out->bits_out = stats.bits.original;
+    }
+
+    log_end_progress();
+    log_size_stats(stats.bits.original, stats.bits.read,
+                   stats.nodes.processed, elapsed);
+
+    if (reader.has_error)
+    {
+        log_message(LOG_LEVEL_ERROR, "Decompression failed: %s",
+                    reader.error_msg ? reader.error_msg : "Unknown error");
+        qtree_array_free(tree);
+        return QTREE_ERROR_FORMAT;
+    }
+
+    log_message(LOG_LEVEL_SUCCESS, "Decompression completed successfully");
+    return QTREE_SUCCESS;
+}
+
+/**
+ * @brief Array version of extract_pixels
+ */
+static void extract_array_pixels(const qtree_array_t *tree, size_t i,
+                                 uint8_t *block, uint32_t size)
+{
+    const size_t stride = tree->size;
 
-        // Recursively process each quadrant
-        extract_pixels(node->children[quadrant_order[i]], pixels,
-                       new_row, new_col, half_size, total_size);
+    if (tree->u[i] || size == 1)
+    {
+        block_fill(block, stride, size, tree->m[i]);
+        return;
     }
+
+    // Siblings sit next to each other, already in quadrant order
+    const uint32_t half_size = size / 2;
+    const size_t child = qtree_first_child_index(i);
+    if (size == 2)
+    {
+        block_fill_2x2(block, stride, tree->m + child);
+        return;
+    }
+    if (size == 4 && tree->u[child] && tree->u[child + 1] && tree->u[child + 2] &&
+        tree->u[child + 3])
+    {
+        block_fill_4x4(block, stride, tree->m + child);
+        return;
+    }
+
+    extract_array_pixels(tree, child + QUADRANT_TOP_LEFT, block, half_size);
+    extract_array_pixels(tree, child + QUADRANT_TOP_RIGHT, block + half_size, half_size);
+    extract_array_pixels(tree, child + QUADRANT_BOTTOM_RIGHT,
+                         block + half_size * stride + half_size, half_size);
+    extract_array_pixels(tree, child + QUADRANT_BOTTOM_LEFT, block + half_size * stride,
+                         half_size);
+}
+
+qtree_status_t qtree_array_to_pgm(const qtree_array_t *tree, const char *output_filename,
+                                  pgm_t *pgm)
+{
+    log_header("PGM CONVERSION");
+
+    if (!tree || !tree->m || !pgm)
+    {
+        log_message(LOG_LEVEL_ERROR, "Invalid conversion parameters");
+        return QTREE_ERROR_INVALID_PARAM;
+    }
+
+    log_subheader("Initializing Conversion");
+    log_item("Output path", output_filename);
+
+    pgm->size = tree->size;
+    pgm->max_value = 255;
+
+    const size_t total_pixels = (size_t)tree->size * tree->size;
+    pgm->pixels = malloc(total_pixels);
+    if (!pgm->pixels)
+    {
+        log_message(LOG_LEVEL_ERROR, "Memory allocation failed for pixel data");
+        return QTREE_ERROR_MEMORY;
+    }
+
+    const double start_time = wall_seconds();
+    extract_array_pixels(tree, 0, pgm->pixels, tree->size);
+    double elapsed = wall_seconds() - start_time;
+
+    log_item("Processing rate", "%.2f MP/s", (double)total_pixels / elapsed / 1000000.0);
+    log_item("Processing time", "%.3f seconds", elapsed);
+
+    log_separator();
+    log_message(LOG_LEVEL_SUCCESS, "PGM conversion completed successfully");
+
+    return QTREE_SUCCESS;
+}
+
+/**
+ * @brief A decoded non-uniform node whose children come next
+ */
+typedef struct
+{
+    uint32_t row;  // Top edge of the block
+    uint32_t col;  // Left edge of the block
+    uint32_t size; // Block width/height
+    uint8_t m;     // Mean value
+    uint8_t e;     // Rounding error
+    uint8_t u;     // Uniformity flag
+} stream_entry_t;
+
+/**
+ * @brief Shared streaming decoder, from the first payload bit on
+ *
+ * Levels past stop_level are never read. Nodes on stop_level are painted
+ * whatever their flags say, so the image holds the level-k means.
+ *
+ * @param reader Bit source, already open; closed on return
+ * @param n_levels Depth from the header (1..16)
+ * @param stop_level Last level to decode (clamped to the tree depth)
+ * @param upscale Paint at full size instead of (2^k)x(2^k)
+ * @param target Buffer big enough for the image, or NULL to allocate one
+ * @param succinct Set up with qtree_succinct_init() to collect the nodes
+ *                 instead of painting them (pgm is then unused)
+ * @param out Gets the nodes per level and the bits read (can be NULL)
+ */
+static qtree_status_t decode_levels(bit_reader_t *reader, uint32_t n_levels,
+                                    uint32_t stop_level, bool upscale,
+                                    uint8_t *target, pgm_t *pgm,
+                                    qtree_succinct_t *succinct, qtc_stats_t *out)
+{
+    pgm_t no_image = {0};
+    if (succinct)
+    {
+        stop_level = n_levels;
+        pgm = &no_image;
+    }
+
+    if (stop_level > n_levels)
+        stop_level = n_levels;
+    if (stop_level < n_levels)
+        log_item("Preview level", "%u of %u (%s)", stop_level, n_levels,
+                 upscale ? "upscaled" : "reduced size");
+
+    const uint32_t out_levels = upscale ? n_levels : stop_level;
+    const uint32_t size = 1u << out_levels;
+    pgm->size = size;
+    pgm->max_value = 255;
+    pgm->pixels = succinct ? NULL : target ? target : malloc((size_t)size * size);
+
+    // Only levels below stop_level are ever queued, and the widest is 4^(k-1)
+    const size_t widest = stop_level > 0 ? (size_t)1 << (2 * (stop_level - 1)) : 1;
+    stream_entry_t *current = malloc(widest * sizeof(stream_entry_t));
+    stream_entry_t *next = malloc(widest * sizeof(stream_entry_t));
+
+    decompress_stats_t stats = init_stats(stop_level, 1u << n_levels);
+    reader->stats = &stats;
+
+    if ((!succinct && !pgm->pixels) || !current || !next)
+    {
+        log_message(LOG_LEVEL_ERROR, "Memory allocation failed for streaming decode");
+        free(current);
+        free(next);
+        if (target)
+            *pgm = (pgm_t){0};
+        else
+            pgm_free(pgm);
+        reader_close(reader);
+        return QTREE_ERROR_MEMORY;
+    }
+
+    log_file_info("input.qtc", 1u << n_levels, n_levels, 0.0);
+    log_subheader("Decompressing Data");
+
+    // Root
+    stream_entry_t root = {.row = 0, .col = 0, .size = size};
+    qtree_q2_family_t root_family = {0};
+    root.m = read_mean(reader, ROOT_PARENT_MEAN, n_levels, &root_family);
+    read_flags(reader, n_levels, &root.e, &root.u);
+    stats.nodes.processed++;
+    if (out)
+    {
+        out->size = 1u << n_levels;
+        out->n_levels = n_levels;
+        out->level_nodes[0] = 1;
+    }
+
+    size_t current_count = 0;
+    bool stored = !succinct || qtree_succinct_append(succinct, root.m, root.e, !root.u);
+    if (succinct)
+    {
+        if (!root.u)
+            current[current_count++] = root;
+    }
+    else if (root.u || stop_level == 0)
+        block_fill(pgm->pixels, size, size, root.m);
+    else
+        current[current_count++] = root;
+
+    for (uint32_t level = 1; level <= stop_level && current_count > 0 && !reader->has_error && stored; level++)
+    {
+        const bool bottom = level == n_levels;
+        const bool last = level == stop_level;
+        const uint32_t height = n_levels - level;
+        size_t next_count = 0;
+
+        for (size_t p = 0; p < current_count && !reader->has_error; p++)
+        {
+            const stream_entry_t *parent = &current[p];
+            const uint32_t half = parent->size / 2;
+            uint8_t means[4];
+            qtree_q2_family_t family = {0};
+
+            // Q1 pixels: one read and one 2x2 store for the family
+            if (bottom && half == 1 && !reader->q2 && !succinct)
+            {
+                read_leaf_family(reader, parent->m, parent->e, means);
+                block_fill_2x2(pgm->pixels + (size_t)parent->row * size + parent->col, size,
+                               means);
+                stats.nodes.processed += 4;
+                continue;
+            }
+
+            for (int q = 0; q < 4; q++)
+            {
+                stream_entry_t child = {
+                    .row = parent->row + ((q & 2) ? half : 0),
+                    .col = parent->col + (((q & 1) ^ ((q & 2) >> 1)) ? half : 0),
+                    .size = half};
+
+                child.m = q < 3 ? read_mean(reader, parent->m, height, &family)
+                                : calculate_fourth_mean(parent->m, parent->e,
+                                                        means[0], means[1], means[2]);
+                means[q] = child.m;
+
+                if (bottom)
+                {
+                    child.e = 0;
+                    child.u = 1;
+                }
+                else
+                {
+                    read_flags(reader, height, &child.e, &child.u);
+                }
+
+                if (succinct)
+                {
+                    stored = stored && qtree_succinct_append(succinct, child.m, child.e, !child.u);
+                    if (!child.u)
+                        next[next_count++] = child;
+                }
+                else if (half == 1)
+                    continue; // Painted all four at once below
+                else if (child.u || last)
+                    block_fill(pgm->pixels + (size_t)child.row * size + child.col, size, half,
+                               child.m);
+                else
+                    next[next_count++] = child;
+            }
+            if (half == 1 && !succinct)
+                block_fill_2x2(pgm->pixels + (size_t)parent->row * size + parent->col, size,
+                               means);
+            stats.nodes.processed += 4;
+        }
+
+        if (out)
+            out->level_nodes[level] = (uint64_t)current_count * 4;
+
+        stream_entry_t *swap = current;
+        current = next;
+        next = swap;
+        current_count = next_count;
+
+        check_payload(reader);
+        stats.levels.current = level;
+        stats.bits.read = bit_reader_bits_read(&reader->bits);
+        update_progress(&stats);
+    }
+
+    check_payload(reader);
+    double elapsed = wall_seconds() - stats.start_time;
+    stats.bits.read = bit_reader_bits_read(&reader->bits);
+    reader_close(reader);
+    free(current);
+    free(next);
+    if (out)
+    {
+        out->nodes = stats.nodes.processed;
+        out->bits_in = stats.bits.read;
+        // A succinct tree isn't painted here, but it holds the whole image
+        const uint64_t side = succinct ? 1u << n_levels : pgm->size;
+        out->bits_out = side * side * 8;
+    }
+
+    log_end_progress();
+    log_size_stats(stats.bits.original, stats.bits.read,
+                   stats.nodes.processed, elapsed);
+
+    if (!stored)
+    {
+        log_message(LOG_LEVEL_ERROR, "Memory allocation failed for succinct quadtree");
+        return QTREE_ERROR_MEMORY;
+    }
+
+    if (reader->has_error)
+    {
+        log_message(LOG_LEVEL_ERROR, "Decompression failed: %s",
+                    reader->error_msg ? reader->error_msg : "Unknown error");
+        if (target)
+            *pgm = (pgm_t){0};
+        else
+            pgm_free(pgm);
+        return QTREE_ERROR_FORMAT;
+    }
+
+    log_message(LOG_LEVEL_SUCCESS, "Decompression completed successfully");
+    return QTREE_SUCCESS;
+}
+
+/**
+ * @brief Streaming decode of a file: header, then decode_levels()
+ */
+static qtree_status_t decode_stream(FILE *file, const char *input_filename,
+                                    uint32_t stop_level, bool upscale, pgm_t *pgm,
+                                    qtree_succinct_t *succinct, qtc_stats_t *out)
+{
+    log_header("QUADTREE DECOMPRESSION");
+
+    if (!file || (!pgm && !succinct))
+    {
+        log_message(LOG_LEVEL_ERROR, "Invalid input parameters");
+        return QTREE_ERROR_INVALID_PARAM;
+    }
+
+    char magic[3] = {0};
+    uint8_t n_levels = 0;
+
+    log_subheader("Processing File Header");
+    log_item("Input path", input_filename);
+
+    process_file_header(file, magic, &n_levels);
+    if (n_levels < 1 || n_levels > 16)
+    {
+        log_message(LOG_LEVEL_ERROR, "Unsupported tree depth for streaming decode");
+        return QTREE_ERROR_FORMAT;
+    }
+    if (succinct)
+    {
+        const qtree_status_t status = qtree_succinct_init(succinct, 1u << n_levels);
+        if (status != QTREE_SUCCESS)
+            return status;
+    }
+
+    bit_reader_t reader = {
+        .arena = NULL,
+        .stats = NULL,
+        .has_error = false,
+        .error_msg = NULL};
+
+    // A preview stops after level k, reading ahead would pull the rest of the file
+    if (!bit_reader_open_file(&reader.bits, file, stop_level >= n_levels))
+    {
+        log_message(LOG_LEVEL_ERROR, "Memory allocation failed for streaming decode");
+        return QTREE_ERROR_MEMORY;
+    }
+    if (!begin_payload(&reader, magic))
+    {
+        log_message(LOG_LEVEL_ERROR, "%s", reader.error_msg);
+        reader_close(&reader);
+        return QTREE_ERROR_FORMAT;
+    }
+
+    return decode_levels(&reader, n_levels, stop_level, upscale, NULL, pgm, succinct, out);
+}
+
+/**
+ * @brief Where the payload starts in a file held in memory
+ *
+ * Same layout process_file_header() reads: "Q1\n" or "Q2\n", two
+ * comment lines, then the depth byte.
+ *
+ * @param magic Set to the two magic bytes
+ * @return Offset of the first payload byte, or 0 if the header is bad
+ */
+static size_t buffer_payload_offset(const uint8_t *data, size_t length, char *magic,
+                                    uint8_t *levels)
+{
+    if (length < 3 || !valid_magic((const char *)data) || data[2] != '\n')
+        return 0;
+    memcpy(magic, data, 2);
+
+    size_t pos = 3;
+    for (int line = 0; line < 2; line++)
+    {
+        const uint8_t *end = memchr(data + pos, '\n', length - pos);
+        if (!end)
+            return 0;
+        pos = (size_t)(end - data) + 1;
+    }
+
+    if (pos >= length)
+        return 0;
+    *levels = data[pos];
+    return pos + 1;
+}
+
+/**
+ * @brief Streaming decode of a payload held in memory
+ * @param magic Says how the payload is coded
+ */
+static qtree_status_t decode_buffer(const uint8_t *data, size_t length, const char *magic,
+                                    uint32_t n_levels, uint8_t *pixels, pgm_t *pgm,
+                                    qtc_stats_t *out)
+{
+    bit_reader_t reader = {
+        .arena = NULL,
+        .stats = NULL,
+        .has_error = false,
+        .error_msg = NULL};
+    bit_reader_open_memory(&reader.bits, data, length);
+    if (!begin_payload(&reader, magic))
+    {
+        log_message(LOG_LEVEL_ERROR, "%s", reader.error_msg);
+        reader_close(&reader);
+        return QTREE_ERROR_FORMAT;
+    }
+
+    return decode_levels(&reader, n_levels, UINT32_MAX, false, pixels, pgm, NULL, out);
+}
+
+uint32_t qtree_buffer_image_size(const uint8_t *data, size_t length)
+{
+    char magic[3] = {0};
+    uint8_t n_levels = 0;
+    if (!data || buffer_payload_offset(data, length, magic, &n_levels) == 0 ||
+        n_levels < 1 || n_levels > 16)
+        return 0;
+    return 1u << n_levels;
+}
+
+qtree_status_t qtree_decompress_buffer(const uint8_t *data, size_t length,
+                                       uint8_t *pixels, pgm_t *pgm)
+{
+    return qtree_decompress_buffer_with_stats(data, length, pixels, pgm, NULL);
+}
+
+qtree_status_t qtree_decompress_buffer_with_stats(const uint8_t *data, size_t length,
+                                                  uint8_t *pixels, pgm_t *pgm,
+                                                  qtc_stats_t *stats)
+{
+    log_header("QUADTREE DECOMPRESSION");
+
+    if (!data || !pgm)
+    {
+        log_message(LOG_LEVEL_ERROR, "Invalid input parameters");
+        return QTREE_ERROR_INVALID_PARAM;
+    }
+
+    char magic[3] = {0};
+    uint8_t n_levels = 0;
+    const size_t offset = buffer_payload_offset(data, length, magic, &n_levels);
+    if (offset == 0 || n_levels < 1 || n_levels > 16)
+    {
+        log_message(LOG_LEVEL_ERROR, "Invalid or unsupported compressed header");
+        return QTREE_ERROR_FORMAT;
+    }
+    log_item("Tree Depth", "%u levels", (uint32_t)n_levels);
+
+    return decode_buffer(data + offset, length - offset, magic, n_levels, pixels, pgm, stats);
+}
+
+qtree_status_t qtree_decompress_payload(const uint8_t *data, size_t length,
+                                        qtree_format_t format, uint32_t n_levels,
+                                        uint8_t *pixels, pgm_t *pgm)
+{
+    return qtree_decompress_payload_with_stats(data, length, format, n_levels, pixels, pgm,
+                                               NULL);
+}
+
+qtree_status_t qtree_decompress_payload_with_stats(const uint8_t *data, size_t length,
+                                                   qtree_format_t format, uint32_t n_levels,
+                                                   uint8_t *pixels, pgm_t *pgm,
+                                                   qtc_stats_t *stats)
+{
+    if (!data || !pgm || n_levels < 1 || n_levels > 16)
+    {
+        log_message(LOG_LEVEL_ERROR, "Invalid input parameters");
+        return QTREE_ERROR_INVALID_PARAM;
+    }
+
+    const char magic[3] = {'Q', format == QTREE_FORMAT_Q2 ? '2' : '1', '\0'};
+    return decode_buffer(data, length, magic, n_levels, pixels, pgm, stats);
+}
+
+qtree_status_t qtree_decompress_stream(FILE *file, const char *input_filename, pgm_t *pgm)
+{
+    return qtree_decompress_stream_with_stats(file, input_filename, pgm, NULL);
+}
+
+qtree_status_t qtree_decompress_stream_with_stats(FILE *file, const char *input_filename,
+                                                  pgm_t *pgm, qtc_stats_t *stats)
+{
+    return decode_stream(file, input_filename, UINT32_MAX, false, pgm, NULL, stats);
+}
+
+qtree_status_t qtree_decompress_preview(FILE *file, const char *input_filename,
+                                        uint32_t level, bool upscale, pgm_t *pgm)
+{
+    return qtree_decompress_preview_with_stats(file, input_filename, level, upscale, pgm, NULL);
+}
+
+qtree_status_t qtree_decompress_preview_with_stats(FILE *file, const char *input_filename,
+                                                   uint32_t level, bool upscale, pgm_t *pgm,
+                                                   qtc_stats_t *stats)
+{
+    return decode_stream(file, input_filename, level, upscale, pgm, NULL, stats);
+}
+
+qtree_status_t qtree_decompress_succinct(FILE *file, const char *input_filename,
+                                         qtree_succinct_t *tree)
+{
+    return qtree_decompress_succinct_with_stats(file, input_filename, tree, NULL);
+}
+
+qtree_status_t qtree_decompress_succinct_with_stats(FILE *file, const char *input_filename,
+                                                    qtree_succinct_t *tree, qtc_stats_t *stats)
+{
+    if (!tree)
+    {
+        log_message(LOG_LEVEL_ERROR, "Invalid input parameters");
+        return QTREE_ERROR_INVALID_PARAM;
+    }
+
+    *tree = (qtree_succinct_t){0};
+    qtree_status_t status = decode_stream(file, input_filename, UINT32_MAX, false, NULL, tree, stats);
+    if (status == QTREE_SUCCESS)
+        status = qtree_succinct_finish(tree);
+    if (status != QTREE_SUCCESS)
+    {
+        qtree_succinct_free(tree);
+        return status;
+    }
+
+    log_item("Succinct tree", "%zu nodes in %zu bytes (%.2f bytes/node)", tree->n_nodes,
+             qtree_succinct_bytes(tree),
+             (double)qtree_succinct_bytes(tree) / (double)tree->n_nodes);
+    return QTREE_SUCCESS;
+}
+
+/**
+ * @brief Succinct version of extract_pixels
+ */
+static void extract_succinct_pixels(const qtree_succinct_t *tree, size_t i,
+                                    uint8_t *block, uint32_t size)
+{
+    const size_t stride = tree->size;
+
+    if (!qtree_succinct_has_children(tree, i))
+    {
+        block_fill(block, stride, size, tree->m[i]);
+        return;
+    }
+
+    const uint32_t half_size = size / 2;
+    const size_t child = qtree_succinct_first_child(tree, i);
+    if (size == 2)
+    {
+        block_fill_2x2(block, stride, tree->m + child);
+        return;
+    }
+    if (size == 4 && !qtree_succinct_has_children(tree, child) &&
+        !qtree_succinct_has_children(tree, child + 1) &&
+        !qtree_succinct_has_children(tree, child + 2) &&
+        !qtree_succinct_has_children(tree, child + 3))
+    {
+        block_fill_4x4(block, stride, tree->m + child);
+        return;
+    }
+
+    extract_succinct_pixels(tree, child + QUADRANT_TOP_LEFT, block, half_size);
+    extract_succinct_pixels(tree, child + QUADRANT_TOP_RIGHT, block + half_size, half_size);
+    extract_succinct_pixels(tree, child + QUADRANT_BOTTOM_RIGHT,
+                            block + half_size * stride + half_size, half_size);
+    extract_succinct_pixels(tree, child + QUADRANT_BOTTOM_LEFT, block + half_size * stride,
+                            half_size);
+}
+
+qtree_status_t qtree_succinct_to_pgm(const qtree_succinct_t *tree, const char *output_filename,
+                                     pgm_t *pgm)
+{
+    log_header("PGM CONVERSION");
+
+    if (!tree || !tree->rank || !pgm)
+    {
+        log_message(LOG_LEVEL_ERROR, "Invalid conversion parameters");
+        return QTREE_ERROR_INVALID_PARAM;
+    }
+
+    log_subheader("Initializing Conversion");
+    log_item("Output path", output_filename);
+
+    pgm->size = tree->size;
+    pgm->max_value = 255;
+
+    const size_t total_pixels = (size_t)tree->size * tree->size;
+    pgm->pixels = malloc(total_pixels);
+    if (!pgm->pixels)
+    {
+        log_message(LOG_LEVEL_ERROR, "Memory allocation failed for pixel data");
+        return QTREE_ERROR_MEMORY;
+    }
+
+    const double start_time = wall_seconds();
+    extract_succinct_pixels(tree, 0, pgm->pixels, tree->size);
+    double elapsed = wall_seconds() - start_time;
+
+    log_item("Processing rate", "%.2f MP/s", (double)total_pixels / elapsed / 1000000.0);
+    log_item("Processing time", "%.3f seconds", elapsed);
+
+    log_separator();
+    log_message(LOG_LEVEL_SUCCESS, "PGM conversion completed successfully");
+
+    return QTREE_SUCCESS;
 }
@@ -0,0 +1,420 @@
+/**
+ * @file entropy.c
+ * @brief Q2 encoder, and the table setup of the decoder
+ */
+
+#include "codec/entropy.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/* Starting size of the symbol queue, doubled when full */
+#define Q2_QUEUE_SIZE (64u * 1024u)
+
+/* Queued symbols: context, token, then up to 8 bits sent at even odds */
+#define PACK_SYMBOL(context, token, num_bits, bits) \
+    (((uint32_t)(context) << 24) | ((uint32_t)(token) << 16) | ((uint32_t)(num_bits) << 8) | (uint32_t)(bits))
+#define NO_CONTEXT 0xFFu
+
+/* What an unused context decodes to; it leaves the state alone */
+static const uint32_t bad_slot = Q2_BAD_TOKEN | (1u << 5);
+
+static uint32_t context_tokens(uint32_t context)
+{
+    return context < Q2_MEAN_CONTEXTS ? Q2_MEAN_TOKENS : Q2_FLAG_TOKENS;
+}
+
+bool q2_encoder_init(qtree_q2_encoder_t *encoder)
+{
+    *encoder = (qtree_q2_encoder_t){0};
+    encoder->symbols = malloc(Q2_QUEUE_SIZE * sizeof(uint32_t));
+    encoder->capacity = Q2_QUEUE_SIZE;
+    encoder->error = encoder->symbols == NULL;
+    return !encoder->error;
+}
+
+void q2_encoder_release(qtree_q2_encoder_t *encoder)
+{
+    free(encoder->symbols);
+    encoder->symbols = NULL;
+    encoder->count = 0;
+    encoder->capacity = 0;
+}
+
+static void queue(qtree_q2_encoder_t *encoder, uint32_t symbol)
+{
+    if (encoder->error)
+        return;
+
+    if (encoder->count == encoder->capacity)
+    {
+        uint32_t *grown = realloc(encoder->symbols, encoder->capacity * 2 * sizeof(uint32_t));
+        if (!grown)
+        {
+            encoder->error = true;
+            return;
+        }
+        encoder->symbols = grown;
+        encoder->capacity *= 2;
+    }
+    encoder->symbols[encoder->count++] = symbol;
+}
+
+static void queue_token(qtree_q2_encoder_t *encoder, uint32_t context, uint32_t token,
+                        uint32_t num_bits, uint32_t bits)
+{
+    encoder->counts[context][token]++;
+    queue(encoder, PACK_SYMBOL(context, token, num_bits, bits));
+}
+
+void q2_encode_residual(qtree_q2_encoder_t *encoder, uint32_t height,
+                        qtree_q2_family_t *family, int32_t residual)
+{
+    const uint32_t context = q2_mean_context(height, family);
+
+    if (residual == 0)
+    {
+        queue_token(encoder, context, 0, 0, 0);
+    }
+    else
+    {
+        const uint32_t magnitude = (uint32_t)(residual < 0 ? -residual : residual);
+        const uint32_t range = q2_magnitude_range(magnitude);
+        uint32_t extra = 0;
+        const uint32_t start = q2_range_start(range, &extra);
+
+        const uint32_t token = 1 + range + (residual < 0 ? Q2_MAGNITUDES : 0u);
+        queue_token(encoder, context, token, extra, magnitude - start);
+    }
+
+    q2_family_add(family, residual);
+}
+
+void q2_encode_flags(qtree_q2_encoder_t *encoder, uint32_t height, uint8_t e, uint8_t u)
+{
+    const uint32_t token = e == 0 ? (u ? 1u : 0u) : (uint32_t)e + 1u;
+    queue_token(encoder, q2_flag_context(height), token, 0, 0);
+}
+
+/**
+ * @brief Scale a context's counts to a power of two
+ * @param freqs Set to the scaled counts; used tokens keep at least 1
+ * @return The power, or 0 if the context was never used
+ */
+static uint32_t normalize_counts(const uint32_t *counts, uint32_t tokens, uint32_t *freqs)
+{
+    uint64_t total = 0;
+    uint32_t largest = 0;
+    for (uint32_t t = 0; t < tokens; t++)
+    {
+        total += counts[t];
+        if (counts[t] > counts[largest])
+            largest = t;
+    }
+    if (total == 0)
+        return 0;
+
+    uint32_t scale = Q2_MIN_SCALE_BITS;
+    while (scale < Q2_MAX_SCALE_BITS && ((uint64_t)1 << (scale + 1)) <= total)
+        scale++;
+    const uint32_t target = 1u << scale;
+
+    uint32_t assigned = 0;
+    for (uint32_t t = 0; t < tokens; t++)
+    {
+        freqs[t] = 0;
+        if (counts[t] > 0)
+        {
+            const uint32_t scaled = (uint32_t)((uint64_t)counts[t] * target / total);
+            freqs[t] = scaled > 0 ? scaled : 1;
+        }
+        assigned += freqs[t];
+    }
+
+    // Rounding up rare tokens can overshoot by a few; take it from the biggest
+    while (assigned > target)
+    {
+        uint32_t biggest = 0;
+        for (uint32_t t = 1; t < tokens; t++)
+        {
+            if (freqs[t] > freqs[biggest])
+                biggest = t;
+        }
+        freqs[biggest]--;
+        assigned--;
+    }
+    freqs[largest] += target - assigned;
+    return scale;
+}
+
+/**
+ * @brief Bits of the table header, in reading order
+ */
+static void queue_bits(uint32_t *header, size_t *count, uint32_t num_bits, uint32_t bits)
+{
+    header[(*count)++] = PACK_SYMBOL(NO_CONTEXT, 0, num_bits, bits);
+}
+
+/**
+ * @brief Elias gamma code of value >= 1: zeros, a one, then the low bits
+ */
+static void queue_gamma(uint32_t *header, size_t *count, uint32_t value)
+{
+    uint32_t n = 0;
+    while (value >> (n + 1))
+        n++;
+
+    for (uint32_t i = 0; i < n; i++)
+        queue_bits(header, count, 1, 0);
+    queue_bits(header, count, 1, 1);
+    if (n > 8)
+        queue_bits(header, count, n - 8, (value >> 8) & ((1u << (n - 8)) - 1u));
+    if (n > 0)
+    {
+        const uint32_t low = n > 8 ? 8 : n;
+        queue_bits(header, count, low, value & ((1u << low) - 1u));
+    }
+}
+
+/**
+ * @brief Backwards byte output of the encoder
+ */
+typedef struct
+{
+    uint64_t state;
+    uint8_t *front; /* First byte written so far */
+} rans_output_t;
+
+/**
+ * @brief Move the low 32 bits of the state out, for the decoder's refill
+ */
+static void emit_word(rans_output_t *out)
+{
+    for (int i = 0; i < 4; i++)
+        *--out->front = (uint8_t)(out->state >> (8 * i));
+    out->state >>= 32;
+}
+
+static void encode_symbol(rans_output_t *out, uint32_t symbol,
+                          uint32_t (*freqs)[Q2_MEAN_TOKENS],
+                          uint32_t (*starts)[Q2_MEAN_TOKENS], const uint32_t *scales)
+{
+    const uint32_t context = symbol >> 24;
+    const uint32_t num_bits = (symbol >> 8) & 0xFu;
+
+    // Bits alone: the decoder shifts them out, then refills
+    if (context == NO_CONTEXT)
+    {
+        if (out->state >= (uint64_t)1 << (63 - num_bits))
+            emit_word(out);
+        out->state = (out->state << num_bits) | (symbol & 0xFFu);
+        return;
+    }
+
+    // Token and bits: one lookup, one shift, then one refill for both
+    const uint32_t token = (symbol >> 16) & 0x1Fu;
+    const uint32_t freq = freqs[context][token];
+    const uint32_t scale = scales[context];
+    if (out->state >= (uint64_t)freq << (63 - scale - num_bits))
+        emit_word(out);
+
+    const uint64_t shifted = (out->state << num_bits) | (symbol & 0xFFu);
+    out->state = ((shifted / freq) << scale) + (shifted % freq) + starts[context][token];
+}
+
+bool q2_encoder_finish(qtree_q2_encoder_t *encoder, uint8_t **data, size_t *length)
+{
+    if (encoder->error)
+        return false;
+
+    uint32_t (*freqs)[Q2_MEAN_TOKENS] = calloc(Q2_CONTEXTS, sizeof(*freqs));
+    uint32_t (*starts)[Q2_MEAN_TOKENS] = calloc(Q2_CONTEXTS, sizeof(*starts));
+    uint32_t scales[Q2_CONTEXTS];
+
+    // Presence bit, scale and gamma codes: well under 32 entries per token
+    const size_t header_room = (size_t)Q2_CONTEXTS * (2 + Q2_MEAN_TOKENS * 32);
+    uint32_t *header = malloc(header_room * sizeof(uint32_t));
+    size_t header_count = 0;
+
+    // Every symbol is under 3 bytes (12 bits of token, 8 of raw bits)
+    const size_t capacity = (encoder->count + header_room) * 3 + 8;
+    uint8_t *buffer = malloc(capacity);
+
+    if (!freqs || !starts || !header || !buffer)
+    {
+        free(freqs);
+        free(starts);
+        free(header);
+        free(buffer);
+        return false;
+    }
+
+    for (uint32_t context = 0; context < Q2_CONTEXTS; context++)
+    {
+        const uint32_t tokens = context_tokens(context);
+        scales[context] = normalize_counts(encoder->counts[context], tokens, freqs[context]);
+
+        queue_bits(header, &header_count, 1, scales[context] != 0);
+        if (scales[context] == 0)
+            continue;
+
+        queue_bits(header, &header_count, 3, scales[context] - Q2_MIN_SCALE_BITS);
+        uint32_t start = 0;
+        for (uint32_t t = 0; t < tokens; t++)
+        {
+            starts[context][t] = start;
+            start += freqs[context][t];
+            // The last one is whatever is left
+            if (t + 1 < tokens)
+                queue_gamma(header, &header_count, freqs[context][t] + 1);
+        }
+    }
+
+    rans_output_t out = {.state = RANS_LOW, .front = buffer + capacity};
+    for (size_t i = encoder->count; i-- > 0;)
+        encode_symbol(&out, encoder->symbols[i], freqs, starts, scales);
+    for (size_t i = header_count; i-- > 0;)
+        encode_symbol(&out, header[i], freqs, starts, scales);
+
+    emit_word(&out);
+    emit_word(&out);
+
+    *length = (size_t)(buffer + capacity - out.front);
+    memmove(buffer, out.front, *length);
+    *data = buffer;
+
+    free(freqs);
+    free(starts);
+    free(header);
+    return true;
+}
+
+/**
+ * @brief Reverse of queue_gamma()
+ * @return The value, or 0 if the code is too long to be one of ours
+ */
+static uint32_t decode_gamma(qtree_q2_decoder_t *decoder)
+{
+    uint32_t n = 0;
+    while (q2_decode_bits(decoder, 1) == 0)
+    {
+        if (++n > Q2_MAX_SCALE_BITS + 1 || decoder->source->has_error)
+            return 0;
+    }
+
+    uint32_t value = 1u << n;
+    if (n > 8)
+        value |= q2_decode_bits(decoder, n - 8) << 8;
+    if (n > 0)
+        value |= q2_decode_bits(decoder, n > 8 ? 8 : n);
+    return value;
+}
+
+/**
+ * @brief Reads one context's scaled counts
+ * @return The scale, or 0 if the context is unused or the counts are bad
+ */
+static uint32_t read_context(qtree_q2_decoder_t *decoder, uint32_t context, uint32_t *freqs,
+                             bool *ok)
+{
+    if (q2_decode_bits(decoder, 1) == 0)
+        return 0;
+
+    const uint32_t scale = Q2_MIN_SCALE_BITS + q2_decode_bits(decoder, 3);
+    const uint32_t target = 1u << scale;
+    const uint32_t tokens = context_tokens(context);
+
+    uint32_t sum = 0;
+    for (uint32_t t = 0; t + 1 < tokens && *ok; t++)
+    {
+        const uint32_t value = decode_gamma(decoder);
+        if (value == 0 || value - 1 > target - sum)
+        {
+            *ok = false;
+            return 0;
+        }
+        freqs[t] = value - 1;
+        sum += freqs[t];
+    }
+    freqs[tokens - 1] = target - sum;
+    return *ok ? scale : 0;
+}
+
+bool q2_decoder_init(qtree_q2_decoder_t *decoder, qtree_bit_reader_t *source)
+{
+    *decoder = (qtree_q2_decoder_t){0};
+    decoder->source = source;
+
+    // Token 0 and the bad token stay at residual 0, no extra bits
+    for (uint32_t range = 0; range < Q2_MAGNITUDES; range++)
+    {
+        uint32_t extra = 0;
+        const int16_t start = (int16_t)q2_range_start(range, &extra);
+        decoder->base[1 + range] = start;
+        decoder->sign[1 + range] = 1;
+        decoder->base[1 + Q2_MAGNITUDES + range] = (int16_t)-start;
+        decoder->sign[1 + Q2_MAGNITUDES + range] = -1;
+        decoder->extra[1 + range] = (uint8_t)extra;
+        decoder->extra[1 + Q2_MAGNITUDES + range] = (uint8_t)extra;
+    }
+
+    decoder->state = bit_reader_read(source, 32);
+    decoder->state = (decoder->state << 32) | bit_reader_read(source, 32);
+    if (source->has_error || decoder->state < RANS_LOW)
+        return false;
+
+    uint32_t (*freqs)[Q2_MEAN_TOKENS] = malloc(Q2_CONTEXTS * sizeof(*freqs));
+    uint32_t scales[Q2_CONTEXTS];
+    if (!freqs)
+        return false;
+
+    bool ok = true;
+    size_t total = 0;
+    for (uint32_t context = 0; context < Q2_CONTEXTS && ok; context++)
+    {
+        scales[context] = read_context(decoder, context, freqs[context], &ok);
+        if (scales[context] != 0)
+            total += (size_t)1 << scales[context];
+    }
+    ok = ok && !source->has_error;
+
+    decoder->slots = ok ? malloc((total > 0 ? total : 1) * sizeof(uint32_t)) : NULL;
+    if (!decoder->slots)
+    {
+        free(freqs);
+        return false;
+    }
+
+    uint32_t *slots = decoder->slots;
+    for (uint32_t context = 0; context < Q2_CONTEXTS; context++)
+    {
+        qtree_q2_table_t *table = &decoder->tables[context];
+        if (scales[context] == 0)
+        {
+            *table = (qtree_q2_table_t){.slots = &bad_slot, .mask = 0, .scale = 0};
+            continue;
+        }
+
+        *table = (qtree_q2_table_t){.slots = slots,
+                                    .mask = (1u << scales[context]) - 1u,
+                                    .scale = scales[context]};
+
+        uint32_t start = 0;
+        for (uint32_t t = 0; t < context_tokens(context); t++)
+        {
+            for (uint32_t k = 0; k < freqs[context][t]; k++)
+                slots[start + k] = t | (freqs[context][t] << 5) | (k << 18);
+            start += freqs[context][t];
+        }
+        slots += (size_t)1 << scales[context];
+    }
+
+    free(freqs);
+    return true;
+}
+
+void q2_decoder_release(qtree_q2_decoder_t *decoder)
+{
+    free(decoder->slots);
+    decoder->slots = NULL;
+}
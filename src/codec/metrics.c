@@ -0,0 +1,318 @@
+/**
+ * @file metrics.c
+ * @brief Squared-error kernels and the walk that sums them per flat block
+ *
+ * The kernel for one row of a block returns Σ(p - m)² in 32 bits, which
+ * holds even for a 65536-pixel row (65536·255² < 2^32); rows are added
+ * up in 64 bits. The vector paths are picked at compile time (AVX2,
+ * SSE2 or NEON), like the pyramid's, and fall back to the scalar loop
+ * for narrow blocks and row tails.
+ */
+
+#include <math.h>
+#include <stddef.h>
+
+#include "codec/metrics.h"
+#include "core/tree_walk.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+/**
+ * @brief Scalar Σ(p - value)² over pixels [x, width) of one row
+ */
+static uint32_t row_error_scalar(const uint8_t *row, uint32_t x, uint32_t width, uint8_t value)
+{
+    uint32_t sum = 0;
+    for (; x < width; x++)
+    {
+        const int diff = (int)row[x] - (int)value;
+        sum += (uint32_t)(diff * diff);
+    }
+    return sum;
+}
+
+#if defined(__AVX2__)
+
+static uint32_t row_error(const uint8_t *row, uint32_t width, uint8_t value)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i mean = _mm256_set1_epi16(value);
+    __m256i acc = _mm256_setzero_si256();
+    uint32_t x = 0;
+
+    // Each 32-bit lane takes 4 squares a step: at most 2^11 steps of 4·255²
+    for (; x + 32 <= width; x += 32)
+    {
+        const void *p = row + x;
+        const __m256i pixels = _mm256_loadu_si256(p);
+        const __m256i lo = _mm256_sub_epi16(_mm256_unpacklo_epi8(pixels, zero), mean);
+        const __m256i hi = _mm256_sub_epi16(_mm256_unpackhi_epi8(pixels, zero), mean);
+        acc = _mm256_add_epi32(acc, _mm256_add_epi32(_mm256_madd_epi16(lo, lo),
+                                                     _mm256_madd_epi16(hi, hi)));
+    }
+
+    __m128i sum = _mm_add_epi32(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0x4E));
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0xB1));
+    return (uint32_t)_mm_cvtsi128_si32(sum) + row_error_scalar(row, x, width, value);
+}
+
+const char *qtree_metrics_kernel_name(void)
+{
+    return "avx2";
+}
+
+#elif defined(__SSE2__)
+
+static uint32_t row_error(const uint8_t *row, uint32_t width, uint8_t value)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i mean = _mm_set1_epi16(value);
+    __m128i acc = _mm_setzero_si128();
+    uint32_t x = 0;
+
+    // Each 32-bit lane takes 4 squares a step: at most 2^12 steps of 4·255²
+    for (; x + 16 <= width; x += 16)
+    {
+        const void *p = row + x;
+        const __m128i pixels = _mm_loadu_si128(p);
+        const __m128i lo = _mm_sub_epi16(_mm_unpacklo_epi8(pixels, zero), mean);
+        const __m128i hi = _mm_sub_epi16(_mm_unpackhi_epi8(pixels, zero), mean);
+        acc = _mm_add_epi32(acc, _mm_add_epi32(_mm_madd_epi16(lo, lo), _mm_madd_epi16(hi, hi)));
+    }
+
+    acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, 0x4E));
+    acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, 0xB1));
+    return (uint32_t)_mm_cvtsi128_si32(acc) + row_error_scalar(row, x, width, value);
+}
+
+const char *qtree_metrics_kernel_name(void)
+{
+    return "sse2";
+}
+
+#elif defined(__ARM_NEON)
+
+static uint32_t row_error(const uint8_t *row, uint32_t width, uint8_t value)
+{
+    const uint8x16_t mean = vdupq_n_u8(value);
+    uint32x4_t acc = vdupq_n_u32(0);
+    uint32_t x = 0;
+
+    for (; x + 16 <= width; x += 16)
+    {
+        const uint8x16_t diff = vabdq_u8(vld1q_u8(row + x), mean);
+        acc = vpadalq_u16(acc, vmull_u8(vget_low_u8(diff), vget_low_u8(diff)));
+        acc = vpadalq_u16(acc, vmull_u8(vget_high_u8(diff), vget_high_u8(diff)));
+    }
+
+    const uint64x2_t sum = vpaddlq_u32(acc);
+    return (uint32_t)(vgetq_lane_u64(sum, 0) + vgetq_lane_u64(sum, 1)) +
+           row_error_scalar(row, x, width, value);
+}
+
+const char *qtree_metrics_kernel_name(void)
+{
+    return "neon";
+}
+
+#else
+
+static uint32_t row_error(const uint8_t *row, uint32_t width, uint8_t value)
+{
+    return row_error_scalar(row, 0, width, value);
+}
+
+const char *qtree_metrics_kernel_name(void)
+{
+    return "scalar";
+}
+
+#endif
+
+/**
+ * @brief Σ(p - value)² over a size x size block
+ * @param block Top-left pixel of the block
+ * @param stride Bytes per image row
+ */
+static uint64_t block_error(const uint8_t *block, size_t stride, uint32_t size, uint8_t value)
+{
+    uint64_t sum = 0;
+    for (size_t r = 0; r < size; r++)
+        sum += row_error(block + r * stride, size, value);
+    return sum;
+}
+
+double qtree_psnr_from_mse(double mse)
+{
+    return mse > 0.0 ? 10.0 * log10(255.0 * 255.0 / mse) : (double)INFINITY;
+}
+
+/**
+ * @brief What one subtree adds up to
+ */
+typedef struct
+{
+    uint64_t error;  /* Exact, 0 without pixels */
+    double estimate; /* Σ n·v² over the flat blocks */
+} distortion_sum_t;
+
+/**
+ * @brief What the measuring pass needs to know
+ */
+typedef struct
+{
+    const uint8_t *pixels; /* NULL for the estimate only */
+    uint32_t size;
+} measure_walk_t;
+
+/**
+ * @brief Error of painting a cell flat with value, as the decoder would
+ */
+static uint64_t cell_error(const measure_walk_t *walk, const qtree_walk_cell_t *cell,
+                           uint8_t value)
+{
+    if (!walk->pixels)
+        return 0;
+    return block_error(walk->pixels + (size_t)cell->row * walk->size + cell->col, walk->size,
+                       cell->size, value);
+}
+
+static void measure_node(const measure_walk_t *walk, const qtree_node_t *node,
+                         const qtree_walk_cell_t *cell, distortion_sum_t *sum)
+{
+    // A missing child decodes black
+    if (!node)
+    {
+        sum->error += cell_error(walk, cell, 0);
+        return;
+    }
+
+    if (qtree_is_leaf(node) || node->u)
+    {
+        const double pixels = (double)cell->size * cell->size;
+        sum->error += cell_error(walk, cell, node->m);
+        sum->estimate += pixels * (double)node->v * (double)node->v;
+        return;
+    }
+
+    for (uint32_t q = 0; q < 4; q++)
+    {
+        const qtree_walk_cell_t child = qtree_walk_child_cell(cell, q);
+        measure_node(walk, node->children[q], &child, sum);
+    }
+}
+
+static void measure_subtree(void *ctx, qtree_node_t *node, const qtree_walk_cell_t *cell,
+                            uint32_t worker, void *result)
+{
+    (void)worker;
+    distortion_sum_t *sum = result;
+    *sum = (distortion_sum_t){0};
+    measure_node(ctx, node, cell, sum);
+}
+
+/**
+ * @brief Above the split nothing is flat yet, so a node is just its children
+ */
+static void measure_leave(void *ctx, qtree_node_t *node, const qtree_walk_cell_t *cell,
+                          const void *const children[4], void *result)
+{
+    (void)node;
+    distortion_sum_t *sum = result;
+    *sum = (distortion_sum_t){0};
+    for (uint32_t q = 0; q < 4; q++)
+    {
+        if (children[q])
+        {
+            const distortion_sum_t *child = children[q];
+            sum->error += child->error;
+            sum->estimate += child->estimate;
+        }
+        else
+        {
+            const qtree_walk_cell_t missing = qtree_walk_child_cell(cell, q);
+            sum->error += cell_error(ctx, &missing, 0);
+        }
+    }
+}
+
+static const qtree_walk_t measure_pass = {
+    .subtree = measure_subtree,
+    .leave = measure_leave,
+    .result_size = sizeof(distortion_sum_t)};
+
+/**
+ * @brief Turns the sums of a whole image into the figures
+ */
+static void finish_distortion(const distortion_sum_t *sum, uint32_t size, bool exact,
+                              qtree_distortion_t *distortion)
+{
+    const double pixel_count = (double)size * size;
+    const double estimated_mse = sum->estimate / pixel_count;
+    const double mse = exact ? (double)sum->error / pixel_count : estimated_mse;
+    *distortion = (qtree_distortion_t){
+        .exact = exact,
+        .squared_error = sum->error,
+        .mse = mse,
+        .psnr = qtree_psnr_from_mse(mse),
+        .estimated_mse = estimated_mse,
+        .estimated_psnr = qtree_psnr_from_mse(estimated_mse)};
+}
+
+qtree_status_t qtree_measure_distortion(const qtree_t *tree, const uint8_t *pixels,
+                                        qtree_distortion_t *distortion)
+{
+    if (!tree || !tree->root || !distortion || tree->size == 0)
+        return QTREE_ERROR_INVALID_PARAM;
+
+    measure_walk_t walk = {.pixels = pixels, .size = tree->size};
+    distortion_sum_t sum;
+    qtree_walk(&measure_pass, &walk, tree->root, tree->size, tree->pool, &sum);
+
+    finish_distortion(&sum, tree->size, pixels != NULL, distortion);
+    return QTREE_SUCCESS;
+}
+
+/**
+ * @brief measure_node() for the array layout: a uniform node or a pixel is flat
+ */
+static void measure_array_node(const measure_walk_t *walk, const qtree_array_t *tree,
+                               size_t i, const qtree_walk_cell_t *cell, distortion_sum_t *sum)
+{
+    if (tree->u[i] || cell->level == tree->n_levels)
+    {
+        const double pixels = (double)cell->size * cell->size;
+        sum->error += cell_error(walk, cell, tree->m[i]);
+        sum->estimate += pixels * (double)tree->v[i] * (double)tree->v[i];
+        return;
+    }
+
+    const size_t c = qtree_first_child_index(i);
+    for (uint32_t q = 0; q < 4; q++)
+    {
+        const qtree_walk_cell_t child = qtree_walk_child_cell(cell, q);
+        measure_array_node(walk, tree, c + q, &child, sum);
+    }
+}
+
+qtree_status_t qtree_measure_array_distortion(const qtree_array_t *tree, const uint8_t *pixels,
+                                              qtree_distortion_t *distortion)
+{
+    if (!tree || !tree->m || !distortion || tree->size == 0)
+        return QTREE_ERROR_INVALID_PARAM;
+
+    const measure_walk_t walk = {.pixels = pixels, .size = tree->size};
+    const qtree_walk_cell_t root = {.size = tree->size};
+    distortion_sum_t sum = {0};
+    measure_array_node(&walk, tree, 0, &root, &sum);
+
+    finish_distortion(&sum, tree->size, pixels != NULL, distortion);
+    return QTREE_SUCCESS;
+}
@@ -0,0 +1,178 @@
+/**
+ * @file qtc.c
+ * @brief Buffer-to-buffer codec for embedding
+ *
+ * Runs the same pipeline as the codec tool with the logger muted for
+ * the calling thread only; muted threads never touch the logger's
+ * shared state, which is what makes these calls safe to run in
+ * parallel.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "codec/qtc.h"
+#include "codec/compression.h"
+#include "codec/decompression.h"
+#include "codec/metrics.h"
+#include "codec/stats.h"
+#include "common/common.h"
+#include "core/quadtree.h"
+#include "logger/logger.h"
+
+/**
+ * @brief Hand a result over: as is, or copied into the caller's buffer
+ * @param data Our buffer (always freed or handed over)
+ */
+static codec_status_t deliver(uint8_t *data, size_t length, uint8_t **out, size_t *out_len)
+{
+    if (!*out)
+    {
+        *out = data;
+        *out_len = length;
+        return CODEC_SUCCESS;
+    }
+
+    const size_t capacity = *out_len;
+    *out_len = length;
+    if (capacity < length)
+    {
+        free(data);
+        return CODEC_ERROR_MEMORY;
+    }
+
+    memcpy(*out, data, length);
+    free(data);
+    return CODEC_SUCCESS;
+}
+
+codec_status_t qtc_encode(const uint8_t *pixels, uint32_t size, float alpha,
+                          uint8_t **out, size_t *out_len)
+{
+    return qtc_encode_with_stats(pixels, size, alpha, out, out_len, NULL);
+}
+
+codec_status_t qtc_encode_with_stats(const uint8_t *pixels, uint32_t size, float alpha,
+                                     uint8_t **out, size_t *out_len, qtc_stats_t *stats)
+{
+    if (!pixels || !out || !out_len)
+        return CODEC_ERROR_INVALID_PARAM;
+
+    const bool was_muted = logger_thread_muted();
+    logger_mute_thread(true);
+
+    const double start = wall_seconds();
+    qtc_stats_init(stats, "compress");
+
+    qtree_t tree = {0};
+    uint8_t *data = NULL;
+    size_t length = 0;
+
+    double stage = wall_seconds();
+    qtree_status_t op_status = qtree_init(&tree, size);
+    if (op_status == QTREE_SUCCESS)
+        op_status = qtree_build_with(&tree, pixels, size, "buffer", QTREE_BUILD_RECURSIVE, 1);
+    qtc_stats_stage(stats, QTC_STAGE_BUILD, stage);
+
+    stage = wall_seconds();
+    if (op_status == QTREE_SUCCESS && alpha > 1.0f)
+    {
+        op_status = apply_lossy_compression(&tree, alpha);
+
+        // Only worth the pass over the pixels when someone looks at it
+        qtree_distortion_t distortion;
+        if (op_status == QTREE_SUCCESS && stats &&
+            qtree_measure_distortion(&tree, pixels, &distortion) == QTREE_SUCCESS)
+            qtc_stats_set_distortion(stats, distortion.mse, distortion.estimated_mse);
+    }
+    qtc_stats_stage(stats, QTC_STAGE_FILTER, stage);
+
+    stage = wall_seconds();
+    if (op_status == QTREE_SUCCESS)
+        op_status = compress_to_buffer(&tree, &data, &length);
+    qtc_stats_stage(stats, QTC_STAGE_ENCODE, stage);
+
+    if (op_status == QTREE_SUCCESS && stats)
+    {
+        qtc_stats_count_tree(stats, &tree);
+        stats->bytes_in = (uint64_t)size * size;
+        stats->bits_in = stats->bytes_in * 8;
+        stats->bytes_out = length;
+        stats->bits_out = (uint64_t)length * 8;
+    }
+    qtree_free(&tree);
+
+    codec_status_t status = codec_status_from_qtree(op_status);
+    if (status == CODEC_SUCCESS)
+        status = deliver(data, length, out, out_len);
+
+    if (stats)
+    {
+        stats->total_seconds = wall_seconds() - start;
+        stats->ok = status == CODEC_SUCCESS;
+    }
+    logger_mute_thread(was_muted);
+    return status;
+}
+
+codec_status_t qtc_decode(const uint8_t *data, size_t len, uint8_t **pixels,
+                          size_t *pixels_len, uint32_t *size)
+{
+    return qtc_decode_with_stats(data, len, pixels, pixels_len, size, NULL);
+}
+
+codec_status_t qtc_decode_with_stats(const uint8_t *data, size_t len, uint8_t **pixels,
+                                     size_t *pixels_len, uint32_t *size, qtc_stats_t *stats)
+{
+    if (!data || !pixels || !pixels_len || !size)
+        return CODEC_ERROR_INVALID_PARAM;
+
+    const double start = wall_seconds();
+    qtc_stats_init(stats, "decompress");
+    if (stats)
+        stats->bytes_in = len;
+
+    const uint32_t side = qtree_buffer_image_size(data, len);
+    const size_t needed = (size_t)side * side;
+    codec_status_t status = CODEC_SUCCESS;
+    if (side == 0)
+    {
+        status = CODEC_ERROR_FORMAT;
+    }
+    else if (*pixels && *pixels_len < needed)
+    {
+        *pixels_len = needed;
+        status = CODEC_ERROR_MEMORY;
+    }
+    else
+    {
+        const bool was_muted = logger_thread_muted();
+        logger_mute_thread(true);
+
+        pgm_t pgm = {0};
+        status = codec_status_from_qtree(
+            qtree_decompress_buffer_with_stats(data, len, *pixels, &pgm, stats));
+        qtc_stats_stage(stats, QTC_STAGE_DECODE, start);
+        if (status == CODEC_SUCCESS)
+        {
+            *pixels = pgm.pixels;
+            *pixels_len = needed;
+            *size = side;
+        }
+        logger_mute_thread(was_muted);
+    }
+
+    // Failures get a whole record too, they are what a caller logs
+    if (stats)
+    {
+        stats->bytes_out = status == CODEC_SUCCESS ? needed : 0;
+        stats->total_seconds = wall_seconds() - start;
+        stats->ok = status == CODEC_SUCCESS;
+    }
+    return status;
+}
+
+void qtc_free(void *buffer)
+{
+    free(buffer);
+}
@@ -0,0 +1,447 @@
+/**
+ * @file sequence.c
+ * @brief Frame sequences, coded as the blocks that changed
+ *
+ * Blocks are compared a row at a time with memcmp, which stops at the
+ * first byte that differs, so a block that moved costs a few rows and
+ * one that didn't costs a read of both frames. Block work mutes the
+ * logger the way tiled.c does; the caller reports per frame instead.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "codec/decompression.h"
+#include "codec/sequence.h"
+#include "common/common.h"
+#include "core/node_arena.h"
+#include "logger/logger.h"
+
+/* Room for the magic and comment lines */
+#define HEADER_TEXT_SIZE 96
+
+/* Bytes of a frame's or a block's length field */
+#define LENGTH_SIZE 4u
+
+static void put_le(uint8_t *out, uint64_t value, unsigned n_bytes)
+{
+    for (unsigned i = 0; i < n_bytes; i++)
+        out[i] = (uint8_t)(value >> (8 * i));
+}
+
+static uint64_t get_le(const uint8_t *in, unsigned n_bytes)
+{
+    uint64_t value = 0;
+    for (unsigned i = 0; i < n_bytes; i++)
+        value |= (uint64_t)in[i] << (8 * i);
+    return value;
+}
+
+static uint32_t levels_of(uint32_t size)
+{
+    uint32_t levels = 0;
+    while ((1u << levels) < size)
+        levels++;
+    return levels;
+}
+
+/**
+ * @brief Makes room for needed bytes in a growable buffer
+ */
+static bool reserve(uint8_t **buffer, size_t *capacity, size_t needed)
+{
+    if (needed <= *capacity)
+        return true;
+
+    size_t grown = *capacity ? *capacity : 1u << 12;
+    while (grown < needed)
+        grown *= 2;
+    uint8_t *bigger = realloc(*buffer, grown);
+    if (!bigger)
+        return false;
+    *buffer = bigger;
+    *capacity = grown;
+    return true;
+}
+
+bool qtree_sequence_magic(const uint8_t *data, size_t length)
+{
+    return data && length >= 3 && memcmp(data, QTREE_SEQUENCE_MAGIC "\n", 3) == 0;
+}
+
+static bool bit_is_set(const uint8_t *bitmap, size_t i)
+{
+    return ((unsigned)bitmap[i / 8] >> (i % 8)) & 1u;
+}
+
+static bool block_changed(const qtree_sequence_encoder_t *encoder, const uint8_t *pixels,
+                          size_t top, size_t left)
+{
+    if (!encoder->previous)
+        return true;
+
+    for (size_t r = top; r < top + encoder->block_size; r++)
+    {
+        const size_t at = r * encoder->size + left;
+        if (memcmp(encoder->previous + at, pixels + at, encoder->block_size) != 0)
+            return true;
+    }
+    return false;
+}
+
+qtree_status_t qtree_sequence_encoder_init(qtree_sequence_encoder_t *encoder, FILE *file,
+                                           uint32_t size, uint32_t block_size,
+                                           qtree_format_t format)
+{
+    if (!encoder || !file || size < 2 || size > (1u << 16) || !is_power_of_two(size) ||
+        block_size < 2 || !is_power_of_two(block_size))
+    {
+        log_message(LOG_LEVEL_ERROR, "Invalid parameters for sequence compression");
+        return QTREE_ERROR_INVALID_PARAM;
+    }
+
+    if (block_size > size)
+        block_size = size;
+    const uint32_t split = levels_of(size) - levels_of(block_size);
+    if (split > QTREE_SEQUENCE_MAX_SPLIT)
+    {
+        log_message(LOG_LEVEL_ERROR, "Blocks of %ux%u are too small for a %ux%u frame",
+                    block_size, block_size, size, size);
+        return QTREE_ERROR_INVALID_PARAM;
+    }
+
+    *encoder = (qtree_sequence_encoder_t){
+        .file = file,
+        .size = size,
+        .block_size = block_size,
+        .block_levels = levels_of(block_size),
+        .split = split,
+        .blocks_per_side = 1u << split,
+        .format = format};
+    qtree_arena_init(&encoder->arena);
+
+    const size_t count = (size_t)encoder->blocks_per_side * encoder->blocks_per_side;
+    encoder->bitmap = malloc((count + 7) / 8);
+    if (!encoder->bitmap)
+    {
+        qtree_sequence_encoder_free(encoder);
+        return QTREE_ERROR_MEMORY;
+    }
+
+    char text[HEADER_TEXT_SIZE];
+    const int text_length = snprintf(text, sizeof(text),
+                                     "%s\n# frames of %ux%u, blocks of %ux%u\n",
+                                     QTREE_SEQUENCE_MAGIC, size, size, block_size, block_size);
+    if (text_length <= 0 || (size_t)text_length >= sizeof(text))
+    {
+        qtree_sequence_encoder_free(encoder);
+        return QTREE_ERROR_FORMAT;
+    }
+
+    const uint8_t fields[3] = {(uint8_t)levels_of(size), (uint8_t)encoder->block_levels,
+                               format == QTREE_FORMAT_Q2 ? 2 : 1};
+    if (fwrite(text, 1, (size_t)text_length, file) != (size_t)text_length ||
+        fwrite(fields, 1, sizeof(fields), file) != sizeof(fields))
+    {
+        log_message(LOG_LEVEL_ERROR, "Failed to write sequence header");
+        qtree_sequence_encoder_free(encoder);
+        return QTREE_ERROR_FORMAT;
+    }
+    encoder->bytes = (uint64_t)text_length + sizeof(fields);
+    return QTREE_SUCCESS;
+}
+
+/**
+ * @brief Builds one block's subtree and appends its payload to the frame
+ *
+ * The nodes go straight back to the arena, so the next block reuses them.
+ */
+static qtree_status_t code_block(qtree_sequence_encoder_t *encoder, const uint8_t *pixels,
+                                 uint32_t block_row, uint32_t block_col, size_t *used)
+{
+    qtree_node_t *root = qtree_build_block(&encoder->arena, pixels, encoder->size,
+                                           encoder->block_levels,
+                                           block_row * encoder->block_size,
+                                           block_col * encoder->block_size);
+    if (!root)
+        return QTREE_ERROR_MEMORY;
+
+    // The block's subtree on its own, as a tiled file would code it
+    const qtree_t block = {
+        .root = root, .n_levels = encoder->block_levels, .size = encoder->block_size};
+    uint8_t *data = NULL;
+    size_t length = 0;
+    qtree_status_t status = compress_payload_to_buffer(&block, encoder->format, &data, &length);
+    qtree_arena_release_subtree(&encoder->arena, root);
+    if (status != QTREE_SUCCESS)
+        return status;
+
+    if (length > UINT32_MAX)
+        status = QTREE_ERROR_FORMAT;
+    else if (!reserve(&encoder->frame, &encoder->frame_capacity, *used + LENGTH_SIZE + length))
+        status = QTREE_ERROR_MEMORY;
+    else
+    {
+        put_le(encoder->frame + *used, length, LENGTH_SIZE);
+        memcpy(encoder->frame + *used + LENGTH_SIZE, data, length);
+        *used += LENGTH_SIZE + length;
+    }
+    free(data);
+    return status;
+}
+
+qtree_status_t qtree_sequence_encode_frame(qtree_sequence_encoder_t *encoder,
+                                           const uint8_t *pixels, size_t *changed)
+{
+    if (!encoder || !encoder->file || !pixels)
+    {
+        log_message(LOG_LEVEL_ERROR, "Invalid parameters for sequence compression");
+        return QTREE_ERROR_INVALID_PARAM;
+    }
+
+    const size_t count = (size_t)encoder->blocks_per_side * encoder->blocks_per_side;
+    const size_t bitmap_bytes = (count + 7) / 8;
+    size_t used = LENGTH_SIZE + bitmap_bytes;
+    if (!reserve(&encoder->frame, &encoder->frame_capacity, used))
+        return QTREE_ERROR_MEMORY;
+    memset(encoder->bitmap, 0, bitmap_bytes);
+
+    const bool was_muted = logger_thread_muted();
+    logger_mute_thread(true);
+
+    qtree_status_t status = QTREE_SUCCESS;
+    size_t coded = 0;
+    for (size_t i = 0; i < count && status == QTREE_SUCCESS; i++)
+    {
+        const uint32_t block_row = (uint32_t)(i / encoder->blocks_per_side);
+        const uint32_t block_col = (uint32_t)(i % encoder->blocks_per_side);
+        if (!block_changed(encoder, pixels, (size_t)block_row * encoder->block_size,
+                           (size_t)block_col * encoder->block_size))
+        {
+            continue;
+        }
+
+        encoder->bitmap[i / 8] |= (uint8_t)(1u << (i % 8));
+        status = code_block(encoder, pixels, block_row, block_col, &used);
+        coded++;
+    }
+
+    logger_mute_thread(was_muted);
+    if (status != QTREE_SUCCESS)
+    {
+        log_message(LOG_LEVEL_ERROR, "Failed to code frame %zu", encoder->frames);
+        return status;
+    }
+
+    if (used - LENGTH_SIZE > UINT32_MAX)
+    {
+        log_message(LOG_LEVEL_ERROR, "Frame %zu is too big for its length field",
+                    encoder->frames);
+        return QTREE_ERROR_FORMAT;
+    }
+    put_le(encoder->frame, used - LENGTH_SIZE, LENGTH_SIZE);
+    memcpy(encoder->frame + LENGTH_SIZE, encoder->bitmap, bitmap_bytes);
+    if (fwrite(encoder->frame, 1, used, encoder->file) != used)
+    {
+        log_message(LOG_LEVEL_ERROR, "Failed to write frame %zu", encoder->frames);
+        return QTREE_ERROR_FORMAT;
+    }
+
+    const size_t frame_pixels = (size_t)encoder->size * encoder->size;
+    if (!encoder->previous)
+    {
+        encoder->previous = malloc(frame_pixels);
+        if (!encoder->previous)
+            return QTREE_ERROR_MEMORY;
+    }
+    memcpy(encoder->previous, pixels, frame_pixels);
+
+    encoder->frames++;
+    encoder->blocks_coded += coded;
+    encoder->bytes += used;
+    if (changed)
+        *changed = coded;
+    return QTREE_SUCCESS;
+}
+
+void qtree_sequence_encoder_free(qtree_sequence_encoder_t *encoder)
+{
+    if (!encoder)
+        return;
+
+    qtree_arena_destroy(&encoder->arena);
+    free(encoder->previous);
+    free(encoder->bitmap);
+    free(encoder->frame);
+    encoder->previous = NULL;
+    encoder->bitmap = NULL;
+    encoder->frame = NULL;
+    encoder->frame_capacity = 0;
+}
+
+qtree_status_t qtree_sequence_decoder_init(qtree_sequence_decoder_t *decoder, FILE *file)
+{
+    if (!decoder || !file)
+        return QTREE_ERROR_INVALID_PARAM;
+
+    char text[HEADER_TEXT_SIZE];
+    uint8_t fields[3];
+    if (!fgets(text, sizeof(text), file) ||
+        !qtree_sequence_magic((const uint8_t *)text, strlen(text)))
+    {
+        log_message(LOG_LEVEL_ERROR, "Invalid file signature (expected '%s')",
+                    QTREE_SEQUENCE_MAGIC);
+        return QTREE_ERROR_FORMAT;
+    }
+    if (!fgets(text, sizeof(text), file) || fread(fields, 1, sizeof(fields), file) != 3)
+    {
+        log_message(LOG_LEVEL_ERROR, "Truncated sequence header");
+        return QTREE_ERROR_FORMAT;
+    }
+
+    const uint32_t n_levels = fields[0];
+    const uint32_t block_levels = fields[1];
+    if (n_levels < 1 || n_levels > 16 || block_levels < 1 || block_levels > n_levels ||
+        n_levels - block_levels > QTREE_SEQUENCE_MAX_SPLIT || (fields[2] != 1 && fields[2] != 2))
+    {
+        log_message(LOG_LEVEL_ERROR,
+                    "Invalid sequence header (depth %u, block depth %u, format %u)", n_levels,
+                    block_levels, (uint32_t)fields[2]);
+        return QTREE_ERROR_FORMAT;
+    }
+
+    *decoder = (qtree_sequence_decoder_t){
+        .file = file,
+        .size = 1u << n_levels,
+        .block_size = 1u << block_levels,
+        .block_levels = block_levels,
+        .blocks_per_side = 1u << (n_levels - block_levels),
+        .format = fields[2] == 2 ? QTREE_FORMAT_Q2 : QTREE_FORMAT_Q1};
+
+    // Blocks a frame doesn't carry keep what the last one left, black at first
+    decoder->pixels = calloc((size_t)decoder->size * decoder->size, 1);
+    decoder->block = malloc((size_t)decoder->block_size * decoder->block_size);
+    if (!decoder->pixels || !decoder->block)
+    {
+        qtree_sequence_decoder_free(decoder);
+        return QTREE_ERROR_MEMORY;
+    }
+    return QTREE_SUCCESS;
+}
+
+/**
+ * @brief Decodes one block payload and paints it into the frame
+ */
+static qtree_status_t paint_block(qtree_sequence_decoder_t *decoder, const uint8_t *data,
+                                  size_t length, size_t i, qtc_stats_t *stats)
+{
+    pgm_t pgm = {0};
+    qtc_stats_t part = {0};
+    const qtree_status_t status = qtree_decompress_payload_with_stats(
+        data, length, decoder->format, decoder->block_levels, decoder->block, &pgm,
+        stats ? &part : NULL);
+    if (status != QTREE_SUCCESS)
+        return status;
+    qtc_stats_add_payload(stats, &part, levels_of(decoder->blocks_per_side));
+
+    const size_t block_size = decoder->block_size;
+    const size_t top = i / decoder->blocks_per_side * block_size;
+    const size_t left = i % decoder->blocks_per_side * block_size;
+    for (size_t r = 0; r < block_size; r++)
+    {
+        memcpy(decoder->pixels + (top + r) * decoder->size + left,
+               decoder->block + r * block_size, block_size);
+    }
+    return QTREE_SUCCESS;
+}
+
+qtree_status_t qtree_sequence_decode_frame(qtree_sequence_decoder_t *decoder, bool *got)
+{
+    return qtree_sequence_decode_frame_with_stats(decoder, got, NULL);
+}
+
+qtree_status_t qtree_sequence_decode_frame_with_stats(qtree_sequence_decoder_t *decoder,
+                                                      bool *got, qtc_stats_t *stats)
+{
+    if (!decoder || !decoder->file || !got)
+        return QTREE_ERROR_INVALID_PARAM;
+    *got = false;
+
+    uint8_t field[LENGTH_SIZE];
+    const size_t read = fread(field, 1, LENGTH_SIZE, decoder->file);
+    if (read == 0 && feof(decoder->file))
+        return QTREE_SUCCESS;
+
+    const size_t length = read == LENGTH_SIZE ? (size_t)get_le(field, LENGTH_SIZE) : 0;
+    const size_t count = (size_t)decoder->blocks_per_side * decoder->blocks_per_side;
+    const size_t bitmap_bytes = (count + 7) / 8;
+    if (read != LENGTH_SIZE || length < bitmap_bytes)
+    {
+        log_message(LOG_LEVEL_ERROR, "Truncated frame %zu", decoder->frames);
+        return QTREE_ERROR_FORMAT;
+    }
+    if (!reserve(&decoder->frame, &decoder->frame_capacity, length))
+        return QTREE_ERROR_MEMORY;
+    if (fread(decoder->frame, 1, length, decoder->file) != length)
+    {
+        log_message(LOG_LEVEL_ERROR, "Truncated frame %zu", decoder->frames);
+        return QTREE_ERROR_FORMAT;
+    }
+
+    const bool was_muted = logger_thread_muted();
+    logger_mute_thread(true);
+
+    qtree_status_t status = QTREE_SUCCESS;
+    size_t at = bitmap_bytes;
+    size_t painted = 0;
+    for (size_t i = 0; i < count && status == QTREE_SUCCESS; i++)
+    {
+        if (!bit_is_set(decoder->frame, i))
+            continue;
+
+        if (length - at < LENGTH_SIZE)
+        {
+            status = QTREE_ERROR_FORMAT;
+            break;
+        }
+        const size_t block_length = (size_t)get_le(decoder->frame + at, LENGTH_SIZE);
+        at += LENGTH_SIZE;
+        if (block_length > length - at)
+        {
+            status = QTREE_ERROR_FORMAT;
+            break;
+        }
+        status = paint_block(decoder, decoder->frame + at, block_length, i, stats);
+        at += block_length;
+        painted++;
+    }
+
+    logger_mute_thread(was_muted);
+    if (status == QTREE_SUCCESS && at != length)
+        status = QTREE_ERROR_FORMAT;
+    if (status != QTREE_SUCCESS)
+    {
+        log_message(LOG_LEVEL_ERROR, "Frame %zu is damaged", decoder->frames);
+        return status;
+    }
+
+    decoder->frames++;
+    decoder->blocks_decoded += painted;
+    *got = true;
+    return QTREE_SUCCESS;
+}
+
+void qtree_sequence_decoder_free(qtree_sequence_decoder_t *decoder)
+{
+    if (!decoder)
+        return;
+
+    free(decoder->pixels);
+    free(decoder->block);
+    free(decoder->frame);
+    decoder->pixels = NULL;
+    decoder->block = NULL;
+    decoder->frame = NULL;
+    decoder->frame_capacity = 0;
+}
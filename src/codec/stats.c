@@ -0,0 +1,282 @@
+/**
+ * @file stats.c
+ * @brief Filling and printing qtc_stats_t
+ *
+ * Nodes are counted the way the encoder sees them: a uniform node is
+ * written as flat and its children (which the filter may have left in
+ * place) are not, so they aren't counted either.
+ */
+
+#include <math.h>
+#include <string.h>
+
+#include "codec/stats.h"
+#include "codec/metrics.h"
+#include "common/common.h"
+#include "core/tree_walk.h"
+
+static const char *const stage_names[QTC_STAGE_COUNT] = {
+    "read", "build", "filter", "encode", "write", "decode", "render", "grid"};
+
+/**
+ * @brief Nodes per level under one subtree
+ */
+typedef struct
+{
+    uint64_t counts[QTC_STATS_MAX_LEVELS];
+} level_counts_t;
+
+void qtc_stats_init(qtc_stats_t *stats, const char *operation)
+{
+    if (!stats)
+        return;
+    *stats = (qtc_stats_t){.operation = operation};
+}
+
+void qtc_stats_stage(qtc_stats_t *stats, qtc_stage_t stage, double start)
+{
+    if (!stats || stage >= QTC_STAGE_COUNT)
+        return;
+    stats->stage_seconds[stage] += wall_seconds() - start;
+}
+
+void qtc_stats_set_distortion(qtc_stats_t *stats, double mse, double mse_estimate)
+{
+    if (!stats)
+        return;
+    stats->measured = true;
+    stats->mse = mse;
+    stats->psnr = qtree_psnr_from_mse(mse);
+    stats->mse_estimate = mse_estimate;
+    stats->psnr_estimate = qtree_psnr_from_mse(mse_estimate);
+}
+
+const char *qtc_stage_name(qtc_stage_t stage)
+{
+    return stage < QTC_STAGE_COUNT ? stage_names[stage] : "unknown";
+}
+
+static void count_node(const qtree_node_t *node, uint32_t level, level_counts_t *counts)
+{
+    if (!node)
+        return;
+    if (level < QTC_STATS_MAX_LEVELS)
+        counts->counts[level]++;
+    if (node->u)
+        return;
+    for (uint32_t q = 0; q < 4; q++)
+        count_node(node->children[q], level + 1, counts);
+}
+
+static void count_subtree(void *ctx, qtree_node_t *node, const qtree_walk_cell_t *cell,
+                          uint32_t worker, void *result)
+{
+    (void)ctx;
+    (void)worker;
+    level_counts_t *counts = result;
+    *counts = (level_counts_t){0};
+    count_node(node, cell->level, counts);
+}
+
+static void count_leave(void *ctx, qtree_node_t *node, const qtree_walk_cell_t *cell,
+                        const void *const children[4], void *result)
+{
+    (void)ctx;
+    level_counts_t *counts = result;
+    *counts = (level_counts_t){0};
+    if (cell->level < QTC_STATS_MAX_LEVELS)
+        counts->counts[cell->level] = 1;
+    // The walk went under a uniform node anyway; what it found isn't coded
+    if (node->u)
+        return;
+    for (uint32_t q = 0; q < 4; q++)
+    {
+        if (!children[q])
+            continue;
+        const level_counts_t *child = children[q];
+        for (uint32_t l = 0; l < QTC_STATS_MAX_LEVELS; l++)
+            counts->counts[l] += child->counts[l];
+    }
+}
+
+static const qtree_walk_t count_pass = {
+    .subtree = count_subtree,
+    .leave = count_leave,
+    .result_size = sizeof(level_counts_t)};
+
+void qtc_stats_count_tree(qtc_stats_t *stats, const qtree_t *tree)
+{
+    if (!stats || !tree)
+        return;
+
+    stats->size = tree->size;
+    stats->n_levels = tree->n_levels;
+    stats->node_allocs = tree->arena.node_allocs;
+    stats->block_allocs = tree->arena.block_allocs;
+    stats->peak_nodes = tree->arena.peak_nodes;
+    stats->arena_bytes = (uint64_t)tree->arena.reserved_nodes * sizeof(qtree_node_t);
+
+    memset(stats->level_nodes, 0, sizeof(stats->level_nodes));
+    stats->nodes = 0;
+    if (!tree->root || tree->size == 0)
+        return;
+
+    level_counts_t counts;
+    qtree_walk(&count_pass, NULL, tree->root, tree->size, tree->pool, &counts);
+    for (uint32_t l = 0; l < QTC_STATS_MAX_LEVELS; l++)
+    {
+        stats->level_nodes[l] = counts.counts[l];
+        stats->nodes += counts.counts[l];
+    }
+}
+
+void qtc_stats_add_payload(qtc_stats_t *stats, const qtc_stats_t *part, uint32_t depth)
+{
+    if (!stats || !part)
+        return;
+
+    stats->nodes += part->nodes;
+    stats->bits_in += part->bits_in;
+    stats->bits_out += part->bits_out;
+    for (uint32_t l = 0; l + depth < QTC_STATS_MAX_LEVELS; l++)
+        stats->level_nodes[l + depth] += part->level_nodes[l];
+}
+
+void qtc_stats_count_subtree(qtc_stats_t *stats, const qtree_node_t *root, uint32_t level)
+{
+    if (!stats)
+        return;
+
+    level_counts_t counts = {0};
+    count_node(root, level, &counts);
+    for (uint32_t l = 0; l < QTC_STATS_MAX_LEVELS; l++)
+    {
+        stats->level_nodes[l] += counts.counts[l];
+        stats->nodes += counts.counts[l];
+    }
+}
+
+void qtc_stats_count_array(qtc_stats_t *stats, const qtree_array_t *tree)
+{
+    if (!stats || !tree)
+        return;
+
+    stats->size = tree->size;
+    stats->n_levels = tree->n_levels;
+    memset(stats->level_nodes, 0, sizeof(stats->level_nodes));
+    stats->nodes = 0;
+    if (!tree->u || tree->size == 0)
+        return;
+
+    // Same walk as the array encoder: the children of every non-uniform parent
+    stats->level_nodes[0] = 1;
+    for (uint32_t level = 1; level <= tree->n_levels && level < QTC_STATS_MAX_LEVELS; level++)
+    {
+        const size_t end = qtree_array_level_offset(level);
+        for (size_t parent = qtree_array_level_offset(level - 1); parent < end; parent++)
+        {
+            if (!tree->u[parent])
+                stats->level_nodes[level] += 4;
+        }
+    }
+    for (uint32_t l = 0; l < QTC_STATS_MAX_LEVELS; l++)
+        stats->nodes += stats->level_nodes[l];
+}
+
+/**
+ * @brief Writes a string as a JSON string literal (null for NULL)
+ */
+static void write_string(FILE *file, const char *text)
+{
+    if (!text)
+    {
+        fputs("null", file);
+        return;
+    }
+
+    fputc('"', file);
+    for (const unsigned char *c = (const unsigned char *)text; *c; c++)
+    {
+        if (*c == '"' || *c == '\\')
+            fprintf(file, "\\%c", *c);
+        else if (*c < 0x20)
+            fprintf(file, "\\u%04x", (unsigned)*c);
+        else
+            fputc(*c, file);
+    }
+    fputc('"', file);
+}
+
+/**
+ * @brief A number JSON can hold (it has no inf or nan)
+ */
+static double json_number(double value)
+{
+    return isfinite(value) ? value : 0.0;
+}
+
+/**
+ * @brief A quality figure, null if it wasn't measured or is infinite
+ */
+static void write_quality(FILE *file, const char *name, bool measured, double value)
+{
+    if (measured && isfinite(value))
+        fprintf(file, ",\"%s\":%.6f", name, value);
+    else
+        fprintf(file, ",\"%s\":null", name);
+}
+
+bool qtc_stats_write_json(const qtc_stats_t *stats, FILE *file)
+{
+    if (!stats || !file)
+        return false;
+
+    fputs("{\"op\":", file);
+    write_string(file, stats->operation);
+    fputs(",\"input\":", file);
+    write_string(file, stats->input);
+    fputs(",\"output\":", file);
+    write_string(file, stats->output);
+    fprintf(file, ",\"ok\":%s,\"size\":%u,\"levels\":%u,\"total_s\":%.6f,\"stages\":{",
+            stats->ok ? "true" : "false", stats->size, stats->n_levels,
+            json_number(stats->total_seconds));
+    for (uint32_t s = 0; s < QTC_STAGE_COUNT; s++)
+        fprintf(file, "%s\"%s\":%.6f", s ? "," : "", stage_names[s],
+                json_number(stats->stage_seconds[s]));
+
+    fprintf(file, "},\"nodes\":%llu,\"level_nodes\":[", (unsigned long long)stats->nodes);
+    const uint32_t levels =
+        stats->n_levels + 1 < QTC_STATS_MAX_LEVELS ? stats->n_levels + 1 : QTC_STATS_MAX_LEVELS;
+    for (uint32_t l = 0; l < levels; l++)
+        fprintf(file, "%s%llu", l ? "," : "", (unsigned long long)stats->level_nodes[l]);
+
+    fprintf(file,
+            "],\"bytes_in\":%llu,\"bytes_out\":%llu,\"bits_in\":%llu,\"bits_out\":%llu,"
+            "\"node_allocs\":%llu,\"block_allocs\":%llu,\"peak_nodes\":%llu,"
+            "\"arena_bytes\":%llu,\"measured\":%s",
+            (unsigned long long)stats->bytes_in, (unsigned long long)stats->bytes_out,
+            (unsigned long long)stats->bits_in, (unsigned long long)stats->bits_out,
+            (unsigned long long)stats->node_allocs, (unsigned long long)stats->block_allocs,
+            (unsigned long long)stats->peak_nodes, (unsigned long long)stats->arena_bytes,
+            stats->measured ? "true" : "false");
+    write_quality(file, "mse", stats->measured, stats->mse);
+    write_quality(file, "psnr", stats->measured, stats->psnr);
+    write_quality(file, "mse_estimate", stats->measured, stats->mse_estimate);
+    write_quality(file, "psnr_estimate", stats->measured, stats->psnr_estimate);
+    fputs("}\n", file);
+    return !ferror(file);
+}
+
+bool qtc_stats_append_json(const qtc_stats_t *stats, const char *path)
+{
+    if (!path)
+        return false;
+    if (strcmp(path, "-") == 0)
+        return qtc_stats_write_json(stats, stdout) && fflush(stdout) == 0;
+
+    FILE *file = fopen(path, "a");
+    if (!file)
+        return false;
+    const bool ok = qtc_stats_write_json(stats, file);
+    return fclose(file) == 0 && ok;
+}
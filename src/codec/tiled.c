@@ -0,0 +1,569 @@
+/**
+ * @file tiled.c
+ * @brief Tiled container, encoded and decoded a tile at a time
+ *
+ * Work is shared out the same way both ways: one task per pool worker,
+ * each pulling the next tile number off a shared counter until none
+ * are left, so a 4096-tile image costs a handful of tasks and not a
+ * full queue. Tasks mute the logger for their thread, the way qtc.c
+ * does, so tiles never fight over the terminal.
+ */
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "codec/decompression.h"
+#include "codec/metrics.h"
+#include "codec/tiled.h"
+#include "common/common.h"
+#include "logger/logger.h"
+
+/* Room for the magic and comment lines */
+#define HEADER_TEXT_SIZE 96
+
+typedef struct
+{
+    uint8_t *data; /* Payload, no header */
+    size_t length; /* Its size in bytes */
+} tile_blob_t;
+
+/**
+ * @brief What encode tasks share
+ */
+typedef struct
+{
+    const uint8_t *pixels;
+    uint32_t size;
+    uint32_t tile_size;
+    uint32_t tiles_per_side;
+    qtree_format_t format;
+    float alpha;
+    tile_blob_t *blobs; /* One per tile, row by row */
+    size_t count;       /* Tiles in all */
+    atomic_size_t next; /* Next tile nobody has taken yet */
+    atomic_int failure; /* First qtree_status_t that wasn't a success */
+    qtc_stats_t *stats; /* Where tasks add their tiles (NULL to skip) */
+    double squared_error; /* Lossy only: what the filtered tiles cost, summed */
+    double estimated_error;
+    pthread_mutex_t stats_lock;
+} encode_job_t;
+
+/**
+ * @brief What decode tasks share
+ */
+typedef struct
+{
+    const qtree_tiled_t *tiled;
+    uint32_t row;          /* Requested rectangle, in image pixels */
+    uint32_t col;
+    uint32_t width;
+    uint32_t height;
+    uint32_t first_row;    /* Tiles it overlaps */
+    uint32_t first_col;
+    uint32_t tiles_across;
+    uint8_t *pixels;       /* width*height output */
+    size_t count;
+    atomic_size_t next;
+    atomic_int failure;
+    qtc_stats_t *stats;    /* Where tasks add their tiles (NULL to skip) */
+    pthread_mutex_t stats_lock;
+} decode_job_t;
+
+static void put_le(uint8_t *out, uint64_t value, unsigned n_bytes)
+{
+    for (unsigned i = 0; i < n_bytes; i++)
+        out[i] = (uint8_t)(value >> (8 * i));
+}
+
+static uint64_t get_le(const uint8_t *in, unsigned n_bytes)
+{
+    uint64_t value = 0;
+    for (unsigned i = 0; i < n_bytes; i++)
+        value |= (uint64_t)in[i] << (8 * i);
+    return value;
+}
+
+static uint32_t levels_of(uint32_t size)
+{
+    uint32_t levels = 0;
+    while ((1u << levels) < size)
+        levels++;
+    return levels;
+}
+
+/**
+ * @brief Remembers the first failure, the one worth reporting
+ */
+static void record_failure(atomic_int *failure, qtree_status_t status)
+{
+    int expected = QTREE_SUCCESS;
+    atomic_compare_exchange_strong(failure, &expected, (int)status);
+}
+
+/**
+ * @brief Runs fn on every worker of the pool (or once, here, without one)
+ */
+static void run_everywhere(thread_pool_t *pool, thread_pool_fn fn, void *job)
+{
+    if (!pool)
+    {
+        fn(job);
+        return;
+    }
+
+    thread_pool_seat_t seat;
+    thread_pool_enter(pool, &seat);
+    thread_pool_group_t group;
+    thread_pool_group_init(&group);
+    for (uint32_t i = 0; i < thread_pool_size(pool); i++)
+    {
+        thread_pool_submit(pool, &group, fn, job);
+    }
+    thread_pool_wait(pool, &group);
+    thread_pool_leave(pool, &seat);
+}
+
+bool qtree_tiled_magic(const uint8_t *data, size_t length)
+{
+    return data && length >= 3 && memcmp(data, QTREE_TILED_MAGIC "\n", 3) == 0;
+}
+
+/**
+ * @brief Encode task: build and code tiles until there are none left
+ */
+static void encode_tiles(void *arg)
+{
+    encode_job_t *job = arg;
+    const bool was_muted = logger_thread_muted();
+    logger_mute_thread(true);
+
+    const uint32_t tile_size = job->tile_size;
+    const uint32_t depth = levels_of(job->tiles_per_side);
+    uint8_t *tile = malloc((size_t)tile_size * tile_size);
+    qtree_t tree = {0};
+    qtc_stats_t mine = {0};
+    double squared_error = 0.0;
+    double estimated_error = 0.0;
+
+    for (;;)
+    {
+        const size_t i = atomic_fetch_add(&job->next, 1);
+        if (i >= job->count || atomic_load(&job->failure) != QTREE_SUCCESS)
+            break;
+        if (!tile)
+        {
+            record_failure(&job->failure, QTREE_ERROR_MEMORY);
+            break;
+        }
+
+        const size_t top = i / job->tiles_per_side * tile_size;
+        const size_t left = i % job->tiles_per_side * tile_size;
+        for (uint32_t r = 0; r < tile_size; r++)
+        {
+            memcpy(tile + (size_t)r * tile_size,
+                   job->pixels + (top + r) * job->size + left, tile_size);
+        }
+
+        qtree_status_t status = qtree_init(&tree, tile_size);
+        if (status == QTREE_SUCCESS)
+            status = qtree_build_with(&tree, tile, tile_size, "tile", QTREE_BUILD_RECURSIVE, 1);
+        if (status == QTREE_SUCCESS && job->alpha > 1.0f)
+            status = apply_lossy_compression(&tree, job->alpha);
+        if (status == QTREE_SUCCESS)
+            status = compress_payload_to_buffer(&tree, job->format, &job->blobs[i].data,
+                                                &job->blobs[i].length);
+        if (status != QTREE_SUCCESS)
+        {
+            record_failure(&job->failure, status);
+            continue;
+        }
+
+        // The encoder stages into a big buffer; small tiles only need a few bytes of it
+        const size_t length = job->blobs[i].length;
+        uint8_t *trimmed = realloc(job->blobs[i].data, length ? length : 1);
+        if (trimmed)
+            job->blobs[i].data = trimmed;
+
+        if (job->stats)
+        {
+            qtc_stats_t part = {0};
+            qtc_stats_count_tree(&part, &tree);
+            part.bits_out = (uint64_t)length * 8;
+            qtc_stats_add_payload(&mine, &part, depth);
+
+            qtree_distortion_t distortion;
+            if (job->alpha > 1.0f &&
+                qtree_measure_distortion(&tree, tile, &distortion) == QTREE_SUCCESS)
+            {
+                const double pixels = (double)tile_size * tile_size;
+                squared_error += (double)distortion.squared_error;
+                estimated_error += distortion.estimated_mse * pixels;
+            }
+        }
+    }
+
+    if (job->stats)
+    {
+        pthread_mutex_lock(&job->stats_lock);
+        qtc_stats_add_payload(job->stats, &mine, 0);
+        job->squared_error += squared_error;
+        job->estimated_error += estimated_error;
+        pthread_mutex_unlock(&job->stats_lock);
+    }
+
+    qtree_free(&tree);
+    free(tile);
+    logger_mute_thread(was_muted);
+}
+
+/**
+ * @brief Header and index in front, then every payload in tile order
+ */
+static qtree_status_t assemble(const encode_job_t *job, uint8_t **data, size_t *length)
+{
+    char text[HEADER_TEXT_SIZE];
+    const int text_length = snprintf(text, sizeof(text), "%s\n# %zu tiles of %ux%u\n",
+                                     QTREE_TILED_MAGIC, job->count, job->tile_size,
+                                     job->tile_size);
+    if (text_length <= 0 || (size_t)text_length >= sizeof(text))
+        return QTREE_ERROR_FORMAT;
+
+    const size_t header_length = (size_t)text_length + 3;
+    size_t total = header_length + job->count * QTREE_TILED_ENTRY_SIZE;
+    for (size_t i = 0; i < job->count; i++)
+    {
+        if (job->blobs[i].length > UINT32_MAX)
+        {
+            log_message(LOG_LEVEL_ERROR, "Tile %zu is too big for the index", i);
+            return QTREE_ERROR_FORMAT;
+        }
+        total += job->blobs[i].length;
+    }
+
+    uint8_t *out = malloc(total);
+    if (!out)
+        return QTREE_ERROR_MEMORY;
+
+    memcpy(out, text, (size_t)text_length);
+    out[text_length] = (uint8_t)levels_of(job->size);
+    out[text_length + 1] = (uint8_t)levels_of(job->tile_size);
+    out[text_length + 2] = job->format == QTREE_FORMAT_Q2 ? 2 : 1;
+
+    uint8_t *entry = out + header_length;
+    size_t offset = header_length + job->count * QTREE_TILED_ENTRY_SIZE;
+    for (size_t i = 0; i < job->count; i++, entry += QTREE_TILED_ENTRY_SIZE)
+    {
+        put_le(entry, offset, 8);
+        put_le(entry + 8, job->blobs[i].length, 4);
+        memcpy(out + offset, job->blobs[i].data, job->blobs[i].length);
+        offset += job->blobs[i].length;
+    }
+
+    *data = out;
+    *length = total;
+    return QTREE_SUCCESS;
+}
+
+qtree_status_t qtree_tiled_encode(const uint8_t *pixels, uint32_t size, uint32_t tile_size,
+                                  qtree_format_t format, float alpha, thread_pool_t *pool,
+                                  uint8_t **data, size_t *length)
+{
+    return qtree_tiled_encode_with_stats(pixels, size, tile_size, format, alpha, pool, data,
+                                         length, NULL);
+}
+
+qtree_status_t qtree_tiled_encode_with_stats(const uint8_t *pixels, uint32_t size,
+                                             uint32_t tile_size, qtree_format_t format,
+                                             float alpha, thread_pool_t *pool, uint8_t **data,
+                                             size_t *length, qtc_stats_t *stats)
+{
+    if (!pixels || !data || !length || size < 2 || size > (1u << 16) ||
+        !is_power_of_two(size) || tile_size < 2 || !is_power_of_two(tile_size))
+    {
+        log_message(LOG_LEVEL_ERROR, "Invalid parameters for tiled compression");
+        return QTREE_ERROR_INVALID_PARAM;
+    }
+
+    if (tile_size > size)
+        tile_size = size;
+    const uint32_t tiles_per_side = size / tile_size;
+    if (levels_of(tiles_per_side) > QTREE_TILED_MAX_SPLIT)
+    {
+        log_message(LOG_LEVEL_ERROR, "Tiles of %ux%u are too small for a %ux%u image",
+                    tile_size, tile_size, size, size);
+        return QTREE_ERROR_INVALID_PARAM;
+    }
+
+    encode_job_t job = {
+        .pixels = pixels,
+        .size = size,
+        .tile_size = tile_size,
+        .tiles_per_side = tiles_per_side,
+        .format = format,
+        .alpha = alpha,
+        .count = (size_t)tiles_per_side * tiles_per_side,
+        .stats = stats};
+    atomic_init(&job.next, 0);
+    atomic_init(&job.failure, QTREE_SUCCESS);
+
+    job.blobs = calloc(job.count, sizeof(tile_blob_t));
+    if (!job.blobs)
+    {
+        log_message(LOG_LEVEL_ERROR, "Memory allocation failed for %zu tiles", job.count);
+        return QTREE_ERROR_MEMORY;
+    }
+
+    log_item("Tiles", "%zu of %ux%u on %u threads", job.count, tile_size, tile_size,
+             pool ? thread_pool_size(pool) : 1u);
+    if (stats)
+    {
+        stats->size = size;
+        stats->n_levels = levels_of(size);
+        stats->bits_in = (uint64_t)size * size * 8;
+        pthread_mutex_init(&job.stats_lock, NULL);
+    }
+    run_everywhere(pool, encode_tiles, &job);
+    if (stats)
+    {
+        pthread_mutex_destroy(&job.stats_lock);
+        const double pixel_count = (double)size * size;
+        if (alpha > 1.0f)
+            qtc_stats_set_distortion(stats, job.squared_error / pixel_count,
+                                     job.estimated_error / pixel_count);
+    }
+
+    qtree_status_t status = (qtree_status_t)atomic_load(&job.failure);
+    if (status != QTREE_SUCCESS)
+        log_message(LOG_LEVEL_ERROR, "Failed to compress a tile");
+    else
+        status = assemble(&job, data, length);
+
+    for (size_t i = 0; i < job.count; i++)
+    {
+        free(job.blobs[i].data);
+    }
+    free(job.blobs);
+    return status;
+}
+
+qtree_status_t qtree_tiled_open(const uint8_t *data, size_t length, qtree_tiled_t *tiled)
+{
+    if (!tiled || !qtree_tiled_magic(data, length))
+    {
+        log_message(LOG_LEVEL_ERROR, "Invalid file signature (expected '%s')",
+                    QTREE_TILED_MAGIC);
+        return QTREE_ERROR_FORMAT;
+    }
+
+    const uint8_t *end = memchr(data + 3, '\n', length - 3);
+    const size_t fields = end ? (size_t)(end - data) + 1 : length;
+    if (length - fields < 3)
+    {
+        log_message(LOG_LEVEL_ERROR, "Truncated tiled header");
+        return QTREE_ERROR_FORMAT;
+    }
+
+    const uint32_t n_levels = data[fields];
+    const uint32_t tile_levels = data[fields + 1];
+    const uint8_t format = data[fields + 2];
+    if (n_levels < 1 || n_levels > 16 || tile_levels < 1 || tile_levels > n_levels ||
+        n_levels - tile_levels > QTREE_TILED_MAX_SPLIT || (format != 1 && format != 2))
+    {
+        log_message(LOG_LEVEL_ERROR, "Invalid tiled header (depth %u, tile depth %u, format %u)",
+                    n_levels, tile_levels, (uint32_t)format);
+        return QTREE_ERROR_FORMAT;
+    }
+
+    const uint32_t tiles_per_side = 1u << (n_levels - tile_levels);
+    const size_t count = (size_t)tiles_per_side * tiles_per_side;
+    const size_t payload_start = fields + 3 + count * QTREE_TILED_ENTRY_SIZE;
+    if (payload_start > length)
+    {
+        log_message(LOG_LEVEL_ERROR, "Truncated tile index");
+        return QTREE_ERROR_FORMAT;
+    }
+
+    // Check every entry once so decoding can trust them
+    const uint8_t *entry = data + fields + 3;
+    for (size_t i = 0; i < count; i++, entry += QTREE_TILED_ENTRY_SIZE)
+    {
+        const uint64_t offset = get_le(entry, 8);
+        const uint64_t size = get_le(entry + 8, 4);
+        if (offset < payload_start || offset > length || size > length - offset)
+        {
+            log_message(LOG_LEVEL_ERROR, "Tile %zu lies outside the file", i);
+            return QTREE_ERROR_FORMAT;
+        }
+    }
+
+    *tiled = (qtree_tiled_t){
+        .data = data,
+        .length = length,
+        .index = data + fields + 3,
+        .size = 1u << n_levels,
+        .n_levels = n_levels,
+        .tile_size = 1u << tile_levels,
+        .tile_levels = tile_levels,
+        .tiles_per_side = tiles_per_side,
+        .format = format == 2 ? QTREE_FORMAT_Q2 : QTREE_FORMAT_Q1};
+    return QTREE_SUCCESS;
+}
+
+qtree_status_t qtree_tiled_decode_tile(const qtree_tiled_t *tiled, uint32_t tile_row,
+                                       uint32_t tile_col, uint8_t *pixels)
+{
+    return qtree_tiled_decode_tile_with_stats(tiled, tile_row, tile_col, pixels, NULL);
+}
+
+qtree_status_t qtree_tiled_decode_tile_with_stats(const qtree_tiled_t *tiled,
+                                                  uint32_t tile_row, uint32_t tile_col,
+                                                  uint8_t *pixels, qtc_stats_t *stats)
+{
+    if (!tiled || !pixels || tile_row >= tiled->tiles_per_side ||
+        tile_col >= tiled->tiles_per_side)
+    {
+        log_message(LOG_LEVEL_ERROR, "Invalid tile %u,%u", tile_row, tile_col);
+        return QTREE_ERROR_INVALID_PARAM;
+    }
+
+    const uint8_t *entry = tiled->index +
+        ((size_t)tile_row * tiled->tiles_per_side + tile_col) * QTREE_TILED_ENTRY_SIZE;
+    const size_t offset = (size_t)get_le(entry, 8);
+    const size_t length = (size_t)get_le(entry + 8, 4);
+
+    pgm_t pgm = {0};
+    return qtree_decompress_payload_with_stats(tiled->data + offset, length, tiled->format,
+                                               tiled->tile_levels, pixels, &pgm, stats);
+}
+
+/**
+ * @brief Decode task: decode tiles and copy their part of the rectangle
+ */
+static void decode_tiles(void *arg)
+{
+    decode_job_t *job = arg;
+    const bool was_muted = logger_thread_muted();
+    logger_mute_thread(true);
+
+    const uint32_t tile_size = job->tiled->tile_size;
+    const uint32_t depth = job->tiled->n_levels - job->tiled->tile_levels;
+    uint8_t *tile = malloc((size_t)tile_size * tile_size);
+    qtc_stats_t mine = {0};
+
+    for (;;)
+    {
+        const size_t i = atomic_fetch_add(&job->next, 1);
+        if (i >= job->count || atomic_load(&job->failure) != QTREE_SUCCESS)
+            break;
+        if (!tile)
+        {
+            record_failure(&job->failure, QTREE_ERROR_MEMORY);
+            break;
+        }
+
+        const uint32_t tile_row = job->first_row + (uint32_t)(i / job->tiles_across);
+        const uint32_t tile_col = job->first_col + (uint32_t)(i % job->tiles_across);
+        qtc_stats_t part = {0};
+        const qtree_status_t status = qtree_tiled_decode_tile_with_stats(
+            job->tiled, tile_row, tile_col, tile, job->stats ? &part : NULL);
+        if (status != QTREE_SUCCESS)
+        {
+            record_failure(&job->failure, status);
+            break;
+        }
+        qtc_stats_add_payload(&mine, &part, depth);
+
+        // Overlap of this tile and the rectangle, in image pixels
+        const uint32_t top = tile_row * tile_size;
+        const uint32_t left = tile_col * tile_size;
+        const uint32_t r0 = top > job->row ? top : job->row;
+        const uint32_t c0 = left > job->col ? left : job->col;
+        const uint32_t r1 = top + tile_size < job->row + job->height ? top + tile_size
+                                                                     : job->row + job->height;
+        const uint32_t c1 = left + tile_size < job->col + job->width ? left + tile_size
+                                                                     : job->col + job->width;
+
+        for (uint32_t r = r0; r < r1; r++)
+        {
+            memcpy(job->pixels + (size_t)(r - job->row) * job->width + (c0 - job->col),
+                   tile + (size_t)(r - top) * tile_size + (c0 - left), c1 - c0);
+        }
+    }
+
+    // One lock per task, not per tile
+    if (job->stats)
+    {
+        pthread_mutex_lock(&job->stats_lock);
+        qtc_stats_add_payload(job->stats, &mine, 0);
+        pthread_mutex_unlock(&job->stats_lock);
+    }
+
+    free(tile);
+    logger_mute_thread(was_muted);
+}
+
+qtree_status_t qtree_tiled_decode_region(const qtree_tiled_t *tiled, uint32_t row, uint32_t col,
+                                         uint32_t width, uint32_t height, thread_pool_t *pool,
+                                         uint8_t *pixels)
+{
+    return qtree_tiled_decode_region_with_stats(tiled, row, col, width, height, pool, pixels,
+                                                NULL);
+}
+
+qtree_status_t qtree_tiled_decode_region_with_stats(const qtree_tiled_t *tiled, uint32_t row,
+                                                    uint32_t col, uint32_t width,
+                                                    uint32_t height, thread_pool_t *pool,
+                                                    uint8_t *pixels, qtc_stats_t *stats)
+{
+    if (!tiled || !pixels || width == 0 || height == 0 || row >= tiled->size ||
+        col >= tiled->size || height > tiled->size - row || width > tiled->size - col)
+    {
+        log_message(LOG_LEVEL_ERROR, "Invalid region for a %ux%u image",
+                    tiled ? tiled->size : 0u, tiled ? tiled->size : 0u);
+        return QTREE_ERROR_INVALID_PARAM;
+    }
+
+    const uint32_t tile_size = tiled->tile_size;
+    decode_job_t job = {
+        .tiled = tiled,
+        .row = row,
+        .col = col,
+        .width = width,
+        .height = height,
+        .first_row = row / tile_size,
+        .first_col = col / tile_size,
+        .pixels = pixels,
+        .stats = stats};
+    job.tiles_across = (col + width - 1) / tile_size - job.first_col + 1;
+    job.count = (size_t)((row + height - 1) / tile_size - job.first_row + 1) * job.tiles_across;
+    atomic_init(&job.next, 0);
+    atomic_init(&job.failure, QTREE_SUCCESS);
+
+    log_item("Tiles", "%zu of %zu, %ux%u each", job.count,
+             (size_t)tiled->tiles_per_side * tiled->tiles_per_side, tile_size, tile_size);
+    if (stats)
+    {
+        stats->size = tiled->size;
+        stats->n_levels = tiled->n_levels;
+        pthread_mutex_init(&job.stats_lock, NULL);
+    }
+    run_everywhere(pool, decode_tiles, &job);
+    if (stats)
+        pthread_mutex_destroy(&job.stats_lock);
+
+    const qtree_status_t status = (qtree_status_t)atomic_load(&job.failure);
+    if (status != QTREE_SUCCESS)
+        log_message(LOG_LEVEL_ERROR, "Failed to decode a tile");
+    return status;
+}
+
+qtree_status_t qtree_tiled_decode(const qtree_tiled_t *tiled, thread_pool_t *pool,
+                                  uint8_t *pixels)
+{
+    if (!tiled)
+        return QTREE_ERROR_INVALID_PARAM;
+    return qtree_tiled_decode_region(tiled, 0, 0, tiled->size, tiled->size, pool, pixels);
+}
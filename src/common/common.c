@@ -1,3 +1,5 @@
+#include <time.h>
+
 #include "common/common.h"
 
 uint8_t calculate_fourth_mean(uint8_t parent_mean, uint8_t error, uint8_t m1, uint8_t m2, uint8_t m3)
@@ -11,4 +13,11 @@ uint8_t calculate_fourth_mean(uint8_t parent_mean, uint8_t error, uint8_t m1, ui
 bool is_power_of_two(uint32_t x)
 {
     return x && !(x & (x - 1));
-}
\ No newline at end of file
+}
+
+double wall_seconds(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec + (double)now.tv_nsec * 1e-9;
+}
@@ -0,0 +1,335 @@
+/**
+ * @file thread_pool.c
+ * @brief Work-stealing thread pool
+ *
+ * Deques are small mutex-protected rings. Tasks handed to the pool are
+ * coarse (whole subtrees, whole images), so a lock per push/pop costs
+ * nothing next to the work itself and keeps the stealing logic simple.
+ *
+ * A thread waiting on a group sleeps once there is nothing left to
+ * run: a submit wakes it to help, and the task that empties a group
+ * wakes it to go on.
+ */
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "common/thread_pool.h"
+
+typedef struct
+{
+    thread_pool_fn fn;
+    void *arg;
+    thread_pool_group_t *group;
+} task_t;
+
+typedef struct
+{
+    pthread_mutex_t lock;
+    task_t tasks[THREAD_POOL_QUEUE_SIZE];
+    size_t head;  /* Oldest task, where thieves take from */
+    size_t count; /* Tasks in the ring */
+} deque_t;
+
+typedef struct
+{
+    thread_pool_t *pool;
+    uint32_t index;
+    pthread_t thread;
+    deque_t deque;
+} worker_t;
+
+struct thread_pool
+{
+    worker_t *workers;       /* workers[0] is the creating thread */
+    uint32_t n_workers;      /* Including worker 0 */
+    uint32_t n_slots;        /* Workers asked for (slots set up) */
+    atomic_size_t queued;    /* Tasks sitting in any deque */
+    atomic_bool stop;        /* Set once on shutdown */
+    pthread_mutex_t idle_lock;
+    pthread_cond_t idle_cond;  /* Idle workers sleep here until something is queued */
+    pthread_cond_t wait_cond;  /* Waiters sleep here until work or their group is done */
+    atomic_uint sleeping;      /* Waiters on wait_cond (changed under idle_lock) */
+    pthread_mutex_t seat_lock; /* Held by the outside thread that is worker 0 */
+};
+
+/* Which pool and slot the current thread works for (NULL off the pool) */
+static _Thread_local const thread_pool_t *current_pool = NULL;
+static _Thread_local uint32_t current_index = 0;
+
+uint32_t thread_pool_default_threads(void)
+{
+    const long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    return cpus > 0 ? (uint32_t)cpus : 1u;
+}
+
+uint32_t thread_pool_size(const thread_pool_t *pool)
+{
+    return pool->n_workers;
+}
+
+uint32_t thread_pool_worker_index(const thread_pool_t *pool)
+{
+    return current_pool == pool ? current_index : 0;
+}
+
+void thread_pool_group_init(thread_pool_group_t *group)
+{
+    atomic_init(&group->pending, 0);
+}
+
+/**
+ * @brief Push at the back of a deque
+ * @return False if it is full
+ */
+static bool deque_push(deque_t *deque, const task_t *task)
+{
+    bool pushed = false;
+    pthread_mutex_lock(&deque->lock);
+    if (deque->count < THREAD_POOL_QUEUE_SIZE)
+    {
+        deque->tasks[(deque->head + deque->count) % THREAD_POOL_QUEUE_SIZE] = *task;
+        deque->count++;
+        pushed = true;
+    }
+    pthread_mutex_unlock(&deque->lock);
+    return pushed;
+}
+
+/**
+ * @brief Take from the back (owner) or the front (thief)
+ */
+static bool deque_take(deque_t *deque, bool steal, task_t *task)
+{
+    bool taken = false;
+    pthread_mutex_lock(&deque->lock);
+    if (deque->count > 0)
+    {
+        if (steal)
+        {
+            *task = deque->tasks[deque->head];
+            deque->head = (deque->head + 1) % THREAD_POOL_QUEUE_SIZE;
+        }
+        else
+        {
+            *task = deque->tasks[(deque->head + deque->count - 1) % THREAD_POOL_QUEUE_SIZE];
+        }
+        deque->count--;
+        taken = true;
+    }
+    pthread_mutex_unlock(&deque->lock);
+    return taken;
+}
+
+/**
+ * @brief Own work first (newest, still hot in cache), then steal the oldest
+ */
+static bool find_task(thread_pool_t *pool, uint32_t index, task_t *task)
+{
+    if (atomic_load_explicit(&pool->queued, memory_order_acquire) == 0)
+        return false;
+
+    bool found = deque_take(&pool->workers[index].deque, false, task);
+    for (uint32_t k = 1; !found && k < pool->n_workers; k++)
+    {
+        found = deque_take(&pool->workers[(index + k) % pool->n_workers].deque, true, task);
+    }
+
+    if (found)
+        atomic_fetch_sub_explicit(&pool->queued, 1, memory_order_relaxed);
+    return found;
+}
+
+/**
+ * @brief Wakes the threads asleep in thread_pool_wait(), if there are any
+ */
+static void wake_waiters(thread_pool_t *pool)
+{
+    // Pairs with the waiter's count-then-check: one of the two sees the other
+    if (atomic_load(&pool->sleeping) == 0)
+        return;
+    pthread_mutex_lock(&pool->idle_lock);
+    pthread_cond_broadcast(&pool->wait_cond);
+    pthread_mutex_unlock(&pool->idle_lock);
+}
+
+static void run_task(thread_pool_t *pool, const task_t *task)
+{
+    task->fn(task->arg);
+    if (atomic_fetch_sub(&task->group->pending, 1) == 1)
+        wake_waiters(pool);
+}
+
+static void *worker_main(void *arg)
+{
+    worker_t *self = arg;
+    thread_pool_t *pool = self->pool;
+    current_pool = pool;
+    current_index = self->index;
+
+    while (!atomic_load_explicit(&pool->stop, memory_order_acquire))
+    {
+        task_t task;
+        if (find_task(pool, self->index, &task))
+        {
+            run_task(pool, &task);
+            continue;
+        }
+
+        pthread_mutex_lock(&pool->idle_lock);
+        while (atomic_load(&pool->queued) == 0 && !atomic_load(&pool->stop))
+        {
+            pthread_cond_wait(&pool->idle_cond, &pool->idle_lock);
+        }
+        pthread_mutex_unlock(&pool->idle_lock);
+    }
+    return NULL;
+}
+
+thread_pool_t *thread_pool_create(uint32_t n_threads)
+{
+    if (n_threads == 0)
+        n_threads = thread_pool_default_threads();
+
+    thread_pool_t *pool = calloc(1, sizeof(*pool));
+    if (!pool)
+        return NULL;
+
+    pool->workers = calloc(n_threads, sizeof(worker_t));
+    if (!pool->workers)
+    {
+        free(pool);
+        return NULL;
+    }
+
+    atomic_init(&pool->queued, 0);
+    atomic_init(&pool->stop, false);
+    atomic_init(&pool->sleeping, 0);
+    pthread_mutex_init(&pool->idle_lock, NULL);
+    pthread_cond_init(&pool->idle_cond, NULL);
+    pthread_cond_init(&pool->wait_cond, NULL);
+    pthread_mutex_init(&pool->seat_lock, NULL);
+
+    pool->n_slots = n_threads;
+    for (uint32_t i = 0; i < n_threads; i++)
+    {
+        pool->workers[i].pool = pool;
+        pool->workers[i].index = i;
+        pthread_mutex_init(&pool->workers[i].deque.lock, NULL);
+    }
+
+    // Worker 0 is whoever takes the seat, so only the others get a thread
+    pool->n_workers = 1;
+    for (uint32_t i = 1; i < n_threads; i++)
+    {
+        if (pthread_create(&pool->workers[i].thread, NULL, worker_main, &pool->workers[i]) != 0)
+            break;
+        pool->n_workers++;
+    }
+
+    if (pool->n_workers != n_threads)
+    {
+        thread_pool_destroy(pool);
+        return NULL;
+    }
+    return pool;
+}
+
+void thread_pool_destroy(thread_pool_t *pool)
+{
+    if (!pool)
+        return;
+
+    pthread_mutex_lock(&pool->idle_lock);
+    atomic_store(&pool->stop, true);
+    pthread_cond_broadcast(&pool->idle_cond);
+    pthread_mutex_unlock(&pool->idle_lock);
+
+    for (uint32_t i = 1; i < pool->n_workers; i++)
+    {
+        pthread_join(pool->workers[i].thread, NULL);
+    }
+
+    // Deque locks were set up for every slot, even ones that never started
+    for (uint32_t i = 0; i < pool->n_slots; i++)
+    {
+        pthread_mutex_destroy(&pool->workers[i].deque.lock);
+    }
+    pthread_mutex_destroy(&pool->seat_lock);
+    pthread_cond_destroy(&pool->wait_cond);
+    pthread_cond_destroy(&pool->idle_cond);
+    pthread_mutex_destroy(&pool->idle_lock);
+    free(pool->workers);
+    free(pool);
+}
+
+void thread_pool_submit(thread_pool_t *pool, thread_pool_group_t *group,
+                        thread_pool_fn fn, void *arg)
+{
+    const task_t task = {.fn = fn, .arg = arg, .group = group};
+    atomic_fetch_add_explicit(&group->pending, 1, memory_order_relaxed);
+
+    // Count it first so a thief can never take it before it is counted
+    atomic_fetch_add_explicit(&pool->queued, 1, memory_order_release);
+    if (!deque_push(&pool->workers[thread_pool_worker_index(pool)].deque, &task))
+    {
+        // Queue is full: doing it now is just as correct
+        atomic_fetch_sub_explicit(&pool->queued, 1, memory_order_relaxed);
+        run_task(pool, &task);
+        return;
+    }
+
+    pthread_mutex_lock(&pool->idle_lock);
+    pthread_cond_signal(&pool->idle_cond);
+    if (atomic_load(&pool->sleeping) > 0)
+        pthread_cond_signal(&pool->wait_cond);
+    pthread_mutex_unlock(&pool->idle_lock);
+}
+
+void thread_pool_wait(thread_pool_t *pool, thread_pool_group_t *group)
+{
+    const uint32_t index = thread_pool_worker_index(pool);
+    while (atomic_load_explicit(&group->pending, memory_order_acquire) > 0)
+    {
+        task_t task;
+        if (find_task(pool, index, &task))
+        {
+            run_task(pool, &task);
+            continue;
+        }
+
+        // Nothing to help with: the rest of the group is running elsewhere
+        pthread_mutex_lock(&pool->idle_lock);
+        atomic_fetch_add(&pool->sleeping, 1);
+        while (atomic_load(&group->pending) > 0 && atomic_load(&pool->queued) == 0)
+        {
+            pthread_cond_wait(&pool->wait_cond, &pool->idle_lock);
+        }
+        atomic_fetch_sub(&pool->sleeping, 1);
+        pthread_mutex_unlock(&pool->idle_lock);
+    }
+}
+
+void thread_pool_enter(thread_pool_t *pool, thread_pool_seat_t *seat)
+{
+    seat->pool = current_pool;
+    seat->index = current_index;
+    seat->held = current_pool != pool;
+    if (!seat->held)
+        return;
+
+    pthread_mutex_lock(&pool->seat_lock);
+    current_pool = pool;
+    current_index = 0;
+}
+
+void thread_pool_leave(thread_pool_t *pool, const thread_pool_seat_t *seat)
+{
+    if (!seat->held)
+        return;
+
+    current_pool = seat->pool;
+    current_index = seat->index;
+    pthread_mutex_unlock(&pool->seat_lock);
+}
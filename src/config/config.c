@@ -10,4 +10,6 @@ void config_init(config_t *config)
 {
     memset(config, 0, sizeof(config_t));
     config->alpha = DEFAULT_ALPHA;
+    config->preview_level = DEFAULT_PREVIEW_LEVEL;
+    config->threads = DEFAULT_THREADS;
 }
\ No newline at end of file
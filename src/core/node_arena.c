@@ -0,0 +1,209 @@
+/**
+ * @file node_arena.c
+ * @brief Bump allocator with a free list for quadtree nodes
+ *
+ * Blocks grow geometrically so small images stay small and big ones
+ * don't end up with thousands of blocks. Blocks are chained in the
+ * order they were made; a reset just rewinds to the first one.
+ */
+
+#include <stdlib.h>
+
+#include "core/node_arena.h"
+
+#define ARENA_MIN_BLOCK_NODES 256u
+#define ARENA_MAX_BLOCK_NODES (1u << 16)
+
+struct qtree_arena_block
+{
+    struct qtree_arena_block *next; /* Next block in the chain */
+    size_t capacity;                /* Nodes this block can hold */
+    size_t used;                    /* Nodes already bumped out */
+    qtree_node_t nodes[];           /* The storage itself */
+};
+
+void qtree_arena_init(qtree_arena_t *arena)
+{
+    *arena = (qtree_arena_t){0};
+}
+
+/**
+ * @brief Move on to the next block, making a new one if we're at the end
+ */
+static bool advance_block(qtree_arena_t *arena)
+{
+    if (arena->current && arena->current->next)
+    {
+        arena->current = arena->current->next;
+        arena->current->used = 0;
+        return true;
+    }
+
+    size_t capacity = ARENA_MIN_BLOCK_NODES;
+    if (arena->current)
+    {
+        capacity = arena->current->capacity * 2;
+        if (capacity > ARENA_MAX_BLOCK_NODES)
+            capacity = ARENA_MAX_BLOCK_NODES;
+    }
+
+    qtree_arena_block_t *block = malloc(sizeof(qtree_arena_block_t) +
+                                        capacity * sizeof(qtree_node_t));
+    if (!block)
+        return false;
+
+    block->next = NULL;
+    block->capacity = capacity;
+    block->used = 0;
+
+    if (arena->current)
+        arena->current->next = block;
+    else
+        arena->first = block;
+    arena->current = block;
+    arena->reserved_nodes += capacity;
+    arena->block_allocs++;
+    return true;
+}
+
+qtree_node_t *qtree_arena_alloc(qtree_arena_t *arena)
+{
+    qtree_node_t *node = arena->free_list;
+
+    if (node)
+    {
+        arena->free_list = node->children[0];
+    }
+    else
+    {
+        if (!arena->current || arena->current->used == arena->current->capacity)
+        {
+            if (!advance_block(arena))
+                return NULL;
+        }
+        node = &arena->current->nodes[arena->current->used++];
+    }
+
+    *node = (qtree_node_t){0};
+
+    arena->node_allocs++;
+    arena->live_nodes++;
+    if (arena->live_nodes > arena->peak_nodes)
+        arena->peak_nodes = arena->live_nodes;
+    return node;
+}
+
+void qtree_arena_release(qtree_arena_t *arena, qtree_node_t *node)
+{
+    if (!node)
+        return;
+    if (!arena->free_list)
+        arena->free_tail = node;
+    node->children[0] = arena->free_list;
+    arena->free_list = node;
+    arena->live_nodes--;
+}
+
+void qtree_arena_release_subtree(qtree_arena_t *arena, qtree_node_t *node)
+{
+    if (!node)
+        return;
+    for (int i = 0; i < 4; i++)
+    {
+        qtree_arena_release_subtree(arena, node->children[i]);
+    }
+    qtree_arena_release(arena, node);
+}
+
+void qtree_arena_reset(qtree_arena_t *arena)
+{
+    arena->current = arena->first;
+    if (arena->current)
+        arena->current->used = 0;
+    arena->free_list = NULL;
+    arena->live_nodes = 0;
+    arena->peak_nodes = 0;
+    arena->node_allocs = 0;
+}
+
+void qtree_arena_destroy(qtree_arena_t *arena)
+{
+    qtree_arena_block_t *block = arena->first;
+    while (block)
+    {
+        qtree_arena_block_t *next = block->next;
+        free(block);
+        block = next;
+    }
+    qtree_arena_init(arena);
+}
+
+/**
+ * @brief Puts side's free list in front of arena's
+ */
+static void splice_free_list(qtree_arena_t *arena, const qtree_arena_t *side)
+{
+    if (!side->free_list)
+        return;
+    side->free_tail->children[0] = arena->free_list;
+    if (!arena->free_list)
+        arena->free_tail = side->free_tail;
+    arena->free_list = side->free_list;
+}
+
+void qtree_arena_merge(qtree_arena_t *dst, qtree_arena_t *src)
+{
+    if (!src->first)
+        return;
+
+    qtree_arena_block_t *tail = src->first;
+    while (tail->next)
+        tail = tail->next;
+
+    // Blocks after dst->current are spares that get recycled, so the
+    // moved ones go in front of it where nothing will bump into them
+    if (!dst->current)
+    {
+        // dst has no blocks at all, so it simply continues where src was
+        dst->first = src->first;
+        dst->current = src->current;
+    }
+    else if (dst->first == dst->current)
+    {
+        tail->next = dst->current;
+        dst->first = src->first;
+    }
+    else
+    {
+        qtree_arena_block_t *prev = dst->first;
+        while (prev->next != dst->current)
+            prev = prev->next;
+        tail->next = dst->current;
+        prev->next = src->first;
+    }
+
+    // Nodes src released are in its blocks, which dst owns now
+    splice_free_list(dst, src);
+
+    // The peaks came at different times, so their sum is only an upper bound
+    dst->live_nodes += src->live_nodes;
+    dst->peak_nodes += src->peak_nodes;
+    dst->reserved_nodes += src->reserved_nodes;
+    dst->node_allocs += src->node_allocs;
+    dst->block_allocs += src->block_allocs;
+    qtree_arena_init(src);
+}
+
+void qtree_arena_take_released(qtree_arena_t *arena, qtree_arena_t *side)
+{
+    splice_free_list(arena, side);
+
+    // side only ever released, so its count wrapped below zero by just as many
+    arena->live_nodes += side->live_nodes;
+    qtree_arena_init(side);
+}
+
+size_t qtree_arena_reserved_bytes(const qtree_arena_t *arena)
+{
+    return arena->reserved_nodes * sizeof(qtree_node_t);
+}
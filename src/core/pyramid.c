@@ -0,0 +1,383 @@
+/**
+ * @file pyramid.c
+ * @brief Row-streaming 2x2 reduction kernels and pyramid-to-tree conversion
+ *
+ * The kernel for a pair of child rows produces, per parent cell:
+ * - m = sum / 4
+ * - e = sum % 4
+ * - u = all four children equal and uniform
+ *
+ * which is exactly what calculate_node_properties() does. The vector
+ * paths are picked at compile time (AVX2, SSE2 or NEON) and always fall
+ * back to the scalar loop for narrow levels and row tails.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "core/pyramid.h"
+#include "core/qtree_array.h"
+#include "core/node_arena.h"
+#include "common/common.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+/**
+ * @brief Scalar reduction of parent cells [x, width) of one row
+ *
+ * @param r0 Upper child row
+ * @param r1 Lower child row
+ * @param u0 Upper child uniformity row (NULL means all uniform)
+ * @param u1 Lower child uniformity row (NULL means all uniform)
+ */
+static void reduce_row_scalar(const uint8_t *r0, const uint8_t *r1,
+                              const uint8_t *u0, const uint8_t *u1,
+                              uint8_t *pm, uint8_t *pe, uint8_t *pu,
+                              uint32_t x, uint32_t width)
+{
+    for (; x < width; x++)
+    {
+        const uint32_t c = 2 * x;
+        const uint8_t a = r0[c], b = r0[c + 1];
+        const uint8_t d = r1[c], f = r1[c + 1];
+        const uint32_t sum = (uint32_t)a + b + d + f;
+
+        bool uniform = a == b && a == d && a == f;
+        if (u0)
+        {
+            uniform = uniform && u0[c] && u0[c + 1] && u1[c] && u1[c + 1];
+        }
+
+        pm[x] = (uint8_t)(sum / 4);
+        pe[x] = (uint8_t)(sum % 4);
+        pu[x] = uniform ? 1 : 0;
+    }
+}
+
+#if defined(__AVX2__)
+
+static __m256i load32(const uint8_t *p)
+{
+    const void *v = p;
+    return _mm256_loadu_si256(v);
+}
+
+static void store32(uint8_t *p, __m256i x)
+{
+    void *v = p;
+    _mm256_storeu_si256(v, x);
+}
+
+/**
+ * @brief Reduce 32 children (one register per row) into 16-bit lanes
+ */
+static void reduce_half_avx2(const uint8_t *r0, const uint8_t *r1,
+                             const uint8_t *u0, const uint8_t *u1,
+                             __m256i *sum, __m256i *uniform)
+{
+    const __m256i low = _mm256_set1_epi16(0x00FF);
+    const __m256i a = load32(r0), b = load32(r1);
+    const __m256i ae = _mm256_and_si256(a, low), ao = _mm256_srli_epi16(a, 8);
+    const __m256i be = _mm256_and_si256(b, low), bo = _mm256_srli_epi16(b, 8);
+
+    *sum = _mm256_add_epi16(_mm256_add_epi16(ae, ao), _mm256_add_epi16(be, bo));
+
+    __m256i eq = _mm256_and_si256(_mm256_cmpeq_epi16(ae, ao), _mm256_cmpeq_epi16(a, b));
+    if (u0)
+    {
+        const __m256i ua = load32(u0), ub = load32(u1);
+        const __m256i usum = _mm256_add_epi16(
+            _mm256_add_epi16(_mm256_and_si256(ua, low), _mm256_srli_epi16(ua, 8)),
+            _mm256_add_epi16(_mm256_and_si256(ub, low), _mm256_srli_epi16(ub, 8)));
+        eq = _mm256_and_si256(eq, _mm256_cmpeq_epi16(usum, _mm256_set1_epi16(4)));
+    }
+    *uniform = _mm256_and_si256(eq, _mm256_set1_epi16(1));
+}
+
+/* packus works per 128-bit lane, this puts the quadwords back in order */
+static __m256i pack_ordered(__m256i lo, __m256i hi)
+{
+    return _mm256_permute4x64_epi64(_mm256_packus_epi16(lo, hi), 0xD8);
+}
+
+static void reduce_row(const uint8_t *r0, const uint8_t *r1,
+                       const uint8_t *u0, const uint8_t *u1,
+                       uint8_t *pm, uint8_t *pe, uint8_t *pu, uint32_t width)
+{
+    const __m256i three = _mm256_set1_epi16(3);
+    uint32_t x = 0;
+
+    for (; x + 32 <= width; x += 32)
+    {
+        const uint32_t c = 2 * x;
+        __m256i s0, s1, q0, q1;
+        reduce_half_avx2(r0 + c, r1 + c, u0 ? u0 + c : NULL, u1 ? u1 + c : NULL, &s0, &q0);
+        reduce_half_avx2(r0 + c + 32, r1 + c + 32, u0 ? u0 + c + 32 : NULL,
+                         u1 ? u1 + c + 32 : NULL, &s1, &q1);
+
+        store32(pm + x, pack_ordered(_mm256_srli_epi16(s0, 2), _mm256_srli_epi16(s1, 2)));
+        store32(pe + x, pack_ordered(_mm256_and_si256(s0, three), _mm256_and_si256(s1, three)));
+        store32(pu + x, pack_ordered(q0, q1));
+    }
+
+    reduce_row_scalar(r0, r1, u0, u1, pm, pe, pu, x, width);
+}
+
+const char *qtree_pyramid_kernel_name(void)
+{
+    return "avx2";
+}
+
+#elif defined(__SSE2__)
+
+static __m128i load16(const uint8_t *p)
+{
+    const void *v = p;
+    return _mm_loadu_si128(v);
+}
+
+static void store16(uint8_t *p, __m128i x)
+{
+    void *v = p;
+    _mm_storeu_si128(v, x);
+}
+
+/**
+ * @brief Reduce 16 children (one register per row) into 16-bit lanes
+ */
+static void reduce_half_sse2(const uint8_t *r0, const uint8_t *r1,
+                             const uint8_t *u0, const uint8_t *u1,
+                             __m128i *sum, __m128i *uniform)
+{
+    const __m128i low = _mm_set1_epi16(0x00FF);
+    const __m128i a = load16(r0), b = load16(r1);
+    const __m128i ae = _mm_and_si128(a, low), ao = _mm_srli_epi16(a, 8);
+    const __m128i be = _mm_and_si128(b, low), bo = _mm_srli_epi16(b, 8);
+
+    *sum = _mm_add_epi16(_mm_add_epi16(ae, ao), _mm_add_epi16(be, bo));
+
+    // Left == right in the top row, and top row == bottom row
+    __m128i eq = _mm_and_si128(_mm_cmpeq_epi16(ae, ao), _mm_cmpeq_epi16(a, b));
+    if (u0)
+    {
+        const __m128i ua = load16(u0), ub = load16(u1);
+        const __m128i usum = _mm_add_epi16(
+            _mm_add_epi16(_mm_and_si128(ua, low), _mm_srli_epi16(ua, 8)),
+            _mm_add_epi16(_mm_and_si128(ub, low), _mm_srli_epi16(ub, 8)));
+        eq = _mm_and_si128(eq, _mm_cmpeq_epi16(usum, _mm_set1_epi16(4)));
+    }
+    *uniform = _mm_and_si128(eq, _mm_set1_epi16(1));
+}
+
+static void reduce_row(const uint8_t *r0, const uint8_t *r1,
+                       const uint8_t *u0, const uint8_t *u1,
+                       uint8_t *pm, uint8_t *pe, uint8_t *pu, uint32_t width)
+{
+    const __m128i three = _mm_set1_epi16(3);
+    uint32_t x = 0;
+
+    for (; x + 16 <= width; x += 16)
+    {
+        const uint32_t c = 2 * x;
+        __m128i s0, s1, q0, q1;
+        reduce_half_sse2(r0 + c, r1 + c, u0 ? u0 + c : NULL, u1 ? u1 + c : NULL, &s0, &q0);
+        reduce_half_sse2(r0 + c + 16, r1 + c + 16, u0 ? u0 + c + 16 : NULL,
+                         u1 ? u1 + c + 16 : NULL, &s1, &q1);
+
+        store16(pm + x, _mm_packus_epi16(_mm_srli_epi16(s0, 2), _mm_srli_epi16(s1, 2)));
+        store16(pe + x, _mm_packus_epi16(_mm_and_si128(s0, three), _mm_and_si128(s1, three)));
+        store16(pu + x, _mm_packus_epi16(q0, q1));
+    }
+
+    reduce_row_scalar(r0, r1, u0, u1, pm, pe, pu, x, width);
+}
+
+const char *qtree_pyramid_kernel_name(void)
+{
+    return "sse2";
+}
+
+#elif defined(__ARM_NEON)
+
+/**
+ * @brief Reduce 16 children (one register per row) into 16-bit lanes
+ */
+static void reduce_half_neon(const uint8_t *r0, const uint8_t *r1,
+                             const uint8_t *u0, const uint8_t *u1,
+                             uint16x8_t *sum, uint16x8_t *uniform)
+{
+    const uint8x16_t a = vld1q_u8(r0), b = vld1q_u8(r1);
+
+    *sum = vaddq_u16(vpaddlq_u8(a), vpaddlq_u8(b));
+
+    // Swapping bytes inside each pair lines left up with right
+    const uint8x16_t eq8 = vandq_u8(vceqq_u8(a, vrev16q_u8(a)), vceqq_u8(a, b));
+    uint16x8_t eq = vceqq_u16(vreinterpretq_u16_u8(eq8), vdupq_n_u16(0xFFFF));
+    if (u0)
+    {
+        const uint16x8_t usum = vaddq_u16(vpaddlq_u8(vld1q_u8(u0)), vpaddlq_u8(vld1q_u8(u1)));
+        eq = vandq_u16(eq, vceqq_u16(usum, vdupq_n_u16(4)));
+    }
+    *uniform = vandq_u16(eq, vdupq_n_u16(1));
+}
+
+static void reduce_row(const uint8_t *r0, const uint8_t *r1,
+                       const uint8_t *u0, const uint8_t *u1,
+                       uint8_t *pm, uint8_t *pe, uint8_t *pu, uint32_t width)
+{
+    const uint16x8_t three = vdupq_n_u16(3);
+    uint32_t x = 0;
+
+    for (; x + 16 <= width; x += 16)
+    {
+        const uint32_t c = 2 * x;
+        uint16x8_t s0, s1, q0, q1;
+        reduce_half_neon(r0 + c, r1 + c, u0 ? u0 + c : NULL, u1 ? u1 + c : NULL, &s0, &q0);
+        reduce_half_neon(r0 + c + 16, r1 + c + 16, u0 ? u0 + c + 16 : NULL,
+                         u1 ? u1 + c + 16 : NULL, &s1, &q1);
+
+        vst1q_u8(pm + x, vcombine_u8(vshrn_n_u16(s0, 2), vshrn_n_u16(s1, 2)));
+        vst1q_u8(pe + x, vcombine_u8(vmovn_u16(vandq_u16(s0, three)),
+                                     vmovn_u16(vandq_u16(s1, three))));
+        vst1q_u8(pu + x, vcombine_u8(vmovn_u16(q0), vmovn_u16(q1)));
+    }
+
+    reduce_row_scalar(r0, r1, u0, u1, pm, pe, pu, x, width);
+}
+
+const char *qtree_pyramid_kernel_name(void)
+{
+    return "neon";
+}
+
+#else
+
+static void reduce_row(const uint8_t *r0, const uint8_t *r1,
+                       const uint8_t *u0, const uint8_t *u1,
+                       uint8_t *pm, uint8_t *pe, uint8_t *pu, uint32_t width)
+{
+    reduce_row_scalar(r0, r1, u0, u1, pm, pe, pu, 0, width);
+}
+
+const char *qtree_pyramid_kernel_name(void)
+{
+    return "scalar";
+}
+
+#endif
+
+qtree_status_t qtree_pyramid_build(qtree_pyramid_t *pyramid, const uint8_t *pixels,
+                                   uint32_t size)
+{
+    if (!pyramid || !pixels || !is_power_of_two(size))
+        return QTREE_ERROR_INVALID_PARAM;
+
+    *pyramid = (qtree_pyramid_t){0};
+    pyramid->pixels = pixels;
+    pyramid->size = size;
+    while ((1u << pyramid->n_levels) < size)
+        pyramid->n_levels++;
+
+    // Levels 0..n-1 take as many cells as the top of a complete tree
+    const size_t cells = qtree_array_level_offset(pyramid->n_levels);
+    if (cells > 0)
+    {
+        pyramid->m = malloc(cells);
+        pyramid->e = malloc(cells);
+        pyramid->u = malloc(cells);
+        if (!pyramid->m || !pyramid->e || !pyramid->u)
+        {
+            qtree_pyramid_free(pyramid);
+            return QTREE_ERROR_MEMORY;
+        }
+    }
+
+    for (uint32_t level = pyramid->n_levels; level-- > 0;)
+    {
+        const uint32_t width = 1u << level;
+        const uint32_t child_width = width * 2;
+        const size_t out = qtree_array_level_offset(level);
+
+        // The image level has no u plane: every pixel is uniform
+        const bool from_pixels = level + 1 == pyramid->n_levels;
+        const uint8_t *cm = from_pixels ? pixels : pyramid->m + qtree_array_level_offset(level + 1);
+        const uint8_t *cu = from_pixels ? NULL : pyramid->u + qtree_array_level_offset(level + 1);
+
+        for (uint32_t y = 0; y < width; y++)
+        {
+            const size_t r0 = (size_t)(2 * y) * child_width;
+            const size_t r1 = r0 + child_width;
+            const size_t row = out + (size_t)y * width;
+
+            reduce_row(cm + r0, cm + r1,
+                       cu ? cu + r0 : NULL, cu ? cu + r1 : NULL,
+                       pyramid->m + row, pyramid->e + row, pyramid->u + row, width);
+        }
+    }
+
+    return QTREE_SUCCESS;
+}
+
+void qtree_pyramid_free(qtree_pyramid_t *pyramid)
+{
+    if (!pyramid)
+        return;
+    free(pyramid->m);
+    free(pyramid->e);
+    free(pyramid->u);
+    *pyramid = (qtree_pyramid_t){0};
+}
+
+/**
+ * @brief Create the node for cell (y, x) of a level and everything under it
+ */
+static qtree_node_t *pyramid_node(const qtree_pyramid_t *pyramid, qtree_arena_t *arena,
+                                  uint32_t level, uint32_t y, uint32_t x)
+{
+    qtree_node_t *node = qtree_arena_alloc(arena);
+    if (!node)
+        return NULL;
+
+    if (level == pyramid->n_levels)
+    {
+        node->m = pyramid->pixels[(size_t)y * pyramid->size + x];
+        node->e = 0;
+        node->u = 1;
+        return node;
+    }
+
+    const size_t cell = qtree_array_level_offset(level) + ((size_t)y << level) + x;
+    node->m = pyramid->m[cell];
+    node->e = (unsigned char)(pyramid->e[cell] & 0x3);
+    node->u = (unsigned char)(pyramid->u[cell] & 0x1);
+
+    if (node->u)
+        return node;
+
+    for (int i = 0; i < 4; i++)
+    {
+        const int q = quadrant_order[i];
+        const uint32_t cy = 2 * y + ((q & 2) ? 1u : 0u);
+        const uint32_t cx = 2 * x + (((q & 1) ^ ((q & 2) >> 1)) ? 1u : 0u);
+
+        node->children[q] = pyramid_node(pyramid, arena, level + 1, cy, cx);
+        if (!node->children[q])
+            return NULL;
+    }
+    return node;
+}
+
+qtree_status_t qtree_pyramid_to_tree(const qtree_pyramid_t *pyramid, qtree_t *tree)
+{
+    if (!pyramid || !tree || pyramid->size != tree->size)
+        return QTREE_ERROR_INVALID_PARAM;
+
+    tree->root = pyramid_node(pyramid, &tree->arena, 0, 0, 0);
+    return tree->root ? QTREE_SUCCESS : QTREE_ERROR_MEMORY;
+}
@@ -0,0 +1,244 @@
+/**
+ * @file qtree_array.c
+ * @brief Level-major structure-of-arrays quadtree
+ */
+
+#include <stdlib.h>
+#include <math.h>
+
+#include "core/qtree_array.h"
+#include "core/variance_hist.h"
+#include "logger/logger.h"
+#include "common/common.h"
+
+size_t qtree_array_level_offset(uint32_t level)
+{
+    return (((size_t)1 << (2 * level)) - 1) / 3;
+}
+
+size_t qtree_array_node_count(uint32_t n_levels)
+{
+    return qtree_array_level_offset(n_levels + 1);
+}
+
+qtree_status_t qtree_array_init(qtree_array_t *tree, uint32_t size)
+{
+    if (!tree || !is_power_of_two(size))
+    {
+        log_message(LOG_LEVEL_ERROR, "Invalid parameters for array quadtree initialization");
+        return QTREE_ERROR_INVALID_PARAM;
+    }
+
+    *tree = (qtree_array_t){0};
+    tree->size = size;
+    while ((1u << tree->n_levels) < size)
+        tree->n_levels++;
+    tree->n_nodes = qtree_array_node_count(tree->n_levels);
+
+    tree->m = malloc(tree->n_nodes);
+    tree->e = malloc(tree->n_nodes);
+    tree->u = malloc(tree->n_nodes);
+    tree->v = malloc(tree->n_nodes * sizeof(float));
+    if (!tree->m || !tree->e || !tree->u || !tree->v)
+    {
+        qtree_array_free(tree);
+        log_message(LOG_LEVEL_ERROR, "Memory allocation failed for array quadtree");
+        return QTREE_ERROR_MEMORY;
+    }
+
+    log_message(LOG_LEVEL_INFO, "Initialized array quadtree (%ux%u, %zu nodes)",
+                size, size, tree->n_nodes);
+    return QTREE_SUCCESS;
+}
+
+void qtree_array_free(qtree_array_t *tree)
+{
+    if (!tree)
+        return;
+    free(tree->m);
+    free(tree->e);
+    free(tree->u);
+    free(tree->v);
+    *tree = (qtree_array_t){0};
+}
+
+/**
+ * @brief Spread the low 16 bits of x onto the even bit positions
+ */
+static uint64_t spread_bits(uint32_t x)
+{
+    uint64_t v = x & 0xFFFFu;
+    v = (v | (v << 8)) & 0x00FF00FFu;
+    v = (v | (v << 4)) & 0x0F0F0F0Fu;
+    v = (v | (v << 2)) & 0x33333333u;
+    v = (v | (v << 1)) & 0x55555555u;
+    return v;
+}
+
+/**
+ * @brief Position of pixel (row, col) inside the bottom level
+ *
+ * Each quadrant digit is (row bit << 1) | (row bit ^ col bit), which
+ * gives TL=0, TR=1, BR=2, BL=3 like quadrant_order.
+ */
+static size_t pixel_level_index(uint32_t row, uint32_t col)
+{
+    return (size_t)((spread_bits(row) << 1) | spread_bits(row ^ col));
+}
+
+qtree_status_t qtree_array_build(qtree_array_t *tree, const uint8_t *pixels,
+                                 uint32_t size, const char *input_filename)
+{
+    if (!tree || !tree->m || !pixels || size != tree->size)
+    {
+        log_message(LOG_LEVEL_ERROR, "Invalid parameters for array quadtree build");
+        return QTREE_ERROR_INVALID_PARAM;
+    }
+
+    log_header("QUADTREE CONSTRUCTION");
+
+    log_subheader("Image Information");
+    log_item("Input path", input_filename);
+    log_item("Dimensions", "%ux%u pixels", size, size);
+    log_item("Tree depth", "%u levels", tree->n_levels);
+    log_item("Layout", "level-major arrays");
+
+    const double start_time = wall_seconds();
+
+    // Bottom level: scatter the raster into quadrant order
+    const size_t leaf_base = qtree_array_level_offset(tree->n_levels);
+    for (uint32_t row = 0; row < size; row++)
+    {
+        const uint8_t *line = pixels + (size_t)row * size;
+        for (uint32_t col = 0; col < size; col++)
+        {
+            const size_t i = leaf_base + pixel_level_index(row, col);
+            tree->m[i] = line[col];
+            tree->e[i] = 0;
+            tree->u[i] = 1;
+        }
+    }
+
+    // Every other level comes from its four contiguous children
+    for (uint32_t level = tree->n_levels; level-- > 0;)
+    {
+        const size_t begin = qtree_array_level_offset(level);
+        const size_t end = qtree_array_level_offset(level + 1);
+        for (size_t i = begin; i < end; i++)
+        {
+            const size_t c = qtree_first_child_index(i);
+            const uint8_t m1 = tree->m[c];
+            const uint8_t m2 = tree->m[c + 1];
+            const uint8_t m3 = tree->m[c + 2];
+            const uint8_t m4 = tree->m[c + 3];
+
+            const uint32_t sum = (uint32_t)m1 + (uint32_t)m2 + (uint32_t)m3 + (uint32_t)m4;
+            const uint8_t error_val = (uint8_t)(sum % 4);
+            const bool all_uniform = tree->u[c] && tree->u[c + 1] &&
+                                     tree->u[c + 2] && tree->u[c + 3];
+            const bool all_same = (m1 == m2) && (m2 == m3) && (m3 == m4);
+
+            tree->m[i] = (uint8_t)(sum / 4);
+            tree->e[i] = error_val;
+            tree->u[i] = (error_val == 0 && all_uniform && all_same) ? 1 : 0;
+        }
+    }
+
+    double elapsed = wall_seconds() - start_time;
+
+    log_subheader("Construction Statistics");
+    log_item("Total nodes", "%zu nodes", tree->n_nodes);
+    log_item("Processing time", "%.3f seconds", elapsed);
+    log_item("Memory usage", "%.2f MB",
+             (double)(tree->n_nodes * (3 + sizeof(float))) / (1024.0 * 1024.0));
+
+    log_separator();
+    log_message(LOG_LEVEL_SUCCESS, "Quadtree construction completed successfully");
+
+    return QTREE_SUCCESS;
+}
+
+void qtree_array_normalize(qtree_array_t *tree)
+{
+    if (!tree || !tree->m)
+        return;
+
+    for (uint32_t level = 0; level < tree->n_levels; level++)
+    {
+        const size_t begin = qtree_array_level_offset(level);
+        const size_t end = qtree_array_level_offset(level + 1);
+        for (size_t i = begin; i < end; i++)
+        {
+            if (!tree->u[i])
+                continue;
+
+            const size_t c = qtree_first_child_index(i);
+            for (size_t k = 0; k < 4; k++)
+            {
+                tree->m[c + k] = tree->m[i];
+                tree->e[c + k] = 0;
+                tree->u[c + k] = 1;
+            }
+        }
+    }
+}
+
+qtree_variance_stats_t qtree_array_variance_stats(qtree_array_t *tree)
+{
+    qtree_variance_stats_t stats = {0.0f, 0.0f};
+    if (!tree || !tree->m)
+        return stats;
+
+    qtree_variance_hist_t hist;
+    if (!qtree_variance_hist_init(&hist))
+        return stats;
+
+    const size_t leaf_base = qtree_array_level_offset(tree->n_levels);
+    for (size_t i = leaf_base; i < tree->n_nodes; i++)
+    {
+        tree->v[i] = 0.0f;
+    }
+
+    // Bottom-up so children are always done before their parent
+    for (uint32_t level = tree->n_levels; level-- > 0;)
+    {
+        const size_t begin = qtree_array_level_offset(level);
+        const size_t end = qtree_array_level_offset(level + 1);
+        for (size_t i = begin; i < end; i++)
+        {
+            if (tree->u[i])
+            {
+                tree->v[i] = 0.0f;
+                continue;
+            }
+
+            const size_t c = qtree_first_child_index(i);
+            float μ = 0.0f;
+            for (size_t k = 0; k < 4; k++)
+            {
+                float diff = (float)tree->m[i] - (float)tree->m[c + k];
+                μ += tree->v[c + k] * tree->v[c + k] + diff * diff;
+            }
+            tree->v[i] = sqrtf(μ / 4.0f);
+
+            if (tree->v[i] > 0.0f)
+            {
+                qtree_variance_hist_add(&hist, tree->v[i]);
+            }
+        }
+    }
+
+    // Leaves are always 0, so only the inner levels need a second look
+    if (qtree_variance_hist_select(&hist))
+    {
+        for (size_t i = 0; i < leaf_base; i++)
+        {
+            if (tree->v[i] > 0.0f)
+                qtree_variance_hist_refine(&hist, tree->v[i]);
+        }
+    }
+
+    stats = qtree_variance_hist_finish(&hist);
+    qtree_variance_hist_free(&hist);
+    return stats;
+}
@@ -0,0 +1,178 @@
+/**
+ * @file qtree_succinct.c
+ * @brief Breadth-first bit-vector quadtree with rank/select
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "core/qtree_succinct.h"
+#include "logger/logger.h"
+#include "common/common.h"
+
+/* Nodes a new tree has room for before it first grows */
+#define INITIAL_CAPACITY 1024u
+
+qtree_status_t qtree_succinct_init(qtree_succinct_t *tree, uint32_t size)
+{
+    if (!tree || !is_power_of_two(size))
+    {
+        log_message(LOG_LEVEL_ERROR, "Invalid parameters for succinct quadtree initialization");
+        return QTREE_ERROR_INVALID_PARAM;
+    }
+
+    *tree = (qtree_succinct_t){0};
+    tree->size = size;
+    while ((1u << tree->n_levels) < size)
+        tree->n_levels++;
+    return QTREE_SUCCESS;
+}
+
+/**
+ * @brief Makes room for at least one more node
+ */
+static bool grow(qtree_succinct_t *tree)
+{
+    const size_t capacity = tree->capacity ? tree->capacity * 2 : INITIAL_CAPACITY;
+
+    uint8_t *m = realloc(tree->m, capacity);
+    if (!m)
+        return false;
+    tree->m = m;
+
+    uint8_t *e = realloc(tree->e, capacity / 4);
+    if (!e)
+        return false;
+    tree->e = e;
+
+    uint64_t *shape = realloc(tree->shape, capacity / 64 * sizeof(uint64_t));
+    if (!shape)
+        return false;
+    tree->shape = shape;
+
+    // New bits and error slots start cleared, append only ever sets them
+    memset(tree->e + tree->capacity / 4, 0, (capacity - tree->capacity) / 4);
+    memset(tree->shape + tree->capacity / 64, 0,
+           (capacity - tree->capacity) / 64 * sizeof(uint64_t));
+    tree->capacity = capacity;
+    return true;
+}
+
+bool qtree_succinct_append(qtree_succinct_t *tree, uint8_t m, uint8_t e, bool has_children)
+{
+    if (tree->n_nodes == tree->capacity && !grow(tree))
+        return false;
+
+    const size_t index = tree->n_nodes++;
+    tree->m[index] = m;
+    tree->e[index / 4] |= (uint8_t)((e & 3u) << (2 * (index % 4)));
+    if (has_children)
+    {
+        tree->shape[index / 64] |= (uint64_t)1 << (index % 64);
+        tree->n_parents++;
+    }
+    return true;
+}
+
+qtree_status_t qtree_succinct_finish(qtree_succinct_t *tree)
+{
+    if (!tree || tree->n_nodes == 0 || tree->n_nodes != 1 + 4 * tree->n_parents)
+    {
+        log_message(LOG_LEVEL_ERROR, "Incomplete succinct quadtree");
+        return QTREE_ERROR_FORMAT;
+    }
+
+    const size_t n_blocks = tree->n_nodes / QTREE_SUCCINCT_BLOCK_BITS + 1;
+    tree->rank = malloc(n_blocks * sizeof(uint64_t));
+    if (!tree->rank)
+    {
+        log_message(LOG_LEVEL_ERROR, "Memory allocation failed for succinct quadtree");
+        return QTREE_ERROR_MEMORY;
+    }
+
+    // Whole rank blocks of shape, so rank() never reads past the end
+    const size_t n_words = tree->capacity / 64;
+    const size_t kept_words = n_blocks * QTREE_SUCCINCT_BLOCK_WORDS;
+    uint64_t *shape = realloc(tree->shape, kept_words * sizeof(uint64_t));
+    if (!shape && kept_words > n_words)
+    {
+        log_message(LOG_LEVEL_ERROR, "Memory allocation failed for succinct quadtree");
+        return QTREE_ERROR_MEMORY;
+    }
+    tree->shape = shape ? shape : tree->shape;
+    if (kept_words > n_words)
+        memset(tree->shape + n_words, 0, (kept_words - n_words) * sizeof(uint64_t));
+    tree->capacity = kept_words * 64;
+
+    uint64_t count = 0;
+    for (size_t w = 0; w < kept_words; w++)
+    {
+        if (w % QTREE_SUCCINCT_BLOCK_WORDS == 0)
+            tree->rank[w / QTREE_SUCCINCT_BLOCK_WORDS] = count;
+        count += (uint64_t)__builtin_popcountll(tree->shape[w]);
+    }
+
+    uint8_t *m = realloc(tree->m, tree->n_nodes);
+    tree->m = m ? m : tree->m;
+    uint8_t *e = realloc(tree->e, (tree->n_nodes + 3) / 4);
+    tree->e = e ? e : tree->e;
+
+    log_message(LOG_LEVEL_INFO, "Packed %zu nodes into %zu bytes", tree->n_nodes,
+                qtree_succinct_bytes(tree));
+    return QTREE_SUCCESS;
+}
+
+void qtree_succinct_free(qtree_succinct_t *tree)
+{
+    if (!tree)
+        return;
+    free(tree->shape);
+    free(tree->rank);
+    free(tree->m);
+    free(tree->e);
+    *tree = (qtree_succinct_t){0};
+}
+
+size_t qtree_succinct_bytes(const qtree_succinct_t *tree)
+{
+    return tree->n_nodes + (tree->n_nodes + 3) / 4 +
+           tree->capacity / 8 +
+           (tree->n_nodes / QTREE_SUCCINCT_BLOCK_BITS + 1) * sizeof(uint64_t);
+}
+
+size_t qtree_succinct_select(const qtree_succinct_t *tree, size_t k)
+{
+    // Last block that starts at or before set bit k
+    size_t low = 0;
+    size_t high = tree->n_nodes / QTREE_SUCCINCT_BLOCK_BITS;
+    while (low < high)
+    {
+        const size_t middle = (low + high + 1) / 2;
+        if (tree->rank[middle] <= k)
+            low = middle;
+        else
+            high = middle - 1;
+    }
+
+    size_t remaining = k - (size_t)tree->rank[low];
+    size_t word = low * QTREE_SUCCINCT_BLOCK_WORDS;
+    for (;; word++)
+    {
+        const size_t count = (size_t)__builtin_popcountll(tree->shape[word]);
+        if (remaining < count)
+            break;
+        remaining -= count;
+    }
+
+    uint64_t bits = tree->shape[word];
+    for (size_t i = 0; i < remaining; i++)
+    {
+        bits &= bits - 1;
+    }
+    return word * 64 + (size_t)__builtin_ctzll(bits);
+}
+
+size_t qtree_succinct_parent(const qtree_succinct_t *tree, size_t index)
+{
+    return qtree_succinct_select(tree, (index - 1) / 4);
+}
@@ -3,46 +3,109 @@
  * @brief Quadtree implementation with progress tracking
  */
 
+#include <stdatomic.h>
 #include <stdlib.h>
 #include <math.h>
 #include <string.h>
 #include <stdio.h>
-#include <time.h>
 
 #include "core/quadtree.h"
+#include "core/node_arena.h"
+#include "core/pyramid.h"
+#include "core/tree_walk.h"
+#include "core/variance_hist.h"
 #include "logger/logger.h"
 #include "common/common.h"
+#include "common/thread_pool.h"
 
-/* Node tracking for progress updates */
+#ifndef QTREE_NO_PROGRESS
+/* Nodes a thread counts before it publishes them */
+#define PROGRESS_BATCH 4096u
+#endif
+
+/* Smallest subtree (as a level) worth a task of its own */
+#define PARALLEL_MIN_GRAIN_LEVEL 5u
+
+/* Tasks we want per thread so stealing can even out the load */
+#define PARALLEL_TASKS_PER_THREAD 16u
+
+/* Node tracking for progress updates, shared by every build thread */
 typedef struct
 {
-    uint32_t processed;
-    uint32_t total;
+    atomic_size_t processed;
+    size_t total;
 } progress_tracker_t;
 
+/* One thread's share: counted locally, published in batches */
+typedef struct
+{
+    progress_tracker_t *shared;
+    uint32_t pending;      /* Counted here, not yet published */
+    uint32_t last_percent; /* What the bar shows right now */
+    bool reporter;         /* Only the calling thread draws the bar */
+} progress_local_t;
+
 /**
- * @brief Create and initialize a new node
+ * @brief Add this thread's count to the total and redraw if it moved 1%
  */
-static qtree_node_t *create_node(void)
+static void progress_publish(progress_local_t *local)
 {
-    qtree_node_t *node = malloc(sizeof(qtree_node_t));
-    if (node)
+#ifdef QTREE_NO_PROGRESS
+    (void)local;
+#else
+    if (local->pending == 0)
+        return;
+
+    progress_tracker_t *shared = local->shared;
+    const size_t done = atomic_fetch_add_explicit(&shared->processed, local->pending,
+                                                  memory_order_relaxed) +
+                        local->pending;
+    local->pending = 0;
+
+    if (!local->reporter)
+        return;
+
+    const uint32_t percent = (uint32_t)(done * 100 / shared->total);
+    if (percent != local->last_percent || done == shared->total)
     {
-        node->m = 0;
-        node->e = 0;
-        node->u = 0;
-        memset(node->children, 0, sizeof(node->children));
+        local->last_percent = percent;
+        log_progress((double)done / (double)shared->total);
     }
-    return node;
+#endif
+}
+
+static void progress_add(progress_local_t *local, uint32_t nodes)
+{
+#ifdef QTREE_NO_PROGRESS
+    (void)local;
+    (void)nodes;
+#else
+    local->pending += nodes;
+    if (local->pending >= PROGRESS_BATCH)
+        progress_publish(local);
+#endif
+}
+
+static void progress_tick(progress_local_t *local)
+{
+    progress_add(local, 1);
+}
+
+/**
+ * @brief Create and initialize a new node
+ */
+static qtree_node_t *create_node(qtree_arena_t *arena)
+{
+    return qtree_arena_alloc(arena);
 }
 
 /**
  * @brief Calculate total nodes needed for progress tracking
  */
-static uint32_t calculate_total_nodes(uint32_t levels)
+static size_t calculate_total_nodes(uint32_t levels)
 {
-    uint32_t total = 0;
-    uint32_t nodes_at_level = 1;
+    size_t total = 0;
+    size_t nodes_at_level = 1;
 
     for (uint32_t i = 0; i <= levels; i++)
     {
@@ -55,14 +118,15 @@ static uint32_t calculate_total_nodes(uint32_t levels)
 /**
  * @brief Create a leaf node
  */
-static qtree_node_t *create_leaf_node(const uint8_t *pixels, uint32_t size,
+static qtree_node_t *create_leaf_node(qtree_arena_t *arena,
+                                      const uint8_t *pixels, uint32_t size,
                                       uint32_t row, uint32_t col)
 {
-    qtree_node_t *node = create_node();
+    qtree_node_t *node = create_node(arena);
     if (!node)
         return NULL;
 
-    node->m = pixels[row * size + col];
+    node->m = pixels[(size_t)row * size + col];
     node->e = 0;
     node->u = 1;
 
@@ -100,33 +164,124 @@ static bool calculate_node_properties(qtree_node_t *node)
 }
 
 /**
- * @brief Build quadtree recursively with progress tracking
+ * @brief Give a uniform node's children back, it is a leaf from now on
  */
-static qtree_node_t *build_recursive(const uint8_t *pixels, uint32_t size,
-                                     uint32_t level, uint32_t row, uint32_t col,
-                                     progress_tracker_t *progress)
+static void collapse_if_uniform(qtree_arena_t *arena, qtree_node_t *node)
+{
+    if (!calculate_node_properties(node))
+        return;
+
+    for (int i = 0; i < 4; i++)
+    {
+        qtree_arena_release_subtree(arena, node->children[i]);
+        node->children[i] = NULL;
+    }
+}
+
+/**
+ * @brief A 2x2 block: one node and its four pixels, no recursion
+ *
+ * Same nodes in the same order as build_recursive() would make them,
+ * just with the quadrant offsets written out.
+ *
+ * @param block Top-left pixel of the block
+ * @param stride Bytes per image row
+ */
+static qtree_node_t *build_block_2(qtree_arena_t *arena, const uint8_t *block, size_t stride,
+                                   progress_local_t *progress)
 {
-    // Create node and update progress
-    qtree_node_t *node = create_node();
+    progress_add(progress, 5);
+
+    qtree_node_t *node = create_node(arena);
     if (!node)
         return NULL;
 
-    progress->processed++;
-    if (progress->processed % (progress->total / 100) == 0 ||
-        progress->processed == progress->total)
+    // TL, TR, BR, BL
+    const uint8_t means[4] = {block[0], block[1], block[stride + 1], block[stride]};
+    for (int q = 0; q < 4; q++)
     {
-        double percent = (double)progress->processed / (double)progress->total;
-        log_progress(percent);
+        qtree_node_t *leaf = create_node(arena);
+        if (!leaf)
+        {
+            qtree_arena_release_subtree(arena, node);
+            return NULL;
+        }
+        leaf->m = means[q];
+        leaf->u = 1;
+        node->children[q] = leaf;
     }
 
-    // Handle leaf nodes
-    if (level == 0)
+    collapse_if_uniform(arena, node);
+    return node;
+}
+
+/*
+ * build_block_4 and build_block_8: a node over four blocks of half the
+ * size, at offsets the compiler knows, down to build_block_2
+ */
+#define DEFINE_BUILD_BLOCK(n, half)                                                        \
+    static qtree_node_t *build_block_##n(qtree_arena_t *arena, const uint8_t *block,      \
+                                         size_t stride, progress_local_t *progress)        \
+    {                                                                                      \
+        progress_tick(progress);                                                           \
+                                                                                           \
+        qtree_node_t *node = create_node(arena);                                           \
+        if (!node)                                                                         \
+            return NULL;                                                                   \
+                                                                                           \
+        const uint8_t *const quadrants[4] = {block, block + (half),                        \
+                                             block + (half) * stride + (half),             \
+                                             block + (half) * stride};                     \
+        for (int q = 0; q < 4; q++)                                                        \
+        {                                                                                  \
+            node->children[q] = build_block_##half(arena, quadrants[q], stride, progress); \
+            if (!node->children[q])                                                        \
+            {                                                                              \
+                qtree_arena_release_subtree(arena, node);                                  \
+                return NULL;                                                               \
+            }                                                                              \
+        }                                                                                  \
+                                                                                           \
+        collapse_if_uniform(arena, node);                                                  \
+        return node;                                                                       \
+    }
+
+DEFINE_BUILD_BLOCK(4, 2)
+DEFINE_BUILD_BLOCK(8, 4)
+
+/**
+ * @brief Build quadtree recursively with progress tracking
+ *
+ * The last three levels (8x8 blocks and down) go to the kernels above,
+ * where most of the calls of a tree that never prunes would be.
+ */
+static qtree_node_t *build_recursive(qtree_arena_t *arena,
+                                     const uint8_t *pixels, uint32_t size,
+                                     uint32_t level, uint32_t row, uint32_t col,
+                                     progress_local_t *progress)
+{
+    const uint8_t *block = pixels + (size_t)row * size + col;
+    switch (level)
     {
-        qtree_node_t *leaf = create_leaf_node(pixels, size, row, col);
-        free(node); // Free the unnecessary node
-        return leaf;
+    case 0:
+        progress_tick(progress);
+        return create_leaf_node(arena, pixels, size, row, col);
+    case 1:
+        return build_block_2(arena, block, size, progress);
+    case 2:
+        return build_block_4(arena, block, size, progress);
+    case 3:
+        return build_block_8(arena, block, size, progress);
+    default:
+        break;
     }
 
+    progress_tick(progress);
+
+    qtree_node_t *node = create_node(arena);
+    if (!node)
+        return NULL;
+
     // Process children
     uint32_t step = 1 << (level - 1);
     for (int i = 0; i < 4; i++)
@@ -140,27 +295,306 @@ static qtree_node_t *build_recursive(const uint8_t *pixels, uint32_t size,
         if ((q & 1) ^ ((q & 2) >> 1))
             new_col += step; // Right quadrants
 
-        node->children[q] = build_recursive(pixels, size, level - 1,
+        node->children[q] = build_recursive(arena, pixels, size, level - 1,
                                             new_row, new_col, progress);
         if (!node->children[q])
         {
-            free_quadtree_recursive(node);
+            qtree_arena_release_subtree(arena, node);
             return NULL;
         }
     }
 
-    // Process node properties
-    if (calculate_node_properties(node))
+    // Convert to leaf if uniform, children go back to the arena
+    collapse_if_uniform(arena, node);
+    return node;
+}
+
+/**
+ * @brief A uniform leaf holding one value
+ */
+static qtree_node_t *create_leaf(qtree_arena_t *arena, uint8_t m)
+{
+    qtree_node_t *node = create_node(arena);
+    if (!node)
+        return NULL;
+
+    node->m = m;
+    node->e = 0;
+    node->u = 1;
+    return node;
+}
+
+/**
+ * @brief A block the pruned build has been through
+ *
+ * Constant blocks come back as a value only; the parent decides whether
+ * they need a node at all.
+ */
+typedef struct
+{
+    qtree_node_t *node; /* NULL while the block is constant */
+    uint8_t m;          /* The block's value when it is */
+} pruned_block_t;
+
+/**
+ * @brief Build a subtree top-down without allocating inside constant blocks
+ *
+ * A block is uniform exactly when all of its pixels are equal, so the
+ * four quadrants are looked at first and a node only gets allocated
+ * once they turn out to differ. Nodes that would be freed right away
+ * never exist, which keeps the arena at the size of the final tree.
+ *
+ * @return False if we ran out of memory
+ */
+static bool build_pruned(qtree_arena_t *arena, const uint8_t *pixels, uint32_t size,
+                         uint32_t level, uint32_t row, uint32_t col,
+                         progress_local_t *progress, pruned_block_t *block)
+{
+    progress_tick(progress);
+
+    if (level == 0)
     {
-        // Convert to leaf if uniform
-        for (int i = 0; i < 4; i++)
+        *block = (pruned_block_t){.node = NULL, .m = pixels[(size_t)row * size + col]};
+        return true;
+    }
+
+    pruned_block_t children[4];
+    bool complete = true;
+    const uint32_t step = 1u << (level - 1);
+    for (int i = 0; i < 4 && complete; i++)
+    {
+        const int q = quadrant_order[i];
+        children[q] = (pruned_block_t){0};
+        complete = build_pruned(arena, pixels, size, level - 1,
+                                row + ((q & 2) ? step : 0),
+                                col + (((q & 1) ^ ((q & 2) >> 1)) ? step : 0),
+                                progress, &children[q]);
+    }
+
+    bool constant = complete;
+    for (int q = 0; q < 4 && constant; q++)
+    {
+        constant = !children[q].node && children[q].m == children[0].m;
+    }
+
+    if (constant)
+    {
+        *block = (pruned_block_t){.node = NULL, .m = children[0].m};
+        return true;
+    }
+
+    // The quadrants differ: constant ones become leaves now
+    qtree_node_t *node = complete ? create_node(arena) : NULL;
+    bool linked = node != NULL;
+    for (int q = 0; q < 4 && linked; q++)
+    {
+        if (!children[q].node)
+            children[q].node = create_leaf(arena, children[q].m);
+        linked = children[q].node != NULL;
+    }
+
+    if (!linked)
+    {
+        for (int q = 0; q < 4; q++)
         {
-            free_quadtree_recursive(node->children[i]);
-            node->children[i] = NULL;
+            qtree_arena_release_subtree(arena, children[q].node);
         }
+        qtree_arena_release_subtree(arena, node);
+        return false;
     }
 
-    return node;
+    for (int q = 0; q < 4; q++)
+    {
+        node->children[q] = children[q].node;
+    }
+    calculate_node_properties(node);
+
+    *block = (pruned_block_t){.node = node, .m = node->m};
+    return true;
+}
+
+/**
+ * @brief Pruned build of a whole subtree, with its root always a node
+ */
+static qtree_node_t *build_pruned_root(qtree_arena_t *arena,
+                                       const uint8_t *pixels, uint32_t size,
+                                       uint32_t level, uint32_t row, uint32_t col,
+                                       progress_local_t *progress)
+{
+    pruned_block_t block = {0};
+    if (!build_pruned(arena, pixels, size, level, row, col, progress, &block))
+        return NULL;
+    if (block.node)
+        return block.node;
+
+    return create_leaf(arena, block.m);
+}
+
+/**
+ * @brief What every task of a parallel build shares
+ */
+typedef struct
+{
+    const uint8_t *pixels;
+    uint32_t size;
+    uint32_t grain_level;        /* Subtrees this small are built serially */
+    bool pruned;                 /* Serial subtrees skip constant blocks */
+    thread_pool_t *pool;
+    qtree_arena_t *arenas;       /* One per worker, [0] is the tree's own */
+    progress_tracker_t *progress;
+} parallel_build_t;
+
+/**
+ * @brief One subtree to build
+ */
+typedef struct
+{
+    const parallel_build_t *build;
+    uint32_t level;
+    uint32_t row;
+    uint32_t col;
+    qtree_node_t *result; /* NULL if we ran out of memory */
+} build_task_t;
+
+static void build_task_run(void *arg)
+{
+    build_task_t *task = arg;
+    const parallel_build_t *build = task->build;
+    const uint32_t worker = thread_pool_worker_index(build->pool);
+    qtree_arena_t *arena = &build->arenas[worker];
+    progress_local_t progress = {.shared = build->progress, .reporter = worker == 0};
+
+    if (task->level <= build->grain_level)
+    {
+        task->result = build->pruned
+                           ? build_pruned_root(arena, build->pixels, build->size, task->level,
+                                               task->row, task->col, &progress)
+                           : build_recursive(arena, build->pixels, build->size, task->level,
+                                             task->row, task->col, &progress);
+        progress_publish(&progress);
+        return;
+    }
+
+    progress_tick(&progress);
+    progress_publish(&progress);
+
+    qtree_node_t *node = create_node(arena);
+    task->result = node;
+    if (!node)
+        return;
+
+    // Three quadrants go to the pool, this thread takes the fourth
+    build_task_t children[4];
+    thread_pool_group_t group;
+    thread_pool_group_init(&group);
+
+    const uint32_t step = 1u << (task->level - 1);
+    for (int i = 0; i < 4; i++)
+    {
+        const int q = quadrant_order[i];
+        children[q] = (build_task_t){
+            .build = build,
+            .level = task->level - 1,
+            .row = task->row + ((q & 2) ? step : 0),
+            .col = task->col + (((q & 1) ^ ((q & 2) >> 1)) ? step : 0),
+            .result = NULL};
+
+        if (i < 3)
+            thread_pool_submit(build->pool, &group, build_task_run, &children[q]);
+    }
+    build_task_run(&children[quadrant_order[3]]);
+    thread_pool_wait(build->pool, &group);
+
+    bool complete = true;
+    for (int q = 0; q < 4; q++)
+    {
+        node->children[q] = children[q].result;
+        complete = complete && children[q].result;
+    }
+
+    if (!complete)
+    {
+        qtree_arena_release_subtree(arena, node);
+        task->result = NULL;
+        return;
+    }
+
+    collapse_if_uniform(arena, node);
+}
+
+/**
+ * @brief Recursive build spread over a thread pool
+ */
+static qtree_status_t build_parallel(qtree_t *tree, const uint8_t *pixels, uint32_t size,
+                                     uint32_t threads, bool pruned,
+                                     progress_tracker_t *progress)
+{
+    // The tree's own pool if it has one, else one just for the build
+    thread_pool_t *pool = tree->pool ? tree->pool : thread_pool_create(threads);
+    qtree_arena_t *arenas = calloc(threads, sizeof(qtree_arena_t));
+    if (!pool || !arenas)
+    {
+        if (pool != tree->pool)
+            thread_pool_destroy(pool);
+        free(arenas);
+        return QTREE_ERROR_MEMORY;
+    }
+
+    // The calling thread builds straight into the tree's arena
+    arenas[0] = tree->arena;
+
+    // Cut the tree where there are enough subtrees to keep everyone busy
+    uint32_t grain_level = tree->n_levels;
+    while (grain_level > PARALLEL_MIN_GRAIN_LEVEL &&
+           (tree->n_levels - grain_level) < 16 &&
+           ((uint64_t)1 << (2 * (tree->n_levels - grain_level))) <
+               (uint64_t)threads * PARALLEL_TASKS_PER_THREAD)
+    {
+        grain_level--;
+    }
+
+    const parallel_build_t build = {
+        .pixels = pixels,
+        .size = size,
+        .grain_level = grain_level,
+        .pruned = pruned,
+        .pool = pool,
+        .arenas = arenas,
+        .progress = progress};
+    build_task_t root = {.build = &build, .level = tree->n_levels, .row = 0, .col = 0};
+
+    thread_pool_seat_t seat;
+    thread_pool_enter(pool, &seat);
+    build_task_run(&root);
+    thread_pool_leave(pool, &seat);
+    if (pool != tree->pool)
+        thread_pool_destroy(pool);
+
+    tree->arena = arenas[0];
+    for (uint32_t i = 1; i < threads; i++)
+    {
+        qtree_arena_merge(&tree->arena, &arenas[i]);
+    }
+    free(arenas);
+
+    tree->root = root.result;
+    return tree->root ? QTREE_SUCCESS : QTREE_ERROR_MEMORY;
+}
+
+qtree_node_t *qtree_build_block(qtree_arena_t *arena, const uint8_t *pixels, uint32_t stride,
+                                uint32_t level, uint32_t row, uint32_t col)
+{
+    // Nobody draws a bar for a single block, the ticks just go nowhere
+    progress_tracker_t progress = {.total = 1};
+    atomic_init(&progress.processed, 0);
+    progress_local_t local = {.shared = &progress, .reporter = false};
+
+    return build_pruned_root(arena, pixels, stride, level, row, col, &local);
+}
+
+bool qtree_node_combine(qtree_node_t *node)
+{
+    return calculate_node_properties(node);
 }
 
 qtree_status_t qtree_init(qtree_t *tree, uint32_t size)
@@ -174,12 +608,37 @@ qtree_status_t qtree_init(qtree_t *tree, uint32_t size)
     tree->size = size;
     tree->n_levels = (uint32_t)(floor(log2(size)));
     tree->root = NULL;
+    qtree_arena_reset(&tree->arena);
 
     log_message(LOG_LEVEL_INFO, "Initialized quadtree structure (%ux%u)", size, size);
     return QTREE_SUCCESS;
 }
 
+/**
+ * @brief Build through the bottom-up pyramid, then link up the nodes
+ */
+static qtree_status_t build_from_pyramid(qtree_t *tree, const uint8_t *pixels, uint32_t size)
+{
+    qtree_pyramid_t pyramid;
+    qtree_status_t status = qtree_pyramid_build(&pyramid, pixels, size);
+    if (status != QTREE_SUCCESS)
+        return status;
+    log_progress_hook(0.5);
+
+    status = qtree_pyramid_to_tree(&pyramid, tree);
+    qtree_pyramid_free(&pyramid);
+    log_progress_hook(1.0);
+    return status;
+}
+
 qtree_status_t qtree_build(qtree_t *tree, const uint8_t *pixels, uint32_t size, const char *input_filename)
+{
+    return qtree_build_with(tree, pixels, size, input_filename, QTREE_BUILD_RECURSIVE, 1);
+}
+
+qtree_status_t qtree_build_with(qtree_t *tree, const uint8_t *pixels, uint32_t size,
+                                const char *input_filename, qtree_build_mode_t mode,
+                                uint32_t threads)
 {
     if (!tree || !pixels || size == 0 || size != tree->size)
     {
@@ -194,36 +653,77 @@ qtree_status_t qtree_build(qtree_t *tree, const uint8_t *pixels, uint32_t size,
     log_item("Input path", input_filename);
     log_item("Dimensions", "%ux%u pixels", size, size);
     log_item("Tree depth", "%u levels", tree->n_levels);
-    log_item("Maximum nodes", "%u nodes", calculate_total_nodes(tree->n_levels));
+    log_item("Maximum nodes", "%zu nodes", calculate_total_nodes(tree->n_levels));
 
     // Setup progress tracking
-    progress_tracker_t progress = {
-        .processed = 0,
-        .total = calculate_total_nodes(tree->n_levels)};
+    progress_tracker_t progress = {.total = calculate_total_nodes(tree->n_levels)};
+    atomic_init(&progress.processed, 0);
+
+    if (threads == 0)
+        threads = thread_pool_default_threads();
+    if (tree->pool)
+        threads = thread_pool_size(tree->pool);
 
     // Track construction time
-    clock_t start_time = clock();
+    const double start_time = wall_seconds();
 
     log_subheader("Building Tree Structure");
-    tree->root = build_recursive(pixels, size, tree->n_levels, 0, 0, &progress);
+    qtree_status_t status = QTREE_SUCCESS;
+    switch (mode)
+    {
+    case QTREE_BUILD_PYRAMID:
+        log_item("Strategy", "bottom-up pyramid (%s)", qtree_pyramid_kernel_name());
+        status = build_from_pyramid(tree, pixels, size);
+        break;
+    case QTREE_BUILD_PRUNED:
+    case QTREE_BUILD_RECURSIVE:
+    default:
+        if (threads > 1)
+        {
+            log_item("Strategy", "%s, %u threads",
+                     mode == QTREE_BUILD_PRUNED ? "pruned" : "recursive", threads);
+            status = build_parallel(tree, pixels, size, threads,
+                                    mode == QTREE_BUILD_PRUNED, &progress);
+            break;
+        }
+
+        progress_local_t local = {.shared = &progress, .reporter = true};
+        if (mode == QTREE_BUILD_PRUNED)
+        {
+            log_item("Strategy", "pruned");
+            tree->root = build_pruned_root(&tree->arena, pixels, size, tree->n_levels,
+                                           0, 0, &local);
+        }
+        else
+        {
+            tree->root = build_recursive(&tree->arena, pixels, size, tree->n_levels,
+                                         0, 0, &local);
+        }
+        progress_publish(&local);
+        if (!tree->root)
+            status = QTREE_ERROR_MEMORY;
+        break;
+    }
 
-    double cpu_time = (double)(clock() - start_time) / CLOCKS_PER_SEC;
+    const double build_time = wall_seconds() - start_time;
     log_end_progress();
 
-    if (!tree->root)
+    if (status != QTREE_SUCCESS)
     {
         log_message(LOG_LEVEL_ERROR, "Failed to build quadtree");
-        return QTREE_ERROR_MEMORY;
+        return status;
     }
 
-    // Log final statistics
+    // Every strategy visits the full tree, so the count is known up front
     log_subheader("Construction Statistics");
-    log_item("Total nodes", "%u nodes", progress.processed);
-    log_item("Processing time", "%.3f seconds", cpu_time);
+    log_item("Total nodes", "%zu nodes", progress.total);
+    log_item("Processing time", "%.3f seconds", build_time);
     log_item("Processing rate", "%.2f MNodes/s",
-                (progress.processed / cpu_time) / 1000000.0);
+                ((double)progress.total / build_time) / 1000000.0);
+    log_item("Live nodes", "%zu nodes (peak %zu)",
+                tree->arena.live_nodes, tree->arena.peak_nodes);
     log_item("Memory usage", "%.2f MB",
-                (progress.processed * sizeof(qtree_node_t)) / (1024.0 * 1024.0));
+                (double)qtree_arena_reserved_bytes(&tree->arena) / (1024.0 * 1024.0));
 
     log_separator();
     log_message(LOG_LEVEL_SUCCESS, "Quadtree construction completed successfully");
@@ -231,23 +731,20 @@ qtree_status_t qtree_build(qtree_t *tree, const uint8_t *pixels, uint32_t size,
     return QTREE_SUCCESS;
 }
 
-void free_quadtree_recursive(qtree_node_t *node)
+void qtree_free(qtree_t *tree)
 {
-    if (!node)
+    if (!tree)
         return;
-    for (int i = 0; i < 4; i++)
-    {
-        free_quadtree_recursive(node->children[i]);
-    }
-    free(node);
+    qtree_arena_destroy(&tree->arena);
+    tree->root = NULL;
 }
 
-uint32_t qtree_parent_index(uint32_t index)
+size_t qtree_parent_index(size_t index)
 {
     return (index - 1) / 4;
 }
 
-uint32_t qtree_first_child_index(uint32_t index)
+size_t qtree_first_child_index(size_t index)
 {
     return 4 * index + 1;
 }
@@ -294,60 +791,144 @@ static void calculate_node_variance(qtree_node_t *node)
 /**
  * @brief Recursively calculate variances for all nodes in the tree
  */
-static void calculate_variances_recursive(qtree_node_t *node, float *variances, size_t *count)
+static void calculate_variances_recursive(qtree_node_t *node, qtree_variance_hist_t *hist)
 {
     if (!node)
         return;
 
     for (int i = 0; i < 4; i++)
     {
-        calculate_variances_recursive(node->children[i], variances, count);
+        calculate_variances_recursive(node->children[i], hist);
     }
 
     calculate_node_variance(node);
 
-    // Store non-zero variances for statistics
+    // Only non-zero variances count towards the statistics
     if (node->v > 0.0f)
     {
-        variances[*count] = node->v;
-        (*count)++;
+        qtree_variance_hist_add(hist, node->v);
     }
 }
 
 /**
- * @brief Compare function for qsort
+ * @brief Second look at the variances just computed, for the median bin
  */
-static int compare_floats(const void *a, const void *b)
+static void refine_variances_recursive(const qtree_node_t *node, qtree_variance_hist_t *hist)
+{
+    if (!node)
+        return;
+
+    for (int i = 0; i < 4; i++)
+    {
+        refine_variances_recursive(node->children[i], hist);
+    }
+
+    if (node->v > 0.0f)
+    {
+        qtree_variance_hist_refine(hist, node->v);
+    }
+}
+
+/**
+ * @brief Per-worker tables for the parallel variance walks
+ */
+typedef struct
+{
+    qtree_variance_hist_t *hists; /* One per worker, [0] is the calling thread's */
+} variance_walk_t;
+
+static void variance_subtree(void *ctx, qtree_node_t *node, const qtree_walk_cell_t *cell,
+                             uint32_t worker, void *result)
 {
-    float fa = *(const float *)a;
-    float fb = *(const float *)b;
-    return (fa > fb) - (fa < fb);
+    (void)cell;
+    (void)result;
+    const variance_walk_t *walk = ctx;
+    calculate_variances_recursive(node, &walk->hists[worker]);
 }
 
+static void variance_leave(void *ctx, qtree_node_t *node, const qtree_walk_cell_t *cell,
+                           const void *const children[4], void *result)
+{
+    (void)cell;
+    (void)children;
+    (void)result;
+    const variance_walk_t *walk = ctx;
+    calculate_node_variance(node);
+    if (node->v > 0.0f)
+    {
+        qtree_variance_hist_add(&walk->hists[0], node->v);
+    }
+}
+
+static void refine_subtree(void *ctx, qtree_node_t *node, const qtree_walk_cell_t *cell,
+                           uint32_t worker, void *result)
+{
+    (void)cell;
+    (void)result;
+    const variance_walk_t *walk = ctx;
+    refine_variances_recursive(node, &walk->hists[worker]);
+}
+
+static void refine_leave(void *ctx, qtree_node_t *node, const qtree_walk_cell_t *cell,
+                         const void *const children[4], void *result)
+{
+    (void)cell;
+    (void)children;
+    (void)result;
+    const variance_walk_t *walk = ctx;
+    if (node->v > 0.0f)
+    {
+        qtree_variance_hist_refine(&walk->hists[0], node->v);
+    }
+}
+
+static const qtree_walk_t variance_pass = {.subtree = variance_subtree, .leave = variance_leave};
+static const qtree_walk_t refine_pass = {.subtree = refine_subtree, .leave = refine_leave};
+
 qtree_variance_stats_t calculate_variance_stats(const qtree_t *tree)
 {
     qtree_variance_stats_t stats = {0.0f, 0.0f};
     if (!tree || !tree->root)
         return stats;
 
-    // Allocate space for all possible variances
-    uint32_t max_nodes = calculate_total_nodes(tree->n_levels);
-    float *variances = malloc(max_nodes * sizeof(float));
-    if (!variances)
-        return stats;
-
-    // Calculate variances and collect non-zero ones
-    size_t count = 0;
-    calculate_variances_recursive(tree->root, variances, &count);
+    const uint32_t workers = tree->pool ? thread_pool_size(tree->pool) : 1;
+    qtree_variance_hist_t *hists = calloc(workers, sizeof(qtree_variance_hist_t));
+    bool ready = hists != NULL;
+    for (uint32_t w = 0; w < workers && ready; w++)
+    {
+        ready = qtree_variance_hist_init(&hists[w]);
+    }
 
-    if (count > 0)
+    if (ready)
     {
-        // Sort variances to find median and max
-        qsort(variances, count, sizeof(float), compare_floats);
-        stats.median_variance = variances[count / 2];
-        stats.max_variance = variances[count - 1];
+        // Variances and the coarse histogram come out of the same pass
+        variance_walk_t walk = {.hists = hists};
+        qtree_walk(&variance_pass, &walk, tree->root, tree->size, tree->pool, NULL);
+        for (uint32_t w = 1; w < workers; w++)
+        {
+            qtree_variance_hist_merge(&hists[0], &hists[w]);
+        }
+
+        if (qtree_variance_hist_select(&hists[0]))
+        {
+            for (uint32_t w = 1; w < workers; w++)
+            {
+                qtree_variance_hist_share_target(&hists[w], &hists[0]);
+            }
+            qtree_walk(&refine_pass, &walk, tree->root, tree->size, tree->pool, NULL);
+            for (uint32_t w = 1; w < workers; w++)
+            {
+                qtree_variance_hist_merge(&hists[0], &hists[w]);
+            }
+        }
+
+        stats = qtree_variance_hist_finish(&hists[0]);
     }
 
-    free(variances);
+    for (uint32_t w = 0; hists && w < workers; w++)
+    {
+        qtree_variance_hist_free(&hists[w]);
+    }
+    free(hists);
     return stats;
-}
\ No newline at end of file
+}
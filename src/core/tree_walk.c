@@ -0,0 +1,196 @@
+/**
+ * @file tree_walk.c
+ * @brief Split tree walks: a serial top, parallel subtrees, a serial merge
+ *
+ * The nodes above the split are laid out in pre-order in one array, so
+ * every child comes after its parent and going through the array
+ * backwards visits children before parents. The results sit in a second
+ * array with the same numbering.
+ */
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "core/tree_walk.h"
+
+/* Deepest split allowed; 4^8 tasks is already far more than any pool needs */
+#define WALK_MAX_SPLIT 8u
+
+/* Marks a missing child */
+#define WALK_NO_ITEM SIZE_MAX
+
+struct walk_run;
+
+/**
+ * @brief One node above or on the split
+ */
+typedef struct
+{
+    const struct walk_run *run;
+    qtree_node_t *node;
+    qtree_walk_cell_t cell;
+    size_t children[4]; /* Items of the children (WALK_NO_ITEM if none) */
+    bool task;          /* Handed to subtree() as a whole */
+} walk_item_t;
+
+/**
+ * @brief Everything one call of qtree_walk() keeps
+ */
+typedef struct walk_run
+{
+    const qtree_walk_t *walk;
+    void *ctx;
+    thread_pool_t *pool;
+    uint32_t split_level;
+    walk_item_t *items;
+    size_t n_items;
+    uint8_t *results; /* n_items results, NULL if the pass has none */
+} walk_run_t;
+
+/**
+ * @brief Depth to cut the tree at, 0 for not at all
+ */
+static uint32_t pick_split(const qtree_walk_t *walk, uint32_t size, const thread_pool_t *pool)
+{
+    uint32_t n_levels = 0;
+    while (n_levels < 31 && (1u << n_levels) < size)
+        n_levels++;
+
+    uint32_t deepest = n_levels > QTREE_WALK_MIN_GRAIN_LEVEL ? n_levels - QTREE_WALK_MIN_GRAIN_LEVEL
+                                                              : 0;
+    if (deepest > WALK_MAX_SPLIT)
+        deepest = WALK_MAX_SPLIT;
+
+    const uint32_t threads = thread_pool_size(pool);
+    if (threads <= 1)
+        return 0;
+    if (walk->split_level > 0)
+        return walk->split_level < deepest ? walk->split_level : deepest;
+
+    uint32_t split = 0;
+    while (split < deepest &&
+           ((uint64_t)1 << (2 * split)) < (uint64_t)threads * QTREE_WALK_TASKS_PER_THREAD)
+    {
+        split++;
+    }
+    return split;
+}
+
+static size_t count_items(const qtree_node_t *node, uint32_t level, uint32_t split_level)
+{
+    size_t count = 1;
+    if (level < split_level && !qtree_is_leaf(node))
+    {
+        for (int q = 0; q < 4; q++)
+        {
+            if (node->children[q])
+                count += count_items(node->children[q], level + 1, split_level);
+        }
+    }
+    return count;
+}
+
+/**
+ * @brief Lays out the top of the tree, calling enter on the way down
+ * @return Item of node
+ */
+static size_t collect_items(walk_run_t *run, qtree_node_t *node, const qtree_walk_cell_t *cell)
+{
+    const size_t index = run->n_items++;
+    walk_item_t *item = &run->items[index];
+    *item = (walk_item_t){
+        .run = run,
+        .node = node,
+        .cell = *cell,
+        .task = cell->level == run->split_level || qtree_is_leaf(node)};
+    if (item->task)
+        return index;
+
+    if (run->walk->enter)
+        run->walk->enter(run->ctx, node, cell);
+
+    for (uint32_t q = 0; q < 4; q++)
+    {
+        const qtree_walk_cell_t child = qtree_walk_child_cell(cell, q);
+        item->children[q] = node->children[q] ? collect_items(run, node->children[q], &child)
+                                              : WALK_NO_ITEM;
+    }
+    return index;
+}
+
+static void *result_at(const walk_run_t *run, size_t index)
+{
+    return run->results ? run->results + index * run->walk->result_size : NULL;
+}
+
+static void run_item(void *arg)
+{
+    const walk_item_t *item = arg;
+    const walk_run_t *run = item->run;
+    run->walk->subtree(run->ctx, item->node, &item->cell, thread_pool_worker_index(run->pool),
+                       result_at(run, (size_t)(item - run->items)));
+}
+
+void qtree_walk(const qtree_walk_t *walk, void *ctx, qtree_node_t *root, uint32_t size,
+                thread_pool_t *pool, void *result)
+{
+    const qtree_walk_cell_t top = {.size = size};
+    walk_run_t run = {
+        .walk = walk,
+        .ctx = ctx,
+        .pool = pool,
+        .split_level = pool ? pick_split(walk, size, pool) : 0};
+
+    if (run.split_level > 0)
+    {
+        const size_t n_items = count_items(root, 0, run.split_level);
+        run.items = malloc(n_items * sizeof(walk_item_t));
+        if (walk->result_size > 0)
+            run.results = malloc(n_items * walk->result_size);
+    }
+
+    if (!run.items || (walk->result_size > 0 && !run.results))
+    {
+        free(run.items);
+        free(run.results);
+        walk->subtree(ctx, root, &top, 0, result);
+        return;
+    }
+
+    collect_items(&run, root, &top);
+
+    thread_pool_seat_t seat;
+    thread_pool_enter(pool, &seat);
+    thread_pool_group_t group;
+    thread_pool_group_init(&group);
+    for (size_t i = 0; i < run.n_items; i++)
+    {
+        if (run.items[i].task)
+            thread_pool_submit(pool, &group, run_item, &run.items[i]);
+    }
+    thread_pool_wait(pool, &group);
+    thread_pool_leave(pool, &seat);
+
+    // Children come after their parent, so backwards is post-order
+    for (size_t i = run.n_items; i-- > 0;)
+    {
+        const walk_item_t *item = &run.items[i];
+        if (item->task)
+            continue;
+
+        const void *children[4];
+        for (int q = 0; q < 4; q++)
+        {
+            children[q] = item->children[q] == WALK_NO_ITEM ? NULL
+                                                            : result_at(&run, item->children[q]);
+        }
+        walk->leave(ctx, item->node, &item->cell, children, result_at(&run, i));
+    }
+
+    if (result && run.results)
+        memcpy(result, run.results, walk->result_size);
+
+    free(run.items);
+    free(run.results);
+}
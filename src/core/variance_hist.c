@@ -0,0 +1,89 @@
+/**
+ * @file variance_hist.c
+ * @brief Two-pass histogram selection of the variance median
+ */
+
+#include <stdlib.h>
+
+#include "core/variance_hist.h"
+
+bool qtree_variance_hist_init(qtree_variance_hist_t *hist)
+{
+    *hist = (qtree_variance_hist_t){0};
+    hist->bins = calloc(VARIANCE_HIST_BINS, sizeof(size_t));
+    return hist->bins != NULL;
+}
+
+void qtree_variance_hist_free(qtree_variance_hist_t *hist)
+{
+    free(hist->bins);
+    hist->bins = NULL;
+}
+
+/**
+ * @brief First bin where the running count passes rank
+ * @param rank 0-based rank to look for
+ * @param before Set to how many samples come before that bin
+ */
+static uint32_t find_bin(const size_t *bins, size_t rank, size_t *before)
+{
+    size_t seen = 0;
+    uint32_t bin = 0;
+    while (bin < VARIANCE_HIST_BINS - 1 && seen + bins[bin] <= rank)
+    {
+        seen += bins[bin];
+        bin++;
+    }
+    *before = seen;
+    return bin;
+}
+
+bool qtree_variance_hist_select(qtree_variance_hist_t *hist)
+{
+    if (hist->count == 0)
+        return false;
+
+    // Same rank the sorted version used: samples[count / 2]
+    size_t before = 0;
+    hist->target = find_bin(hist->bins, hist->count / 2, &before);
+    hist->rank_in_bin = hist->count / 2 - before;
+
+    memset(hist->bins, 0, VARIANCE_HIST_BINS * sizeof(size_t));
+    return true;
+}
+
+void qtree_variance_hist_merge(qtree_variance_hist_t *hist, const qtree_variance_hist_t *other)
+{
+    for (size_t bin = 0; bin < VARIANCE_HIST_BINS; bin++)
+    {
+        hist->bins[bin] += other->bins[bin];
+    }
+    hist->count += other->count;
+    if (other->max > hist->max)
+        hist->max = other->max;
+}
+
+void qtree_variance_hist_share_target(qtree_variance_hist_t *table,
+                                      const qtree_variance_hist_t *hist)
+{
+    memset(table->bins, 0, VARIANCE_HIST_BINS * sizeof(size_t));
+    table->count = 0;
+    table->max = 0.0f;
+    table->target = hist->target;
+    table->rank_in_bin = hist->rank_in_bin;
+}
+
+qtree_variance_stats_t qtree_variance_hist_finish(const qtree_variance_hist_t *hist)
+{
+    qtree_variance_stats_t stats = {0.0f, 0.0f};
+    if (hist->count == 0)
+        return stats;
+
+    size_t before = 0;
+    const uint32_t low = find_bin(hist->bins, hist->rank_in_bin, &before);
+    const uint32_t bits = (hist->target << 16) | low;
+
+    memcpy(&stats.median_variance, &bits, sizeof(bits));
+    stats.max_variance = hist->max;
+    return stats;
+}
@@ -7,6 +7,7 @@
 #include <string.h>
 #include "grid/segmentation_grid.h"
 #include "common/common.h"
+#include "core/tree_walk.h"
 
 #define GRID_LINE_THICKNESS 1
 #define GRID_COLOR 128 // Mid-gray
@@ -49,6 +50,20 @@ static void draw_vertical_line(uint8_t *pixels, const size_t size,
     }
 }
 
+/**
+ * @brief Draw the two lines splitting a node into its quadrants
+ */
+static void draw_node_cross(uint8_t *pixels, const size_t size,
+                            const size_t x, const size_t y,
+                            const size_t node_size)
+{
+    size_t half_size = node_size / 2;
+
+    draw_horizontal_line(pixels, size, x, y + half_size, node_size);
+
+    draw_vertical_line(pixels, size, x + half_size, y, node_size);
+}
+
 /**
  * @brief Recursively draw grid lines for a node
  */
@@ -66,9 +81,7 @@ static void draw_node_grid(uint8_t *pixels, const size_t size,
     {
         size_t half_size = node_size / 2;
 
-        draw_horizontal_line(pixels, size, x, y + half_size, node_size);
-
-        draw_vertical_line(pixels, size, x + half_size, y, node_size);
+        draw_node_cross(pixels, size, x, y, node_size);
 
         if (node->children[QUADRANT_TOP_LEFT])
         {
@@ -93,6 +106,111 @@ static void draw_node_grid(uint8_t *pixels, const size_t size,
     }
 }
 
+typedef struct
+{
+    uint8_t *pixels;
+    size_t size;
+} grid_walk_t;
+
+static void grid_subtree(void *ctx, qtree_node_t *node, const qtree_walk_cell_t *cell,
+                         uint32_t worker, void *result)
+{
+    (void)worker;
+    (void)result;
+    const grid_walk_t *walk = ctx;
+    draw_node_grid(walk->pixels, walk->size, node, cell->col, cell->row, cell->size);
+}
+
+static void grid_leave(void *ctx, qtree_node_t *node, const qtree_walk_cell_t *cell,
+                       const void *const children[4], void *result)
+{
+    (void)node;
+    (void)children;
+    (void)result;
+    const grid_walk_t *walk = ctx;
+    draw_node_cross(walk->pixels, walk->size, cell->col, cell->row, cell->size);
+}
+
+static const qtree_walk_t grid_pass = {.subtree = grid_subtree, .leave = grid_leave};
+
+/**
+ * @brief Recursively draw grid lines for a node of an array tree
+ */
+static void draw_array_node_grid(uint8_t *pixels, const size_t size,
+                                 const qtree_array_t *tree, const size_t index,
+                                 const size_t x, const size_t y,
+                                 const size_t node_size)
+{
+    if (node_size <= 1 || tree->u[index])
+    {
+        return;
+    }
+
+    size_t half_size = node_size / 2;
+    size_t child = qtree_first_child_index(index);
+
+    draw_horizontal_line(pixels, size, x, y + half_size, node_size);
+    draw_vertical_line(pixels, size, x + half_size, y, node_size);
+
+    draw_array_node_grid(pixels, size, tree, child + QUADRANT_TOP_LEFT,
+                         x, y, half_size);
+    draw_array_node_grid(pixels, size, tree, child + QUADRANT_TOP_RIGHT,
+                         x + half_size, y, half_size);
+    draw_array_node_grid(pixels, size, tree, child + QUADRANT_BOTTOM_LEFT,
+                         x, y + half_size, half_size);
+    draw_array_node_grid(pixels, size, tree, child + QUADRANT_BOTTOM_RIGHT,
+                         x + half_size, y + half_size, half_size);
+}
+
+/**
+ * @brief Recursively draw grid lines for a node of a succinct tree
+ */
+static void draw_succinct_node_grid(uint8_t *pixels, const size_t size,
+                                    const qtree_succinct_t *tree, const size_t index,
+                                    const size_t x, const size_t y,
+                                    const size_t node_size)
+{
+    if (node_size <= 1 || !qtree_succinct_has_children(tree, index))
+    {
+        return;
+    }
+
+    size_t half_size = node_size / 2;
+    size_t child = qtree_succinct_first_child(tree, index);
+
+    draw_horizontal_line(pixels, size, x, y + half_size, node_size);
+    draw_vertical_line(pixels, size, x + half_size, y, node_size);
+
+    draw_succinct_node_grid(pixels, size, tree, child + QUADRANT_TOP_LEFT,
+                            x, y, half_size);
+    draw_succinct_node_grid(pixels, size, tree, child + QUADRANT_TOP_RIGHT,
+                            x + half_size, y, half_size);
+    draw_succinct_node_grid(pixels, size, tree, child + QUADRANT_BOTTOM_LEFT,
+                            x, y + half_size, half_size);
+    draw_succinct_node_grid(pixels, size, tree, child + QUADRANT_BOTTOM_RIGHT,
+                            x + half_size, y + half_size, half_size);
+}
+
+/**
+ * @brief Draw the outer border and save the grid image
+ */
+static qtree_status_t finish_grid(pgm_t *grid_pgm, const char *output_file)
+{
+    const size_t size = grid_pgm->size;
+
+    // Draw outer border
+    draw_horizontal_line(grid_pgm->pixels, size, 0, 0, size);
+    draw_horizontal_line(grid_pgm->pixels, size, 0, size - 1, size);
+    draw_vertical_line(grid_pgm->pixels, size, 0, 0, size);
+    draw_vertical_line(grid_pgm->pixels, size, size - 1, 0, size);
+
+    // Write PGM file
+    pgm_status_t status = pgm_write(grid_pgm, output_file);
+    free(grid_pgm->pixels);
+
+    return (status == PGM_SUCCESS) ? QTREE_SUCCESS : QTREE_ERROR_FORMAT;
+}
+
 qtree_status_t qtree_generate_grid(const qtree_t *tree, const char *output_file)
 {
     if (!tree || !tree->root || !output_file)
@@ -104,26 +222,62 @@ qtree_status_t qtree_generate_grid(const qtree_t *tree, const char *output_file)
     pgm_t grid_pgm;
     grid_pgm.size = tree->size;
     grid_pgm.max_value = 255;
-    grid_pgm.pixels = calloc(tree->size * tree->size, sizeof(uint8_t));
+    grid_pgm.pixels = calloc((size_t)tree->size * tree->size, sizeof(uint8_t));
 
     if (!grid_pgm.pixels)
     {
         return QTREE_ERROR_MEMORY;
     }
 
-    // Draw grid lines recursively
-    draw_node_grid(grid_pgm.pixels, tree->size, tree->root,
-                   0, 0, tree->size);
+    // Draw grid lines recursively, subtrees spread over the pool if there is one
+    grid_walk_t walk = {.pixels = grid_pgm.pixels, .size = tree->size};
+    qtree_walk(&grid_pass, &walk, tree->root, tree->size, tree->pool, NULL);
 
-    // Draw outer border
-    draw_horizontal_line(grid_pgm.pixels, tree->size, 0, 0, tree->size);
-    draw_horizontal_line(grid_pgm.pixels, tree->size, 0, tree->size - 1, tree->size);
-    draw_vertical_line(grid_pgm.pixels, tree->size, 0, 0, tree->size);
-    draw_vertical_line(grid_pgm.pixels, tree->size, tree->size - 1, 0, tree->size);
+    return finish_grid(&grid_pgm, output_file);
+}
 
-    // Write PGM file
-    pgm_status_t status = pgm_write(&grid_pgm, output_file);
-    free(grid_pgm.pixels);
+qtree_status_t qtree_array_generate_grid(const qtree_array_t *tree, const char *output_file)
+{
+    if (!tree || !tree->m || !output_file)
+    {
+        return QTREE_ERROR_INVALID_PARAM;
+    }
 
-    return (status == PGM_SUCCESS) ? QTREE_SUCCESS : QTREE_ERROR_FORMAT;
+    pgm_t grid_pgm;
+    grid_pgm.size = tree->size;
+    grid_pgm.max_value = 255;
+    grid_pgm.pixels = calloc((size_t)tree->size * tree->size, sizeof(uint8_t));
+
+    if (!grid_pgm.pixels)
+    {
+        return QTREE_ERROR_MEMORY;
+    }
+
+    draw_array_node_grid(grid_pgm.pixels, tree->size, tree, 0,
+                         0, 0, tree->size);
+
+    return finish_grid(&grid_pgm, output_file);
+}
+
+qtree_status_t qtree_succinct_generate_grid(const qtree_succinct_t *tree, const char *output_file)
+{
+    if (!tree || !tree->rank || !output_file)
+    {
+        return QTREE_ERROR_INVALID_PARAM;
+    }
+
+    pgm_t grid_pgm;
+    grid_pgm.size = tree->size;
+    grid_pgm.max_value = 255;
+    grid_pgm.pixels = calloc((size_t)tree->size * tree->size, sizeof(uint8_t));
+
+    if (!grid_pgm.pixels)
+    {
+        return QTREE_ERROR_MEMORY;
+    }
+
+    draw_succinct_node_grid(grid_pgm.pixels, tree->size, tree, 0,
+                            0, 0, tree->size);
+
+    return finish_grid(&grid_pgm, output_file);
 }
\ No newline at end of file
@@ -0,0 +1,315 @@
+/**
+ * @file async_io.c
+ * @brief Read-ahead and write-behind threads over a ring of blocks
+ *
+ * The ring is guarded by one mutex and one condition; each side
+ * broadcasts whenever it hands a block over. Blocks are 1 MB, so a lock
+ * round-trip per block is nothing next to the I/O behind it. The actual
+ * fread/fwrite always happens with the lock dropped.
+ */
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "io/async_io.h"
+
+typedef struct
+{
+    uint8_t *data;
+    size_t length;
+} io_block_t;
+
+struct async_reader
+{
+    FILE *file;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    io_block_t blocks[ASYNC_IO_BLOCKS];
+    size_t head;   /* Oldest block not given back yet */
+    size_t filled; /* Blocks read and not handed out */
+    bool in_use;   /* The codec holds blocks[head] */
+    bool done;     /* End of file or a failed read */
+    bool failed;   /* A read failed */
+    bool stop;     /* Asked to quit */
+};
+
+struct async_writer
+{
+    FILE *file;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    io_block_t blocks[ASYNC_IO_BLOCKS];
+    size_t head;   /* Oldest block waiting to be written */
+    size_t queued; /* Blocks handed to the thread */
+    size_t fill;   /* Bytes in the block being filled, blocks[head + queued] */
+    bool failed;   /* A write failed */
+    bool stop;     /* Nothing more is coming */
+};
+
+static bool alloc_blocks(io_block_t *blocks)
+{
+    for (size_t i = 0; i < ASYNC_IO_BLOCKS; i++)
+    {
+        blocks[i].data = malloc(ASYNC_IO_BLOCK_SIZE);
+        if (!blocks[i].data)
+            return false;
+    }
+    return true;
+}
+
+static void free_blocks(io_block_t *blocks)
+{
+    for (size_t i = 0; i < ASYNC_IO_BLOCKS; i++)
+    {
+        free(blocks[i].data);
+        blocks[i].data = NULL;
+    }
+}
+
+static void *reader_thread(void *arg)
+{
+    async_reader_t *reader = arg;
+
+    pthread_mutex_lock(&reader->lock);
+    for (;;)
+    {
+        while (!reader->stop && (size_t)reader->in_use + reader->filled == ASYNC_IO_BLOCKS)
+        {
+            pthread_cond_wait(&reader->changed, &reader->lock);
+        }
+        if (reader->stop)
+            break;
+
+        io_block_t *block = &reader->blocks[(reader->head + reader->in_use + reader->filled) %
+                                            ASYNC_IO_BLOCKS];
+        pthread_mutex_unlock(&reader->lock);
+
+        const size_t got = fread(block->data, 1, ASYNC_IO_BLOCK_SIZE, reader->file);
+        const bool failed = got < ASYNC_IO_BLOCK_SIZE && ferror(reader->file);
+
+        pthread_mutex_lock(&reader->lock);
+        if (got > 0)
+        {
+            block->length = got;
+            reader->filled++;
+        }
+        if (got < ASYNC_IO_BLOCK_SIZE)
+        {
+            reader->done = true;
+            reader->failed = failed;
+        }
+        pthread_cond_broadcast(&reader->changed);
+        if (reader->done)
+            break;
+    }
+    pthread_mutex_unlock(&reader->lock);
+    return NULL;
+}
+
+async_reader_t *async_reader_start(FILE *file)
+{
+    async_reader_t *reader = calloc(1, sizeof(*reader));
+    if (!reader)
+        return NULL;
+
+    reader->file = file;
+    if (!alloc_blocks(reader->blocks))
+    {
+        free_blocks(reader->blocks);
+        free(reader);
+        return NULL;
+    }
+
+    pthread_mutex_init(&reader->lock, NULL);
+    pthread_cond_init(&reader->changed, NULL);
+    if (pthread_create(&reader->thread, NULL, reader_thread, reader) != 0)
+    {
+        pthread_cond_destroy(&reader->changed);
+        pthread_mutex_destroy(&reader->lock);
+        free_blocks(reader->blocks);
+        free(reader);
+        return NULL;
+    }
+    return reader;
+}
+
+size_t async_reader_next(async_reader_t *reader, const uint8_t **data)
+{
+    pthread_mutex_lock(&reader->lock);
+    if (reader->in_use)
+    {
+        reader->head = (reader->head + 1) % ASYNC_IO_BLOCKS;
+        reader->in_use = false;
+        pthread_cond_broadcast(&reader->changed);
+    }
+
+    while (reader->filled == 0 && !reader->done)
+    {
+        pthread_cond_wait(&reader->changed, &reader->lock);
+    }
+
+    size_t length = 0;
+    if (reader->filled > 0)
+    {
+        *data = reader->blocks[reader->head].data;
+        length = reader->blocks[reader->head].length;
+        reader->filled--;
+        reader->in_use = true;
+    }
+    pthread_mutex_unlock(&reader->lock);
+    return length;
+}
+
+bool async_reader_failed(async_reader_t *reader)
+{
+    pthread_mutex_lock(&reader->lock);
+    const bool failed = reader->failed;
+    pthread_mutex_unlock(&reader->lock);
+    return failed;
+}
+
+void async_reader_stop(async_reader_t *reader)
+{
+    if (!reader)
+        return;
+
+    pthread_mutex_lock(&reader->lock);
+    reader->stop = true;
+    pthread_cond_broadcast(&reader->changed);
+    pthread_mutex_unlock(&reader->lock);
+
+    pthread_join(reader->thread, NULL);
+    pthread_cond_destroy(&reader->changed);
+    pthread_mutex_destroy(&reader->lock);
+    free_blocks(reader->blocks);
+    free(reader);
+}
+
+static void *writer_thread(void *arg)
+{
+    async_writer_t *writer = arg;
+
+    pthread_mutex_lock(&writer->lock);
+    for (;;)
+    {
+        while (writer->queued == 0 && !writer->stop)
+        {
+            pthread_cond_wait(&writer->changed, &writer->lock);
+        }
+        if (writer->queued == 0)
+            break;
+
+        const io_block_t *block = &writer->blocks[writer->head];
+        pthread_mutex_unlock(&writer->lock);
+
+        const bool written = fwrite(block->data, 1, block->length, writer->file) ==
+                             block->length;
+
+        pthread_mutex_lock(&writer->lock);
+        writer->failed = writer->failed || !written;
+        writer->head = (writer->head + 1) % ASYNC_IO_BLOCKS;
+        writer->queued--;
+        pthread_cond_broadcast(&writer->changed);
+    }
+    pthread_mutex_unlock(&writer->lock);
+    return NULL;
+}
+
+async_writer_t *async_writer_start(FILE *file)
+{
+    async_writer_t *writer = calloc(1, sizeof(*writer));
+    if (!writer)
+        return NULL;
+
+    writer->file = file;
+    if (!alloc_blocks(writer->blocks))
+    {
+        free_blocks(writer->blocks);
+        free(writer);
+        return NULL;
+    }
+
+    pthread_mutex_init(&writer->lock, NULL);
+    pthread_cond_init(&writer->changed, NULL);
+    if (pthread_create(&writer->thread, NULL, writer_thread, writer) != 0)
+    {
+        pthread_cond_destroy(&writer->changed);
+        pthread_mutex_destroy(&writer->lock);
+        free_blocks(writer->blocks);
+        free(writer);
+        return NULL;
+    }
+    return writer;
+}
+
+/**
+ * @brief Hands the block being filled to the thread and waits for a free one
+ */
+static bool submit_block(async_writer_t *writer)
+{
+    pthread_mutex_lock(&writer->lock);
+    writer->blocks[(writer->head + writer->queued) % ASYNC_IO_BLOCKS].length = writer->fill;
+    writer->queued++;
+    pthread_cond_broadcast(&writer->changed);
+
+    while (writer->queued == ASYNC_IO_BLOCKS)
+    {
+        pthread_cond_wait(&writer->changed, &writer->lock);
+    }
+    const bool ok = !writer->failed;
+    pthread_mutex_unlock(&writer->lock);
+
+    writer->fill = 0;
+    return ok;
+}
+
+bool async_writer_write(async_writer_t *writer, const void *data, size_t length)
+{
+    const uint8_t *bytes = data;
+    while (length > 0)
+    {
+        // Only this thread moves queued up, so the slot can't change under us
+        pthread_mutex_lock(&writer->lock);
+        uint8_t *block = writer->blocks[(writer->head + writer->queued) % ASYNC_IO_BLOCKS].data;
+        const bool failed = writer->failed;
+        pthread_mutex_unlock(&writer->lock);
+        if (failed)
+            return false;
+
+        const size_t room = ASYNC_IO_BLOCK_SIZE - writer->fill;
+        const size_t chunk = length < room ? length : room;
+        memcpy(block + writer->fill, bytes, chunk);
+        writer->fill += chunk;
+        bytes += chunk;
+        length -= chunk;
+
+        if (writer->fill == ASYNC_IO_BLOCK_SIZE && !submit_block(writer))
+            return false;
+    }
+    return true;
+}
+
+bool async_writer_finish(async_writer_t *writer)
+{
+    if (!writer)
+        return false;
+
+    if (writer->fill > 0)
+        submit_block(writer);
+
+    pthread_mutex_lock(&writer->lock);
+    writer->stop = true;
+    pthread_cond_broadcast(&writer->changed);
+    pthread_mutex_unlock(&writer->lock);
+
+    pthread_join(writer->thread, NULL);
+    const bool ok = !writer->failed;
+    pthread_cond_destroy(&writer->changed);
+    pthread_mutex_destroy(&writer->lock);
+    free_blocks(writer->blocks);
+    free(writer);
+    return ok;
+}
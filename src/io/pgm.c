@@ -6,6 +6,12 @@
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
 
 #include "io/pgm.h"
 #include "common/common.h"
@@ -114,6 +120,62 @@ static pgm_status_t read_header(FILE *file, pgm_t *pgm)
     return PGM_SUCCESS;
 }
 
+/**
+ * @brief Try to map the whole file and point the pixels into it
+ *
+ * The header is parsed through fmemopen() on the mapping so it goes
+ * through the exact same read_header() as the stdio path.
+ *
+ * @return PGM_SUCCESS, PGM_ERROR_FILE if this file can't be mapped (the
+ *         caller falls back to reading), or a real format error
+ */
+static pgm_status_t map_file(FILE *file, pgm_t *pgm)
+{
+    struct stat info;
+    if (fstat(fileno(file), &info) != 0 || !S_ISREG(info.st_mode) || info.st_size <= 0)
+    {
+        return PGM_ERROR_FILE;
+    }
+
+    const size_t length = (size_t)info.st_size;
+    void *base = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE, fileno(file), 0);
+    if (base == MAP_FAILED)
+    {
+        return PGM_ERROR_FILE;
+    }
+
+    FILE *header = fmemopen(base, length, "rb");
+    if (!header)
+    {
+        munmap(base, length);
+        return PGM_ERROR_FILE;
+    }
+
+    pgm_status_t status = read_header(header, pgm);
+    const long offset = ftell(header);
+    fclose(header);
+
+    const size_t pixel_count = (size_t)pgm->size * pgm->size;
+    if (status == PGM_SUCCESS && (offset < 0 || length - (size_t)offset < pixel_count))
+    {
+        status = PGM_ERROR_FORMAT;
+    }
+    if (status != PGM_SUCCESS)
+    {
+        munmap(base, length);
+        return status;
+    }
+
+    // The tree build reads all of it right away
+    madvise(base, length, MADV_WILLNEED);
+
+    pgm->pixels = (uint8_t *)base + offset;
+    pgm->mapped = true;
+    pgm->map_base = base;
+    pgm->map_length = length;
+    return PGM_SUCCESS;
+}
+
 pgm_status_t pgm_read(const char *path, pgm_t *pgm)
 {
     if (!path || !pgm)
@@ -130,8 +192,20 @@ pgm_status_t pgm_read(const char *path, pgm_t *pgm)
     // Initialize structure
     memset(pgm, 0, sizeof(pgm_t));
 
+    // Regular files are used in place
+    pgm_status_t status = map_file(file, pgm);
+    if (status != PGM_ERROR_FILE)
+    {
+        fclose(file);
+        return status;
+    }
+
+    // Pipes and the like: read and copy
+    memset(pgm, 0, sizeof(pgm_t));
+    rewind(file);
+
     // Read and validate header
-    pgm_status_t status = read_header(file, pgm);
+    status = read_header(file, pgm);
     if (status != PGM_SUCCESS)
     {
         fclose(file);
@@ -159,6 +233,64 @@ pgm_status_t pgm_read(const char *path, pgm_t *pgm)
     return PGM_SUCCESS;
 }
 
+pgm_status_t pgm_open_rows(const char *path, pgm_rows_t *rows)
+{
+    if (!path || !rows)
+    {
+        return PGM_ERROR_PARAM;
+    }
+
+    memset(rows, 0, sizeof(pgm_rows_t));
+    FILE *file = fopen(path, "rb");
+    if (!file)
+    {
+        return PGM_ERROR_FILE;
+    }
+
+    // Reuse the whole-image header parser, then keep the position
+    pgm_t header = {0};
+    const pgm_status_t status = read_header(file, &header);
+    if (status != PGM_SUCCESS)
+    {
+        fclose(file);
+        return status;
+    }
+
+    // Every row gets read once, front to back
+    posix_fadvise(fileno(file), 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    rows->file = file;
+    rows->size = header.size;
+    rows->max_value = header.max_value;
+    return PGM_SUCCESS;
+}
+
+pgm_status_t pgm_read_rows(pgm_rows_t *rows, uint8_t *pixels, uint32_t count)
+{
+    if (!rows || !rows->file || !pixels || count > rows->size - rows->next_row)
+    {
+        return PGM_ERROR_PARAM;
+    }
+
+    const size_t length = (size_t)count * rows->size;
+    if (fread(pixels, 1, length, rows->file) != length)
+    {
+        return PGM_ERROR_FORMAT;
+    }
+
+    rows->next_row += count;
+    return PGM_SUCCESS;
+}
+
+void pgm_close_rows(pgm_rows_t *rows)
+{
+    if (rows && rows->file)
+    {
+        fclose(rows->file);
+        rows->file = NULL;
+    }
+}
+
 pgm_status_t pgm_write(const pgm_t *pgm, const char *path)
 {
     if (!pgm || !pgm->pixels || !path)
@@ -166,29 +298,57 @@ pgm_status_t pgm_write(const pgm_t *pgm, const char *path)
         return PGM_ERROR_FORMAT;
     }
 
+    char header[64];
+    const int header_length = snprintf(header, sizeof(header), "%s\n%u %u\n%u\n",
+                                       MAGIC_NUMBER, pgm->size, pgm->size, pgm->max_value);
+    if (header_length < 0 || (size_t)header_length >= sizeof(header))
+    {
+        return PGM_ERROR_FORMAT;
+    }
+
     FILE *file = fopen(path, "wb");
     if (!file)
     {
         return PGM_ERROR_FILE;
     }
 
-    // Write header
-    if (fprintf(file, "%s\n%u %u\n%u\n",
-                MAGIC_NUMBER, pgm->size, pgm->size, pgm->max_value) < 0)
+    // Header and pixels go out together, straight from our buffers
+    struct iovec parts[2] = {
+        {.iov_base = header, .iov_len = (size_t)header_length},
+        {.iov_base = pgm->pixels, .iov_len = (size_t)pgm->size * pgm->size}};
+    struct iovec *next = parts;
+    int left = 2;
+
+    while (left > 0)
     {
-        fclose(file);
-        return PGM_ERROR_FILE;
+        const ssize_t written = writev(fileno(file), next, left);
+        if (written < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            fclose(file);
+            return PGM_ERROR_FILE;
+        }
+
+        // Skip whatever made it out, only a partial write loops
+        size_t done = (size_t)written;
+        while (left > 0 && done >= next->iov_len)
+        {
+            done -= next->iov_len;
+            next++;
+            left--;
+        }
+        if (left > 0)
+        {
+            next->iov_base = (uint8_t *)next->iov_base + done;
+            next->iov_len -= done;
+        }
     }
 
-    // Write pixel data
-    size_t pixel_count = (size_t)pgm->size * pgm->size;
-    if (fwrite(pgm->pixels, 1, pixel_count, file) != pixel_count)
+    if (fclose(file) != 0)
     {
-        fclose(file);
         return PGM_ERROR_FILE;
     }
-
-    fclose(file);
     return PGM_SUCCESS;
 }
 
@@ -196,9 +356,15 @@ void pgm_free(pgm_t *pgm)
 {
     if (pgm)
     {
-        free(pgm->pixels);
+        if (pgm->mapped)
+            munmap(pgm->map_base, pgm->map_length);
+        else
+            free(pgm->pixels);
         pgm->pixels = NULL;
         pgm->size = 0;
         pgm->max_value = 0;
+        pgm->mapped = false;
+        pgm->map_base = NULL;
+        pgm->map_length = 0;
     }
 }
\ No newline at end of file
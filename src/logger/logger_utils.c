@@ -14,12 +14,14 @@
 LoggerState g_state = {
     .config = {
         .enabled = true,
+        .quiet = false,
         .use_colors = true,
         .show_timestamp = true
     },
     .output_stream = NULL,
     .is_progress_active = false,
-    .is_initialized = false
+    .is_initialized = false,
+    .last_progress_time = 0.0
 };
 
 static const struct TerminalSymbols s_symbols = {
@@ -75,6 +77,9 @@ static const struct LayoutConfig s_layout = {
     .label_width = 20
 };
 
+/* Set by threads that must stay quiet, like batch workers */
+static _Thread_local bool s_thread_muted = false;
+
 /* Public constant references */
 const struct TerminalSymbols *const SYMBOLS = &s_symbols;
 const struct ColorConfig *const COLORS = &s_colors;
@@ -94,9 +99,20 @@ void safe_vfprintf(FILE *out, const char *format, va_list args)
 #endif
 }
 
+bool output_enabled(void)
+{
+    return !s_thread_muted && g_state.config.enabled;
+}
+
+bool chatter_enabled(void)
+{
+    return output_enabled() && !g_state.config.quiet;
+}
+
 void ensure_initialized(void)
 {
-    if (g_state.is_initialized)
+    // Muted threads never touch the shared state, so they need no lock
+    if (s_thread_muted || g_state.is_initialized)
         return;
     g_state.output_stream = stdout;
 #ifdef _WIN32
@@ -160,10 +176,22 @@ void logger_configure(logger_config_t config)
     g_state.config = config;
 }
 
+void logger_mute_thread(bool muted)
+{
+    s_thread_muted = muted;
+}
+
+bool logger_thread_muted(void)
+{
+    return s_thread_muted;
+}
+
 void log_message(log_level_t level, const char *format, ...)
 {
     ensure_initialized();
-    if (!g_state.config.enabled)
+    if (!output_enabled())
+        return;
+    if (g_state.config.quiet && (level == LOG_LEVEL_INFO || level == LOG_LEVEL_SUCCESS))
         return;
 
     FILE *out = g_state.output_stream;
@@ -188,53 +216,82 @@ void log_message(log_level_t level, const char *format, ...)
     fprintf(out, "%s\n", COLORS->reset);
 }
 
-void log_progress(double percentage)
+static double monotonic_seconds(void)
 {
-    ensure_initialized();
-    if (!g_state.config.enabled)
-        return;
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &now);
+    return (double)now.tv_sec + (double)now.tv_nsec * 1e-9;
+}
 
-    FILE *out = g_state.output_stream;
-    ColorScheme colors = get_level_colors(LOG_LEVEL_INFO);
-    const int filled = (int)(LAYOUT->progress_width * percentage);
-    const int empty = LAYOUT->progress_width - filled;
+/**
+ * @brief Append a run of one symbol in one color
+ */
+static size_t append_run(char *line, size_t used, size_t capacity, const char *color,
+                         const char *symbol, int count)
+{
+    const size_t symbol_len = strlen(symbol);
+    const size_t color_len = strlen(color);
+    const size_t reset_len = g_state.config.use_colors ? strlen(COLORS->reset) : 0;
 
-    fprintf(out, "\r%s%s%s",
-            colors.regular,
-            SYMBOLS->line_v,
-            g_state.config.use_colors ? COLORS->reset : "");
+    if (count <= 0 || used + color_len + (size_t)count * symbol_len + reset_len >= capacity)
+        return used;
 
-    for (int i = 0; i < filled; i++)
+    memcpy(line + used, color, color_len);
+    used += color_len;
+    for (int i = 0; i < count; i++, used += symbol_len)
     {
-        fprintf(out, "%s%s%s",
-                colors.bold,
-                SYMBOLS->bar_full,
-                g_state.config.use_colors ? COLORS->reset : "");
+        memcpy(line + used, symbol, symbol_len);
     }
+    memcpy(line + used, COLORS->reset, reset_len);
+    return used + reset_len;
+}
 
-    for (int i = 0; i < empty; i++)
-    {
-        fprintf(out, "%s%s%s",
-                colors.dim,
-                SYMBOLS->bar_empty,
-                g_state.config.use_colors ? COLORS->reset : "");
-    }
+void log_progress(double percentage)
+{
+    ensure_initialized();
+    if (!chatter_enabled())
+        return;
 
-    fprintf(out, "%s%s %s%.1f%%%s",
-            colors.regular,
-            SYMBOLS->line_v,
-            colors.bold,
-            percentage * 100.0,
-            g_state.config.use_colors ? COLORS->reset : "");
+    // NaN and out-of-range values (empty work) draw as a full or empty bar
+    if (!(percentage > 0.0))
+        percentage = 0.0;
+    if (percentage > 1.0)
+        percentage = 1.0;
 
-    fflush(out);
+    // At most LOGGER_PROGRESS_INTERVAL between redraws, but always show 100%
+    const double now = monotonic_seconds();
+    if (g_state.is_progress_active && percentage < 1.0 &&
+        now - g_state.last_progress_time < LOGGER_PROGRESS_INTERVAL)
+        return;
+    g_state.last_progress_time = now;
+
+    ColorScheme colors = get_level_colors(LOG_LEVEL_INFO);
+    const int filled = (int)(LAYOUT->progress_width * percentage);
+    const int empty = LAYOUT->progress_width - filled;
+    const char *reset = g_state.config.use_colors ? COLORS->reset : "";
+
+    // The whole bar goes out in one write
+    char line[1024];
+    size_t used = (size_t)snprintf(line, sizeof(line), "\r%s%s%s",
+                                   colors.regular, SYMBOLS->line_v, reset);
+    used = append_run(line, used, sizeof(line), colors.bold, SYMBOLS->bar_full, filled);
+    used = append_run(line, used, sizeof(line), colors.dim, SYMBOLS->bar_empty, empty);
+
+    const int tail = snprintf(line + used, sizeof(line) - used, "%s%s %s%.1f%%%s",
+                        colors.regular, SYMBOLS->line_v, colors.bold,
+                        percentage * 100.0, reset);
+    if (tail > 0 && (size_t)tail < sizeof(line) - used)
+        used += (size_t)tail;
+
+    fwrite(line, 1, used, g_state.output_stream);
+    fflush(g_state.output_stream);
     g_state.is_progress_active = true;
 }
 
 void log_end_progress(void)
 {
     ensure_initialized();
-    if (!g_state.config.enabled || !g_state.is_progress_active)
+    if (!output_enabled() || !g_state.is_progress_active)
         return;
     fprintf(g_state.output_stream, "\n");
     g_state.is_progress_active = false;
@@ -243,7 +300,7 @@ void log_end_progress(void)
 void log_separator(void)
 {
     ensure_initialized();
-    if (!g_state.config.enabled)
+    if (!chatter_enabled())
         return;
 
     fprintf(g_state.output_stream, "%s", THEME->border);
@@ -257,7 +314,7 @@ void log_separator(void)
 void log_header(const char *title)
 {
     ensure_initialized();
-    if (!g_state.config.enabled)
+    if (!chatter_enabled())
         return;
 
     FILE *out = g_state.output_stream;
@@ -283,7 +340,7 @@ void log_header(const char *title)
 void log_subheader(const char *title)
 {
     ensure_initialized();
-    if (!g_state.config.enabled)
+    if (!chatter_enabled())
         return;
 
     ColorScheme colors = get_level_colors(LOG_LEVEL_INFO);
@@ -296,7 +353,7 @@ void log_subheader(const char *title)
 void log_item(const char *label, const char *format, ...)
 {
     ensure_initialized();
-    if (!g_state.config.enabled)
+    if (!chatter_enabled())
         return;
 
     FILE *out = g_state.output_stream;
@@ -317,7 +374,7 @@ void log_item(const char *label, const char *format, ...)
 void log_newline(void)
 {
     ensure_initialized();
-    if (!g_state.config.enabled)
+    if (!chatter_enabled())
         return;
     fprintf(g_state.output_stream, "\n");
 }
@@ -325,7 +382,7 @@ void log_newline(void)
 void log_file_info(const char *filename, uint32_t size, uint32_t levels, const double ratio)
 {
     ensure_initialized();
-    if (!g_state.config.enabled)
+    if (!chatter_enabled())
         return;
 
     log_subheader("File Information");
@@ -351,7 +408,7 @@ void log_file_info(const char *filename, uint32_t size, uint32_t levels, const d
 void log_size_stats(size_t original_size, size_t processed_size, size_t nodes, double time)
 {
     ensure_initialized();
-    if (!g_state.config.enabled)
+    if (!chatter_enabled())
         return;
 
     const double compression_ratio = 100.0 * (double)processed_size / (double)original_size;
@@ -1,9 +1,10 @@
 #include <stdlib.h>
-#include <time.h>
 
 #include "cli/cli.h"
 #include "config/config.h"
 #include "codec/codec.h"
+#include "codec/batch.h"
+#include "common/common.h"
 #include "logger/logger.h"
 #include "grid/segmentation_grid.h"
 
@@ -20,11 +21,19 @@
 int main(int argc, char **argv)
 {
     config_t config;
+    qtc_stats_t stats;
     int status = EXIT_SUCCESS;
-    clock_t start_time;
+    double start_time;
+
+    if (!cli_parse_arguments(argc, argv, &config))
+    {
+        log_error("Failed to parse command line arguments");
+        return EXIT_FAILURE;
+    }
 
     logger_configure((logger_config_t){
         .enabled = true,
+        .quiet = config.quiet,
         .use_colors = true,
         .show_timestamp = true});
 
@@ -32,34 +41,32 @@ int main(int argc, char **argv)
     log_item("Version", "%s", PROGRAM_VERSION);
     log_separator();
 
-    log_info("Parsing command line arguments...");
-    if (!cli_parse_arguments(argc, argv, &config))
-    {
-        log_error("Failed to parse command line arguments");
-        return EXIT_FAILURE;
-    }
-
     /* Start operation timing */
-    start_time = clock();
+    start_time = wall_seconds();
+    qtc_stats_init(&stats, NULL);
 
-    /* Log operation mode */
-    if (config.compress)
+    /* Execute requested operation */
+    if (config.batch_source)
     {
-        log_info("Starting compression: %s -> %s",
-                 config.input_file,
-                 config.output_file);
+        /* Batch mode reports its own totals */
+        log_info("Starting batch %s: %s",
+                 config.compress ? "compression" : "decompression",
+                 config.batch_source);
+
+        codec_status_t result = codec_batch(&config, NULL);
+        if (result != CODEC_SUCCESS)
+        {
+            log_error("Batch finished with errors: %s", codec_status_string(result));
+            status = EXIT_FAILURE;
+        }
     }
-    else
+    else if (config.compress)
     {
-        log_info("Starting decompression: %s -> %s",
+        log_info("Starting compression: %s -> %s",
                  config.input_file,
                  config.output_file);
-    }
 
-    /* Execute requested operation */
-    if (config.compress)
-    {
-        codec_status_t result = codec_compress(&config);
+        codec_status_t result = codec_compress(&config, config.stats_file ? &stats : NULL);
         if (result != CODEC_SUCCESS)
         {
             log_error("Compression failed: %s", codec_status_string(result));
@@ -68,7 +75,11 @@ int main(int argc, char **argv)
     }
     else
     {
-        codec_status_t result = codec_decompress(&config);
+        log_info("Starting decompression: %s -> %s",
+                 config.input_file,
+                 config.output_file);
+
+        codec_status_t result = codec_decompress(&config, config.stats_file ? &stats : NULL);
         if (result != CODEC_SUCCESS)
         {
             log_error("Decompression failed: %s", codec_status_string(result));
@@ -76,8 +87,17 @@ int main(int argc, char **argv)
         }
     }
 
+    /* Batch mode writes its own lines, one per file; a call that never got
+       going (no operation set) has nothing to report */
+    if (config.stats_file && !config.batch_source && stats.operation &&
+        !qtc_stats_append_json(&stats, config.stats_file))
+    {
+        log_error("Failed to write stats to %s", config.stats_file);
+        status = EXIT_FAILURE;
+    }
+
     /* Log operation timing */
-    double elapsed = (double)(clock() - start_time) / CLOCKS_PER_SEC;
+    double elapsed = wall_seconds() - start_time;
 
     log_separator();
     if (status == EXIT_SUCCESS)